@@ -0,0 +1,206 @@
+// copbench_gen.cpp
+//
+// Generates a set of synthetic copper programs to benchmark copasm (see "bench" target in Makefile).  Each program
+// is valid (assembles without errors) and fits in copper memory (XR_COPPER_SIZE words, less the XV_INFO_WORDS info
+// block at the end), like a real program that could be loaded.  Programs share an include file, as real programs
+// share definitions, and together stress the tokenizer and each assembler pass with:
+//   - many symbols (and expressions using them, in the shared include)
+//   - heavy IF/ELSEIF/ELSE chains (mostly false conditionals)
+//   - deep macro nesting (a chain of macros up to nearly MAXMACRO_STACK levels)
+//   - SETI tables (with labels)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "../../../xosera_m68k_api/xosera_m68k_defs.h"
+#include "xlasm.h"
+
+#define BENCH_SYMS       2048                                   // symbols in shared include
+#define BENCH_PROGRAMS   8                                      // programs per scale
+#define BENCH_NESTS      4                                      // deep macro chain invocations per program (1 word)
+#define BENCH_CONDS      64                                     // IF/ELSEIF chains per program (one SETI each)
+#define BENCH_COND_ARMS  16                                     // ELSEIF arms per chain
+#define BENCH_SETI       256                                    // SETI table entries per program
+#define BENCH_MAX_WORDS  (XR_COPPER_SIZE - XV_INFO_WORDS)       // copper memory words a program may use
+
+// copper words per program (SETI is 2 words, plus table size word and final VPOS)
+static_assert(BENCH_NESTS + BENCH_CONDS * 2 + BENCH_SETI * 2 + 2 <= BENCH_MAX_WORDS,
+              "copbench program will not fit in copper memory");
+
+static void show_help()
+{
+    printf("copbench_gen - generate synthetic copasm benchmark input\n");
+    printf("\n");
+    printf("Usage:  copbench_gen [options] <output basename>\n");
+    printf("\n");
+    printf("Writes <basename>_defs.inc and <basename>_NN.casm programs (each fits in copper memory)\n");
+    printf("\n");
+    printf("-s n    scale of generated programs (1-64, default 1, %d programs per scale)\n", BENCH_PROGRAMS);
+    printf("-d n    macro nesting depth (1-%d, default %d)\n",
+           xlasm::MAXMACRO_STACK - 8,
+           xlasm::MAXMACRO_STACK - 8);
+    printf("\n");
+}
+
+// simple repeatable pseudo-random values (same output on every host)
+static uint32_t gen_rand(uint32_t & state)
+{
+    state = state * 1664525U + 1013904223U;
+    return state >> 8;
+}
+
+int main(int argc, char ** argv)
+{
+    const char * out_name   = nullptr;
+    int          scale      = 1;
+    int          macro_deep = xlasm::MAXMACRO_STACK - 8;        // leave room for include and macro invocation
+
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "-d") == 0) && i + 1 < argc)
+        {
+            int v = atoi(argv[i + 1]);
+            if (argv[i][1] == 's')
+                scale = v;
+            else
+                macro_deep = v;
+            i++;
+        }
+        else if (argv[i][0] != '-' && out_name == nullptr)
+        {
+            out_name = argv[i];
+        }
+        else
+        {
+            show_help();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (out_name == nullptr || scale < 1 || scale > 64 || macro_deep < 1 || macro_deep > xlasm::MAXMACRO_STACK - 8)
+    {
+        show_help();
+        exit(EXIT_FAILURE);
+    }
+
+    std::string defs_name = std::string(out_name) + "_defs.inc";
+    FILE *      out       = fopen(defs_name.c_str(), "w");
+    if (!out)
+    {
+        printf("copbench_gen: error creating \"%s\"\n", defs_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t rand_state = 0x1234;
+
+    // shared include: many symbols, each defined with an expression using earlier symbols
+    fprintf(out, "; copbench_gen synthetic copasm benchmark definitions (macro depth %d)\n", macro_deep);
+    fprintf(out, "; %d symbols\n", BENCH_SYMS);
+    fprintf(out, "SYM_00000       =       $0123\n");
+    for (int i = 1; i < BENCH_SYMS; i++)
+    {
+        fprintf(out,
+                "SYM_%05d       =       (SYM_%05d + $%04x) & $0FFF     ; symbol %d\n",
+                i,
+                static_cast<int>(gen_rand(rand_state) % static_cast<uint32_t>(i)),
+                gen_rand(rand_state) & 0xFFF,
+                i);
+    }
+    fprintf(out, "\n");
+
+    // deep macro nesting, each macro invokes the previous one (only the innermost emits a word)
+    fprintf(out, "; %d levels of nested macros\n", macro_deep);
+    fprintf(out, "nest_%04d       MACRO   val\n", 0);
+    fprintf(out, "                .word   \\val\n");
+    fprintf(out, "                ENDM\n");
+    for (int i = 1; i < macro_deep; i++)
+    {
+        fprintf(out, "nest_%04d       MACRO   val\n", i);
+        fprintf(out, "                nest_%04d \\val\n", i - 1);
+        fprintf(out, "                ENDM\n");
+    }
+    fprintf(out, "\n");
+    fprintf(out, "; EOF\n");
+    fclose(out);
+
+    // programs that each fit in copper memory (defs include found with -i like xosera_m68k_defs.inc)
+    const char * slash        = strrchr(defs_name.c_str(), '/');
+    const char * defs_base    = slash ? slash + 1 : defs_name.c_str();
+    const int    num_programs = BENCH_PROGRAMS * scale;
+    for (int p = 0; p < num_programs; p++)
+    {
+        char prog_name[1024];
+        snprintf(prog_name, sizeof(prog_name), "%s_%02d.casm", out_name, p);
+        out = fopen(prog_name, "w");
+        if (!out)
+        {
+            printf("copbench_gen: error creating \"%s\"\n", prog_name);
+            exit(EXIT_FAILURE);
+        }
+
+        fprintf(out, "; copbench_gen synthetic copasm benchmark program %d of %d\n", p + 1, num_programs);
+        fprintf(out, "                .list    false\n");
+        fprintf(out, "                .include \"xosera_m68k_defs.inc\"\n");
+        fprintf(out, "                .include \"%s\"\n", defs_base);
+        fprintf(out, "                .list    true\n");
+        fprintf(out, "\n");
+
+        fprintf(out, "start:\n");
+        for (int i = 0; i < BENCH_NESTS; i++)
+        {
+            fprintf(out, "                nest_%04d SYM_%05d\n", macro_deep - 1, (p * BENCH_NESTS + i) % BENCH_SYMS);
+        }
+        fprintf(out, "\n");
+
+        // heavy IF/ELSEIF/ELSE chains (only one arm true in each)
+        fprintf(out, "; %d IF/ELSEIF chains\n", BENCH_CONDS);
+        for (int i = 0; i < BENCH_CONDS; i++)
+        {
+            int sym = static_cast<int>(gen_rand(rand_state) % static_cast<uint32_t>(BENCH_SYMS));
+            fprintf(out, "                IF      (SYM_%05d & $%02x) == 0\n", sym, BENCH_COND_ARMS - 1);
+            fprintf(out, "                SETI    XR_COLOR_A_ADDR+%d,#SYM_%05d\n", i & 0xFF, sym);
+            for (int a = 1; a < BENCH_COND_ARMS; a++)
+            {
+                fprintf(out, "                ELSEIF  (SYM_%05d & $%02x) == %d\n", sym, BENCH_COND_ARMS - 1, a);
+                fprintf(out, "                SETI    XR_COLOR_B_ADDR+%d,#SYM_%05d+%d\n", (i + a) & 0xFF, sym, a);
+            }
+            fprintf(out, "                ELSE\n");
+            fprintf(out, "                .word   $DEAD                       ; never used\n");
+            fprintf(out, "                ENDIF\n");
+        }
+        fprintf(out, "\n");
+
+        // SETI table (with a label every 16 entries)
+        fprintf(out, "; %d entry SETI table\n", BENCH_SETI);
+        for (int i = 0; i < BENCH_SETI; i++)
+        {
+            if ((i & 0xF) == 0)
+                fprintf(out, "table_%05d:\n", i);
+            fprintf(out,
+                    "                SETI    XR_COLOR_A_ADDR+$%02x,#$%04x         ; entry %d\n",
+                    i & 0xFF,
+                    gen_rand(rand_state) & 0xFFF,
+                    i);
+        }
+        fprintf(out, "table_end:\n");
+        fprintf(out, "                .word   table_end-table_00000       ; table size\n");
+        fprintf(out, "                VPOS    #V_EOF\n");
+        fprintf(out, "\n");
+        fprintf(out, "; EOF\n");
+
+        fclose(out);
+    }
+
+    printf("copbench_gen: wrote \"%s\" and %d programs (\"%s_NN.casm\")\n",
+           defs_name.c_str(),
+           num_programs,
+           out_name);
+
+    return EXIT_SUCCESS;
+}
+
+// EOF
@@ -0,0 +1,105 @@
+// libcopasm.cpp
+//
+// In-memory copper assembler API (see libcopasm.h).  Each call uses a fresh xlasm instance with diagnostics
+// collected in the result, and fatal errors are returned as a failed result instead of exiting the process.
+
+#include <mutex>
+#include <stdexcept>
+
+#include "libcopasm.h"
+#include "xlasm.h"
+#include "xlasmcopper.h"
+
+struct copasm_fatal : public std::runtime_error
+{
+    explicit copasm_fatal(const std::string & msg)
+            : std::runtime_error(msg)
+    {
+    }
+};
+
+static void throw_fatal(const std::string & msg)
+{
+    throw copasm_fatal(msg);
+}
+
+static std::mutex copasm_mutex;        // architecture instance and fatal_error_hook are shared
+
+bool copasm_assemble(const std::string &      name,
+                     const std::string &      source,
+                     const copasm_options_t & options,
+                     copasm_result_t &        result)
+{
+    std::lock_guard<std::mutex> lock(copasm_mutex);
+
+    static copper copperarch;        // registers copper architecture (once)
+
+    result = copasm_result_t();
+
+    xlasm::opts_t opts;
+    opts.verbose      = 0;
+    opts.include_path = options.include_path;
+    opts.define_sym   = options.define_sym;
+    opts.video_width  = options.video_width;
+    opts.optimize     = options.optimize;
+
+    xlasm xl("copper");
+    xl.diag_log = &result.diagnostics;
+
+    bool ok = false;
+
+    fatal_error_hook = throw_fatal;
+    try
+    {
+        for (auto & inc : options.include_files)
+        {
+            xl.source_files[inc.first].read_buffer(&xl, inc.first, inc.second.data(), inc.second.size());
+        }
+
+        ok = xl.assemble_source(name, source, opts) == EXIT_SUCCESS;
+    }
+    catch (const copasm_fatal & e)
+    {
+        result.diagnostics.push_back("FATAL ERROR: " + std::string(e.what()));
+        xl.error_count++;
+        ok = false;
+    }
+    fatal_error_hook = nullptr;
+
+    result.error_count   = xl.error_count;
+    result.warning_count = xl.warning_count;
+
+    if (!ok)
+    {
+        return false;
+    }
+
+    // copper output is a single section (process_output has already checked this)
+    for (auto & it : xl.sections)
+    {
+        const xlasm::section_t & sec = it.second;
+        if (!sec.data.size())
+            continue;
+
+        result.load_addr = static_cast<uint16_t>(sec.load_addr);
+        result.words.reserve(sec.data.size() / 2);
+        for (size_t i = 0; i + 1 < sec.data.size(); i += 2)
+        {
+            result.words.push_back(static_cast<uint16_t>((sec.data[i] << 8) | sec.data[i + 1]));
+        }
+    }
+
+    for (auto & it : xl.symbols)
+    {
+        const xlasm::symbol_t & sym = it.second;
+        if (sym.file_defined == nullptr)        // skip predefined and command line symbols
+            continue;
+
+        if (sym.type == xlasm::symbol_t::LABEL || sym.type == xlasm::symbol_t::VARIABLE)
+        {
+            result.symbols[sym.name] = sym.value;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,51 @@
+// libcopasm.h
+//
+// In-memory copper assembler API (link with copper/CopAsm/bin/libcopasm.a).  Host tools (e.g., xvid_spi or the
+// simulator driver) can assemble copper source text and upload the words directly, without running copasm and
+// round-tripping through temporary files.  Safe to call repeatedly in one process (calls are serialized, so it can
+// also be used from multiple threads).
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct copasm_options_t
+{
+    std::vector<std::string>                     include_path;         // search paths for INCLUDE files on disk
+    std::vector<std::string>                     define_sym;           // "sym" or "sym=expression" (like -d)
+    std::unordered_map<std::string, std::string> include_files;        // INCLUDE files in memory (name -> text)
+    uint32_t                                     video_width;          // 640 or 848 (selects copper cycles per line)
+    bool                                         optimize;             // peephole optimize copper code (like -p)
+
+    copasm_options_t() noexcept
+            : video_width(640)
+            , optimize(false)
+    {
+    }
+};
+
+struct copasm_result_t
+{
+    std::vector<uint16_t>                    words;                // assembled copper program words
+    uint16_t                                 load_addr;            // XR address of first word (normally 0xC000)
+    std::unordered_map<std::string, int64_t> symbols;              // labels and variables defined by the source
+    std::vector<std::string>                 diagnostics;          // "file:line: ERROR: ..." (also WARNING and NOTE)
+    uint32_t                                 error_count;
+    uint32_t                                 warning_count;
+
+    copasm_result_t() noexcept
+            : load_addr(0)
+            , error_count(0)
+            , warning_count(0)
+    {
+    }
+};
+
+// assemble copper source text (name is used for diagnostics), returns true if successful with words in result
+bool copasm_assemble(const std::string &      name,
+                     const std::string &      source,
+                     const copasm_options_t & options,
+                     copasm_result_t &        result);
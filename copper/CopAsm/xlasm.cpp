@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <chrono>
 #include <ctime>
 #include <ctype.h>
 #include <errno.h>
@@ -15,7 +16,12 @@
 #include <codecvt>
 #endif
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#if !defined(_MSC_VER)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "xlasm.h"
 #include "xlasmexpr.h"
@@ -42,8 +48,7 @@ static inline ToType union_cast(const FromType & from)
 }
 #endif
 
-#if 0
-static bool hasEnding(const std::string & fullString, const std::string & ending)
+bool hasEnding(const std::string & fullString, const std::string & ending)
 {
     if (fullString.length() >= ending.length())
     {
@@ -54,8 +59,8 @@ static bool hasEnding(const std::string & fullString, const std::string & ending
         return false;
     }
 }
-#endif
 
+#if 0        // not used
 static void rtrim(std::string & str, const std::string & ws)
 {
     size_t found;
@@ -65,6 +70,97 @@ static void rtrim(std::string & str, const std::string & ws)
     else
         str.clear();        // str is all whitespace
 }
+#endif
+
+// monotonic time in seconds (for phase timing)
+static double phase_clock()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// return str as a quoted JSON string
+static std::string json_string(const std::string & str)
+{
+    std::string newstr = "\"";
+    for (auto it = str.begin(); it != str.end(); ++it)
+    {
+        if (*it == '\"' || *it == '\\')
+            newstr += '\\';
+        if (static_cast<uint8_t>(*it) >= ' ')
+            newstr += *it;
+    }
+    return newstr + "\"";
+}
+
+// read-only contents of a whole file (memory mapped when possible, otherwise read with a single bulk read)
+struct file_view_t
+{
+    const char *      data;
+    size_t            size;
+    void *            map_addr;
+    std::vector<char> buffer;
+
+    file_view_t() noexcept
+            : data(nullptr)
+            , size(0)
+            , map_addr(nullptr)
+    {
+    }
+
+    ~file_view_t()
+    {
+#if !defined(_MSC_VER)
+        if (map_addr)
+            munmap(map_addr, size);
+#endif
+    }
+
+    // returns 0 or errno value
+    int open(const std::string & fn)
+    {
+        struct stat st;
+
+#if !defined(_MSC_VER)
+        int fd = ::open(fn.c_str(), O_RDONLY);
+        if (fd < 0)
+            return errno;
+
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            void * addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                map_addr = addr;
+                data     = static_cast<const char *>(addr);
+                size     = static_cast<size_t>(st.st_size);
+                ::close(fd);
+
+                return 0;
+            }
+        }
+        ::close(fd);
+#endif
+        FILE * fp = fopen(fn.c_str(), "rb");
+        if (!fp)
+            return errno;
+
+        if (fstat(fileno(fp), &st) == 0 && st.st_size > 0)
+            buffer.reserve(static_cast<size_t>(st.st_size));
+
+        char   chunk[0x10000];
+        size_t got;
+        while ((got = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+            buffer.insert(buffer.end(), chunk, chunk + got);
+
+        int e = ferror(fp) ? errno : 0;
+        fclose(fp);
+
+        data = buffer.data();
+        size = buffer.size();
+
+        return e;
+    }
+};
 
 // using these to avoid some "strict" type conversion warnings with system version returning int
 char uppercase(char v)
@@ -77,17 +173,23 @@ char lowercase(char v)
     return static_cast<char>(::tolower(v));
 }
 
+// called with fatal error message before exit (if set, e.g. libcopasm throws to return to caller)
+void (*fatal_error_hook)(const std::string & msg) = nullptr;
+
 // output error and exit immediately
 void fatal_error(const char * msg, ...)
 {
-    va_list ap;
+    va_list     ap;
+    std::string errmsg;
+
     va_start(ap, msg);
+    vstrprintf(errmsg, msg, ap);
+    va_end(ap);
 
-    printf(TERM_ERROR "FATAL ERROR: ");
-    vprintf(msg, ap);
-    printf(TERM_CLEAR "\n");
+    if (fatal_error_hook)
+        fatal_error_hook(errmsg);
 
-    va_end(ap);
+    printf(TERM_ERROR "FATAL ERROR: %s" TERM_CLEAR "\n", errmsg.c_str());
 
     exit(10);
 }
@@ -123,11 +225,15 @@ Ixlarch * Ixlarch::find_arch(const std::string & architecture)
 xlasm::xlasm(const std::string & architecture)
         : initial_variant(architecture)
         , arch(nullptr)
+        , diag_log(nullptr)
         , total_size_generated(0)
         , last_size_generated(0)
         , bytes_optimized(0)
         , undefined_sym_count(0)
         , line_sec_addr(0)
+        , reloc_origin(0)
+        , source_bytes_read(0)
+        , source_read_time(0.0)
         , listing_file(nullptr)
         , last_diag_file(nullptr)
         , undefined_section(nullptr)
@@ -139,6 +245,7 @@ xlasm::xlasm(const std::string & architecture)
         , line_sec_start(nullptr)
         , undefined_begin_size(0)
         , line_sec_size(0)
+        , reloc_checked(0)
         , applied_hints(0)
         , pending_hints(0)
         , crc_value(0)
@@ -149,7 +256,9 @@ xlasm::xlasm(const std::string & architecture)
         , prev_virtual_line_num(0)
         , pass_count(0)
         , last_diag_line(0)
+        , line_cycles(-1)
         , line_sec_org(false)
+        , line_cycles_wait(false)
         , suppress_line_list(false)
         , suppress_line_listsource(false)
         , force_end_file(false)
@@ -174,13 +283,9 @@ int32_t xlasm::assemble(const std::vector<std::string> & in_files, const std::st
         return 0;
     }
 
-    // copy option flags
-    opt = opts;
+    double start_time = phase_clock();
 
-    // init initial architecture
-    arch = Ixlarch::find_arch(initial_variant);
-    arch->activate(this);
-    arch->set_variant(initial_variant);
+    init_assembly(opts);
 
     // copy source file names
     for (auto it = in_files.begin(); it != in_files.end(); ++it)
@@ -198,6 +303,82 @@ int32_t xlasm::assemble(const std::vector<std::string> & in_files, const std::st
             listing_filename = removeExtension(in_files[0]) + ".lst";
     }
 
+    dprintf("Assembling " PR_DSIZET " %s file%s into output \"%s\"",
+            in_files.size(),
+            arch->get_variant().c_str(),
+            in_files.size() == 1 ? "" : "s",
+            object_filename.c_str());
+    if (opt.listing)
+        dprintf(" with listing \"%s\"", listing_filename.c_str());
+    dprintf("\n");
+
+    // Read source files
+    int32_t index = 1;
+    for (auto it = input_names.begin(); it != input_names.end(); ++it, index++)
+    {
+        source_t & f = source_files[*it];
+        int        e = f.read_file(this, *it, *it);
+        if (e)
+            fatal_error("reading file \"%s\" error: %s", it->c_str(), strerror(e));
+
+        dprintf("File \"%s\" read into memory (" PR_DSIZET " lines, " PR_U64 " bytes).\n",
+                it->c_str(),
+                source_files[*it].orig_line.size(),
+                source_files[*it].file_size);
+    }
+
+    do_passes();
+
+    if (opt.verbose > 1 && source_read_time > 0.0)
+    {
+        dprintf("Source files read and tokenized " PR_U64 " bytes in %.3f ms (%.1f MB/sec).\n",
+                source_bytes_read,
+                source_read_time * 1000.0,
+                static_cast<double>(source_bytes_read) / source_read_time / (1024.0 * 1024.0));
+    }
+
+    if (opt.timing_file.size())
+        write_timing(phase_clock() - start_time);
+
+    printf("%scopasm %s%s with %d warning%s and %d error%s%s\n",
+           error_count ? "\n*** " : "",
+           ((error_count && !opt.no_error_kill) || force_exit_assembly) ? "FAILED" : "completed",
+           (error_count == 0 && !force_exit_assembly) ? " successfully" : "",
+           warning_count,
+           warning_count == 1 ? "" : "s",
+           error_count,
+           error_count == 1 ? "" : "s",
+           error_count ? " ***\n" : "");
+
+    return error_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// assemble source text already in memory (used by libcopasm), output is left in sections
+int32_t xlasm::assemble_source(const std::string & name, const std::string & text, const opts_t & opts)
+{
+    init_assembly(opts);
+
+    input_names.push_back(name);
+
+    source_t & f = source_files[name];
+    f.read_buffer(this, name, text.data(), text.size());
+
+    do_passes();
+
+    return (error_count == 0 && !force_exit_assembly) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// set options and architecture and define command line symbols
+void xlasm::init_assembly(const opts_t & opts)
+{
+    // copy option flags
+    opt = opts;
+
+    // init initial architecture
+    arch = Ixlarch::find_arch(initial_variant);
+    arch->activate(this);
+    arch->set_variant(initial_variant);
+
     if (directives.size() == 0)
     {
         for (size_t i = 0; i < NUM_ELEMENTS(directives_list) && directives_list[i].name; i++)
@@ -244,44 +425,6 @@ int32_t xlasm::assemble(const std::vector<std::string> & in_files, const std::st
             notice(2, "    \"%s\"", it->c_str());
         }
     }
-
-    dprintf("Assembling " PR_DSIZET " %s file%s into output \"%s\"",
-            in_files.size(),
-            arch->get_variant().c_str(),
-            in_files.size() == 1 ? "" : "s",
-            object_filename.c_str());
-    if (opt.listing)
-        dprintf(" with listing \"%s\"", listing_filename.c_str());
-    dprintf("\n");
-
-    // Read source files
-    int32_t index = 1;
-    for (auto it = input_names.begin(); it != input_names.end(); ++it, index++)
-    {
-        source_t & f = source_files[*it];
-        int        e = f.read_file(this, *it, *it);
-        if (e)
-            fatal_error("reading file \"%s\" error: %s", it->c_str(), strerror(e));
-
-        dprintf("File \"%s\" read into memory (" PR_DSIZET " lines, " PR_U64 " bytes).\n",
-                it->c_str(),
-                source_files[*it].orig_line.size(),
-                source_files[*it].file_size);
-    }
-
-    do_passes();
-
-    printf("%scopasm %s%s with %d warning%s and %d error%s%s\n",
-           error_count ? "\n*** " : "",
-           ((error_count && !opt.no_error_kill) || force_exit_assembly) ? "FAILED" : "completed",
-           (error_count == 0 && !force_exit_assembly) ? " successfully" : "",
-           warning_count,
-           warning_count == 1 ? "" : "s",
-           error_count,
-           error_count == 1 ? "" : "s",
-           error_count ? " ***\n" : "");
-
-    return error_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 // iterate over all lines of files processing input
@@ -322,6 +465,8 @@ int32_t xlasm::do_passes()
 
     do
     {
+        double pass_start = phase_clock();
+
         pass_reset();
 
         ctxt.section     = &sections["text"];
@@ -344,6 +489,12 @@ int32_t xlasm::do_passes()
         if (ctxt.pass == context_t::PASS_2)
             check_undefined();
 
+        add_phase_time(ctxt.pass == context_t::PASS_1     ? "pass_1"
+                       : ctxt.pass == context_t::PASS_OPT ? "pass_opt"
+                                                          : "pass_2",
+                       pass_count,
+                       pass_start);
+
         if (force_exit_assembly)
             break;
 
@@ -351,7 +502,7 @@ int32_t xlasm::do_passes()
         {
             if (error_count)
             {
-                printf("Continuing despite errors (-k option).\n");
+                dprintf("Continuing despite errors (-k option).\n");
             }
             continue;
         }
@@ -360,26 +511,232 @@ int32_t xlasm::do_passes()
 
     } while (ctxt.pass != context_t::PASS_2);
 
+    if (ctxt.pass == context_t::PASS_2 && !error_count && hasEnding(object_filename, ".cobj"))
+    {
+        double reloc_start = phase_clock();
+        reloc_pass();
+        add_phase_time("reloc", 0, reloc_start);
+    }
+
     if (opt.listing && opt.xref)
     {
-        uint32_t oldpass = ctxt.pass;
-        ctxt.pass        = context_t::UNKNOWN;
+        double   xref_start = phase_clock();
+        uint32_t oldpass    = ctxt.pass;
+        ctxt.pass           = context_t::UNKNOWN;
         process_xref();
         ctxt.pass = oldpass;
+        add_phase_time("xref", 0, xref_start);
     }
 
     if (ctxt.pass == context_t::PASS_2)
     {
+        double output_start = phase_clock();
         process_output();
+        add_phase_time("output", 0, output_start);
     }
     else
     {
-        printf("No output generated.\n");
+        dprintf("No output generated.\n");
     }
 
     return 0;
 }
 
+// record elapsed time of an assembly phase (started at start_time)
+void xlasm::add_phase_time(const char * name, uint32_t pass, double start_time)
+{
+    phase_time_t t;
+    t.name    = name;
+    t.pass    = pass;
+    t.seconds = phase_clock() - start_time;
+    phase_times.push_back(t);
+}
+
+// append timing of this assembly to opt.timing_file as a single line JSON object (so results from many runs can be
+// collected in one file and tracked over time, see Bench/ directory)
+void xlasm::write_timing(double total_time)
+{
+    FILE * out = fopen(opt.timing_file.c_str(), "a");
+    if (!out)
+        fatal_error("Opening timing file \"%s\" error: %s", opt.timing_file.c_str(), strerror(errno));
+
+    size_t source_lines = 0;
+    for (auto it = source_files.begin(); it != source_files.end(); ++it)
+    {
+        source_lines += it->second.orig_line.size();
+    }
+
+    size_t output_words = 0;
+    for (auto it = sections.begin(); it != sections.end(); ++it)
+    {
+        output_words += it->second.data.size() / 2;
+    }
+
+    fprintf(out, "{\"inputs\":[");
+    for (auto it = input_names.begin(); it != input_names.end(); ++it)
+    {
+        fprintf(out, "%s%s", it == input_names.begin() ? "" : ",", json_string(*it).c_str());
+    }
+    fprintf(out,
+            "],\"output\":%s,\"optimize\":%s,\"errors\":%u,\"warnings\":%u,\"passes\":%u,",
+            json_string(object_filename).c_str(),
+            opt.optimize ? "true" : "false",
+            error_count,
+            warning_count,
+            pass_count);
+    fprintf(out,
+            "\"source_bytes\":" PR_U64 ",\"source_lines\":" PR_DSIZET ",\"effective_lines\":%u,\"symbols\":" PR_DSIZET
+            ",\"output_words\":" PR_DSIZET ",",
+            source_bytes_read,
+            source_lines,
+            virtual_line_num,
+            symbols.size(),
+            output_words);
+    fprintf(out, "\"phases\":[{\"phase\":\"tokenize\",\"pass\":0,\"ms\":%.3f}", source_read_time * 1000.0);
+    for (auto it = phase_times.begin(); it != phase_times.end(); ++it)
+    {
+        fprintf(out, ",{\"phase\":\"%s\",\"pass\":%u,\"ms\":%.3f}", it->name.c_str(), it->pass, it->seconds * 1000.0);
+    }
+    fprintf(out,
+            "],\"total_ms\":%.3f,\"lines_per_sec\":%.0f,\"mb_per_sec\":%.3f}\n",
+            total_time * 1000.0,
+            total_time > 0.0 ? static_cast<double>(source_lines) / total_time : 0.0,
+            total_time > 0.0 ? static_cast<double>(source_bytes_read) / total_time / (1024.0 * 1024.0) : 0.0);
+
+    fclose(out);
+}
+
+// re-assemble with the origin shifted by RELOC_PROBE_OFFSET, any output word that moved by exactly that amount holds
+// a copper address (label+constant) and is recorded as a relocation for .cobj object output (likewise for each
+// imported label, shifting only that label)
+int32_t xlasm::reloc_pass()
+{
+    section_t & sec = sections["text"];
+
+    std::unordered_map<std::string, int64_t> final_values;
+    for (auto it = symbols.begin(); it != symbols.end(); ++it)
+    {
+        final_values[it->first] = it->second.value;
+    }
+    int64_t              final_optimized = bytes_optimized;
+    uint32_t             final_hints     = applied_hints;
+    std::vector<uint8_t> final_image     = sec.data;
+    export_list_t        final_imports   = imports;
+
+    reloc_origin = sec.load_addr;
+    relocs.clear();
+    import_relocs.clear();
+
+    auto probe_pass = [&](bool compare) {
+        ctxt.pass = context_t::PASS_RELOC;
+        pass_reset();
+
+        reloc_checked = 0;
+        reloc_image.clear();
+        if (compare)
+            reloc_image = final_image;
+
+        ctxt.section     = &sections["text"];
+        previous_section = ctxt.section;
+
+        for (auto fit = input_names.begin(); fit != input_names.end(); ++fit)
+        {
+            source_t & f = source_files[*fit];
+
+            process_file(f);
+
+            if (force_exit_assembly)
+                break;
+        }
+
+        ctxt.file = nullptr;
+        diag_flush();
+
+        if (compare && !error_count && sec.data.size() != final_image.size())
+        {
+            fatal_error("Relocatable object size depends on %s%s%s (" PR_DSIZET " vs " PR_DSIZET " words).",
+                        reloc_import.size() ? "imported label \"" : "load address",
+                        reloc_import.c_str(),
+                        reloc_import.size() ? "\"" : "",
+                        sec.data.size() >> 1,
+                        final_image.size() >> 1);
+        }
+
+        return !error_count && !force_exit_assembly;
+    };
+
+    // imported labels are shifted one at a time (other labels are unchanged from final pass)
+    for (auto & imp : final_imports)
+    {
+        reloc_import = imp;
+        if (!probe_pass(true))
+            break;
+    }
+    reloc_import.clear();
+
+    // first origin pass settles forward references at the shifted origin, second compares output with final pass
+    sec.load_addr = reloc_origin + RELOC_PROBE_OFFSET;
+    if (!error_count && probe_pass(false) && probe_pass(true))
+    {
+        for (auto & expsym : exports)
+        {
+            symbol_t & sym = symbols[expsym];
+            if (sym.type != symbol_t::UNDEFINED && sym.value - final_values[expsym] != RELOC_PROBE_OFFSET)
+            {
+                fatal_error("Exported symbol \"%s\" is not a relocatable copper address label.", expsym.c_str());
+            }
+        }
+    }
+
+    // restore final pass output
+    for (auto it = symbols.begin(); it != symbols.end(); ++it)
+    {
+        auto fv = final_values.find(it->first);
+        if (fv != final_values.end())
+            it->second.value = fv->second;
+    }
+    sec.load_addr   = reloc_origin;
+    sec.addr        = reloc_origin;
+    bytes_optimized = final_optimized;
+    applied_hints   = final_hints;
+    imports         = final_imports;
+    sec.data.swap(final_image);
+    reloc_image.clear();
+
+    if (!error_count)
+        ctxt.pass = context_t::PASS_2;
+
+    return 0;
+}
+
+// compare output words from this line with the final pass to find relocations
+void xlasm::check_reloc_line()
+{
+    const std::vector<uint8_t> & data = ctxt.section->data;
+    size_t                       end  = data.size() & ~size_t{1};
+
+    for (size_t i = reloc_checked; i < end && i + 1 < reloc_image.size(); i += 2)
+    {
+        uint16_t orig  = static_cast<uint16_t>((reloc_image[i] << 8) | reloc_image[i + 1]);
+        uint16_t moved = static_cast<uint16_t>((data[i] << 8) | data[i + 1]);
+        uint16_t delta = static_cast<uint16_t>(moved - orig);
+
+        if (delta == RELOC_PROBE_OFFSET)
+        {
+            (reloc_import.size() ? import_relocs[reloc_import] : relocs).push_back(static_cast<uint32_t>(i >> 1));
+        }
+        else if (delta != 0)
+        {
+            error("Word 0x%04x at offset " PR_DSIZET " is not relocatable (only label+constant or label difference)",
+                  orig,
+                  i >> 1);
+        }
+    }
+
+    if (end > reloc_checked)
+        reloc_checked = end;
+}
+
 int32_t xlasm::pass_reset()
 {
     error_count = 0;        // ??
@@ -395,6 +752,14 @@ int32_t xlasm::pass_reset()
     }
     prev_virtual_line_num = virtual_line_num;
 
+    // NOTE: before sections are cleared (so architecture can examine previous pass output)
+    arch->deactivate(this);
+    arch = Ixlarch::find_arch(initial_variant);
+    arch->activate(this);
+    arch->set_variant(initial_variant);
+    exports.clear();
+    imports.clear();
+
     std::vector<section_t *> secs;
     for (auto it = sections.begin(); it != sections.end(); ++it)
     {
@@ -463,11 +828,6 @@ int32_t xlasm::pass_reset()
             ++it;
     }
 
-    arch->deactivate(this);
-    arch = Ixlarch::find_arch(initial_variant);
-    arch->activate(this);
-    arch->set_variant(initial_variant);
-
     //	dprintf("Erasing " PR_D64 " macros\n", macros.size());
     macros.clear();
     // BUG: should not clear this between passes:    expanded_macros.clear();
@@ -480,6 +840,8 @@ int32_t xlasm::pass_reset()
     ctxt.conditional_nesting = 0;
     ctxt.macroexp_ptr        = nullptr;
     ctxt.macrodef_ptr        = nullptr;
+    ctxt.loopdef_ptr         = nullptr;
+    ctxt.loop_nesting        = 0;
 
     rng.seed(random_seed);
 
@@ -488,10 +850,10 @@ int32_t xlasm::pass_reset()
     if (ctxt.pass == context_t::PASS_1 && prev_virtual_line_num)
         ctxt.pass = context_t::PASS_OPT;
 
-    if (ctxt.pass == context_t::PASS_OPT && last_size_generated == total_size_generated)
+    if (ctxt.pass == context_t::PASS_OPT && last_size_generated == total_size_generated && !pending_hints)
         ctxt.pass = context_t::PASS_2;
 
-    if (pass_count >= MAX_PASSES)
+    if (pass_count >= MAX_PASSES && ctxt.pass != context_t::PASS_RELOC)
     {
         ctxt.pass = context_t::PASS_2;
         warning(
@@ -628,6 +990,22 @@ static void vsim_dump(FILE * out, const uint8_t * mem, size_t num)
     }
 }
 
+// constant header words as X-macro list "name_words(X)", expanding X(word) for each word (so the same list can
+// initialize the array and be unrolled into immediate writes by xosera_copper_upload_const)
+static void const_dump(FILE * out, const std::string & name, const uint8_t * mem, size_t num)
+{
+    fprintf(out, "#define %s_words(X)", name.c_str());
+    for (size_t i = 0; i < num; i += 2)
+    {
+        if (((i >> 1) & 0x7) == 0)
+        {
+            fprintf(out, " \\\n   ");
+        }
+        fprintf(out, " X(0x%02x%02x)", mem[i], mem[i + 1]);
+    }
+    fprintf(out, "\n");
+}
+
 static void mem_dump(FILE * out, const uint8_t * mem, size_t num)
 {
     for (size_t i = 0; i < num; i += 2)
@@ -642,6 +1020,150 @@ static void mem_dump(FILE * out, const uint8_t * mem, size_t num)
     }
 }
 
+// Relocatable copper object format (text lines, written for .cobj output and read by copasm when linking):
+//   cobj    <name> <origin> <size> - object name, XR address it was assembled at and size in words
+//   word    xxxx xxxx ...          - program words (8 hex words per line)
+//   reloc   n n ...                - word offsets holding a copper address (linker adds placement - origin)
+//   export  <sym> <offset>         - exported label word offset
+//   import  <sym> n n ...          - word offsets using imported label (assembled as origin, linker adds address)
+//   end
+static void obj_dump(FILE * out, const std::vector<uint8_t> & data, const std::vector<uint32_t> & relocs)
+{
+    for (size_t i = 0; i + 1 < data.size(); i += 2)
+    {
+        if (((i >> 1) & 0x7) == 0)
+        {
+            fprintf(out, "%sword   ", i ? "\n" : "");
+        }
+        fprintf(out, " %02x%02x", data[i], data[i + 1]);
+    }
+    fprintf(out, "\n");
+
+    for (size_t i = 0; i < relocs.size(); i++)
+    {
+        if ((i & 0x7) == 0)
+        {
+            fprintf(out, "%sreloc  ", i ? "\n" : "");
+        }
+        fprintf(out, " %u", relocs[i]);
+    }
+    if (relocs.size())
+    {
+        fprintf(out, "\n");
+    }
+}
+
+// Packed copper program format (16-bit big-endian words, unpacked by xosera_copper_unpack() in xosera_m68k_api):
+//   XR start address, unpacked size in words, then commands until a zero command word:
+//   0nnn nnnn nnnn nnnn    - literal: copy n following words
+//   1nnn nnnn nnnn nnnn    - repeat: next word k (1-16) then k delta words, output n words with each word being the
+//                            word k words back plus delta[i % k] (so runs, arithmetic sequences, and repeated
+//                            groups of instructions with incrementing values, like gradients, pack well)
+//   0000 0000 0000 0000    - end
+enum
+{
+    PACK_REPEAT_F = 0x8000,
+    PACK_MAX_K    = 16,
+    PACK_MAX_N    = 0x7FFF
+};
+
+static std::vector<uint16_t> copper_pack(const std::vector<uint8_t> & data, int64_t load_addr)
+{
+    std::vector<uint16_t> w;
+    std::vector<uint16_t> pack;
+
+    for (size_t i = 0; i + 1 < data.size(); i += 2)
+    {
+        w.push_back(static_cast<uint16_t>((data[i] << 8) | data[i + 1]));
+    }
+
+    pack.push_back(static_cast<uint16_t>(load_addr));
+    pack.push_back(static_cast<uint16_t>(w.size()));
+
+    size_t lit_start = 0;
+    auto   flush_lit = [&](size_t end) {
+        while (lit_start < end)
+        {
+            size_t n = std::min(end - lit_start, static_cast<size_t>(PACK_MAX_N));
+            pack.push_back(static_cast<uint16_t>(n));
+            pack.insert(pack.end(),
+                        w.begin() + static_cast<ptrdiff_t>(lit_start),
+                        w.begin() + static_cast<ptrdiff_t>(lit_start + n));
+            lit_start += n;
+        }
+    };
+
+    size_t i = 0;
+    while (i < w.size())
+    {
+        size_t   best_k    = 0;
+        size_t   best_n    = 0;
+        int64_t  best_save = 0;
+        uint16_t delta[PACK_MAX_K];
+
+        for (size_t k = 1; k <= PACK_MAX_K && k <= i; k++)
+        {
+            size_t n = 0;
+            while (i + n < w.size() && n < PACK_MAX_N)
+            {
+                uint16_t d = static_cast<uint16_t>(w[i + n] - w[i + n - k]);
+                if (n < k)
+                    delta[n] = d;
+                else if (d != delta[n % k])
+                    break;
+                n++;
+            }
+
+            int64_t save = static_cast<int64_t>(n) - static_cast<int64_t>(2 + k);
+            if (save > best_save)
+            {
+                best_save = save;
+                best_k    = k;
+                best_n    = n;
+            }
+        }
+
+        if (best_save > 0)
+        {
+            flush_lit(i);
+            pack.push_back(static_cast<uint16_t>(PACK_REPEAT_F | best_n));
+            pack.push_back(static_cast<uint16_t>(best_k));
+            for (size_t j = 0; j < best_k; j++)
+            {
+                pack.push_back(static_cast<uint16_t>(w[i + j] - w[i + j - best_k]));
+            }
+            i += best_n;
+            lit_start = i;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    flush_lit(w.size());
+    pack.push_back(0);
+
+    return pack;
+}
+
+static void C_dump_words(FILE * out, const std::vector<uint16_t> & words)
+{
+    fprintf(out, "    ");
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        fprintf(out, "0x%04x", words[i]);
+        if (i != words.size() - 1)
+        {
+            fprintf(out, ", ");
+            if ((i & 0x7) == 0x7)
+            {
+                fprintf(out, "\n    ");
+            }
+        }
+    }
+    fprintf(out, "\n");
+}
+
 int32_t xlasm::process_output()
 {
     std::vector<section_t *> secs;
@@ -712,8 +1234,10 @@ int32_t xlasm::process_output()
     {
         NONE,
         C_FILE,
+        CONST_FILE,
         VSIM_FILE,
         MEM_FILE,
+        OBJ_FILE,
         BIN_FILE
     } out_fmt = output_format::NONE;
 
@@ -737,6 +1261,7 @@ int32_t xlasm::process_output()
     }
 
     bool header_file = false;
+    bool packed      = false;
     crc_value        = 0xffffffff;
 
     if (pad != 0)
@@ -761,6 +1286,17 @@ int32_t xlasm::process_output()
         out_fmt = output_format::NONE;
         dprintf("Dry run - no output file: " PR_D64 " 16-bit words were generated.\n", total_size >> 1);
     }
+    else if (extension == ".pack.c" || extension == ".pack.h")
+    {
+        header_file = extension == ".pack.h";
+        packed      = true;
+        out_fmt     = output_format::C_FILE;
+    }
+    else if (extension == ".pack")
+    {
+        packed  = true;
+        out_fmt = output_format::BIN_FILE;
+    }
     else if (extension == ".c" || extension == ".cpp" || extension == ".h")
     {
         header_file = extension == ".h";
@@ -770,6 +1306,14 @@ int32_t xlasm::process_output()
                 basename.c_str(),
                 total_size >> 1);
     }
+    else if (extension == ".const.h")
+    {
+        out_fmt = output_format::CONST_FILE;
+        dprintf("Writing constant C/C++ header \"%s\": uint16_t %s_bin[" PR_D64 "];\n",
+                object_filename.c_str(),
+                basename.c_str(),
+                total_size >> 1);
+    }
     else if (extension == ".vsim.h")
     {
         out_fmt = output_format::VSIM_FILE;
@@ -777,6 +1321,14 @@ int32_t xlasm::process_output()
                 object_filename.c_str(),
                 total_size >> 1);
     }
+    else if (extension == ".cobj")
+    {
+        out_fmt = output_format::OBJ_FILE;
+        dprintf("Writing relocatable copper object \"%s\" (with " PR_D64 " 16-bit words, " PR_DSIZET " relocations).\n",
+                object_filename.c_str(),
+                total_size >> 1,
+                relocs.size());
+    }
     else if (extension == ".memh" || extension == ".mem")
     {
         out_fmt = output_format::MEM_FILE;
@@ -789,6 +1341,18 @@ int32_t xlasm::process_output()
         dprintf("Writing binary file \"%s\": " PR_D64 " 16-bit words.\n", object_filename.c_str(), total_size >> 1);
     }
 
+    std::vector<uint16_t> pack_data;
+    if (packed)
+    {
+        pack_data = copper_pack(secs[0]->data, load_addr);
+        dprintf("Writing packed %s file \"%s\": uint16_t %s_pack[" PR_DSIZET "] (" PR_D64 " 16-bit words unpacked).\n",
+                out_fmt == output_format::C_FILE ? "C" : "binary",
+                object_filename.c_str(),
+                basename.c_str(),
+                pack_data.size(),
+                total_size >> 1);
+    }
+
     FILE *      out       = nullptr;
     std::string baseupper = basename;
     std::transform(baseupper.begin(), baseupper.end(), baseupper.begin(), uppercase);
@@ -818,11 +1382,77 @@ int32_t xlasm::process_output()
                     ";    // copper program size in words\n",
                     basename.c_str(),
                     total_size >> 1);
+            if (packed)
+            {
+                fprintf(out,
+                        "static const uint16_t %s_pack_size  __attribute__ ((unused)) = %6" PRId64
+                        ";    // packed size in words (for xosera_copper_unpack)\n",
+                        basename.c_str(),
+                        static_cast<int64_t>(pack_data.size()));
+                fprintf(out,
+                        "static const uint16_t %s_pack[" PR_DSIZET "] __attribute__ ((unused)) =\n",
+                        basename.c_str(),
+                        pack_data.size());
+            }
+            else
+            {
+                fprintf(out,
+                        "static uint16_t %s_bin[" PR_D64 "] __attribute__ ((unused)) =\n",
+                        basename.c_str(),
+                        total_size >> 1);
+            }
+            fprintf(out, "{\n");
+        }
+        break;
+        case output_format::CONST_FILE: {
+            out = fopen(object_filename.c_str(), "w");
+            if (!out)
+                fatal_error("opening output file \"%s\", error: %s", object_filename.c_str(), strerror(errno));
             fprintf(out,
-                    "static uint16_t %s_bin[" PR_D64 "] __attribute__ ((unused)) =\n",
+                    "// Xosera copper binary \"%s\" (constant header, upload with xosera_copper_upload_const(%s))\n",
                     basename.c_str(),
-                    total_size >> 1);
+                    basename.c_str());
+            fprintf(out, "#if !defined(INC_%s_CONST_H)\n", baseupper.c_str());
+            fprintf(out, "#define INC_%s_CONST_H\n", baseupper.c_str());
+            fprintf(out, "#include <stdint.h>\n");
+            fprintf(out, "\n");
+            fprintf(out, "#if !defined(COPASM_CONSTEXPR)\n");
+            fprintf(out, "#if defined(__cplusplus)\n");
+            fprintf(out, "#define COPASM_CONSTEXPR constexpr\n");
+            fprintf(out, "#else\n");
+            fprintf(out, "#define COPASM_CONSTEXPR const\n");
+            fprintf(out, "#endif\n");
+            fprintf(out, "#define COPASM_WORD(w) w,\n");
+            fprintf(out, "#endif\n");
+            fprintf(out, "\n");
+            fprintf(out, "enum\n");
             fprintf(out, "{\n");
+            fprintf(out,
+                    "    %s_start = 0x" PR_X64_04 ",    // copper program XR start addr\n",
+                    basename.c_str(),
+                    load_addr);
+            fprintf(out,
+                    "    %s_size  = " PR_D64 ",    // copper program size in words\n",
+                    basename.c_str(),
+                    total_size >> 1);
+            size_t export_count = 0;
+            for (auto expsym : exports)
+            {
+                symbol_t sym = symbols[expsym];
+                if (sym.type != symbol_t::UNDEFINED)
+                {
+                    fprintf(out,
+                            "    %s__%s = " PR_D64 ",    // 0x%04" PRIx64 "\n",
+                            basename.c_str(),
+                            sym.name.c_str(),
+                            sym.value - load_addr,
+                            sym.value);
+                    export_count++;
+                }
+            }
+            fprintf(out, "    %s_export_size = " PR_DSIZET "\n", basename.c_str(), export_count);
+            fprintf(out, "};\n");
+            fprintf(out, "\n");
         }
         break;
         case output_format::VSIM_FILE: {
@@ -842,6 +1472,14 @@ int32_t xlasm::process_output()
             fprintf(out, "// " PR_D64 " 16-bit words\n", total_size >> 1);
         }
         break;
+        case output_format::OBJ_FILE: {
+            out = fopen(object_filename.c_str(), "w");
+            if (!out)
+                fatal_error("opening output file \"%s\", error: %s", object_filename.c_str(), strerror(errno));
+            fprintf(out, "// Xosera copper relocatable object \"%s\"\n", basename.c_str());
+            fprintf(out, "cobj    %s 0x" PR_X64_04 " " PR_D64 "\n", basename.c_str(), load_addr, total_size >> 1);
+        }
+        break;
         case output_format::BIN_FILE: {
             out = fopen(object_filename.c_str(), "wb");
             if (!out)
@@ -910,7 +1548,14 @@ int32_t xlasm::process_output()
                     case output_format::NONE:
                         break;
                     case output_format::C_FILE: {
-                        C_dump(out, it->data.data(), it->data.size());
+                        if (packed)
+                            C_dump_words(out, pack_data);
+                        else
+                            C_dump(out, it->data.data(), it->data.size());
+                    }
+                    break;
+                    case output_format::CONST_FILE: {
+                        const_dump(out, basename, it->data.data(), it->data.size());
                     }
                     break;
                     case output_format::VSIM_FILE: {
@@ -921,8 +1566,19 @@ int32_t xlasm::process_output()
                         mem_dump(out, it->data.data(), it->data.size());
                     }
                     break;
+                    case output_format::OBJ_FILE: {
+                        obj_dump(out, it->data, relocs);
+                    }
+                    break;
                     case output_format::BIN_FILE: {
-                        if (fwrite(it->data.data(), it->data.size(), 1, out) != 1)
+                        std::vector<uint8_t> pack_bytes;
+                        for (auto w : pack_data)
+                        {
+                            pack_bytes.push_back(static_cast<uint8_t>(w >> 8));
+                            pack_bytes.push_back(static_cast<uint8_t>(w));
+                        }
+                        const std::vector<uint8_t> & bin = packed ? pack_bytes : it->data;
+                        if (fwrite(bin.data(), bin.size(), 1, out) != 1)
                             fatal_error("writing binary output file \"%s\", error: %s",
                                         object_filename.c_str(),
                                         strerror(errno));
@@ -985,24 +1641,62 @@ int32_t xlasm::process_output()
                     fprintf(out, "#endif // INC_%s_%c\n", baseupper.c_str(), header_file ? 'H' : 'C');
                 }
                 break;
+                case output_format::CONST_FILE: {
+                    fprintf(out, "\n");
+                    fprintf(out,
+                            "static COPASM_CONSTEXPR uint16_t %s_bin[%s_size] __attribute__ ((unused)) = "
+                            "{%s_words(COPASM_WORD)};\n",
+                            basename.c_str(),
+                            basename.c_str(),
+                            basename.c_str());
+                    fprintf(out, "#endif // INC_%s_CONST_H\n", baseupper.c_str());
+                }
+                break;
                 case output_format::VSIM_FILE:        // nothing more to do here
                     break;
                 case output_format::MEM_FILE:        // nothing more to do here
                     break;
+                case output_format::OBJ_FILE: {
+                    for (auto expsym : exports)
+                    {
+                        symbol_t sym = symbols[expsym];
+                        if (sym.type != symbol_t::UNDEFINED)
+                            fprintf(out, "export  %s " PR_D64 "\n", sym.name.c_str(), sym.value - load_addr);
+                    }
+                    for (auto impsym : imports)
+                    {
+                        fprintf(out, "import  %s", impsym.c_str());
+                        for (auto r : import_relocs[impsym])
+                            fprintf(out, " %u", r);
+                        fprintf(out, "\n");
+                    }
+                    fprintf(out, "end\n");
+                }
+                break;
                 case output_format::BIN_FILE:        // nothing more to do here
                     break;
                 default:
                     assert(false);
             }
         }
-        fclose(out);
-        out = nullptr;
+        if (out)
+        {
+            fclose(out);
+            out = nullptr;
+        }
     }
 
     dprintf("Total output size " PR_D64 " bytes, CRC-32: 0x%08x, effective lines %d.\n",
             total_size,
             crc_value,
             virtual_line_num);
+    if (opt.optimize)
+    {
+        dprintf("Optimization saved " PR_D64 " words (%u instructions optimized in %u passes).\n",
+                bytes_optimized >> 1,
+                applied_hints,
+                pass_count);
+    }
 
     return 0;
 }
@@ -1039,8 +1733,7 @@ int32_t xlasm::process_file(source_t & f)
 
     if (error_count >= MAXERROR_COUNT)
     {
-        error("Exiting due to maximum error count (%d)", error_count);
-        exit(10);
+        fatal_error("Exiting due to maximum error count (%d)", error_count);
     }
 
     if (func_section != nullptr)
@@ -1049,6 +1742,13 @@ int32_t xlasm::process_file(source_t & f)
     if (ctxt.conditional_nesting != 0)
         warning("Ending file inside conditional IF block");
 
+    if (ctxt.loopdef_ptr != nullptr)
+    {
+        ctxt.line = static_cast<uint32_t>(f.src_line.size() - 1);        // report at last line
+        error("Ending file inside REPT/FOR block (missing ENDR)");
+        ctxt.loopdef_ptr = nullptr;
+    }
+
     return rc;
 }
 
@@ -1077,6 +1777,16 @@ int32_t xlasm::process_line()
 #endif
     }
 
+    // if defining a REPT/FOR loop, save lines (until matching ENDR) for processing when loop is expanded
+    if (ctxt.loopdef_ptr != nullptr && define_loop_line(tokens))
+    {
+        if (listing_file)
+            process_line_listing();
+        virtual_line_num++;
+
+        return rc;
+    }
+
     std::string label;
     std::string command;
     size_t      cur_token = 0;
@@ -1219,6 +1929,9 @@ int32_t xlasm::process_line()
     if (listing_file)
         process_line_listing();
 
+    if (ctxt.pass == context_t::PASS_RELOC)
+        check_reloc_line();
+
     if (error_count >= MAXERROR_COUNT)
     {
         force_exit_assembly = true;
@@ -1427,9 +2140,24 @@ int32_t xlasm::process_line_listing()
         }
 #endif
 
+        // copper cycles (cumulative since last wait)
+        if (line_cycles >= 0 && !suppress_line_listsource)
+        {
+            std::string cycstr;
+            strprintf(cycstr, "~%d%s", line_cycles, line_cycles_wait ? "+" : "");
+            strprintf(outline, "%-6s", cycstr.c_str());
+        }
+        else
+        {
+            strprintf(outline, "      ");
+        }
+
         if (!suppress_line_listsource)
         {
-            strprintf(outline, "\t%s", ctxt.file->orig_line[ctxt.line].c_str());
+            strprintf(outline,
+                      "\t%.*s",
+                      static_cast<int>(ctxt.file->orig_size(ctxt.line)),
+                      ctxt.file->orig_data(ctxt.line));
         }
         else
             strprintf(outline, "\t<alignment pad>");
@@ -1477,7 +2205,9 @@ int32_t xlasm::process_line_listing()
         fputs(outline.c_str(), listing_file);
     }
 
-    sym_defined = nullptr;
+    sym_defined      = nullptr;
+    line_cycles      = -1;
+    line_cycles_wait = false;
 
     return 0;
 }
@@ -1603,11 +2333,32 @@ int32_t xlasm::process_directive(uint32_t                         idx,
     if (ctxt.macrodef_ptr != nullptr)
     {
         ctxt.macrodef_ptr->body.src_line.push_back(tokens);
-        ctxt.macrodef_ptr->body.file_size += ctxt.file->orig_line[ctxt.line].size();
+        ctxt.macrodef_ptr->body.file_size += ctxt.file->orig_size(ctxt.line);
 
         return 0;
     }
 
+    // loop directives (only processed if current conditional true)
+    if (ctxt.conditional.state)
+    {
+        switch (idx)
+        {
+            // REPT/FOR ===============================
+            case DIR_REPT:
+            case DIR_FOR: {
+                return define_loop_begin(idx, directive, label, cur_token, tokens);
+            }
+
+            // ENDR ===============================
+            case DIR_ENDR: {
+                return define_loop_end(directive, label, cur_token, tokens);
+            }
+
+            default:
+                break;
+        }
+    }
+
     // directives processed even if current conditional false
     switch (idx)
     {
@@ -2220,13 +2971,14 @@ int32_t xlasm::process_directive(uint32_t                         idx,
                 return 0;
             }
 
-            if (ctxt.pass == context_t::PASS_2)
+            // NOTE: exports gathered every pass (so architecture can see them), but only checked in final pass
+            do
             {
-                do
-                {
-                    std::string export_label = tokens[cur_token];
+                std::string export_label = tokens[cur_token];
 
-                    if (std::find(exports.begin(), exports.end(), export_label) == exports.end())
+                if (std::find(exports.begin(), exports.end(), export_label) == exports.end())
+                {
+                    if (ctxt.pass == context_t::PASS_2)
                     {
                         symbol_t & sym = symbols[export_label];
 
@@ -2237,26 +2989,80 @@ int32_t xlasm::process_directive(uint32_t                         idx,
                             return 0;
                         }
 
-                        notice(3,
-                               "Exported variable \"%s\" = 0x" PR_X64 "/" PR_D64 "",
-                               export_label.c_str(),
-                               sym.value,
-                               sym.value);
-                        exports.push_back(export_label);
-                    }
+                        notice(3,
+                               "Exported variable \"%s\" = 0x" PR_X64 "/" PR_D64 "",
+                               export_label.c_str(),
+                               sym.value,
+                               sym.value);
+                    }
+                    exports.push_back(export_label);
+                }
+
+                cur_token++;
+
+                if (cur_token < tokens.size())
+                {
+                    assert(tokens[cur_token] == ",");
+
+                    if (cur_token + 1 >= tokens.size())
+                        error("%s missing argument after \",\"", directive.c_str());
+                }
+            } while (++cur_token < tokens.size());
+
+
+            return 0;
+        }
+
+        // IMPORT ===============================
+        case DIR_IMPORT: {
+            if (label.size())
+            {
+                error("Label definition not permitted on %s", directive.c_str());
+                return 0;
+            }
+
+            if (!hasEnding(object_filename, ".cobj"))
+            {
+                error("%s only permitted for relocatable object (.cobj) output", directive.c_str());
+                return 0;
+            }
+
+            // NOTE: imported labels have the object origin as value until patched by linker
+            do
+            {
+                std::string import_label = tokens[cur_token];
+                symbol_t &  sym          = symbols[import_label];
+
+                if (sym.type == symbol_t::UNDEFINED)
+                {
+                    sym.type         = symbol_t::LABEL;
+                    sym.name         = import_label;
+                    sym.line_defined = ctxt.line;
+                    sym.file_defined = ctxt.file;
+                }
+                else if (sym.type != symbol_t::LABEL || sym.line_defined != ctxt.line || sym.file_defined != ctxt.file)
+                {
+                    error("Cannot import symbol already defined: \"%s\"", import_label.c_str());
+                    return 0;
+                }
+
+                sym.value = (ctxt.pass == context_t::PASS_RELOC) ? reloc_origin : ctxt.section->load_addr;
+                if (import_label == reloc_import)
+                    sym.value += RELOC_PROBE_OFFSET;
 
-                    cur_token++;
+                if (std::find(imports.begin(), imports.end(), import_label) == imports.end())
+                    imports.push_back(import_label);
 
-                    if (cur_token < tokens.size())
-                    {
-                        assert(tokens[cur_token] == ",");
+                cur_token++;
 
-                        if (cur_token + 1 >= tokens.size())
-                            error("%s missing argument after \",\"", directive.c_str());
-                    }
-                } while (++cur_token < tokens.size());
-            }
+                if (cur_token < tokens.size())
+                {
+                    assert(tokens[cur_token] == ",");
 
+                    if (cur_token + 1 >= tokens.size())
+                        error("%s missing argument after \",\"", directive.c_str());
+                }
+            } while (++cur_token < tokens.size());
 
             return 0;
         }
@@ -2336,6 +3142,11 @@ int32_t xlasm::process_directive(uint32_t                         idx,
             std::string exprstr;
             int64_t     origin = eval_tokens(directive, exprstr, cur_token, tokens, 1, ctxt.section->addr);
 
+            if (ctxt.pass == context_t::PASS_RELOC)
+            {
+                error("%s not permitted in relocatable object (.cobj) output", directive.c_str());
+            }
+
             if (!ctxt.section->data.size())
             {
                 ctxt.section->load_addr = origin;
@@ -2971,9 +3782,14 @@ int64_t xlasm::eval_tokens(const std::string &              cmd,
     }
     else
     {
+        int32_t paren_depth = 0;
         for (auto it = tokens.begin() + static_cast<int32_t>(cur_token); it != tokens.end(); ++it, cur_token++)
         {
-            if (*it == ",")
+            if (*it == "(")
+                paren_depth++;
+            else if (*it == ")")
+                paren_depth--;
+            else if (*it == "," && paren_depth <= 0)        // commas inside parenthesis are function arguments
                 break;
 
             //			if (exprstr.size())
@@ -3185,6 +4001,207 @@ bool xlasm::define_macro_end(const std::string &              directive,
     return 0;
 }
 
+bool xlasm::define_loop_begin(uint32_t                         idx,
+                              const std::string &              directive,
+                              const std::string &              label,
+                              size_t                           cur_token,
+                              const std::vector<std::string> & tokens)
+{
+    // label is defined once, at start of loop output
+    if (label.size())
+    {
+        process_labeldef(label);
+    }
+
+    std::string exprstr;
+    std::string var;
+    int64_t     first = 0;
+    int64_t     step  = 1;
+    int64_t     count = 0;
+
+    if (idx == DIR_FOR)
+    {
+        // FOR var = first, last [, step]
+        if (tokens.size() - cur_token < 3 || tokens[cur_token + 1] != "=")
+        {
+            error("%s expected \"variable = first, last [, step]\"", directive.c_str());
+        }
+        else
+        {
+            var = tokens[cur_token];
+            cur_token += 2;
+            first        = eval_tokens(directive, exprstr, cur_token, tokens, 2, 0);
+            int64_t last = eval_tokens(directive, exprstr, cur_token, tokens, 2, first);
+            if (cur_token < tokens.size())
+                step = eval_tokens(directive, exprstr, cur_token, tokens, 1, 1);
+
+            if (step == 0)
+                error("%s step of zero", directive.c_str());
+            else if ((step > 0 && last >= first) || (step < 0 && last <= first))
+                count = (last - first) / step + 1;
+        }
+    }
+    else
+    {
+        // REPT count [, var]
+        count = eval_tokens(directive, exprstr, cur_token, tokens, 2, 0);
+        if (cur_token < tokens.size())
+        {
+            var = tokens[cur_token++];
+            if (cur_token < tokens.size())
+            {
+                error("%s unexpected extra argument(s)", directive.c_str());
+            }
+        }
+
+        if (count < 0)
+        {
+            error("%s negative repeat count " PR_D64, directive.c_str(), count);
+            count = 0;
+        }
+    }
+
+    if (var.size() && !isalpha(var[0]) && var[0] != '_')
+    {
+        error("%s illegal variable name \"%s\"", directive.c_str(), var.c_str());
+        var.clear();
+    }
+
+    if (count > MAXLOOP_ITERATIONS)
+    {
+        error("%s iteration count " PR_D64 " exceeds limit of %d", directive.c_str(), count, MAXLOOP_ITERATIONS);
+        count = 0;
+    }
+
+    // loop bodies are kept between passes (keyed by source location) so symbols defined in them stay valid
+    std::string key;
+    strprintf(key, "%p:%u", static_cast<void *>(ctxt.file), ctxt.line);
+
+    loop_t & lp = loops[key];
+
+    lp.var             = var;
+    lp.first           = first;
+    lp.step            = step;
+    lp.count           = count;
+    lp.body.name       = ctxt.file->name;
+    lp.body.line_start = ctxt.file->line_start + ctxt.line + 1;
+    lp.body.file_size  = 0;
+    lp.body.view.reset();
+    lp.body.text.clear();
+    lp.body.orig_line.clear();
+    lp.body.src_line.clear();
+
+    notice(3, "Defining %s loop with " PR_D64 " iterations", directive.c_str(), count);
+
+    ctxt.loopdef_ptr  = &lp;
+    ctxt.loop_nesting = 0;
+
+    return 0;
+}
+
+bool xlasm::define_loop_line(const std::vector<std::string> & tokens)
+{
+    // find directive (after optional label) to track nested loops
+    size_t cmd_token = (tokens.size() && tokens[0].back() == ':') ? 1 : 0;
+    if (cmd_token < tokens.size())
+    {
+        std::string command = tokens[cmd_token][0] == '.' ? tokens[cmd_token].substr(1) : tokens[cmd_token];
+        std::transform(command.begin(), command.end(), command.begin(), uppercase);
+
+        auto     it  = directives.find(command);
+        uint32_t idx = (it != directives.end()) ? it->second : static_cast<uint32_t>(DIR_UNKNOWN);
+
+        if (idx == DIR_REPT || idx == DIR_FOR)
+        {
+            ctxt.loop_nesting++;
+        }
+        else if (idx == DIR_ENDR)
+        {
+            if (ctxt.loop_nesting == 0)
+                return false;        // process ENDR that ends this loop
+            ctxt.loop_nesting--;
+        }
+    }
+
+    ctxt.loopdef_ptr->body.src_line.push_back(tokens);
+    ctxt.loopdef_ptr->body.add_orig_line(ctxt.file->orig_data(ctxt.line), ctxt.file->orig_size(ctxt.line));
+    ctxt.loopdef_ptr->body.file_size += ctxt.file->orig_size(ctxt.line);
+
+    return true;
+}
+
+bool xlasm::define_loop_end(const std::string &              directive,
+                            const std::string &              label,
+                            size_t                           cur_token,
+                            const std::vector<std::string> & tokens)
+{
+    if (ctxt.loopdef_ptr == nullptr)
+    {
+        error("%s encountered without matching REPT or FOR", directive.c_str());
+        return 0;
+    }
+
+    if (label.size())
+    {
+        error("Label definition not permitted on %s", directive.c_str());
+    }
+
+    if (tokens.size() - cur_token != 0)
+        error("" PR_DSIZET " extra token%s after %s",
+              (tokens.size() - cur_token),
+              (tokens.size() - cur_token) == 1 ? "" : "s",
+              directive.c_str());
+
+    loop_t & lp      = *ctxt.loopdef_ptr;
+    ctxt.loopdef_ptr = nullptr;
+
+    notice(3,
+           "%s expanding " PR_DSIZET " lines " PR_D64 " times",
+           directive.c_str(),
+           lp.body.src_line.size(),
+           lp.count);
+
+    if (listing_file)
+        process_line_listing();
+
+    context_stack.push(ctxt);
+
+    int64_t value = lp.first;
+    for (int64_t i = 0; i < lp.count && !force_exit_assembly; i++, value += lp.step)
+    {
+        if (lp.var.size())
+        {
+            symbol_t & sym = symbols[lp.var];
+
+            if (sym.type != symbol_t::UNDEFINED && sym.type != symbol_t::VARIABLE)
+            {
+                error("Cannot assign to non-variable: \"%s\" defined at %s(%d)",
+                      lp.var.c_str(),
+                      sym.file_defined ? sym.file_defined->name.c_str() : "?",
+                      sym.line_defined);
+                break;
+            }
+
+            sym.type         = symbol_t::VARIABLE;
+            sym.name         = lp.var;
+            sym.line_defined = context_stack.top().line;
+            sym.file_defined = context_stack.top().file;
+            sym.section      = ctxt.section;
+            sym.value        = value;
+        }
+
+        process_file(lp.body);
+    }
+
+    ctxt = context_stack.top();
+    context_stack.pop();
+
+    if (listing_file)
+        suppress_line_list = true;        // ENDR line already listed
+
+    return 0;
+}
+
 xlasm::source_t & xlasm::expand_macro(std::string & name, size_t cur_token, const std::vector<std::string> & tokens)
 {
     macro_t & m = macros[name];
@@ -3460,7 +4477,7 @@ xlasm::source_t & xlasm::expand_macro(std::string & name, size_t cur_token, cons
                     if (tit + 1 != lit->end() && idx < 2)
                         fake_line += " ";
                 }
-                s.orig_line.push_back(fake_line);
+                s.add_orig_line(fake_line.data(), fake_line.size());
                 //				dprintf("AFTER : " PR_DSIZET ": %s\n", lit - s.src_line.begin(), fake_line.c_str());
             }
         }
@@ -3806,42 +4823,86 @@ int32_t xlasm::source_t::read_file(xlasm * xa, const std::string & n, const std:
         return 0;
     }
 
-    name = n;
+    auto start_time = std::chrono::steady_clock::now();
 
-    FILE * fp = fopen(fn.c_str(), "r");
-    if (!fp)
+    // keep file mapped while lines refer to it (no per-line copies)
+    std::shared_ptr<file_view_t> fv = std::make_shared<file_view_t>();
+    int                          e  = fv->open(fn);
+    if (e)
     {
-        return errno;
+        return e;
     }
 
-    char        line_buff[MAX_LINE_LENGTH] = {0};
-    std::string nline;
+    view = fv;
+    text.clear();
+    tokenize(xa, n, fv->data, fv->size);
 
-    while (!ferror(fp) && fgets(line_buff, sizeof(line_buff) - 1, fp) != nullptr)
-    {
-        nline = line_buff;
-        file_size += nline.size();
-        rtrim(nline, " \r\n");
-        if (nline.size() < 3 || nline[0] != '#' || nline[1] != ' ' || (nline[2] < '0' && nline[2] > '9'))
-        {
-            orig_line.push_back(nline);
-        }
-    }
+    xa->source_bytes_read += file_size;
+    xa->source_read_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
 
-    if (!feof(fp))
-    {
-        int e = errno;
-        fclose(fp);
-        return e;
-    }
-    fclose(fp);
+    return 0;
+}
+
+// copy caller's source text (one copy of whole text, lines refer to it) and tokenize it
+void xlasm::source_t::read_buffer(xlasm * xa, const std::string & n, const char * data, size_t size)
+{
+    view.reset();
+    text.assign(data, size);
+    tokenize(xa, n, text.data(), text.size());
+}
+
+// original line text in mapped file or text string
+const char * xlasm::source_t::orig_data(size_t line) const
+{
+    return (view ? view->data : text.data()) + orig_line[line].offset;
+}
+
+// append line to text (for macro/loop bodies and generated listing lines, not mapped sources)
+void xlasm::source_t::add_orig_line(const char * line, size_t len)
+{
+    assert(!view);
+    orig_line.push_back({text.size(), len});
+    text.append(line, len);
+}
+
+// split source text (data is view data or text string) into lines and tokenize them
+void xlasm::source_t::tokenize(xlasm * xa, const std::string & n, const char * data, size_t size)
+{
+    name = n;
+
+    const char * fptr = data;
+    const char * fend = data + size;
+
+    file_size = size;
 
-    // do preliminary processing on input file to make it more regular WRT whitespace and removing comments
+    size_t max_lines = static_cast<size_t>(std::count(fptr, fend, '\n')) + 1;
+    orig_line.reserve(max_lines);
+    src_line.reserve(max_lines);
+
+    // split lines and do preliminary processing on them to make it more regular WRT whitespace and removing comments
+    // (in a single scan of the file contents)
     std::vector<std::string> cooked_tokens;
     std::string              token;
     uint32_t                 ln = 0;
-    for (std::vector<std::string>::iterator it = orig_line.begin(); it != orig_line.end(); ++it, ln++)
+    while (fptr < fend)
     {
+        const char * line = fptr;
+        const char * eol  = static_cast<const char *>(memchr(fptr, '\n', static_cast<size_t>(fend - fptr)));
+
+        fptr = eol ? eol + 1 : fend;
+        if (!eol)
+            eol = fend;
+        while (eol > line && (eol[-1] == ' ' || eol[-1] == '\r'))
+            eol--;
+
+        size_t len = static_cast<size_t>(eol - line);
+
+        // skip C preprocessor line markers
+        if (len >= 3 && line[0] == '#' && line[1] == ' ')
+            continue;
+
+        orig_line.push_back({static_cast<size_t>(line - data), len});
+
         char inquotes   = 0;
         bool escape     = false;
         bool whitespace = false;
@@ -3849,12 +4910,12 @@ int32_t xlasm::source_t::read_file(xlasm * xa, const std::string & n, const std:
         cooked_tokens.clear();
         token.clear();
 
-        if (it->c_str()[0] != '#')
+        if (len == 0 || line[0] != '#')
         {
             char c = 0, prev_c = 0;
-            for (std::string::iterator sit = it->begin(); sit != it->end(); ++sit)
+            for (size_t i = 0; i < len; i++)
             {
-                c = *sit;
+                c = line[i];
 
                 if (!inquotes)
                 {
@@ -3863,7 +4924,7 @@ int32_t xlasm::source_t::read_file(xlasm * xa, const std::string & n, const std:
                         break;
 
                     // C++ style comment start
-                    if (c == '/' && (sit + 1 != it->end() && sit[1] == '/'))
+                    if (c == '/' && (i + 1 < len && line[i + 1] == '/'))
                         break;
 
                     bool ws = (isspace(c) || c < ' ');
@@ -3911,7 +4972,7 @@ int32_t xlasm::source_t::read_file(xlasm * xa, const std::string & n, const std:
                             token.clear();
                         }
 
-                        char next_c = ((sit + 1) != it->end()) ? sit[1] : '\0';
+                        char next_c = (i + 1 < len) ? line[i + 1] : '\0';
 
                         bool two_char = (c == '!' && next_c == '=') ||        // !=
                                         (c == '=' && next_c == '=') ||        // ==
@@ -4009,20 +5070,31 @@ int32_t xlasm::source_t::read_file(xlasm * xa, const std::string & n, const std:
 		dprintf("\n");
 #endif
 
-        src_line.push_back(cooked_tokens);
+        src_line.push_back(std::move(cooked_tokens));
+        ln++;
+    }
+}
+
+// print diagnostic line (or add it to diag_log if set)
+void xlasm::diag_output(const std::string & line)
+{
+    if (diag_log)
+    {
+        diag_log->push_back(line);
+        return;
     }
 
-    return 0;
+    printf("%s\n", line.c_str());
 }
 
 void xlasm::diag_showline()
 {
     if (!last_diag_file)
         return;
-    printf("%s:%d: %s\n",
-           last_diag_file->name.c_str(),
-           last_diag_line + last_diag_file->line_start,
-           last_diag_file->orig_line[last_diag_line].c_str());
+    std::string line;
+    strprintf(line, "%s:%d: ", last_diag_file->name.c_str(), last_diag_line + last_diag_file->line_start);
+    line.append(last_diag_file->orig_data(last_diag_line), last_diag_file->orig_size(last_diag_line));
+    diag_output(line);
     fflush(stdout);
     last_diag_file = nullptr;
 }
@@ -4047,12 +5119,14 @@ void xlasm::error(const char * msg, ...)
 
     diag_flush();
 
-    printf("%s:%d: ", ctxt.file->name.c_str(), ctxt.line + ctxt.file->line_start);
-    printf(TERM_ERROR "ERROR: ");
+    std::string line;
+    strprintf(line, "%s:%d: ", ctxt.file->name.c_str(), ctxt.line + ctxt.file->line_start);
+    strprintf(line, "%sERROR: ", diag_log ? "" : TERM_ERROR);
     if (ctxt.macroexp_ptr)
-        printf("[in MACRO \"%s\"] ", ctxt.macroexp_ptr->name.c_str());
-    vprintf(msg, ap);
-    printf(TERM_CLEAR "\n");
+        strprintf(line, "[in MACRO \"%s\"] ", ctxt.macroexp_ptr->name.c_str());
+    vstrprintf(line, msg, ap);
+    strprintf(line, "%s", diag_log ? "" : TERM_CLEAR);
+    diag_output(line);
 
     va_end(ap);
 
@@ -4086,13 +5160,15 @@ void xlasm::warning(const char * msg, ...)
 
     diag_flush();
 
+    std::string line;
     if (ctxt.file)
-        printf("%s:%d: ", ctxt.file->name.c_str(), ctxt.line + ctxt.file->line_start);
-    printf(TERM_WARN "WARNING: ");
+        strprintf(line, "%s:%d: ", ctxt.file->name.c_str(), ctxt.line + ctxt.file->line_start);
+    strprintf(line, "%sWARNING: ", diag_log ? "" : TERM_WARN);
     if (ctxt.macroexp_ptr)
-        printf("[in MACRO \"%s\"] ", ctxt.macroexp_ptr->name.c_str());
-    vprintf(msg, ap);
-    printf(TERM_CLEAR "\n");
+        strprintf(line, "[in MACRO \"%s\"] ", ctxt.macroexp_ptr->name.c_str());
+    vstrprintf(line, msg, ap);
+    strprintf(line, "%s", diag_log ? "" : TERM_CLEAR);
+    diag_output(line);
 
     va_end(ap);
 
@@ -4129,13 +5205,14 @@ void xlasm::notice(int32_t level, const char * msg, ...)
 
     diag_flush();
 
+    std::string line;
     if (ctxt.file)
-        printf("%s:%d: ", ctxt.file->name.c_str(), ctxt.line + ctxt.file->line_start);
-    printf("NOTE: ");
+        strprintf(line, "%s:%d: ", ctxt.file->name.c_str(), ctxt.line + ctxt.file->line_start);
+    strprintf(line, "NOTE: ");
     if (ctxt.macroexp_ptr)
-        printf("[in MACRO \"%s\"] ", ctxt.macroexp_ptr->name.c_str());
-    vprintf(msg, ap);
-    printf("\n");
+        strprintf(line, "[in MACRO \"%s\"] ", ctxt.macroexp_ptr->name.c_str());
+    vstrprintf(line, msg, ap);
+    diag_output(line);
 
     va_end(ap);
 
@@ -4289,203 +5366,4 @@ void strprintf(std::string & str, const char * fmt, ...)
     va_end(ap);
 }
 
-static void show_help()
-{
-    printf("copasm - XarkLabs Xosera \"Slim Copper\" Assembler\n");
-    printf("         Copyright 2022 Xark - MIT Licensed\n");
-    printf("\n");
-    printf("Usage:  copasm [options] <input files ...> [-o output.fmt]\n");
-    printf("\n");
-    printf("-b      maximum bytes hex per listing line (8-64, default 8)\n");
-    printf("-c      suppress listing inside false conditional (.LISTCOND false)\n");
-    printf("-d sym  define <sym>[=expression]\n");
-    printf("-i      add default include search path (tried if include fails)\n");
-    printf("-k      no error-kill, continue assembly despite errors\n");
-    printf("-l      request listing file (uses output name with .lst)\n");
-    printf("-m      suppress macro expansion listing (.LISTMAC false)\n");
-    printf("-n      suppress macro name in listing (.MACNAME false)\n");
-    printf("-o      output file name (using extension format .c/.h or binary)\n");
-    printf("-q      quiet operation\n");
-    printf("-v      verbose operation (repeat up to three times)\n");
-    printf("-x      add symbol cross-reference to end of listing file\n");
-    printf("\n");
-}
-
-int main(int argc, char ** argv)
-{
-    std::string              archname;
-    std::vector<std::string> source_files;
-    std::string              object_file;
-    xlasm::opts_t            opts;
-
-    for (int i = 1; i < argc; i++)
-    {
-        if (argv[i][0] == '-')
-        {
-            switch (argv[i][1])
-            {
-                case 'a':
-                    if (argv[i][2] != 0)
-                        archname = &argv[i][2];
-                    else if (i + 1 < argc)
-                        archname = argv[++i];
-                    else
-                        fatal_error("Expected architecture name after -a option");
-                    break;
-
-                case 'b':
-                    if (argv[i][2] != 0)
-                    {
-                        if (sscanf(&argv[i][2], "%u", &opts.listing_bytes) != 1)
-                            fatal_error("Expected number after -b listing bytes option (8 per line)");
-                    }
-                    else if (i + 1 < argc)
-                    {
-                        if (sscanf(argv[++i], "%u", &opts.listing_bytes) != 1)
-                            fatal_error("Expected number after -b listing bytes option (8 per line)");
-                    }
-                    else
-                    {
-                        fatal_error("Expected number after -b listing bytes option (8 per line)");
-                    }
-
-
-                    opts.listing_bytes = (opts.listing_bytes + 7) & ~7U;
-                    if (opts.listing_bytes < 8)
-                        opts.listing_bytes = 8;
-                    break;
-
-                case 'c':
-                    opts.suppress_false_conditionals = true;
-                    break;
-
-                case 'd':
-                    if (argv[i][2] != 0)
-                    {
-                        opts.define_sym.push_back(&argv[i][2]);
-                    }
-                    else if (i + 1 < argc)
-                    {
-                        opts.define_sym.push_back(argv[++i]);
-                    }
-                    else
-                    {
-                        fatal_error("Expected symbol after -d define sym option");
-                    }
-                    break;
-
-                case 'i':
-                    if (argv[i][2] != 0)
-                    {
-                        opts.include_path.push_back(&argv[i][2]);
-                    }
-                    else if (i + 1 < argc)
-                    {
-                        opts.include_path.push_back(argv[++i]);
-                    }
-                    else
-                    {
-                        fatal_error("Expected path after -i include path option");
-                    }
-                    break;
-
-                case 'h':
-                case '?': {
-                    show_help();
-                    exit(EXIT_SUCCESS);
-                }
-                case 'm':
-                    opts.suppress_macro_expansion = true;
-                    break;
-
-                case 'n':
-                    opts.suppress_macro_name = true;
-                    break;
-
-                case 'k':
-                    opts.no_error_kill = true;
-                    break;
-
-                case 'l':
-                    opts.listing = true;
-                    break;
-
-                case 'o':
-                    if (argv[i][2] != 0)
-                    {
-                        object_file = &argv[i][2];
-                    }
-                    else if (i + 1 < argc)
-                    {
-                        object_file = argv[++i];
-                    }
-                    else
-                    {
-                        fatal_error("Expected filename after -o output file option");
-                    }
-                    break;
-
-                case 'q':
-                    opts.verbose = 0;
-                    break;
-
-                case 'v':
-                    opts.verbose++;
-                    break;
-
-                case 'x':
-                    opts.xref = true;
-                    break;
-
-                default:
-                    show_help();
-                    fatal_error("Unrecognized option -%c", argv[i][1]);
-                    break;
-            }
-
-            continue;
-        }
-        source_files.push_back(std::string(argv[i]));
-    }
-
-    if (opts.verbose > 1)
-    {
-        if (opts.verbose == 2)
-            printf("Verbose status messages enabled.\n");
-        else if (opts.verbose > 2)
-            printf("Verbose status and debugging messages enabled.\n");
-    }
-
-    copper copperarch;
-
-    if (archname.size() == 0)
-        archname = "copper";
-
-    Ixlarch * initialarch = Ixlarch::find_arch(archname);
-
-    if (initialarch == nullptr)
-    {
-        printf("Supported architectures (with variants and identifiers):\n");
-        for (auto & a : Ixlarch::architectures)
-        {
-            printf("  %s\n", a->variant_names());
-        }
-        printf("\n");
-
-        fatal_error("Unrecognized architecture \"%s\".", archname.c_str());
-    }
-
-    if (!source_files.size())
-    {
-        show_help();
-        fatal_error("No input file(s) specified");
-    }
-
-    xlasm xl(archname);
-
-    int rc = xl.assemble(source_files, object_file, opts);
-
-    return rc;
-}
-
 // EOF
@@ -5,6 +5,7 @@
 #include <cinttypes>
 #include <cstdarg>
 #include <list>
+#include <memory>
 #include <random>
 #include <stack>
 #include <stdint.h>
@@ -50,15 +51,18 @@
 #define UNICODE_SUPPORT 0
 
 [[noreturn]] void fatal_error(const char * msg, ...) ATTRIBUTE((noreturn)) ATTRIBUTE((format(printf, 1, 2)));
+extern void (*fatal_error_hook)(const std::string & msg);        // called before fatal_error exits (if set)
 void              vstrprintf(std::string & str, const char * fmt, va_list va) ATTRIBUTE((format(printf, 2, 0)));
 void              strprintf(std::string & str, const char * fmt, ...) ATTRIBUTE((format(printf, 2, 3)));
 char              uppercase(char v);
 char              lowercase(char v);
+bool              hasEnding(const std::string & fullString, const std::string & ending);
 
 #define MAX_LINE_LENGTH 4096
 #define NUM_ELEMENTS(a) (sizeof(a) / sizeof(a[0]))
 
 struct Ixlarch;
+struct file_view_t;        // mapped (or read) source file contents
 
 struct xlasm
 {
@@ -73,7 +77,9 @@ struct xlasm
         int32_t                  verbose;        // 0, 1, 2 or 3
         std::vector<std::string> include_path;
         std::vector<std::string> define_sym;        // unmolested original line (with no newline)
+        std::string              timing_file;       // append per-phase timing as a JSON line (-t, for benchmarking)
         uint32_t                 listing_bytes;
+        uint32_t                 video_width;        // 640 or 848 (selects copper cycles per line)
         uint64_t                 load_address;
         bool                     listing;
         bool                     xref;
@@ -82,10 +88,12 @@ struct xlasm
         bool                     suppress_macro_expansion;
         bool                     suppress_macro_name;
         bool                     suppress_line_numbers;
+        bool                     optimize;        // peephole optimize copper code
 
         opts_t() noexcept
                 : verbose(1)
                 , listing_bytes(0x600)
+                , video_width(640)
                 , load_address(0)
                 , listing(false)
                 , xref(false)
@@ -94,14 +102,23 @@ struct xlasm
                 , suppress_macro_expansion(false)
                 , suppress_macro_name(false)
                 , suppress_line_numbers(false)
+                , optimize(false)
         {
         }
     };
 
+    struct line_span_t
+    {
+        size_t offset;        // offset in source_t text (view data or text string)
+        size_t length;        // line length (with no newline)
+    };
+
     struct source_t
     {
         std::string                           name;
-        std::vector<std::string>              orig_line;        // unmolested original line (with no newline)
+        std::shared_ptr<file_view_t>          view;             // mapped file text (shared by copies, or null)
+        std::string                           text;             // source text when not mapped (or added lines)
+        std::vector<line_span_t>              orig_line;        // unmolested original line (span in source text)
         std::vector<std::vector<std::string>> src_line;         // broken up into vector of tokens per line
         uint64_t                              file_size;
         uint32_t                              line_start;
@@ -112,6 +129,20 @@ struct xlasm
         {
         }
         int32_t read_file(xlasm *, const std::string & n, const std::string & fn);
+        void    read_buffer(xlasm *, const std::string & n, const char * data, size_t size);
+        void    tokenize(xlasm *, const std::string & n, const char * data, size_t size);
+
+        // original line text (only copied when a listing or message needs it)
+        const char * orig_data(size_t line) const;
+        size_t       orig_size(size_t line) const
+        {
+            return orig_line[line].length;
+        }
+        std::string orig_text(size_t line) const
+        {
+            return std::string(orig_data(line), orig_size(line));
+        }
+        void add_orig_line(const char * line, size_t len);        // append line to text (not for mapped source)
     };
     typedef std::unordered_map<std::string, source_t> source_map_t;
 
@@ -198,8 +229,9 @@ struct xlasm
             return symbol_t_abbrev[static_cast<size_t>(type)];
         }
     };
-    typedef std::unordered_map<std::string, symbol_t> symbol_map_t;
-    typedef std::vector<std::string>                  export_list_t;
+    typedef std::unordered_map<std::string, symbol_t>              symbol_map_t;
+    typedef std::vector<std::string>                               export_list_t;
+    typedef std::unordered_map<std::string, std::vector<uint32_t>> reloc_map_t;
 
     struct condition_t
     {
@@ -230,6 +262,23 @@ struct xlasm
     };
     typedef std::unordered_map<std::string, macro_t> macro_map_t;
 
+    struct loop_t
+    {
+        std::string var;          // iteration variable name (optional for REPT)
+        int64_t     first;        // first value of variable
+        int64_t     step;         // value added to variable each iteration
+        int64_t     count;        // number of iterations
+        source_t    body;
+
+        loop_t() noexcept
+                : first(0)
+                , step(1)
+                , count(0)
+        {
+        }
+    };
+    typedef std::unordered_map<std::string, loop_t> loop_map_t;
+
     struct context_t
     {
         enum pass_t
@@ -239,6 +288,7 @@ struct xlasm
             PASS_OPT,        // optimize code for smallest/fastest possible (done repeatedly until optimal or max passes
                              // exceeded)
             PASS_2,          // actually generate output (with all symbols defined)
+            PASS_RELOC,      // re-assemble at shifted origin to find relocatable words (for .cobj output)
             NUM_PASSES
         };
         uint32_t    pass;
@@ -247,6 +297,8 @@ struct xlasm
         section_t * section;
         macro_t *   macroexp_ptr;
         macro_t *   macrodef_ptr;
+        loop_t *    loopdef_ptr;
+        int32_t     loop_nesting;
         int32_t     conditional_nesting;
         condition_t conditional;
 
@@ -257,6 +309,8 @@ struct xlasm
                 , section(nullptr)
                 , macroexp_ptr(nullptr)
                 , macrodef_ptr(nullptr)
+                , loopdef_ptr(nullptr)
+                , loop_nesting(0)
                 , conditional_nesting(0)
         {
         }
@@ -268,8 +322,10 @@ struct xlasm
         MAXINCLUDE_STACK     = 64,            // include nest depth
         MAXMACRO_STACK       = 1024,          // nested macro depth
         MAXMACROREPS_WARNING = 255,           // max parameters replacement iterations per line
+        MAXLOOP_ITERATIONS   = 0x10000,       // max REPT/FOR iterations (safety check)
         MAXFILL_BYTES        = 0xC00L,        // max size output by space or fill directive (safety check)
-        MAX_PASSES           = 10             // maximum number of assembler passes before optimization short-circuited
+        MAX_PASSES           = 10,            // maximum number of assembler passes before optimization short-circuited
+        RELOC_PROBE_OFFSET   = 0x102          // relocation pass origin shift (not power of 2, so scaled labels differ)
     };
 
     enum directive_index
@@ -306,6 +362,10 @@ struct xlasm
         DIR_MACNAME,
         DIR_LISTCOND,
         DIR_EXPORT,
+        DIR_IMPORT,
+        DIR_REPT,
+        DIR_FOR,
+        DIR_ENDR,
         NUM_DIRECTIVES
     };
 
@@ -319,6 +379,14 @@ struct xlasm
     typedef std::unordered_map<std::string, uint32_t> directive_map_t;
     typedef std::unordered_map<uint32_t, uint32_t>    hint_map_t;
 
+    struct phase_time_t
+    {
+        std::string name;           // "pass_1", "pass_opt", "pass_2", "reloc", "xref" or "output"
+        uint32_t    pass;           // pass number (or 0)
+        double      seconds;        // elapsed time
+    };
+    typedef std::vector<phase_time_t> phase_time_list_t;
+
     static constexpr directive_t directives_list[] = {{"INCLUDE", DIR_INCLUDE},   {"INCBIN", DIR_INCBIN},
                                                       {"ORG", DIR_ORG},           {"EQU", DIR_EQU},
                                                       {"=", DIR_ASSIGN},          {"ASSIGN", DIR_ASSIGN},
@@ -337,7 +405,9 @@ struct xlasm
                                                       {"ASSERT", DIR_ASSERT},     {"WARN", DIR_WARN},
                                                       {"ERROR", DIR_ERROR},       {"EXIT", DIR_EXIT},
                                                       {"LIST", DIR_LIST},         {"LISTMAC", DIR_LISTMAC},
-                                                      {"MACNAME", DIR_MACNAME},   {"LISTCOND", DIR_LISTCOND}};
+                                                      {"MACNAME", DIR_MACNAME},   {"LISTCOND", DIR_LISTCOND},
+                                                      {"IMPORT", DIR_IMPORT},     {"REPT", DIR_REPT},
+                                                      {"FOR", DIR_FOR},           {"ENDR", DIR_ENDR}};
 
 
     std::string initial_variant;        // initial architecture name to assemble for
@@ -350,11 +420,18 @@ struct xlasm
     source_map_t           source_files;           // map of source files (tokenized at read time)
     macro_map_t            macros;                 // defined macros
     source_map_t           expanded_macros;        // source fragments from expanded macros
+    loop_map_t             loops;                  // REPT/FOR loop bodies (kept, symbols can refer to them)
     symbol_map_t           symbols;                // labels and other symbols
     export_list_t          exports;
+    export_list_t          imports;                 // labels resolved by linker (for .cobj output)
+    std::vector<uint32_t>  relocs;                  // word offsets that depend on load address (for .cobj output)
+    std::vector<uint8_t>   reloc_image;             // final pass output compared during relocation pass
+    std::string            reloc_import;            // imported label shifted during relocation pass (or empty)
+    reloc_map_t            import_relocs;           // word offsets using each imported label (for .cobj output)
     condition_stack_t      condition_stack;         // stack for conditional assembly
     directive_map_t        directives;              // fast lookup of directives
     hint_map_t             line_hint;               // "hint" for this virtual-line (for squeeze pass)
+    phase_time_list_t      phase_times;             // elapsed time of each assembly phase (for -t timing output)
     std::list<std::string> input_names;             // list of input filenames (assembled into one output)
     std::string            object_filename;         // output filename
     std::string            listing_filename;        // listing filename
@@ -362,11 +439,16 @@ struct xlasm
     std::list<std::string> post_messages;
     std::mt19937_64        rng;
 
+    std::vector<std::string> * diag_log;        // if set, diagnostic lines are added here (instead of printed)
+
     int64_t     total_size_generated;
     int64_t     last_size_generated;
     int64_t     bytes_optimized;
     int64_t     undefined_sym_count;
     int64_t     line_sec_addr;
+    int64_t     reloc_origin;             // final load address during relocation pass
+    uint64_t    source_bytes_read;        // total source bytes read (for -v throughput)
+    double      source_read_time;         // seconds spent reading and tokenizing source
     FILE *      listing_file;
     source_t *  last_diag_file;
     section_t * undefined_section;
@@ -378,6 +460,7 @@ struct xlasm
     section_t * line_sec_start;
     size_t      undefined_begin_size;
     size_t      line_sec_size;
+    size_t      reloc_checked;        // bytes of reloc_image compared so far during relocation pass
     uint32_t    applied_hints;
     uint32_t    pending_hints;
     uint32_t    crc_value;
@@ -388,8 +471,10 @@ struct xlasm
     uint32_t    prev_virtual_line_num;
     uint32_t    pass_count;
     uint32_t    last_diag_line;
+    int32_t     line_cycles;        // cumulative copper cycles listed for current line (-1 if none)
 
     bool line_sec_org;
+    bool line_cycles_wait;        // line_cycles listed for a wait instruction (4+ cycles)
     bool suppress_line_list;
     bool suppress_line_listsource;
     bool force_end_file;
@@ -403,13 +488,24 @@ struct xlasm
     // external interface, gathers input and options
     int32_t assemble(const std::vector<std::string> & in_files, const std::string & out_file, const opts_t & opts);
 
+    // external interface for libcopasm, assembles source text in memory (output is left in sections)
+    int32_t assemble_source(const std::string & name, const std::string & text, const opts_t & opts);
+
+    // external interface, links relocatable copper objects (.cobj) into one output (in xlasmlink.cpp)
+    int32_t link(const std::vector<std::string> & in_files, const std::string & out_file, const opts_t & opts);
+
     // internal functions
+    void    init_assembly(const opts_t & opts);        // set options, architecture and command line symbols
     int32_t do_passes();        // read input files into memory, iterate over files for all assembler passes
     int32_t process_file(source_t & f);        // iterate over source lines in a source_t
     int32_t process_line();                    // process a single line from source_t
     int32_t process_line_listing();
     int32_t process_xref();
     int32_t process_output();
+    int32_t reloc_pass();        // extra pass at shifted origin to collect relocations for .cobj output
+    void    add_phase_time(const char * name, uint32_t pass, double start_time);
+    void    write_timing(double total_time);        // append timing JSON line to opt.timing_file
+    void    check_reloc_line();
     int32_t process_labeldef(std::string label);        // define a "normal" label (i.e., set to current output address)
     int32_t process_directive(uint32_t                         idx,
                               const std::string &              directive,
@@ -433,6 +529,16 @@ struct xlasm
                                  const std::string &              label,
                                  size_t                           cur_token,
                                  const std::vector<std::string> & tokens);
+    bool        define_loop_begin(uint32_t                         idx,
+                                  const std::string &              directive,
+                                  const std::string &              label,
+                                  size_t                           cur_token,
+                                  const std::vector<std::string> & tokens);
+    bool        define_loop_end(const std::string &              directive,
+                                const std::string &              label,
+                                size_t                           cur_token,
+                                const std::vector<std::string> & tokens);
+    bool        define_loop_line(const std::vector<std::string> & tokens);
     source_t &  expand_macro(std::string & name, size_t cur_token, const std::vector<std::string> & tokens);
     int64_t     eval_tokens(const std::string &              cmd,
                             std::string &                    exprstr,
@@ -454,6 +560,7 @@ struct xlasm
     int32_t     lookup_register_symbol(const std::string & sym_name);
     void        add_sym(const char * name, symbol_t::sym_t type, int64_t value);
     void        remove_sym(const char * name);
+    void        diag_output(const std::string & line);
     void        diag_flush();
     void        diag_showline();
     void        update_crc16(uint8_t x);
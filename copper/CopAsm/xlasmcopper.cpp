@@ -14,6 +14,8 @@ copper::directive_map_t copper::directives;
 copper::opcode_map_t    copper::opcodes;
 
 copper::copper() noexcept
+        : opt_last_sym(nullptr)
+        , fold_value(0)
 {
     register_arch(this);
 
@@ -65,6 +67,10 @@ void copper::reset(xlasm * xl)
     xl->sections["text"].load_addr = 0xC000;
     xl->sections["text"].addr      = 0xC000;
 
+    // forget optimizer state from any previous assembly (e.g., repeated libcopasm calls)
+    opt_mem.clear();
+    opt_prev_addr.clear();
+
     xl->add_sym("true", xlasm::symbol_t::LABEL, 1);
     xl->add_sym("TRUE", xlasm::symbol_t::LABEL, 1);
     xl->add_sym("false", xlasm::symbol_t::LABEL, 0);
@@ -94,11 +100,25 @@ void copper::reset(xlasm * xl)
 void copper::activate(xlasm * xl)
 {
     (void)xl;
+
+    // copper restarts at the start of each frame (VPOS 0, HPOS 4)
+    timing            = timing_t();
+    timing.pos_known  = true;
+    timing.line_known = true;
+    timing.hpos       = START_HPOS;
+    timing.wait_desc  = "frame start";
+
+    opt_insts.clear();
+    opt_last_sym = nullptr;
+    fold_value   = 0;
 }
 
 void copper::deactivate(xlasm * xl)
 {
-    (void)xl;
+    if (xl->opt.optimize && xl->ctxt.pass < xlasm::context_t::PASS_2)        // hints are fixed after final pass
+    {
+        optimize(xl);
+    }
 }
 
 // return directive_index or xlasm::DIR_UNKNOWN if not recognized
@@ -180,6 +200,7 @@ int32_t copper::process_opcode(xlasm *                          xl,
     uint16_t word1_val = 0;
     int64_t  result    = 0;
     int      oper_num  = 0;        // operands (not including opcode)
+    int      depth     = 0;        // parenthesis depth (commas inside are function arguments)
     bool     move_imm  = false;
     operstr.clear();
 
@@ -189,7 +210,12 @@ int32_t copper::process_opcode(xlasm *                          xl,
     {
         result = 0;
 
-        if (*it != ",")
+        if (*it == "(")
+            depth++;
+        else if (*it == ")")
+            depth--;
+
+        if (*it != "," || depth > 0)
         {
             //			if (operstr.size())
             //				operstr += " ";
@@ -197,7 +223,7 @@ int32_t copper::process_opcode(xlasm *                          xl,
             operstr += *it;
         }
 
-        if (*it == "," || it + 1 == tokens.end())
+        if ((*it == "," && depth <= 0) || it + 1 == tokens.end())
         {
             operand operand_type = ops[idx].a[oper_num];
 
@@ -524,11 +550,456 @@ int32_t copper::process_opcode(xlasm *                          xl,
         xl->error("Unexpected additional operand(s) for instruction %s", opcode.c_str());
     }
 
-    xl->emit(static_cast<uint16_t>((opval & opmask) | (word0_val & ~opmask)));
-    if (ops[idx].len == 2)
+    opt_inst_t inst;
+    inst.line    = xl->virtual_line_num;
+    inst.addr    = xl->ctxt.section->addr + static_cast<int64_t>(xl->ctxt.section->data.size() >> 1);
+    inst.w0      = static_cast<uint16_t>((opval & opmask) | (word0_val & ~opmask));
+    inst.w1      = static_cast<uint16_t>(word1_val);
+    inst.len     = static_cast<uint32_t>(ops[idx].len);
+    inst.labeled = xl->ctxt.section->last_defined_sym != opt_last_sym;
+    opt_last_sym = xl->ctxt.section->last_defined_sym;
+
+    uint16_t word0_out = inst.w0;
+    uint16_t word1_out = inst.w1;
+
+    // apply peephole optimization hint from previous pass
+    auto hint = xl->line_hint.find(xl->virtual_line_num);
+    if (hint != xl->line_hint.end())
+    {
+        switch (hint->second)
+        {
+            case HINT_REMOVE:
+                fold_value = inst.w1;        // LDI value (if folded into next STM)
+                inst.len   = 0;
+                break;
+            case HINT_SETI_RA:
+                word0_out = inst.w1;
+                word1_out = fold_value;
+                break;
+            case HINT_SETI_MEM:
+                word0_out = inst.w1;
+                word1_out = static_cast<uint16_t>(opt_mem[inst.w0 & (COP_SIZE - 1)]);
+                break;
+            default:
+                break;
+        }
+
+        if (xl->ctxt.pass != xlasm::context_t::PASS_2)
+        {
+            xl->bytes_optimized += (ops[idx].len - static_cast<int32_t>(inst.len)) * 2;
+        }
+        xl->applied_hints++;
+    }
+    opt_insts.push_back(inst);
+
+    if (inst.len > 0)
+    {
+        xl->emit(word0_out);
+    }
+    if (inst.len > 1)
+    {
+        xl->emit(word1_out);
+    }
+
+    if (inst.len > 0)
     {
-        xl->emit(static_cast<uint16_t>(word1_val));
+        check_cycles(xl, idx, word0_val);
     }
 
     return 0;
 }
+
+// Decide peephole optimizations for the next pass from the instructions (and copper memory) of this pass.  Only
+// straight-line code is changed (nothing across a label, branch target or instruction written by SETM/STM or at an
+// exported label), and only when the RA register and B flag results are not used afterward:
+//   - SETI/SETM from constant copper memory to XR memory of a value already written since the last wait is removed
+//   - duplicate consecutive HPOS/VPOS waits are removed (except HPOS past end of line, as with H_EOL)
+//   - LDI #val followed by STM xaddr is folded into SETI xaddr,#val
+//   - SETM xaddr,cadr from copper memory never written (by copper or at exported label) becomes SETI xaddr,#val
+void copper::optimize(xlasm * xl)
+{
+    enum
+    {
+        F_TARGET  = (1 << 0),        // branch target
+        F_WRITTEN = (1 << 1),        // written by SETM/STM or exported to CPU
+        F_CODE    = (1 << 2)         // instruction word
+    };
+
+    // copper memory from this pass (for SETM constant source values)
+    opt_mem.assign(COP_SIZE, -1);
+    for (auto it = xl->sections.begin(); it != xl->sections.end(); ++it)
+    {
+        const auto & sec = it->second;
+        for (size_t i = 0; i + 1 < sec.data.size(); i += 2)
+        {
+            int64_t a = sec.addr + static_cast<int64_t>(i >> 1) - COP_ADDR;
+            if (a >= 0 && a < COP_SIZE)
+            {
+                opt_mem[static_cast<size_t>(a)] = (sec.data[i] << 8) | sec.data[i + 1];
+            }
+        }
+    }
+
+    // forward references are only consistent once instruction addresses are unchanged from previous pass, so until
+    // then keep the current hints (and request another pass)
+    std::vector<int64_t> addrs;
+    addrs.reserve(opt_insts.size());
+    for (const auto & inst : opt_insts)
+    {
+        addrs.push_back(inst.addr);
+    }
+    if (addrs != opt_prev_addr)
+    {
+        opt_prev_addr.swap(addrs);
+        xl->pending_hints = 1;
+
+        return;
+    }
+
+    std::vector<uint8_t> flags(COP_SIZE, 0);
+    bool                 unknown_write = false;
+
+    auto flag_addr = [&flags](int64_t addr, uint8_t f) {
+        if (addr >= COP_ADDR && addr < COP_ADDR + COP_SIZE)
+        {
+            flags[static_cast<size_t>(addr - COP_ADDR)] |= f;
+        }
+    };
+
+    for (const auto & name : xl->exports)
+    {
+        auto sym = xl->symbols.find(name);
+        if (sym != xl->symbols.end())
+        {
+            flag_addr(sym->second.value, F_WRITTEN);
+            flag_addr(sym->second.value + 1, F_WRITTEN);
+        }
+    }
+
+    for (const auto & inst : opt_insts)
+    {
+        for (uint32_t w = 0; w < inst.len; w++)
+        {
+            flag_addr(inst.addr + w, F_CODE);
+        }
+
+        switch (inst.w0 & 0x3000)
+        {
+            case 0x0000:        // SETI
+            case 0x1000: {      // SETM
+                uint16_t dest = (inst.w0 & 0x1000) ? inst.w1 : inst.w0;
+                if (dest >= COP_ADDR + COP_SIZE)
+                    unknown_write = true;
+                else
+                    flag_addr(dest, F_WRITTEN);
+            }
+            break;
+            case 0x3000:        // BRGE/BRLT
+                flag_addr(COP_ADDR | (inst.w0 & 0x7FF), F_TARGET);
+                break;
+            default:
+                break;
+        }
+    }
+
+    size_t                n = opt_insts.size();
+    std::vector<uint32_t> hint(n, HINT_NONE);
+    std::vector<uint16_t> w0(n);
+    std::vector<uint16_t> w1(n);
+    std::vector<bool>     start(n);
+    std::vector<bool>     opaque(n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const auto & inst = opt_insts[i];
+
+        w0[i] = inst.w0;
+        w1[i] = inst.w1;
+
+        // start of straight-line code (label, branch target or non-contiguous)
+        start[i] = i == 0 || inst.labeled || inst.addr != opt_insts[i - 1].addr + opt_insts[i - 1].len;
+        if (inst.len && inst.addr >= COP_ADDR && inst.addr < COP_ADDR + COP_SIZE &&
+            (flags[static_cast<size_t>(inst.addr - COP_ADDR)] & F_TARGET))
+        {
+            start[i] = true;
+        }
+
+        // instruction modified at run-time
+        opaque[i]     = false;
+        uint32_t olen = (inst.w0 & 0x2000) ? 1 : 2;
+        for (uint32_t w = 0; w < olen; w++)
+        {
+            int64_t a = inst.addr + w - COP_ADDR;
+            if (a >= 0 && a < COP_SIZE && (flags[static_cast<size_t>(a)] & F_WRITTEN))
+            {
+                opaque[i] = true;
+            }
+        }
+    }
+
+    // true if RA (when ra_changed) or B flag value after instruction i may be used
+    auto ra_b_used = [&](size_t i, bool ra_changed) {
+        for (size_t k = i + 1; k < n; k++)
+        {
+            if (hint[k] == HINT_REMOVE)
+                continue;
+            if (start[k] || opaque[k])
+                return true;
+
+            uint16_t dest     = 0;
+            bool     reads_ra = false;
+            switch (w0[k] & 0x3000)
+            {
+                case 0x0000:        // SETI
+                    dest     = w0[k];
+                    reads_ra = dest == RA_SUB;
+                    break;
+                case 0x1000:        // SETM
+                    dest     = w1[k];
+                    reads_ra = (w0[k] & RA) || dest == RA_SUB;
+                    break;
+                case 0x2000:        // HPOS/VPOS
+                    continue;
+                default:            // BRGE/BRLT
+                    return true;
+            }
+
+            if (!ra_changed)
+                return false;        // B updated by write
+            if (reads_ra)
+                return true;
+            if (dest == RA)
+                return false;        // RA set and B cleared
+        }
+
+        return true;
+    };
+
+    // LDI #val + STM xaddr => SETI xaddr,#val (backward, so RA use considers later folds)
+    for (size_t i = n; i-- > 1;)
+    {
+        uint16_t dest = w1[i];
+        if (w0[i - 1] == RA && w0[i] == (0x1000 | RA) && !start[i] && !opaque[i - 1] && !opaque[i] &&
+            (dest & 0x3000) == 0 && dest != RA && dest != RA_SUB && dest != RA_CMP && !ra_b_used(i, true))
+        {
+            hint[i - 1] = HINT_REMOVE;
+            hint[i]     = HINT_SETI_RA;
+            w0[i]       = dest;
+            w1[i]       = w1[i - 1];
+        }
+    }
+
+    // SETM xaddr,cadr => SETI xaddr,#val when cadr is constant data (not for relocatable output, data may be address)
+    bool relocatable = hasEnding(xl->object_filename, ".cobj");
+    for (size_t i = 0; i < n && !relocatable; i++)
+    {
+        uint16_t src = w0[i] & 0x7FF;
+        if (hint[i] == HINT_NONE && !opaque[i] && !unknown_write && (w0[i] & 0x3000) == 0x1000 && !(w0[i] & RA) &&
+            (w1[i] & 0x3000) == 0 && opt_mem[src] >= 0 && !(flags[src] & (F_WRITTEN | F_CODE)))
+        {
+            hint[i] = HINT_SETI_MEM;
+            w0[i]   = w1[i];
+            w1[i]   = static_cast<uint16_t>(opt_mem[src]);
+        }
+    }
+
+    // redundant XR memory writes and duplicate waits
+    std::vector<bool>                      redundant(n);
+    std::unordered_map<uint16_t, uint16_t> known;
+    size_t                                 prev = n;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (hint[i] == HINT_REMOVE)
+            continue;
+
+        if (start[i] || opaque[i])
+        {
+            known.clear();
+            prev = n;
+        }
+        if (opaque[i])
+            continue;
+
+        switch (w0[i] & 0x3000)
+        {
+            case 0x0000:        // SETI
+                if (w0[i] >= XMEM_START && w0[i] < XMEM_END)
+                {
+                    auto k = known.find(w0[i]);
+                    if (k != known.end() && k->second == w1[i])
+                        redundant[i] = true;
+                    else
+                        known[w0[i]] = w1[i];
+                }
+                break;
+            case 0x1000:        // SETM
+                known.erase(w1[i]);
+                break;
+            case 0x2000:        // HPOS/VPOS (HPOS past end of line waits for next line, so never a duplicate)
+                if (prev < n && w0[prev] == w0[i] && !start[i] && ((w0[i] & 0x800) || (w0[i] & 0x7FF) < TOTAL_H_640))
+                {
+                    hint[i] = HINT_REMOVE;
+                    continue;
+                }
+                known.clear();
+                break;
+            default:
+                break;
+        }
+        prev = i;
+    }
+
+    // remove redundant writes when B flag result not used (backward, so later removals considered)
+    for (size_t i = n; i-- > 0;)
+    {
+        if (redundant[i] && !ra_b_used(i, false))
+        {
+            hint[i] = HINT_REMOVE;
+        }
+    }
+
+    xlasm::hint_map_t line_hint;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (hint[i] != HINT_NONE)
+        {
+            line_hint[opt_insts[i].line] = hint[i];
+        }
+    }
+
+    // count changed hints (another pass needed unless none)
+    xl->pending_hints = 0;
+    for (const auto & h : line_hint)
+    {
+        auto it = xl->line_hint.find(h.first);
+        if (it == xl->line_hint.end() || it->second != h.second)
+            xl->pending_hints++;
+    }
+    for (const auto & h : xl->line_hint)
+    {
+        if (line_hint.find(h.first) == line_hint.end())
+            xl->pending_hints++;
+    }
+
+    xl->line_hint.swap(line_hint);
+}
+
+// Sum cycles between waits (in source order, assuming straight-line execution) and warn when a wait position has
+// already passed by the time the copper reaches it (so the wait would silently fall through late).
+void copper::check_cycles(xlasm * xl, int32_t idx, uint16_t word0_val)
+{
+    int64_t total_h = xl->opt.video_width == 848 ? TOTAL_H_848 : TOTAL_H_640;
+    int64_t total_v = xl->opt.video_width == 848 ? TOTAL_V_848 : TOTAL_V_640;
+
+    if (idx != OP_HPOS && idx != OP_VPOS)
+    {
+        timing.cycles += ops[idx].cyc;
+        xl->line_cycles      = static_cast<int32_t>(timing.cycles);
+        xl->line_cycles_wait = false;
+
+        return;
+    }
+
+    int64_t arrival = timing.hpos + static_cast<int64_t>(timing.cycles);
+    int64_t a_line  = arrival / total_h;
+    int64_t a_hpos  = arrival % total_h;
+
+    if (idx == OP_HPOS)
+    {
+        int64_t h = word0_val & 0x7FF;
+
+        if (h >= total_h)
+        {
+            if (h != H_EOL)
+            {
+                xl->warning("HPOS #%d is past last HPOS %d for %ux480 (waits until end of line)",
+                            static_cast<int>(h),
+                            static_cast<int>(total_h - 1),
+                            xl->opt.video_width);
+            }
+
+            timing.line += timing.pos_known ? a_line + 1 : 0;
+            timing.hpos = 0;
+        }
+        else if (timing.pos_known)
+        {
+            // only warn if waiting for a position after the last wait (earlier HPOS is a no-op)
+            if (h > timing.hpos && (a_line > 0 || a_hpos > h))
+            {
+                xl->warning("%u copper cycles after %s reach HPOS %d%s, past HPOS #%d wait for %ux480",
+                            timing.cycles,
+                            timing.wait_desc.c_str(),
+                            static_cast<int>(a_hpos),
+                            a_line > 0 ? " (on a later line)" : "",
+                            static_cast<int>(h),
+                            xl->opt.video_width);
+            }
+
+            timing.line += a_line;
+            timing.hpos = (a_hpos >= h) ? a_hpos : h;
+        }
+        else
+        {
+            timing.hpos = h;
+        }
+
+        timing.pos_known = true;
+        timing.wait_desc.clear();
+        strprintf(timing.wait_desc, "HPOS #%d", static_cast<int>(h));
+    }
+    else
+    {
+        int64_t v = word0_val & 0x3FF;
+
+        if (v == V_EOF || (word0_val & V_BLIT_F))
+        {
+            // end of frame or blitter wait, position afterward unknown
+            timing.pos_known  = false;
+            timing.line_known = false;
+        }
+        else if (v >= total_v)
+        {
+            xl->warning("VPOS #%d is past last VPOS %d for %ux480 (waits until end of frame)",
+                        static_cast<int>(v),
+                        static_cast<int>(total_v - 1),
+                        xl->opt.video_width);
+
+            timing.pos_known  = false;
+            timing.line_known = false;
+        }
+        else
+        {
+            // only warn if waiting for a line at or after the last wait (earlier VPOS is a no-op)
+            if (timing.pos_known && timing.line_known && v >= timing.line && timing.line + a_line > v)
+            {
+                xl->warning("%u copper cycles after %s reach VPOS %d, past VPOS #%d wait for %ux480",
+                            timing.cycles,
+                            timing.wait_desc.c_str(),
+                            static_cast<int>(timing.line + a_line),
+                            static_cast<int>(v),
+                            xl->opt.video_width);
+            }
+
+            if (timing.pos_known && timing.line_known && timing.line + a_line >= v)
+            {
+                timing.line += a_line;
+                timing.hpos = a_hpos;
+            }
+            else
+            {
+                timing.line = v;
+                timing.hpos = 0;
+            }
+
+            timing.pos_known  = true;
+            timing.line_known = true;
+        }
+
+        timing.wait_desc.clear();
+        strprintf(timing.wait_desc, "VPOS #%d", static_cast<int>(v));
+    }
+
+    timing.cycles        = WAIT_MIN_CYCLE;
+    xl->line_cycles      = static_cast<int32_t>(timing.cycles);
+    xl->line_cycles_wait = true;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <string>
@@ -80,10 +81,10 @@ struct copper : public Ixlarch
     // |---------------------|----------------------|-----|-----|----------------------------------|
     // | rr00 oooo oooo oooo | SETI   xadr14,#val16 |  B  |  4  | dest [xadr14] <= source #val16   |
     // | iiii iiii iiii iiii |    <im16 value>      |     |     |   (2 word op)                    |
-    // | --01 rccc cccc cccc | SETM  xadr16,cadr11  |  B  |  5  | dest [xadr16] <= source [cadr11] |
+    // | --01 rccc cccc cccc | SETM  xadr16,cadr11  |  B  |  4  | dest [xadr16] <= source [cadr11] |
     // | rroo oooo oooo oooo |    <xadr16 address>  |     |     |   (2 word op)                    |
-    // | --10 0iii iiii iiii | HPOS   #im11         |     |  5+ | wait until video HPOS >= im11    |
-    // | --10 1iii iiii iiii | VPOS   #im11         |     |  5+ | wait until video VPOS >= im11    |
+    // | --10 0iii iiii iiii | HPOS   #im11         |     |  4+ | wait until video HPOS >= im11    |
+    // | --10 1iii iiii iiii | VPOS   #im11         |     |  4+ | wait until video VPOS >= im11    |
     // | --11 0ccc cccc cccc | BRGE   cadr10        |     |  4  | if (B==0) PC <= cadr10           |
     // | --11 1ccc cccc cccc | BRLT   cadr10        |     |  4  | if (B==1) PC <= cadr10           |
     // |---------------------|----------------------|-----|-----|----------------------------------|
@@ -155,6 +156,91 @@ struct copper : public Ixlarch
         RA_CMP = 0x7FF
     };
 
+    // special wait positions (and video mode timing for copper cycle checks)
+    enum wait_pos
+    {
+        H_EOL          = 0x7FF,        // HPOS wait until end of line
+        V_EOF          = 0x3FF,        // VPOS wait until end of frame
+        V_BLIT_F       = 0x400,        // VPOS bit to also stop waiting when blitter idle
+        TOTAL_H_640    = 800,          // cycles per line 640x480
+        TOTAL_V_640    = 525,          // lines per frame 640x480
+        TOTAL_H_848    = 1088,         // cycles per line 848x480
+        TOTAL_V_848    = 517,          // lines per frame 848x480
+        START_HPOS     = 4,            // HPOS when copper restarts each frame (at VPOS 0)
+        WAIT_MIN_CYCLE = 4             // cycles for HPOS/VPOS after wait position reached
+    };
+
+    // straight-line tracking of copper beam position (from last wait) for cycle checks
+    struct timing_t
+    {
+        bool        pos_known;         // hpos at last wait is known
+        bool        line_known;        // line at last wait is known
+        int64_t     line;              // line at last wait
+        int64_t     hpos;              // hpos at last wait
+        uint32_t    cycles;            // cycles executed since last wait position
+        std::string wait_desc;         // description of last wait (for warnings)
+
+        timing_t() noexcept
+                : pos_known(false)
+                , line_known(false)
+                , line(0)
+                , hpos(0)
+                , cycles(0)
+        {
+        }
+    };
+
+    timing_t timing;
+
+    void check_cycles(xlasm * xl, int32_t idx, uint16_t word0_val);
+
+    // peephole optimization hints (per virtual line, decided from previous pass)
+    enum opt_hint
+    {
+        HINT_NONE,
+        HINT_REMOVE,          // remove instruction (redundant write, duplicate wait or LDI folded into next STM)
+        HINT_SETI_RA,         // STM after folded LDI becomes SETI with LDI value
+        HINT_SETI_MEM         // SETM from constant copper memory becomes SETI with memory value
+    };
+
+    // copper address range (and special XR addresses) for optimization
+    enum opt_addr
+    {
+        COP_ADDR     = 0xC000,        // copper memory XR address
+        COP_SIZE     = 0x0800,        // copper address space (1.5K words memory plus registers)
+        XMEM_START   = 0x4000,        // start of XR memory with no side effects on write (tile/color/pointer)
+        XMEM_END     = 0xC000         // end of XR memory with no side effects on write
+    };
+
+    // instruction emitted in previous pass (with original unoptimized words)
+    struct opt_inst_t
+    {
+        uint32_t line;        // virtual line number
+        uint32_t len;         // words emitted (after optimization)
+        int64_t  addr;        // address emitted
+        uint16_t w0;          // original opcode word
+        uint16_t w1;          // original second word (if SETI or SETM)
+        bool     labeled;     // label defined since previous instruction
+
+        opt_inst_t() noexcept
+                : line(0)
+                , len(0)
+                , addr(0)
+                , w0(0)
+                , w1(0)
+                , labeled(false)
+        {
+        }
+    };
+
+    std::vector<opt_inst_t>  opt_insts;           // instructions emitted in current pass
+    std::vector<int32_t>     opt_mem;             // copper memory from previous pass (-1 if not emitted)
+    std::vector<int64_t>     opt_prev_addr;       // instruction addresses from previous pass (to detect changes)
+    const xlasm::symbol_t *  opt_last_sym;        // last label defined before previous instruction
+    uint16_t                 fold_value;          // LDI value folded into next STM
+
+    void optimize(xlasm * xl);
+
     struct op_tbl
     {
         op_t         op_idx;
@@ -185,8 +271,8 @@ struct copper : public Ixlarch
                                      {OP_MOVI, 0x0000, 0x3000, "MOVI", {IM16, XM14}, 2, 0, 4},
                                      {OP_SETM, 0x1000, 0x3000, "SETM", {XM16, CM}, 2, 0, 4},
                                      {OP_MOVM, 0x1000, 0x3000, "MOVM", {CM, XM16}, 2, 0, 4},
-                                     {OP_HPOS, 0x2000, 0x3800, "HPOS", {IM11}, 1, 0, 5},
-                                     {OP_VPOS, 0x2800, 0x3800, "VPOS", {IM11}, 1, 0, 5},
+                                     {OP_HPOS, 0x2000, 0x3800, "HPOS", {IM11}, 1, 0, 4},
+                                     {OP_VPOS, 0x2800, 0x3800, "VPOS", {IM11}, 1, 0, 4},
                                      {OP_BRGE, 0x3000, 0x3800, "BRGE", {CM}, 1, 0, 4},
                                      {OP_BRLT, 0x3800, 0x3800, "BRLT", {CM}, 1, 0, 4},
                                      {OP_LDI, 0x0800, 0x3FFF, "LDI", {IM16}, 2, 0, 4},
@@ -2,3 +2,4 @@
 #include "xlasm.h"
 
 constexpr expression::op_s expression::ops[];
+constexpr expression::func_s expression::funcs[];
@@ -22,6 +22,7 @@ Retrieved from: http://en.literateprograms.org/Shunting_yard_algorithm_(C)?oldid
 
 #include <assert.h>
 #include <ctype.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -42,7 +43,14 @@ class expression
     enum
     {
         MAXOPSTACK  = 64,
-        MAXNUMSTACK = 64
+        MAXNUMSTACK = 64,
+        MAXFUNCARGS = 4
+    };
+
+    enum
+    {
+        FUNC_ANGLE_360 = 256,        // intrinsic sin/cos angle units per full circle
+        FUNC_FIXED_ONE = 256         // default sin/cos amplitude and lerp fraction for 1.0 (i.e., 8.8 fixed-point)
     };
 
     enum
@@ -97,6 +105,14 @@ class expression
         int64_t (*eval)(expression * exp, int64_t a1, int64_t a2);
     };
 
+    struct func_s
+    {
+        const char * name;
+        int32_t      min_args;
+        int32_t      max_args;
+        int64_t (*eval)(expression * exp, const int64_t * a, int32_t nargs);
+    };
+
     xlasm *             xl;
     const struct op_s * opstack[MAXOPSTACK];
     int64_t             numstack[MAXNUMSTACK];
@@ -326,6 +342,46 @@ private:
         return a1 % a2;
     }
 
+    // assembly-time math intrinsics (for generating tables), used as function calls, e.g., "sin(angle, amplitude)"
+    static int64_t eval_fsin(expression *, const int64_t * a, int32_t nargs)
+    {
+        const double two_pi = 6.28318530717958647692;
+        int64_t      angle  = a[0] % FUNC_ANGLE_360;        // reduce angle first (so large angles are exact)
+        int64_t      amp    = nargs > 1 ? a[1] : static_cast<int64_t>(FUNC_FIXED_ONE);
+        int64_t      r      = llround(sin(static_cast<double>(angle) * two_pi / FUNC_ANGLE_360) * amp);
+        exp_dprintf("sin(%lld, %lld) = %lld\n", a[0], amp, r);
+        return r;
+    }
+    static int64_t eval_fcos(expression * exp, const int64_t * a, int32_t nargs)
+    {
+        int64_t sa[2] = {a[0] % FUNC_ANGLE_360 + FUNC_ANGLE_360 / 4, nargs > 1 ? a[1] : 0};        // cos = sin+90
+        return eval_fsin(exp, sa, nargs);
+    }
+    static int64_t eval_flerp(expression * exp, const int64_t * a, int32_t nargs)
+    {
+        int64_t one = nargs > 3 ? a[3] : static_cast<int64_t>(FUNC_FIXED_ONE);
+        if (one <= 0)
+        {
+            exp->eval_error(0x10E, "lerp() fraction range must be positive");
+            return 0;
+        }
+        int64_t d = (a[1] - a[0]) * a[2];        // round to nearest (away from zero on .5)
+        int64_t r = a[0] + (d >= 0 ? (d + one / 2) / one : -((-d + one / 2) / one));
+        exp_dprintf("lerp(%lld, %lld, %lld/%lld) = %lld\n", a[0], a[1], a[2], one, r);
+        return r;
+    }
+    static int64_t eval_fclamp(expression *, const int64_t * a, int32_t)
+    {
+        exp_dprintf("clamp(%lld, %lld, %lld)\n", a[0], a[1], a[2]);
+        return a[0] < a[1] ? a[1] : (a[0] > a[2] ? a[2] : a[0]);
+    }
+
+    static constexpr func_s funcs[] = {
+        {"sin", 1, 2, eval_fsin},
+        {"cos", 1, 2, eval_fcos},
+        {"lerp", 3, 4, eval_flerp},
+        {"clamp", 3, 3, eval_fclamp},
+    };
 
     static constexpr op_s ops[] = {
         {"u-", 2, OP_UMINUS, 100, ASSOC_RIGHT, 1, eval_uminus},
@@ -412,6 +468,98 @@ private:
         return nullptr;
     }
 
+    const func_s * getfunc(const char * name)
+    {
+        for (uint32_t i = 0; i < (sizeof(funcs) / sizeof(funcs[0])); ++i)
+        {
+            if (strcmp(funcs[i].name, name) == 0)
+            {
+                return funcs + i;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // evaluate function arguments (chptr at opening parenthesis, left at closing parenthesis)
+    bool eval_func(const func_s * fn, const char *& chptr, int64_t * result, bool allow_undefined)
+    {
+        int64_t      args[MAXFUNCARGS] = {0};
+        int32_t      nargs             = 0;
+        int32_t      depth             = 0;
+        const char * argstart          = chptr + 1;
+        const char * p;
+
+        for (p = argstart;; ++p)
+        {
+            if (*p == '\0')
+            {
+                eval_error2(0x10D, "Missing ')' after %s() arguments", fn->name);
+                return false;
+            }
+
+            if (p[0] == '\'' && p[1] && p[2] == '\'')        // skip character literal
+            {
+                p += 2;
+                continue;
+            }
+
+            if (*p == '(')
+            {
+                depth++;
+            }
+            else if (*p == ')' && depth > 0)
+            {
+                depth--;
+            }
+            else if ((*p == ',' || *p == ')') && depth == 0)
+            {
+                std::string argstr(argstart, p);
+                size_t      last_offset = 0;
+                expression  argexp;
+
+                if (nargs >= fn->max_args || argstr.find_first_not_of(' ') == std::string::npos)
+                {
+                    eval_error2(0x10D,
+                                "%s() argument count error (expects %d to %d)",
+                                fn->name,
+                                fn->min_args,
+                                fn->max_args);
+                    return false;
+                }
+
+                if (!argexp.evaluate(xl, argstr, &args[nargs], &last_offset, allow_undefined))
+                {
+                    errorcode = argexp.errorcode ? argexp.errorcode : 0x10D;
+                    return false;
+                }
+
+                if (last_offset < argstr.size())
+                {
+                    eval_error2(0x10D, "%s() argument syntax error at: %.32s", fn->name, argstr.c_str() + last_offset);
+                    return false;
+                }
+
+                nargs++;
+                argstart = p + 1;
+
+                if (*p == ')')
+                    break;
+            }
+        }
+
+        if (nargs < fn->min_args)
+        {
+            eval_error2(0x10D, "%s() argument count error (expects %d to %d)", fn->name, fn->min_args, fn->max_args);
+            return false;
+        }
+
+        chptr   = p;
+        *result = fn->eval(this, args, nargs);
+
+        return errorcode ? false : true;
+    }
+
     void push_opstack(const struct op_s * op)
     {
         if (nopstack > MAXOPSTACK - 1)
@@ -707,6 +855,24 @@ public:
                 }
                 strncpy(symname, expr, symlen);
 
+                // intrinsic function call?
+                const char * args = sptr;
+                while (*args == ' ')
+                    args++;
+                const func_s * fn = (*args == '(') ? getfunc(symname) : nullptr;
+                if (fn)
+                {
+                    int64_t v = 0;
+                    if (!eval_func(fn, args, &v, allow_undefined))
+                        return false;
+
+                    push_numstack(v);
+                    lastop = nullptr;
+
+                    expr = args;        // at closing parenthesis
+                    continue;
+                }
+
                 bool    undefined = false;
                 int64_t v         = xl->symbol_value(xl, symname, &undefined);
                 exp_dprintf("parsed sym '%s' v = 0x%llx\n", symname, v);
@@ -0,0 +1,402 @@
+// xlasmlink.cpp
+//
+// Copper relocatable object linker.  Places copper objects (.cobj output) into copper memory, patches relocated
+// words and writes the combined program using the normal copasm output formats.  The first object is the entry
+// point (copper starts each frame at XR 0xC000), any object can be given a fixed address with "file.cobj@0xC400"
+// (e.g., to keep a region stable for runtime hot-swapping) and the others are placed largest first into the lowest
+// free gap that fits.  Each object start/end and its exported labels are exported for the 68k side as "<object>",
+// "<object>_end" and "<object>__<label>".
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xlasm.h"
+
+enum
+{
+    LINK_COP_ADDR = 0xC000,        // XR_COPPER_ADDR
+    LINK_COP_SIZE = 0x0600         // XR_COPPER_SIZE (words)
+};
+
+struct cobj_t
+{
+    std::string                                  file;
+    std::string                                  name;
+    int64_t                                      origin;        // XR address object was assembled at
+    int64_t                                      addr;          // XR address placed at (-1 until placed)
+    bool                                         fixed;         // address given on command line
+    std::vector<uint16_t>                        words;
+    std::vector<uint32_t>                        relocs;
+    std::vector<std::pair<std::string, int64_t>> exports;
+    xlasm::reloc_map_t                           imports;
+
+    cobj_t() noexcept
+            : origin(LINK_COP_ADDR)
+            , addr(-1)
+            , fixed(false)
+    {
+    }
+
+    int64_t size() const
+    {
+        return static_cast<int64_t>(words.size());
+    }
+};
+
+// read relocatable object records (see obj_dump in xlasm.cpp for format)
+static void read_cobj(cobj_t & obj)
+{
+    FILE * in = fopen(obj.file.c_str(), "r");
+    if (!in)
+        fatal_error("opening object file \"%s\", error: %s", obj.file.c_str(), strerror(errno));
+
+    char     line[MAX_LINE_LENGTH];
+    int64_t  size     = -1;
+    uint32_t line_num = 0;
+    bool     ended    = false;
+
+    while (!ended && fgets(line, sizeof(line), in))
+    {
+        char         keyword[16] = {0};
+        char         name[256]   = {0};
+        const char * p           = line;
+        int          n           = 0;
+        unsigned int v           = 0;
+        long long    lv          = 0;
+
+        line_num++;
+
+        if (sscanf(p, "%15s%n", keyword, &n) != 1 || strncmp(keyword, "//", 2) == 0)
+            continue;
+        p += n;
+
+        if (strcmp(keyword, "cobj") == 0)
+        {
+            if (sscanf(p, "%255s %x %lld", name, &v, &lv) != 3)
+                fatal_error("%s:%u: bad object header", obj.file.c_str(), line_num);
+            obj.name   = name;
+            obj.origin = v;
+            size       = lv;
+        }
+        else if (strcmp(keyword, "word") == 0)
+        {
+            while (sscanf(p, "%x%n", &v, &n) == 1)
+            {
+                obj.words.push_back(static_cast<uint16_t>(v));
+                p += n;
+            }
+        }
+        else if (strcmp(keyword, "reloc") == 0)
+        {
+            while (sscanf(p, "%u%n", &v, &n) == 1)
+            {
+                obj.relocs.push_back(v);
+                p += n;
+            }
+        }
+        else if (strcmp(keyword, "export") == 0)
+        {
+            if (sscanf(p, "%255s %lld", name, &lv) != 2)
+                fatal_error("%s:%u: bad export record", obj.file.c_str(), line_num);
+            obj.exports.push_back(std::make_pair(std::string(name), static_cast<int64_t>(lv)));
+        }
+        else if (strcmp(keyword, "import") == 0)
+        {
+            if (sscanf(p, "%255s%n", name, &n) != 1)
+                fatal_error("%s:%u: bad import record", obj.file.c_str(), line_num);
+            p += n;
+
+            std::vector<uint32_t> & offsets = obj.imports[name];
+            while (sscanf(p, "%u%n", &v, &n) == 1)
+            {
+                offsets.push_back(v);
+                p += n;
+            }
+        }
+        else if (strcmp(keyword, "end") == 0)
+        {
+            ended = true;
+        }
+        else
+        {
+            fatal_error("%s:%u: unrecognized object record \"%s\"", obj.file.c_str(), line_num, keyword);
+        }
+    }
+    fclose(in);
+
+    if (size < 0 || !ended)
+        fatal_error("\"%s\" is not a complete copper object", obj.file.c_str());
+    if (obj.size() != size)
+        fatal_error("\"%s\" has " PR_D64 " words (expected " PR_D64 ")", obj.file.c_str(), obj.size(), size);
+    for (auto r : obj.relocs)
+    {
+        if (r >= obj.words.size())
+            fatal_error("\"%s\" relocation offset %u outside object", obj.file.c_str(), r);
+    }
+    for (auto & e : obj.exports)
+    {
+        if (e.second < 0 || e.second > size)
+            fatal_error("\"%s\" export \"%s\" outside object", obj.file.c_str(), e.first.c_str());
+    }
+    for (auto & imp : obj.imports)
+    {
+        for (auto r : imp.second)
+        {
+            if (r >= obj.words.size())
+                fatal_error("\"%s\" import \"%s\" offset %u outside object", obj.file.c_str(), imp.first.c_str(), r);
+        }
+    }
+}
+
+int32_t xlasm::link(const std::vector<std::string> & in_files, const std::string & out_file, const opts_t & opts)
+{
+    opt = opts;
+
+    arch = Ixlarch::find_arch(initial_variant);
+    arch->activate(this);
+    arch->set_variant(initial_variant);
+
+    object_filename = out_file;
+
+    if (hasEnding(object_filename, ".cobj"))
+        fatal_error("linked output \"%s\" can not be a relocatable object", object_filename.c_str());
+
+    std::vector<cobj_t> objs(in_files.size());
+    for (size_t i = 0; i < in_files.size(); i++)
+    {
+        cobj_t & obj = objs[i];
+        obj.file     = in_files[i];
+
+        auto at = obj.file.rfind('@');
+        if (at != std::string::npos)
+        {
+            std::string addr_str = obj.file.substr(at + 1);
+            char *      endp     = nullptr;
+
+            obj.addr  = strtoll(addr_str.c_str(), &endp, 0);
+            obj.fixed = true;
+            obj.file.resize(at);
+            if (addr_str.empty() || *endp != '\0')
+                fatal_error("bad placement address \"%s\" for \"%s\"", addr_str.c_str(), obj.file.c_str());
+        }
+
+        read_cobj(obj);
+
+        for (size_t j = 0; j < i; j++)
+        {
+            if (objs[j].name == obj.name)
+                fatal_error("duplicate object name \"%s\" (\"%s\" and \"%s\")",
+                            obj.name.c_str(),
+                            objs[j].file.c_str(),
+                            obj.file.c_str());
+        }
+    }
+
+    dprintf("Linking " PR_DSIZET " copper object%s into output \"%s\"\n",
+            objs.size(),
+            objs.size() == 1 ? "" : "s",
+            object_filename.c_str());
+
+    // first object is the entry point (copper starts at XR_COPPER_ADDR each frame)
+    if (!objs[0].fixed)
+    {
+        objs[0].addr  = LINK_COP_ADDR;
+        objs[0].fixed = true;
+    }
+
+    std::vector<cobj_t *> placed;
+
+    auto fits = [&placed](int64_t addr, int64_t size) {
+        if (addr < LINK_COP_ADDR || addr + size > LINK_COP_ADDR + LINK_COP_SIZE)
+            return false;
+        for (auto p : placed)
+        {
+            if (addr < p->addr + p->size() && p->addr < addr + size)
+                return false;
+        }
+        return true;
+    };
+
+    for (auto & obj : objs)
+    {
+        if (!obj.fixed)
+            continue;
+        if (!fits(obj.addr, obj.size()))
+            fatal_error("\"%s\" (" PR_D64 " words) at 0x" PR_X64_04 " overlaps another object or copper memory end",
+                        obj.file.c_str(),
+                        obj.size(),
+                        obj.addr);
+        placed.push_back(&obj);
+    }
+
+    // place remaining objects largest first into lowest gap that fits (after start or end of a placed object)
+    std::vector<cobj_t *> pending;
+    for (auto & obj : objs)
+    {
+        if (!obj.fixed)
+            pending.push_back(&obj);
+    }
+    std::stable_sort(pending.begin(), pending.end(), [](const cobj_t * lhs, const cobj_t * rhs) {
+        return lhs->size() > rhs->size();
+    });
+
+    for (auto obj : pending)
+    {
+        int64_t best = -1;
+        if (fits(LINK_COP_ADDR, obj->size()))
+            best = LINK_COP_ADDR;
+        for (auto p : placed)
+        {
+            int64_t a = p->addr + p->size();
+            if ((best < 0 || a < best) && fits(a, obj->size()))
+                best = a;
+        }
+        if (best < 0)
+            fatal_error("no room in copper memory for \"%s\" (" PR_D64 " words)", obj->file.c_str(), obj->size());
+
+        obj->addr = best;
+        placed.push_back(obj);
+    }
+
+    // imported labels resolve to an exported label (or object name) of another object
+    std::unordered_map<std::string, const cobj_t *> exporter;
+    std::unordered_map<std::string, int64_t>        label_addr;
+    for (auto & obj : objs)
+    {
+        std::vector<std::pair<std::string, int64_t>> labels(obj.exports);
+        labels.push_back(std::make_pair(obj.name, int64_t{0}));
+
+        for (auto & e : labels)
+        {
+            auto prev = exporter.find(e.first);
+            if (prev != exporter.end())
+            {
+                label_addr[e.first] = -1;        // ambiguous (error only if imported)
+                continue;
+            }
+            exporter[e.first]   = &obj;
+            label_addr[e.first] = obj.addr + e.second;
+        }
+    }
+
+    // patch relocations and build copper memory image
+    std::sort(placed.begin(), placed.end(), [](const cobj_t * lhs, const cobj_t * rhs) {
+        return lhs->addr < rhs->addr;
+    });
+
+    int64_t end_addr = LINK_COP_ADDR;
+    for (auto p : placed)
+        end_addr = std::max(end_addr, p->addr + p->size());
+
+    std::vector<uint16_t> image(static_cast<size_t>(end_addr - LINK_COP_ADDR), 0);
+    for (auto p : placed)
+    {
+        for (auto r : p->relocs)
+            p->words[r] = static_cast<uint16_t>(p->words[r] + (p->addr - p->origin));
+
+        for (auto & imp : p->imports)
+        {
+            auto la = label_addr.find(imp.first);
+            if (la == label_addr.end())
+                fatal_error("\"%s\" imports label \"%s\" not exported by any object",
+                            p->file.c_str(),
+                            imp.first.c_str());
+            if (la->second < 0)
+                fatal_error("\"%s\" imports label \"%s\" exported by more than one object",
+                            p->file.c_str(),
+                            imp.first.c_str());
+
+            for (auto r : imp.second)
+                p->words[r] = static_cast<uint16_t>(p->words[r] + (la->second - p->origin));
+        }
+
+        std::copy(p->words.begin(), p->words.end(), image.begin() + (p->addr - LINK_COP_ADDR));
+
+        dprintf("Placed \"%s\" at 0x" PR_X64_04 "-0x" PR_X64_04 " (" PR_D64 " words, " PR_DSIZET " relocations)\n",
+                p->name.c_str(),
+                p->addr,
+                p->addr + p->size() - (p->size() ? 1 : 0),
+                p->size(),
+                p->relocs.size());
+    }
+
+    // output linked program as a single section with object and label exports
+    ctxt.pass             = context_t::PASS_2;
+    sections["text"].name = "text";
+    sections["text"].arch = arch;
+    ctxt.section          = &sections["text"];
+
+    section_t & sec = sections["text"];
+    sec.load_addr   = LINK_COP_ADDR;
+    sec.addr        = LINK_COP_ADDR;
+    for (auto w : image)
+    {
+        sec.data.push_back(static_cast<uint8_t>(w >> 8));
+        sec.data.push_back(static_cast<uint8_t>(w));
+    }
+
+    for (auto & obj : objs)
+    {
+        std::string sym_name = obj.name;
+        add_sym(sym_name.c_str(), symbol_t::LABEL, obj.addr);
+        exports.push_back(sym_name);
+
+        for (auto & e : obj.exports)
+        {
+            sym_name = obj.name + "__" + e.first;
+            add_sym(sym_name.c_str(), symbol_t::LABEL, obj.addr + e.second);
+            exports.push_back(sym_name);
+        }
+
+        sym_name = obj.name + "_end";
+        add_sym(sym_name.c_str(), symbol_t::LABEL, obj.addr + obj.size());
+        exports.push_back(sym_name);
+    }
+
+    if (opt.listing)
+    {
+        std::string map_filename = removeExtension(object_filename.size() ? object_filename : in_files[0]) + ".map";
+        FILE *      map          = fopen(map_filename.c_str(), "w");
+        if (!map)
+            fatal_error("opening map file \"%s\", error: %s", map_filename.c_str(), strerror(errno));
+
+        fprintf(map, "// Xosera copper link map \"%s\"\n", object_filename.c_str());
+        fprintf(map, "//\n");
+        fprintf(map, "// XR addr  words  object\n");
+        for (auto p : placed)
+        {
+            fprintf(map,
+                    "   0x" PR_X64_04 " %6" PRId64 "  %s (%s%s)\n",
+                    p->addr,
+                    p->size(),
+                    p->name.c_str(),
+                    p->file.c_str(),
+                    p->fixed ? ", fixed" : "");
+        }
+        fprintf(map, "//\n");
+        fprintf(map, "// XR addr  symbol\n");
+        for (auto & expsym : exports)
+        {
+            fprintf(map, "   0x" PR_X64_04 "  %s\n", symbols[expsym].value, expsym.c_str());
+        }
+        fprintf(map, "//\n");
+        fprintf(map,
+                "// " PR_D64 " of %d copper words used\n",
+                static_cast<int64_t>(image.size()),
+                static_cast<int>(LINK_COP_SIZE));
+        fclose(map);
+    }
+
+    process_output();
+
+    printf("copasm link completed successfully (" PR_DSIZET " object%s, " PR_D64 " of %d copper words)\n",
+           objs.size(),
+           objs.size() == 1 ? "" : "s",
+           static_cast<int64_t>(image.size()),
+           static_cast<int>(LINK_COP_SIZE));
+
+    return EXIT_SUCCESS;
+}
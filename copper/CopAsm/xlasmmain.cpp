@@ -0,0 +1,267 @@
+// xlasmmain.cpp
+//
+// copasm command line driver (kept separate so the assembler can also be linked into host tools as libcopasm).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "xlasm.h"
+#include "xlasmcopper.h"
+
+static void show_help()
+{
+    printf("copasm - XarkLabs Xosera \"Slim Copper\" Assembler\n");
+    printf("         Copyright 2022 Xark - MIT Licensed\n");
+    printf("\n");
+    printf("Usage:  copasm [options] <input files ...> [-o output.fmt]\n");
+    printf("        copasm [options] <objects.cobj[@addr] ...> -o output.fmt    (link relocatable objects)\n");
+    printf("\n");
+    printf("-b      maximum bytes hex per listing line (8-64, default 8)\n");
+    printf("-c      suppress listing inside false conditional (.LISTCOND false)\n");
+    printf("-d sym  define <sym>[=expression]\n");
+    printf("-i      add default include search path (tried if include fails)\n");
+    printf("-k      no error-kill, continue assembly despite errors\n");
+    printf("-l      request listing file (uses output name with .lst, or .map when linking)\n");
+    printf("-m      suppress macro expansion listing (.LISTMAC false)\n");
+    printf("-n      suppress macro name in listing (.MACNAME false)\n");
+    printf("-o      output file name (using extension format .c/.h, .pack/.pack.h, .const.h, .cobj or binary)\n");
+    printf("-p      peephole optimize copper code (see copasm-REFERENCE.md)\n");
+    printf("-q      quiet operation\n");
+    printf("-r      video mode width for copper cycle checks (640 or 848, default 640)\n");
+    printf("-t file append assembly phase timing to <file> as JSON (one line per run, for benchmarks)\n");
+    printf("-v      verbose operation (repeat up to three times)\n");
+    printf("-x      add symbol cross-reference to end of listing file\n");
+    printf("\n");
+}
+
+int main(int argc, char ** argv)
+{
+    std::string              archname;
+    std::vector<std::string> source_files;
+    std::string              object_file;
+    xlasm::opts_t            opts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            switch (argv[i][1])
+            {
+                case 'a':
+                    if (argv[i][2] != 0)
+                        archname = &argv[i][2];
+                    else if (i + 1 < argc)
+                        archname = argv[++i];
+                    else
+                        fatal_error("Expected architecture name after -a option");
+                    break;
+
+                case 'b':
+                    if (argv[i][2] != 0)
+                    {
+                        if (sscanf(&argv[i][2], "%u", &opts.listing_bytes) != 1)
+                            fatal_error("Expected number after -b listing bytes option (8 per line)");
+                    }
+                    else if (i + 1 < argc)
+                    {
+                        if (sscanf(argv[++i], "%u", &opts.listing_bytes) != 1)
+                            fatal_error("Expected number after -b listing bytes option (8 per line)");
+                    }
+                    else
+                    {
+                        fatal_error("Expected number after -b listing bytes option (8 per line)");
+                    }
+
+
+                    opts.listing_bytes = (opts.listing_bytes + 7) & ~7U;
+                    if (opts.listing_bytes < 8)
+                        opts.listing_bytes = 8;
+                    break;
+
+                case 'c':
+                    opts.suppress_false_conditionals = true;
+                    break;
+
+                case 'd':
+                    if (argv[i][2] != 0)
+                    {
+                        opts.define_sym.push_back(&argv[i][2]);
+                    }
+                    else if (i + 1 < argc)
+                    {
+                        opts.define_sym.push_back(argv[++i]);
+                    }
+                    else
+                    {
+                        fatal_error("Expected symbol after -d define sym option");
+                    }
+                    break;
+
+                case 'i':
+                    if (argv[i][2] != 0)
+                    {
+                        opts.include_path.push_back(&argv[i][2]);
+                    }
+                    else if (i + 1 < argc)
+                    {
+                        opts.include_path.push_back(argv[++i]);
+                    }
+                    else
+                    {
+                        fatal_error("Expected path after -i include path option");
+                    }
+                    break;
+
+                case 'h':
+                case '?': {
+                    show_help();
+                    exit(EXIT_SUCCESS);
+                }
+                case 'm':
+                    opts.suppress_macro_expansion = true;
+                    break;
+
+                case 'n':
+                    opts.suppress_macro_name = true;
+                    break;
+
+                case 'k':
+                    opts.no_error_kill = true;
+                    break;
+
+                case 'l':
+                    opts.listing = true;
+                    break;
+
+                case 'o':
+                    if (argv[i][2] != 0)
+                    {
+                        object_file = &argv[i][2];
+                    }
+                    else if (i + 1 < argc)
+                    {
+                        object_file = argv[++i];
+                    }
+                    else
+                    {
+                        fatal_error("Expected filename after -o output file option");
+                    }
+                    break;
+
+                case 'p':
+                    opts.optimize = true;
+                    break;
+
+                case 'q':
+                    opts.verbose = 0;
+                    break;
+
+                case 'r':
+                    if (argv[i][2] != 0)
+                    {
+                        if (sscanf(&argv[i][2], "%u", &opts.video_width) != 1)
+                            fatal_error("Expected 640 or 848 after -r video mode option");
+                    }
+                    else if (i + 1 < argc)
+                    {
+                        if (sscanf(argv[++i], "%u", &opts.video_width) != 1)
+                            fatal_error("Expected 640 or 848 after -r video mode option");
+                    }
+                    else
+                    {
+                        fatal_error("Expected 640 or 848 after -r video mode option");
+                    }
+
+                    if (opts.video_width != 640 && opts.video_width != 848)
+                        fatal_error("Unsupported -r video mode width %u (expected 640 or 848)", opts.video_width);
+                    break;
+
+                case 't':
+                    if (argv[i][2] != 0)
+                    {
+                        opts.timing_file = &argv[i][2];
+                    }
+                    else if (i + 1 < argc)
+                    {
+                        opts.timing_file = argv[++i];
+                    }
+                    else
+                    {
+                        fatal_error("Expected filename after -t timing file option");
+                    }
+                    break;
+
+                case 'v':
+                    opts.verbose++;
+                    break;
+
+                case 'x':
+                    opts.xref = true;
+                    break;
+
+                default:
+                    show_help();
+                    fatal_error("Unrecognized option -%c", argv[i][1]);
+                    break;
+            }
+
+            continue;
+        }
+        source_files.push_back(std::string(argv[i]));
+    }
+
+    if (opts.verbose > 1)
+    {
+        if (opts.verbose == 2)
+            printf("Verbose status messages enabled.\n");
+        else if (opts.verbose > 2)
+            printf("Verbose status and debugging messages enabled.\n");
+    }
+
+    copper copperarch;
+
+    if (archname.size() == 0)
+        archname = "copper";
+
+    Ixlarch * initialarch = Ixlarch::find_arch(archname);
+
+    if (initialarch == nullptr)
+    {
+        printf("Supported architectures (with variants and identifiers):\n");
+        for (auto & a : Ixlarch::architectures)
+        {
+            printf("  %s\n", a->variant_names());
+        }
+        printf("\n");
+
+        fatal_error("Unrecognized architecture \"%s\".", archname.c_str());
+    }
+
+    if (!source_files.size())
+    {
+        show_help();
+        fatal_error("No input file(s) specified");
+    }
+
+    // link input files if they are all relocatable copper objects (optionally with @address)
+    size_t num_objects = 0;
+    for (auto & f : source_files)
+    {
+        if (hasEnding(f.substr(0, f.rfind('@')), ".cobj"))
+            num_objects++;
+    }
+    if (num_objects && num_objects != source_files.size())
+    {
+        fatal_error("Can't mix relocatable .cobj objects with source files (assemble each to .cobj first)");
+    }
+
+    xlasm xl(archname);
+
+    int rc = num_objects ? xl.link(source_files, object_file, opts) : xl.assemble(source_files, object_file, opts);
+
+    return rc;
+}
+
+// EOF
@@ -1,4 +1,4 @@
-// ftdi_spi.cpp - source for FTDI SPI routines
+// ftdi_spi.cpp - source for FTDI SPI routines (and host_spi_* transport selection)
 //
 // vim: set et ts=4 sw=4
 //
@@ -12,26 +12,185 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <unistd.h>
 
+#include <deque>
+
+#include <ftdi.h>
+
 #include "ftdi_spi.h"
 
 unsigned int         chunksize;                 // set on open to the maximum size that can be sent/received per call
 static bool          ftdi_device_opened;        // true if device was opened (and should be closed at exit)
 static bool          ftdi_set_device_latency;        // true if latency was set (and should be restored at exit)
 static unsigned char ftdi_original_latency;          // saved original FTDI latency value
-static bool          slow_clock = true;
+static bool          slow_clock = false;
 
 static struct ftdi_context ftdi_ctx;        // context for libftdi
 
+static uint8_t xfer_buffer[2][4096 + 3];        // MPSSE command and data for next two transfer chunks
+
 static void ftdi_put_byte(uint8_t data);
 static void ftdi_put_word(uint16_t data);
-static void host_spi_cleanup();
+static void ftdi_spi_cleanup();
+
+// Mock FTDI device (HOST_SPI_MOCK environment variable set to USB round trip microseconds), so transfers and the
+// host_spi benchmark can run with no device attached.  It decodes MPSSE commands like an FT2232H with COPI looped
+// back to CIPO, so every transfer reads back the bytes sent.  Reply data is ready one USB round trip after the
+// write that sent it plus the time to shift the bytes at the SPI clock rate, so overlapped writes and reads
+// complete sooner (like a real device), but throughput is still limited by the SPI clock.
+static bool           mock_device;             // true if using mock device instead of libftdi
+static unsigned int   mock_latency_us;         // USB round trip time (write to reply available)
+static unsigned int   mock_spi_hz;             // SPI clock rate (set by TCK_DIVISOR)
+static uint64_t       mock_spi_done;           // time SPI finishes shifting previous transfers (microseconds)
+static std::deque<uint8_t>  mock_in;           // MPSSE command bytes not yet decoded
+static std::deque<uint8_t>  mock_reply;        // reply bytes
+static std::deque<uint64_t> mock_ready;        // time each reply byte is available (microseconds)
+
+static uint64_t mock_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void mock_put_reply(uint8_t data, uint64_t ready)
+{
+    mock_reply.push_back(data);
+    mock_ready.push_back(ready);
+}
+
+// decode MPSSE commands written to mock device
+static int mock_write(const uint8_t * data, int size)
+{
+    mock_in.insert(mock_in.end(), data, data + size);
+    uint64_t ready = mock_now_us() + mock_latency_us;
+    while (!mock_in.empty())
+    {
+        uint8_t cmd  = mock_in[0];
+        size_t  need = 1;
+        switch (cmd)
+        {
+            case SET_BITS_LOW:
+                need = 3;
+                break;
+            case TCK_DIVISOR:
+                need = 3;
+                if (mock_in.size() >= need)
+                {
+                    mock_spi_hz = 12000000 / (((mock_in[1] | mock_in[2] << 8) + 1) * 2);
+                }
+                break;
+            case EN_DIV_5:
+                need = 1;
+                break;
+            case MPSSE_DO_READ | MPSSE_DO_WRITE | MPSSE_WRITE_NEG:
+                need = mock_in.size() < 3 ? 3 : 3 + (mock_in[1] | mock_in[2] << 8) + 1;
+                break;
+            default:        // bad command reply
+                mock_put_reply(0xFA, ready);
+                mock_put_reply(cmd, ready);
+                break;
+        }
+        if (mock_in.size() < need)
+        {
+            break;
+        }
+        if (need > 3)
+        {
+            // each byte is ready after it has been shifted (8 SPI clocks), after any previous transfer
+            uint64_t start = ready > mock_spi_done ? ready : mock_spi_done;
+            for (size_t i = 3; i < need; i++)
+            {
+                mock_spi_done = start + (i - 2) * 8 * UINT64_C(1000000) / mock_spi_hz;
+                mock_put_reply(mock_in[i], mock_spi_done);
+            }
+        }
+        mock_in.erase(mock_in.begin(), mock_in.begin() + need);
+    }
+
+    return size;
+}
+
+// read reply bytes available from mock device (wait for at least min_size bytes)
+static int mock_read(uint8_t * data, int size, int min_size)
+{
+    if (static_cast<int>(mock_reply.size()) < min_size)
+    {
+        return -1;        // would never complete
+    }
+    if (min_size > 0)
+    {
+        uint64_t ready = mock_ready[min_size - 1];
+        uint64_t now   = mock_now_us();
+        if (ready > now)
+        {
+            usleep(static_cast<useconds_t>(ready - now));
+        }
+    }
+
+    uint64_t now = mock_now_us();
+    int      len = 0;
+    while (len < size && !mock_reply.empty() && mock_ready.front() <= now)
+    {
+        data[len++] = mock_reply.front();
+        mock_reply.pop_front();
+        mock_ready.pop_front();
+    }
+
+    return len;
+}
+
+// write to FTDI device
+static int ftdi_write(const uint8_t * data, int size)
+{
+    if (mock_device)
+    {
+        return mock_write(data, size);
+    }
+    return ftdi_write_data(&ftdi_ctx, data, size);
+}
+
+// read from FTDI device (returns bytes available, up to size)
+static int ftdi_read(uint8_t * data, int size)
+{
+    if (mock_device)
+    {
+        return mock_read(data, size, 0);
+    }
+    return ftdi_read_data(&ftdi_ctx, data, size);
+}
+
+// start asynchronous write or read (mock device writes at once and reads when done)
+static struct ftdi_transfer_control * ftdi_submit(bool read, uint8_t * data, int size)
+{
+    if (mock_device)
+    {
+        static struct ftdi_transfer_control mock_tc[2];
+        struct ftdi_transfer_control *      tc = &mock_tc[read];
+        memset(tc, 0, sizeof(*tc));
+        tc->buf  = data;
+        tc->size = read ? size : mock_write(data, size);
+        return tc;
+    }
+    return read ? ftdi_read_data_submit(&ftdi_ctx, data, size) : ftdi_write_data_submit(&ftdi_ctx, data, size);
+}
+
+// wait for asynchronous write or read to finish (returns bytes transferred)
+static int ftdi_done(struct ftdi_transfer_control * tc, bool read)
+{
+    if (mock_device)
+    {
+        return read ? mock_read(tc->buf, tc->size, tc->size) : tc->size;
+    }
+    return ftdi_transfer_data_done(tc);
+}
 
 // Toggle FTDI ADBUS3 (aka CTS) line used as FPGA SS on iCEBreaker (and UPduino 3.x via TP11)
 // NOTE: cs = false to select (active low)
-void host_spi_cs(bool cs)
+static void ftdi_spi_cs(bool cs)
 {
     uint8_t gpio_pins = 0;
 
@@ -47,8 +206,8 @@ void host_spi_cs(bool cs)
 
 [[noreturn]] static void fatal()
 {
-    host_spi_cs(true);
-    host_spi_cleanup();
+    ftdi_spi_cs(true);
+    ftdi_spi_cleanup();
     printf("EXITING!\n");
     exit(EXIT_FAILURE);
 }
@@ -56,7 +215,7 @@ void host_spi_cs(bool cs)
 // send byte to FTDI device
 static void ftdi_put_byte(uint8_t data)
 {
-    int rc = ftdi_write_data(&ftdi_ctx, &data, 1);
+    int rc = ftdi_write(&data, 1);
     if (rc != 1)
     {
         fprintf(stderr, "ftdi_put_byte: ftdi_write_data failed (rc=%d).\n", rc);
@@ -67,7 +226,7 @@ static void ftdi_put_byte(uint8_t data)
 static void ftdi_put_word(uint16_t data)
 {
     uint8_t d[2] = {static_cast<uint8_t>(data), static_cast<uint8_t>(data >> 8)};
-    int     rc   = ftdi_write_data(&ftdi_ctx, &d[0], 2);
+    int     rc   = ftdi_write(&d[0], 2);
     if (rc != 2)
     {
         fprintf(stderr, "ftdi_put_word: ftdi_put_word failed (rc=%d).\n", rc);
@@ -76,73 +235,126 @@ static void ftdi_put_word(uint16_t data)
 }
 
 
-// receive byte from FTDI device
-static uint8_t ftdi_get_byte()
+// receive num bytes from FTDI device (each read returns as much as is available, up to chunksize)
+static void ftdi_get_bytes(size_t num, uint8_t * data)
 {
-    uint8_t data = 0x00;
-    while (1)
+    size_t got = 0;
+    while (got < num)
     {
-        int rc = ftdi_read_data(&ftdi_ctx, &data, 1);
+        size_t len = num - got < chunksize ? num - got : chunksize;
+        int    rc  = ftdi_read(data + got, static_cast<int>(len));
         if (rc < 0)
         {
-            fprintf(stderr, "ftdi_get_byte: ftdi_read_data failed (rc=%d).\n", rc);
+            fprintf(stderr, "ftdi_get_bytes: ftdi_read_data failed (rc=%d).\n", rc);
             fatal();
         }
-        if (rc == 1)
-        {
-            break;
-        }
-        usleep(100);
+        got += rc;
     }
-
-    return data;
 }
 
+// put MPSSE read/write command for len bytes from data in transfer buffer (returns transfer buffer size)
+static int xfer_chunk(uint8_t * buffer, size_t len, const uint8_t * data)
+{
+    // read CIPO, write COPI, LSB first, update data on negative clock edge
+    buffer[0] = MPSSE_DO_READ | MPSSE_DO_WRITE /* | MPSSE_LSB */ | MPSSE_WRITE_NEG;
+    buffer[1] = static_cast<uint8_t>(len - 1);
+    buffer[2] = static_cast<uint8_t>((len - 1) >> 8);
+    memcpy(buffer + 3, data, len);
+    return static_cast<int>(len + 3);
+}
 
 // SPI transfer, reading and writing num bytes from/into inout
-int host_spi_xfer_bytes(size_t num, uint8_t * inout)
+// Transfers are split into chunks (of up to chunksize with MPSSE command) and the write of each chunk is submitted
+// before waiting for the reply of the previous chunk, so USB writes and reads overlap.
+static int ftdi_spi_xfer_bytes(size_t num, uint8_t * inout)
 {
     if (num < 1)
     {
         return -1;
     }
 
-    //    host_spi_cs(false);
-
-    // read CIPO, write COPI, LSB first, update data on negative clock edge
-    ftdi_put_byte(MPSSE_DO_READ | MPSSE_DO_WRITE /* | MPSSE_LSB */ | MPSSE_WRITE_NEG);
-    ftdi_put_word(static_cast<uint16_t>(num - 1));
-
-    int rc = ftdi_write_data(&ftdi_ctx, inout, static_cast<int>(num));
-    if (rc != static_cast<int>(num))
+    size_t chunk = chunksize - 3;
+    if (chunk > sizeof(xfer_buffer[0]) - 3)
     {
-        fprintf(stderr, "host_spi_xfer_bytes: ftdi_write_data failed (c=%d, expected %zu).\n", rc, num);
-        fatal();
+        chunk = sizeof(xfer_buffer[0]) - 3;
     }
 
-    for (size_t i = 0; i < num; i++)
+    size_t                         len      = num < chunk ? num : chunk;
+    int                            size     = xfer_chunk(xfer_buffer[0], len, inout);
+    struct ftdi_transfer_control * write_tc = ftdi_submit(false, xfer_buffer[0], size);
+    size_t off = 0;
+    while (true)
     {
-        inout[i] = ftdi_get_byte();
-    }
+        struct ftdi_transfer_control * read_tc = ftdi_submit(true, inout + off, static_cast<int>(len));
+        if (!write_tc || ftdi_done(write_tc, false) != size)
+        {
+            fprintf(stderr, "ftdi_spi_xfer_bytes: ftdi_write_data_submit failed (expected %d).\n", size);
+            fatal();
+        }
 
-    //    host_spi_cs(true);
+        // queue next chunk write while this chunk is being read
+        size_t next     = off + len;
+        size_t next_len = num - next < chunk ? num - next : chunk;
+        if (next_len)
+        {
+            uint8_t * buffer = xfer_buffer[(next / chunk) & 1];
+            size             = xfer_chunk(buffer, next_len, inout + next);
+            write_tc         = ftdi_submit(false, buffer, size);
+        }
+
+        if (read_tc)
+        {
+            int rc = ftdi_done(read_tc, true);
+            if (rc != static_cast<int>(len))
+            {
+                fprintf(stderr, "ftdi_spi_xfer_bytes: ftdi_read_data_submit failed (rc=%d, expected %zu).\n",
+                        rc,
+                        len);
+                fatal();
+            }
+        }
+        else
+        {
+            ftdi_get_bytes(len, inout + off);        // no async read, read chunk as it arrives
+        }
+
+        if (!next_len)
+        {
+            break;
+        }
+        off = next;
+        len = next_len;
+    }
 
     return 0;
 }
 
-int host_spi_open()
+static int ftdi_spi_open()
 {
+    const char * mock = getenv("HOST_SPI_MOCK");
+    if (mock && mock[0])
+    {
+        mock_device     = true;
+        mock_latency_us = static_cast<unsigned int>(strtoul(mock, nullptr, 0));
+        mock_spi_hz     = slow_clock ? 50000 : 2000000;        // same as TCK_DIVISOR for device below
+        chunksize       = 4096;
+        printf("Opened mock FTDI FT2232H (loopback, %u us USB latency, %u kHz SPI clock)...\n",
+               mock_latency_us,
+               mock_spi_hz / 1000);
+        return 0;
+    }
+
     int rc = ftdi_init(&ftdi_ctx);
     if (rc != 0)
     {
-        fprintf(stderr, "host_spi_open: ftdi_init failed (rc=%d)\n", rc);
+        fprintf(stderr, "ftdi_spi_open: ftdi_init failed (rc=%d)\n", rc);
         return -1;
     }
 
     rc = ftdi_set_interface(&ftdi_ctx, INTERFACE_A);
     if (rc != 0)
     {
-        fprintf(stderr, "host_spi_open: ftdi_set_interface failed (rc=%d)\n", rc);
+        fprintf(stderr, "ftdi_spi_open: ftdi_set_interface failed (rc=%d)\n", rc);
         return -1;
     }
 
@@ -162,7 +374,7 @@ int host_spi_open()
 
     if (id_num >= 3)
     {
-        fprintf(stderr, "host_spi_open: No FTDI FTx232H USB device found.\n");
+        fprintf(stderr, "ftdi_spi_open: No FTDI FTx232H USB device found.\n");
         return -1;
     }
 
@@ -174,40 +386,40 @@ int host_spi_open()
 
     if (ftdi_usb_reset(&ftdi_ctx))
     {
-        fprintf(stderr, "host_spi_open: ftdi_usb_reset failed (%s).\n", ftdi_get_error_string(&ftdi_ctx));
+        fprintf(stderr, "ftdi_spi_open: ftdi_usb_reset failed (%s).\n", ftdi_get_error_string(&ftdi_ctx));
         return -1;
     }
 
 #if 0
     if (ftdi_usb_purge_buffers(&ftdi_ctx))
     {
-        fprintf(stderr, "host_spi_open: ftdi_usb_purge_buffers failed (%s).\n", ftdi_get_error_string(&ftdi_ctx));
+        fprintf(stderr, "ftdi_spi_open: ftdi_usb_purge_buffers failed (%s).\n", ftdi_get_error_string(&ftdi_ctx));
         return -1;
     }
 #endif
 
     if (ftdi_get_latency_timer(&ftdi_ctx, &ftdi_original_latency) < 0)
     {
-        fprintf(stderr, "host_spi_open: ftdi_get_latency_timer failed (%s).\n", ftdi_get_error_string(&ftdi_ctx));
+        fprintf(stderr, "ftdi_spi_open: ftdi_get_latency_timer failed (%s).\n", ftdi_get_error_string(&ftdi_ctx));
         return -1;
     }
 
     // set 1kHz latency
     if (ftdi_set_latency_timer(&ftdi_ctx, 1) < 0)
     {
-        fprintf(stderr, "host_spi_open: ftdi_set_latency_timer failed (%s).\n", ftdi_get_error_string(&ftdi_ctx));
+        fprintf(stderr, "ftdi_spi_open: ftdi_set_latency_timer failed (%s).\n", ftdi_get_error_string(&ftdi_ctx));
         return -1;
     }
 
     ftdi_set_device_latency = true;
 
-    atexit(host_spi_cleanup);
+    atexit(ftdi_spi_cleanup);
 
     // enter MPSSE, mask ignored
     if (ftdi_set_bitmode(&ftdi_ctx, 0x00, BITMODE_MPSSE) < 0)
     {
         fprintf(
-            stderr, "host_spi_open: ftdi_set_bitmode BITMODE_MPSSE failed (%s)\n", ftdi_get_error_string(&ftdi_ctx));
+            stderr, "ftdi_spi_open: ftdi_set_bitmode BITMODE_MPSSE failed (%s)\n", ftdi_get_error_string(&ftdi_ctx));
         fatal();
     }
 
@@ -220,31 +432,41 @@ int host_spi_open()
     }
     else        // normal
     {
-        // 12 Mhz / (0 + 1 * 2) = 6 MHz
         ftdi_put_byte(EN_DIV_5);
         ftdi_put_byte(TCK_DIVISOR);
-        ftdi_put_word(0x00);
+        // ftdi_put_word(0x0);        // 12 Mhz / (0 + 1 * 2) = 6 MHz (too fast!)
+        ftdi_put_word(0x2);        // 12 Mhz / (2 + 1 * 2) = 2 MHz
     }
 
-
     sleep(1);
 
+    // drain input
+    uint8_t dummy_data;
+    do
+    {
+        rc = ftdi_read(&dummy_data, 1);
+    } while (rc == 1);
+
     printf("Success.\n");
 
+    ftdi_spi_cs(true);
+
     return 0;
 }
 
-int host_spi_close()
+static int ftdi_spi_close()
 {
-    host_spi_cleanup();
+    ftdi_spi_cleanup();
 
     return 0;
 }
 
-static void host_spi_cleanup()
+static void ftdi_spi_cleanup()
 {
     if (ftdi_device_opened)
     {
+        ftdi_spi_cs(true);
+
         if (ftdi_set_device_latency)
         {
             ftdi_set_latency_timer(&ftdi_ctx, ftdi_original_latency);
@@ -256,3 +478,37 @@ static void host_spi_cleanup()
         ftdi_device_opened = false;
     }
 }
+
+const host_spi_transport host_spi_ftdi = {"FTDI", ftdi_spi_open, ftdi_spi_close, ftdi_spi_cs, ftdi_spi_xfer_bytes};
+
+// transport selected by host_spi_open (simulation socket if HOST_SPI_SIM is set, else FTDI device)
+static const host_spi_transport * host_spi = &host_spi_ftdi;
+
+int host_spi_open()
+{
+    const char * sim = getenv("HOST_SPI_SIM");
+    host_spi         = (sim && sim[0]) ? &host_spi_sim : &host_spi_ftdi;
+
+    return host_spi->open();
+}
+
+// true if host_spi_open opened the mock FTDI device (HOST_SPI_MOCK set and not empty, and no HOST_SPI_SIM)
+bool host_spi_mock()
+{
+    return host_spi == &host_spi_ftdi && mock_device;
+}
+
+int host_spi_close()
+{
+    return host_spi->close();
+}
+
+void host_spi_cs(bool cs)
+{
+    host_spi->cs(cs);
+}
+
+int host_spi_xfer_bytes(size_t num, uint8_t * inout)
+{
+    return host_spi->xfer_bytes(num, inout);
+}
@@ -1,4 +1,4 @@
-// ftdi_spi.h - header for FTDI SPI routines
+// ftdi_spi.h - header for host SPI routines (FTDI device or Xosera simulation)
 //
 // vim: set et ts=4 sw=4
 //
@@ -8,7 +8,7 @@
 #if !defined(HOST_SPI_H)
 #define HOST_SPI_H
 
-#include <ftdi.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // Thanks to https://github.com/YosysHQ/icestorm/tree/master/iceprog
@@ -47,10 +47,33 @@
 #define FTDI_FT2232H 0x6010        // FT2232H Hi-Speed Dual USB UART/FIFO
 #define FTDI_FT4232H 0x6011        // FT4232H Hi-Speed Quad USB UART
 
+// Xosera simulation SPI socket messages (host_spi_sim to "-s <port>" option of the Verilator simulation)
+//
+// Host sends a 3 byte header, message type then little endian length, followed by length bytes for SPI_SIM_XFER.
+// Simulation replies to SPI_SIM_XFER with the length bytes received over SPI (nothing for other messages).
+#define SPI_SIM_PORT     4808        // default TCP port
+#define SPI_SIM_SELECT   'S'         // select FPGA (length 0)
+#define SPI_SIM_DESELECT 'D'         // de-select FPGA (length 0)
+#define SPI_SIM_XFER     'X'         // send and receive length bytes (1 to 65535)
+
+// SPI transport used by host_spi_* routines below
+struct host_spi_transport
+{
+    const char * name;
+    int (*open)();                                          // open transport
+    int (*close)();                                         // close transport
+    void (*cs)(bool cs);                                    // cs = false to select FPGA peripheral
+    int (*xfer_bytes)(size_t num, uint8_t * inout);        // send and receive num bytes over SPI
+};
+
+extern const host_spi_transport host_spi_ftdi;        // FTDI device (or mock device if HOST_SPI_MOCK set)
+extern const host_spi_transport host_spi_sim;         // Xosera simulation socket (if HOST_SPI_SIM set)
+
 extern unsigned int chunksize;                   // set on open to the maximum size that can be sent/received per call
-int                 host_spi_open();             // open FTDI device for FPGA SPI I/O
-int                 host_spi_close();            // close FTDI device
+int                 host_spi_open();             // open FTDI device (or simulation) for FPGA SPI I/O
+int                 host_spi_close();            // close FTDI device (or simulation)
 void                host_spi_cs(bool cs);        // cs = false to select FPGA peripheral
 int                 host_spi_xfer_bytes(size_t num, uint8_t * buffer);        // send and receive num bytes over SPI
+bool                host_spi_mock();        // true if open device is the mock FTDI device (loops back bytes sent)
 
 #endif        // HOST_SPI_H
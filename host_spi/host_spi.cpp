@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <unistd.h>
 
@@ -33,12 +34,67 @@ static void hexdump(size_t num, uint8_t * mem)
 static uint8_t to_send[65536] = {0};
 static uint8_t data[65536]    = {0};
 
+// send total bytes as num byte transfers and print throughput (bytes have CS bit clear, so Xosera ignores them)
+static void benchmark(size_t total, size_t num)
+{
+    bool mock = host_spi_mock();        // mock device loops back bytes sent
+
+    printf("Benchmark: %zu bytes in %zu byte transfers...\n", total, num);
+
+    struct timespec start, end;
+    size_t          errors = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    host_spi_cs(false);
+    for (size_t sent = 0; sent < total; sent += num)
+    {
+        size_t len = total - sent < num ? total - sent : num;        // last transfer may be shorter
+        for (size_t i = 0; i < len; i++)
+        {
+            data[i] = static_cast<uint8_t>((sent + i) * 7) & 0x7f;
+        }
+        memcpy(to_send, data, len);
+        host_spi_xfer_bytes(len, to_send);
+        if (mock && memcmp(to_send, data, len) != 0)
+        {
+            errors++;
+        }
+    }
+    host_spi_cs(true);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%zu bytes in %.3f seconds, %.1f KB/sec (%.1f usec per transfer)\n",
+           total,
+           secs,
+           total / secs / 1024.0,
+           secs * 1e6 / ((total + num - 1) / num));
+    if (mock)
+    {
+        printf("Loopback %s (%zu transfers with errors)\n", errors ? "FAILED" : "okay", errors);
+    }
+}
+
 int main(int argc, char ** argv)
 {
     if (host_spi_open() < 0)
     {
         exit(EXIT_FAILURE);
     }
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0)
+    {
+        size_t total = argc > 2 ? strtoul(argv[2], nullptr, 0) * 1024 : 1024 * 1024;
+        size_t num   = argc > 3 ? strtoul(argv[3], nullptr, 0) : sizeof(data);
+        if (num < 1 || num > sizeof(data))
+        {
+            printf("Transfer size needs to be 1 to %zu bytes\n", sizeof(data));
+            exit(EXIT_FAILURE);
+        }
+        benchmark(total, num);
+        host_spi_close();
+        exit(EXIT_SUCCESS);
+    }
+
     size_t len = 0;
 
     for (int i = 1; i < argc && len < sizeof(to_send); i++)
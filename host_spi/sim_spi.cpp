@@ -0,0 +1,192 @@
+// sim_spi.cpp - source for Xosera simulation SPI routines (socket to Verilator simulation)
+//
+// vim: set et ts=4 sw=4
+//
+// See top-level LICENSE file for license information. (Hint: MIT)
+//
+// Used when the HOST_SPI_SIM environment variable is set to "[host:]port" of a Verilator simulation started with
+// "-s <port>" option.  The simulation decodes SPI command/payload bytes just like the iCEBreaker SPI_INTERFACE, so
+// host_spi and xvid_spi run unchanged with no FPGA or FTDI device.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "ftdi_spi.h"
+
+#define SIM_CONNECT_RETRIES 50        // connect retries (100 ms apart, simulation may still be starting)
+#define SIM_XFER_MAX        4096      // chunksize for simulation transfers
+
+static int sim_socket = -1;        // socket connected to simulation
+
+static void sim_spi_cleanup()
+{
+    if (sim_socket >= 0)
+    {
+        close(sim_socket);
+        sim_socket = -1;
+    }
+}
+
+[[noreturn]] static void sim_fatal(const char * msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, errno ? strerror(errno) : "simulation disconnected");
+    sim_spi_cleanup();
+    printf("EXITING!\n");
+    exit(EXIT_FAILURE);
+}
+
+// send len bytes to simulation
+static void sim_send(const uint8_t * data, size_t len)
+{
+    while (len)
+    {
+        ssize_t rc = send(sim_socket, data, len, 0);
+        if (rc <= 0)
+        {
+            if (rc < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            sim_fatal("sim_send: send failed");
+        }
+        data += rc;
+        len -= rc;
+    }
+}
+
+// receive len bytes from simulation
+static void sim_recv(uint8_t * data, size_t len)
+{
+    while (len)
+    {
+        ssize_t rc = recv(sim_socket, data, len, 0);
+        if (rc <= 0)
+        {
+            if (rc < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            errno = rc < 0 ? errno : 0;
+            sim_fatal("sim_recv: recv failed");
+        }
+        data += rc;
+        len -= rc;
+    }
+}
+
+static void sim_message(uint8_t type, size_t len)
+{
+    uint8_t header[3] = {type, static_cast<uint8_t>(len), static_cast<uint8_t>(len >> 8)};
+    sim_send(header, sizeof(header));
+}
+
+static void sim_spi_cs(bool cs)
+{
+    sim_message(cs ? SPI_SIM_DESELECT : SPI_SIM_SELECT, 0);
+}
+
+// SPI transfer, reading and writing num bytes from/into inout (sent in messages of up to 64KB)
+static int sim_spi_xfer_bytes(size_t num, uint8_t * inout)
+{
+    if (num < 1)
+    {
+        return -1;
+    }
+
+    while (num)
+    {
+        size_t len = num < 0xffff ? num : 0xffff;
+        sim_message(SPI_SIM_XFER, len);
+        sim_send(inout, len);
+        sim_recv(inout, len);
+        inout += len;
+        num -= len;
+    }
+
+    return 0;
+}
+
+static int sim_spi_open()
+{
+    // "[host:]port"
+    std::string  sim   = getenv("HOST_SPI_SIM");
+    size_t       colon = sim.rfind(':');
+    std::string  host  = colon == std::string::npos ? "localhost" : sim.substr(0, colon);
+    std::string  port  = colon == std::string::npos ? sim : sim.substr(colon + 1);
+    addrinfo     hints = {};
+    addrinfo *   addrs = nullptr;
+    hints.ai_family    = AF_UNSPEC;
+    hints.ai_socktype  = SOCK_STREAM;
+
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs);
+    if (rc != 0)
+    {
+        fprintf(stderr, "sim_spi_open: can't resolve \"%s\" (%s)\n", sim.c_str(), gai_strerror(rc));
+        return -1;
+    }
+
+    printf("Connecting to Xosera simulation at %s:%s...", host.c_str(), port.c_str());
+    fflush(stdout);
+    for (int retry = 0; retry < SIM_CONNECT_RETRIES && sim_socket < 0; retry++)
+    {
+        if (retry)
+        {
+            usleep(100000);
+        }
+        for (addrinfo * ai = addrs; ai && sim_socket < 0; ai = ai->ai_next)
+        {
+            sim_socket = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (sim_socket >= 0 && connect(sim_socket, ai->ai_addr, ai->ai_addrlen) != 0)
+            {
+                close(sim_socket);
+                sim_socket = -1;
+            }
+        }
+    }
+    freeaddrinfo(addrs);
+
+    if (sim_socket < 0)
+    {
+        printf("FAILED!\n");
+        fprintf(stderr, "sim_spi_open: can't connect to simulation (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    // send SPI messages at once (each transfer waits for reply anyway)
+    int one = 1;
+    setsockopt(sim_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    chunksize = SIM_XFER_MAX;
+
+    printf("okay.\n");
+
+    atexit(sim_spi_cleanup);
+
+    sim_spi_cs(true);
+
+    return 0;
+}
+
+static int sim_spi_close()
+{
+    if (sim_socket >= 0)
+    {
+        sim_spi_cs(true);
+    }
+    sim_spi_cleanup();
+
+    return 0;
+}
+
+const host_spi_transport host_spi_sim = {"simulation", sim_spi_open, sim_spi_close, sim_spi_cs, sim_spi_xfer_bytes};
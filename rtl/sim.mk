@@ -63,7 +63,7 @@ COPASM=$(XOSERA_M68K_API)/bin/copasm
 RESET_COP=default_copper.casm
 ifeq ($(findstring 640x,$(VIDEO_MODE)),)
 RESET_COPMEM=default_copper_848.mem
-COPASMOPT=-d MODE_640x480=0 -d MODE_848x480=1
+COPASMOPT=-d MODE_640x480=0 -d MODE_848x480=1 -r 848
 else
 RESET_COPMEM=default_copper_640.mem
 COPASMOPT=-d MODE_640x480=1 -d MODE_848x480=0
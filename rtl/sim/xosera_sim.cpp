@@ -6,11 +6,21 @@
 // has a nice example of how to use Verilator with Yosys and SDL.  This code
 // was created starting with that (so drr gets most of the credit).
 
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <vector>
+
+#include "../../host_spi/ftdi_spi.h"        // for SPI_SIM_* socket messages
 #include "../../xosera_m68k_api/xosera_m68k_defs.h"
 #include "video_mode_defs.h"
 
@@ -47,6 +57,7 @@ volatile bool done;
 bool          sim_render = SDL_RENDER;
 bool          sim_bus    = BUS_INTERFACE;
 bool          wait_close = false;
+int           spi_port   = 0;        // TCP port for SPI target (0 if not enabled)
 
 bool vsync_detect = false;
 bool vtop_detect  = false;
@@ -110,6 +121,12 @@ class BusInterface
     int     data_upload_num;
     int     data_upload_count;
     int     data_upload_index;
+    int     delta_records;              // records left in delta frame
+    int     delta_frames;               // delta frames started
+    bool    delta_synced;               // waited for vsync before next delta frame
+    int     delta_addr;                 // VRAM address of current delta record
+    int     delta_addr_bytes;           // WR_ADDR bytes left to write for current record
+    int     delta_data_bytes;           // XM_DATA bytes left to write for current record
 
     static int      test_data_len;
     static uint16_t test_data[32768];
@@ -154,9 +171,99 @@ public:
         data_upload_num   = 0;
         data_upload_count = 0;
         data_upload_index = 0;
+        delta_records     = 0;
+        delta_frames      = 0;
+        delta_synced      = false;
+        delta_addr        = 0;
+        delta_addr_bytes  = 0;
+        delta_data_bytes  = 0;
         top->bus_cs_n_i   = 1;
     }
 
+    // next bus write for REG_UPLOAD_DELTA() (xosera_convert anim stream), returns false if nothing to write now
+    // (waiting for vsync before next frame, or upload finished)
+    bool delta_upload_next(int & reg_num, int & bytesel, int & data)
+    {
+        const uint8_t * payload = upload_payload[data_upload_num];
+        // next big-endian stream word, or -1 if past end of upload
+        auto word = [&]() {
+            if (data_upload_index + 2 > data_upload_count)
+            {
+                return -1;
+            }
+            int w = (payload[data_upload_index] << 8) | payload[data_upload_index + 1];
+            data_upload_index += 2;
+            return w;
+        };
+        // end upload (with error if stream is truncated or corrupt)
+        auto end_upload = [&](bool error) {
+            if (error)
+            {
+                log_printf("*** Upload #%d delta stream truncated at byte %d of %d (frame %d), upload ended\n",
+                           data_upload_num + 1,
+                           data_upload_index,
+                           data_upload_count,
+                           delta_frames);
+            }
+            else
+            {
+                logonly_printf("[Upload #%d completed, %d delta frames]\n", data_upload_num + 1, delta_frames);
+            }
+            data_upload      = false;
+            delta_addr_bytes = 0;
+            delta_data_bytes = 0;
+            data_upload_num++;
+            return false;
+        };
+
+        while (delta_addr_bytes == 0 && delta_data_bytes == 0)
+        {
+            if (delta_records == 0)
+            {
+                if (data_upload_index + 2 > data_upload_count)
+                {
+                    return end_upload(data_upload_index != data_upload_count);
+                }
+                if (delta_frames > 0 && !delta_synced)
+                {
+                    delta_synced = true;
+                    wait_vsync   = true;
+                    return false;
+                }
+                delta_synced  = false;
+                delta_records = word();
+                delta_frames++;
+                continue;
+            }
+            int addr  = word();
+            int words = word();
+            if (addr < 0 || words < 0 || data_upload_index + words * 2 > data_upload_count)
+            {
+                return end_upload(true);
+            }
+            delta_addr       = addr;
+            delta_data_bytes = words * 2;
+            delta_addr_bytes = 2;
+            delta_records--;
+        }
+
+        if (delta_addr_bytes)
+        {
+            reg_num = XM_WR_ADDR;
+            bytesel = delta_addr_bytes == 1;
+            data    = bytesel ? delta_addr & 0xff : delta_addr >> 8;
+            delta_addr_bytes--;
+        }
+        else
+        {
+            reg_num = XM_DATA;
+            bytesel = data_upload_index & 1;
+            data    = payload[data_upload_index++];
+            delta_data_bytes--;
+        }
+        return true;
+    }
+
     void process(Vxosera_main * top)
     {
         char tempstr[256];
@@ -288,16 +395,23 @@ public:
                     return;
                 }
 
-                if (!data_upload && (test_data[index] & 0xfffe) == 0xfff0)
+                if (!data_upload && test_data[index] >= 0xfff0 && test_data[index] <= 0xfff2)        // REG_UPLOAD*()
                 {
                     data_upload       = upload_size[data_upload_num] > 0;
-                    data_upload_mode  = test_data[index] & 0x1;
+                    data_upload_mode  = test_data[index] & 0x3;
                     data_upload_count = upload_size[data_upload_num];        // byte count
-                    data_upload_index = 0;
+                    data_upload_index = data_upload_mode == 2 ? 2 : 0;       // skip delta stream frame count
+                    delta_records     = 0;
+                    delta_frames      = 0;
+                    delta_synced      = false;
+                    delta_addr_bytes  = 0;
+                    delta_data_bytes  = 0;
                     logonly_printf("[Upload #%d started, %d bytes, mode %s]\n",
                                    data_upload_num + 1,
                                    data_upload_count,
-                                   data_upload_mode ? "XR_DATA" : "VRAM_DATA");
+                                   data_upload_mode == 2 ? "VRAM_DELTA"
+                                   : data_upload_mode    ? "XR_DATA"
+                                                         : "VRAM_DATA");
 
                     index++;
                 }
@@ -306,7 +420,14 @@ public:
                 int reg_num = (test_data[index] >> 8) & 0xf;
                 int data    = test_data[index] & 0xff;
 
-                if (data_upload && state == BUS_START)
+                if (data_upload && state == BUS_START && data_upload_mode == 2)
+                {
+                    if (!delta_upload_next(reg_num, bytesel, data))
+                    {
+                        return;
+                    }
+                }
+                else if (data_upload && state == BUS_START)
                 {
                     bytesel = data_upload_index & 1;
                     reg_num = data_upload_mode ? XM_XDATA : XM_DATA;
@@ -389,7 +510,7 @@ public:
                         //                        last_time          = bus_time + 9;
                         if (data_upload)
                         {
-                            if (data_upload_index >= data_upload_count)
+                            if (data_upload_mode != 2 && data_upload_index >= data_upload_count)
                             {
                                 data_upload = false;
                                 logonly_printf("[Upload #%d completed]\n", data_upload_num + 1);
@@ -436,6 +557,256 @@ const char * BusInterface::reg_name[] = {"XM_SYS_CTRL ",
                                          "XM_UART",
                                          "XM_FEATURE  "};
 
+// SPI target over a TCP socket ("-s <port>" option), so host_spi and xvid_spi (with HOST_SPI_SIM=<port>) can run
+// against the simulation (socket messages are described in host_spi/ftdi_spi.h).  SPI bytes are decoded like the
+// iCEBreaker SPI_INTERFACE bridge in xosera_iceb.sv: a command byte (CS/WR/RS/BS/REGNUM) replies 0xCB and sets the
+// bus signals, then the payload byte replies with bus_data_o (i.e., register read data) and strobes CS if the
+// command CS bit was set.  The simulation ends when the client disconnects.
+class SpiInterface
+{
+    const int SPI_BYTE_CLOCKS = 8;         // clocks per SPI byte (bus_interface.sv takes 3 to sync bus signals)
+    const int SPI_POLL_CLOCKS = 64;        // clocks between socket polls while waiting for a message
+
+    bool                 enable;
+    int                  listen_fd;
+    int                  client_fd;
+    bool                 selected;            // SPI_SIM_SELECT received
+    bool                 payload_byte;        // next SPI byte is payload byte (else command byte)
+    bool                 reset;               // reset_i set by RS bit
+    uint8_t              cmd_byte;            // last command byte
+    int                  wait_clocks;         // clocks until next SPI byte or socket poll
+    std::vector<uint8_t> in;                  // received message bytes
+    size_t               in_pos;              // next message in received bytes
+    std::vector<uint8_t> xfer;                // SPI_SIM_XFER bytes (replaced by reply bytes as sent)
+    size_t               xfer_pos;            // next SPI byte in xfer
+    uint64_t             xfer_count;          // SPI_SIM_XFER messages
+    uint64_t             byte_count;          // SPI bytes
+
+    void disconnect(const char * why)
+    {
+        log_printf("[@t=%8lu] SPI target %s after %lu transfers (%lu bytes), ending simulation\n",
+                   main_time,
+                   why,
+                   xfer_count,
+                   byte_count);
+        close(client_fd);
+        client_fd = -1;
+        enable    = false;
+        done      = true;
+    }
+
+    void accept_client()
+    {
+        client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd >= 0)
+        {
+            int one = 1;
+            setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            close(listen_fd);        // only one client
+            listen_fd = -1;
+            log_printf("[@t=%8lu] SPI target client connected\n", main_time);
+        }
+    }
+
+    void receive()
+    {
+        uint8_t buffer[4096];
+        ssize_t rc = recv(client_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (rc > 0)
+        {
+            in.insert(in.end(), buffer, buffer + rc);
+        }
+        else if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            disconnect("client disconnected");
+        }
+    }
+
+    void send_reply()
+    {
+        for (size_t sent = 0; sent < xfer.size();)
+        {
+            ssize_t rc = send(client_fd, xfer.data() + sent, xfer.size() - sent, 0);
+            if (rc <= 0 && errno != EINTR)
+            {
+                disconnect("send failed");
+                return;
+            }
+            sent += rc > 0 ? rc : 0;
+        }
+        xfer.clear();
+        xfer_pos = 0;
+        xfer_count++;
+    }
+
+    // parse received messages until a transfer is ready (returns false if more bytes are needed)
+    bool next_message()
+    {
+        while (enable && in.size() - in_pos >= 3)
+        {
+            uint8_t type = in[in_pos];
+            size_t  len  = in[in_pos + 1] | (in[in_pos + 2] << 8);
+            if (type == SPI_SIM_XFER)
+            {
+                if (in.size() - in_pos - 3 < len)
+                {
+                    break;
+                }
+                xfer.assign(in.begin() + in_pos + 3, in.begin() + in_pos + 3 + len);
+                xfer_pos = 0;
+                in_pos += 3 + len;
+                return len > 0;
+            }
+
+            in_pos += 3;
+            if (type == SPI_SIM_SELECT)
+            {
+                selected = true;
+            }
+            else if (type == SPI_SIM_DESELECT)
+            {
+                selected     = false;
+                payload_byte = false;        // next byte is command byte
+            }
+            else
+            {
+                log_printf("SPI target bad message type 0x%02x\n", type);
+                disconnect("protocol error");
+            }
+        }
+
+        if (in_pos == in.size())
+        {
+            in.clear();
+            in_pos = 0;
+        }
+        return false;
+    }
+
+    // send next SPI byte to Xosera (replacing it with reply byte)
+    void spi_byte(Vxosera_main * top)
+    {
+        uint8_t & data = xfer[xfer_pos++];
+        byte_count++;
+        if (!selected)
+        {
+            data = 0xff;
+        }
+        else if (!payload_byte)
+        {
+            cmd_byte           = data;
+            payload_byte       = true;
+            top->bus_rd_nwr_i  = (cmd_byte & 0x40) ? 0 : 1;        // WR bit
+            top->bus_bytesel_i = (cmd_byte & 0x10) ? 1 : 0;        // BS bit
+            top->bus_reg_num_i = cmd_byte & 0xf;                   // REGNUM
+            if (cmd_byte & 0x20)                                   // RS bit
+            {
+                logonly_printf("[@t=%8lu] SPI target reset\n", main_time);
+                top->reset_i = 1;
+                reset        = true;
+            }
+            data = 0xCB;
+        }
+        else
+        {
+            payload_byte    = false;
+            top->bus_data_i = data;
+            data            = top->bus_data_o;        // read data for command register (before bus cycle)
+            if (cmd_byte & 0x80)                      // CS bit
+            {
+                top->bus_cs_n_i = 0;        // CS_ENABLED edge strobes bus cycle
+            }
+        }
+    }
+
+public:
+    bool enabled()
+    {
+        return enable;
+    }
+
+    void init(Vxosera_main * top, int port)
+    {
+        enable       = false;
+        listen_fd    = -1;
+        client_fd    = -1;
+        selected     = false;
+        payload_byte = false;
+        reset        = false;
+        cmd_byte     = 0;
+        wait_clocks  = 0;
+        in_pos       = 0;
+        xfer_pos     = 0;
+        xfer_count   = 0;
+        byte_count   = 0;
+        if (!port)
+        {
+            return;
+        }
+
+        sockaddr_in addr     = {};
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port        = htons(port);
+        int one              = 1;
+        listen_fd            = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 1) != 0 ||
+            fcntl(listen_fd, F_SETFL, O_NONBLOCK) != 0)
+        {
+            fprintf(stderr, "SPI target can't listen on port %d: %s\n", port, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        enable          = true;
+        top->bus_cs_n_i = 1;
+        log_printf("SPI target listening on port %d (run host_spi or xvid_spi with HOST_SPI_SIM=%d)\n", port, port);
+    }
+
+    void process(Vxosera_main * top)
+    {
+        if (!enable || (wait_clocks && --wait_clocks))
+        {
+            return;
+        }
+
+        // end of previous SPI byte
+        top->bus_cs_n_i = 1;
+        if (reset)
+        {
+            top->reset_i = 0;
+            reset        = false;
+        }
+
+        if (xfer_pos < xfer.size())
+        {
+            spi_byte(top);
+            wait_clocks = SPI_BYTE_CLOCKS;
+            if (xfer_pos == xfer.size())
+            {
+                send_reply();
+            }
+            return;
+        }
+
+        if (client_fd < 0)
+        {
+            accept_client();
+        }
+        else
+        {
+            receive();
+        }
+
+        if (!next_message())
+        {
+            wait_clocks = SPI_POLL_CLOCKS;
+        }
+    }
+};
+
+SpiInterface spi;
+
 #define REG_BH(r, v)     (((XM_##r) | 0x00) << 8) | ((v) & 0xff)
 #define REG_BL(r, v)     (((XM_##r) | 0x10) << 8) | ((v) & 0xff)
 #define REG_W(r, v)      ((XM_##r) << 8) | (((v) >> 8) & 0xff), (((XM_##r) | 0x10) << 8) | ((v) & 0xff)
@@ -447,6 +818,7 @@ const char * BusInterface::reg_name[] = {"XM_SYS_CTRL ",
 
 #define REG_UPLOAD()          0xfff0
 #define REG_UPLOAD_AUX()      0xfff1
+#define REG_UPLOAD_DELTA()    0xfff2        // replay xosera_convert anim stream (frame per vsync, needs WR_INCR 1)
 #define REG_WAITHSYNC()       0xfffa
 #define REG_WAIT_BLIT_READY() (((XM_SYS_CTRL) | 0x80) << 8), 0xfffc
 #define REG_WAIT_BLIT_DONE()  (((XM_SYS_CTRL) | 0x80) << 8), 0xfffb
@@ -927,6 +1299,22 @@ uint16_t     BusInterface::test_data[32768] = {
 
 #endif
 
+#if 0
+    // xosera_convert anim delta stream test (-u out_anim.raw from "xosera_convert anim frame*.png out")
+
+    XREG_SETW(PA_GFX_CTRL, 0x0055),         // bitmap, 4-bpp, Hx2, Vx2
+    XREG_SETW(PA_TILE_CTRL, 0x000F),        // tileset 0x0000 in TILEMEM, tilemap in VRAM, 16-high font
+    XREG_SETW(PA_DISP_ADDR, 0x0000),        // display start address
+    XREG_SETW(PA_LINE_LEN, W_4BPP),         // display line word length (320 pixels with 4 pixels per word at 4-bpp)
+
+    REG_W(WR_INCR, 0x0001),        // delta records are runs of sequential words
+    REG_UPLOAD_DELTA(),            // first frame, then one changed frame per vsync
+
+    REG_WAITVTOP(),
+    REG_WAITVSYNC(),
+
+#endif
+
 #if 0
     // true color hack test
 
@@ -9786,6 +10174,16 @@ int main(int argc, char ** argv)
         {
             wait_close = true;
         }
+        else if (strcmp(argv[nextarg] + 1, "s") == 0)
+        {
+            nextarg += 1;
+            spi_port = nextarg < argc ? static_cast<int>(strtoul(argv[nextarg], nullptr, 0)) : 0;
+            if (spi_port <= 0 || spi_port > 0xffff)
+            {
+                printf("-s needs TCP port number (e.g., %d)\n", SPI_SIM_PORT);
+                exit(EXIT_FAILURE);
+            }
+        }
         if (strcmp(argv[nextarg] + 1, "u") == 0)
         {
             nextarg += 1;
@@ -9801,6 +10199,11 @@ int main(int argc, char ** argv)
         nextarg += 1;
     }
 
+    if (spi_port)
+    {
+        sim_bus = false;        // SPI target drives bus signals (instead of BUS_INTERFACE test data)
+    }
+
     if (num_uploads)
     {
         for (int u = 0; u < num_uploads; u++)
@@ -9874,7 +10277,7 @@ int main(int argc, char ** argv)
         SDL_RenderClear(renderer);
     }
 
-    bool shot_all  = true;        // screenshot all frames
+    bool shot_all  = !spi_port;        // screenshot all frames (SPI target runs until client exits)
     bool take_shot = false;
 
 #endif        // SDL_RENDER
@@ -9908,6 +10311,7 @@ int main(int argc, char ** argv)
     top->reset_i = 1;        // start in reset
 
     bus.init(top, sim_bus);
+    spi.init(top, spi_port);
 
     while (!done && !Verilated::gotFinish())
     {
@@ -9919,6 +10323,7 @@ int main(int argc, char ** argv)
 #if BUS_INTERFACE
         bus.process(top);
 #endif
+        spi.process(top);
 
         top->eval();         // see https://lawrie.github.io/blackicemxbook/Simulation/Simulation.html
         top->clk = 1;        // clock rising
@@ -9940,7 +10345,7 @@ int main(int argc, char ** argv)
             logonly_printf("[@t=%8lu FPGA INTERRUPT]\n", main_time);
         }
 
-        if (frame_num > 1)
+        if (frame_num > 1 && !spi.enabled())        // SPI target access log would be huge
         {
             if (top->xosera_main->vram_arb->regs_ack_o)
             {
@@ -10136,7 +10541,7 @@ int main(int argc, char ** argv)
             vsync_count      = 0;
             current_y        = 0;
 
-            if (frame_num == MAX_TRACE_FRAMES)
+            if (frame_num == MAX_TRACE_FRAMES && !spi.enabled())
             {
                 break;
             }
@@ -6,41 +6,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include <algorithm>
+#include "xosera_image.h"
+#include "xosera_palette.h"
 
 bool   word_mode = false;
 bool   c_mode    = false;
-bool   invert    = false;
-bool   monocolor = false;
-bool   color16   = false;
 char * in_file   = nullptr;
 char * out_file  = nullptr;
 
-int     out_width  = 640;
-int     out_height = 480;
-uint8_t color_byte = 0x0F;        // white on black default
-
-uint16_t palette[16] = {0x0000,
-                        0x000A,
-                        0x00A0,
-                        0x00AA,
-                        0x0A00,
-                        0x0A0A,
-                        0x0AA0,
-                        0x0AAA,
-                        0x0555,
-                        0x055F,
-                        0x05F5,
-                        0x05FF,
-                        0x0F55,
-                        0x0F5F,
-                        0x0FF5,
-                        0x0FFF};
-
-Uint32 getpixel(SDL_Surface * surface, int x, int y);
-
-void matchmonocolors(uint8_t *& ptr, const SDL_Color rgb[8]);
-void matchcolors(uint8_t *& ptr, const SDL_Color * rgb);
+int opt_colors = 0;        // generate optimized palette with this many colors (instead of sampling)
 
 int main(int argc, char ** argv)
 {
@@ -50,23 +24,14 @@ int main(int argc, char ** argv)
     {
         if (argv[a][0] == '-')
         {
-            if (strcmp("-i", argv[a]) == 0)
-            {
-                invert = true;
-            }
-            else if (strcmp("-m", argv[a]) == 0)
-            {
-                monocolor = true;
-            }
-            else if (strcmp("-c", argv[a]) == 0)
-            {
-                color16    = true;
-                out_width  = 640 / 2;
-                out_height = 480 / 2;
-            }
-            else if (strcmp("-848", argv[a]) == 0)
+            if (strcmp("-k", argv[a]) == 0 && a + 1 < argc)
             {
-                out_width = 848;
+                opt_colors = atoi(argv[++a]);
+                if (opt_colors < 1 || opt_colors > 256)
+                {
+                    printf("Expected 1 to 256 colors after -k option\n");
+                    exit(EXIT_FAILURE);
+                }
             }
             else
             {
@@ -95,25 +60,13 @@ int main(int argc, char ** argv)
     if (!in_file || !out_file)
     {
         printf("image_to_mem: Convert image to monochome bitmap file.\n");
-        printf("Usage:  image_to_mem <input font image> <output font mem> [-i]\n");
-        printf("   -i   Invert pixels\n");
+        printf("Usage:  image_to_mem <input font image> <output font mem> [-k n]\n");
+        printf("   -k n Print optimized n color palette for image (median cut + k-means)\n");
         exit(EXIT_FAILURE);
     }
 
     printf("Input image file     : \"%s\"\n", in_file);
     printf("Output monochrome bitmap file : \"%s\"\n", out_file);
-    if (invert)
-    {
-        printf("[Inverting pixels] ");
-    }
-    if (monocolor)
-    {
-        printf("[2 monocolor pixels] ");
-    }
-    if (color16)
-    {
-        printf("[4-bpp color pixels] ");
-    }
     printf("\n");
 
     bool quit = false;
@@ -138,14 +91,16 @@ int main(int argc, char ** argv)
         SDL_Quit();
     }
 
-    SDL_Surface * image = IMG_Load(in_file);
+    xosera_image  img;
+    std::string   error;
+    SDL_Surface * image = xosera_image_load(in_file, img, error) ? xosera_image_surface(img) : nullptr;
 
     int w = 0;
     int h = 0;
 
     if (!image)
     {
-        printf("*** Unable to load \"%s\"\n", in_file);
+        printf("*** %s\n", error.c_str());
         quit = true;
     }
     else
@@ -192,15 +147,34 @@ int main(int argc, char ** argv)
         }
     }
 
-#if 1
+    // print palette
     int c = 0;
+    if (image && opt_colors)
+    {
+        xosera_palette gen;
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                SDL_Color rgb = img.color(x, y);
+                gen.add(rgb.r, rgb.g, rgb.b);
+            }
+        }
+        for (auto color : gen.generate(opt_colors))
+        {
+            printf("0x%04x, ", color);
+            if ((++c & 0xf) == 0)
+            {
+                printf("\n");
+            }
+        }
+        h = 0;        // skip sampling palette grid
+    }
     for (int y = 0; y < h; y += 15)
     {
         for (int x = 0; x < w; x += 20)
         {
-            SDL_Color rgb;
-            Uint32    data = getpixel(image, x, y);
-            SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
+            SDL_Color rgb = img.color(x, y);
 #if 0
             printf("0%x%x%x    // %3d (0x%02x)\n", (rgb.r & 0xf0) >> 4, (rgb.g & 0xf0) >> 4, (rgb.b & 0xf0) >> 4, c, c);
             c++;
@@ -214,88 +188,6 @@ int main(int argc, char ** argv)
         }
     }
 
-#else
-
-
-    while (!quit)
-    {
-        int       out_size   = color16 ? (out_width / 2) * out_height : (out_width / 8) * 2 * out_height;
-        uint8_t * out_pixels = (uint8_t *)malloc(out_size);
-
-        if (!out_pixels)
-        {
-            printf("OOM!\n");
-            break;
-        }
-
-        memset(out_pixels, 0, out_size);
-        uint8_t * pptr = out_pixels;
-
-        FILE * fp = fopen(out_file, "w");
-        if (fp != nullptr)
-        {
-            printf("Writing output: \"%s\" %d x %d...\n", out_file, out_width, out_height);
-
-            for (int y = 0; y < out_height; y++)
-            {
-                for (int x = 0; x < out_width; x += 8)
-                {
-                    uint16_t  val            = 0;
-                    SDL_Color byte_pixels[8] = {};
-                    if (y < h && x < w)
-                    {
-                        for (int b = 0; b < 8; b++)
-                        {
-                            SDL_Color rgb;
-                            Uint32    data = getpixel(image, x + b, y);
-                            SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
-                            byte_pixels[b] = rgb;
-                            int v          = (rgb.r + rgb.g + rgb.b) / 3;
-
-                            bool pixel = (v >= 128);
-                            if (invert)
-                            {
-                                pixel = !pixel;
-                            }
-
-                            if (pixel)
-                            {
-                                val |= (0x80 >> b);
-                            }
-                        }
-                    }
-                    if (color16)
-                    {
-                        matchcolors(pptr, &byte_pixels[4]);
-                        matchcolors(pptr, &byte_pixels[0]);
-                    }
-                    else if (monocolor)
-                    {
-                        matchmonocolors(pptr, byte_pixels);
-                    }
-                    else
-                    {
-                        // big-endian!
-                        *pptr++ = val;
-                        *pptr++ = color_byte;
-                    }
-                }
-            }
-
-            bool good = (fwrite(out_pixels, out_size, 1, fp) == 1);
-
-            fclose(fp);
-
-            printf(good ? "Success.\n" : "Failed to write");
-        }
-        else
-        {
-            printf("*** Unable to open write to output file\n");
-        }
-
-        break;
-    }
-#endif
     if (image)
     {
         SDL_FreeSurface(image);
@@ -307,164 +199,3 @@ int main(int argc, char ** argv)
 
     return 0;
 }
-
-Uint32 getpixel(SDL_Surface * surface, int x, int y)
-{
-    int bpp = surface->format->BytesPerPixel;
-    /* Here p is the address to the pixel we want to retrieve */
-    Uint8 * p = (Uint8 *)surface->pixels + y * surface->pitch + x * bpp;
-
-    switch (bpp)
-    {
-        case 1:
-            return *p;
-            break;
-
-        case 2:
-            return *(Uint16 *)p;
-            break;
-
-        case 3:
-            if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
-                return p[0] << 16 | p[1] << 8 | p[2];
-            else
-                return p[0] | p[1] << 8 | p[2] << 16;
-            break;
-
-        case 4:
-            return *(Uint32 *)p;
-            break;
-
-        default:
-            return 0; /* shouldn't happen, but avoids warnings */
-    }
-}
-
-void matchmonocolors(uint8_t *& ptr, const SDL_Color rgb[8])
-{
-    SDL_Color qrgb[8]  = {};
-    int       irgb[8]  = {};
-    int       icnt[16] = {};
-
-    for (int c = 0; c < 16; c++)
-    {
-        icnt[c] = -1;
-    }
-
-    for (int b = 0; b < 8; b++)
-    {
-        qrgb[b].r = rgb[b].r + 63 < 0x100 ? rgb[b].r + 15 : 0xff;
-        qrgb[b].g = rgb[b].g + 63 < 0x100 ? rgb[b].g + 15 : 0xff;
-        qrgb[b].b = rgb[b].b + 63 < 0x100 ? rgb[b].b + 15 : 0xff;
-    }
-
-    for (int b = 0; b < 8; b++)
-    {
-        qrgb[b].r = ((((qrgb[b].r) >> 6) & 0x3) << 2) | (((qrgb[b].r) >> 6) & 0x3);
-        qrgb[b].g = ((((qrgb[b].g) >> 6) & 0x3) << 2) | (((qrgb[b].r) >> 6) & 0x3);
-        qrgb[b].b = ((((qrgb[b].b) >> 6) & 0x3) << 2) | (((qrgb[b].r) >> 6) & 0x3);
-    }
-
-    for (int b = 0; b < 8; b++)
-    {
-        int best      = -1;
-        int best_dist = 99999;
-        for (int c = 0; c < 16; c++)
-        {
-            int dist = (((palette[c] & 0xf00) >> 8) - qrgb[b].r) * (((palette[c] & 0xf00) >> 8) - qrgb[b].r) +
-                       (((palette[c] & 0x0f0) >> 4) - qrgb[b].g) * (((palette[c] & 0x0f0) >> 4) - qrgb[b].g) +
-                       (((palette[c] & 0x00f) >> 0) - qrgb[b].b) * (((palette[c] & 0x00f) >> 0) - qrgb[b].b);
-
-            if (dist < best_dist)
-            {
-                best      = c;
-                best_dist = dist;
-            }
-        }
-        irgb[b] = best;
-        icnt[best] += 1;
-    }
-
-    int back     = 0;
-    int backbest = -1;
-    for (int c = 0; c < 16; c++)
-    {
-        if (icnt[c] > backbest)
-        {
-            back     = c;
-            backbest = icnt[c];
-        }
-    }
-    icnt[back] = -1;
-
-    int fore     = 15;
-    int forebest = -1;
-    for (int c = 15; c >= 0; --c)
-    {
-        if (icnt[c] > forebest)
-        {
-            fore     = c;
-            forebest = icnt[c];
-        }
-    }
-
-    if (back > fore)
-    {
-        std::swap(back, fore);
-    }
-
-    uint16_t val = 0;
-
-    for (int b = 0; b < 8; b++)
-    {
-        if (irgb[b] != back)
-        {
-            val |= (0x80 >> b);
-        }
-    }
-
-    *ptr++ = (back << 4) | fore;
-    *ptr++ = val;
-}
-
-void matchcolors(uint8_t *& ptr, const SDL_Color * rgb)
-{
-    SDL_Color qrgb[4] = {};
-    int       irgb[4] = {};
-
-    for (int b = 0; b < 4; b++)
-    {
-        qrgb[b].r = rgb[b].r + 63 < 0x100 ? rgb[b].r + 15 : 0xff;
-        qrgb[b].g = rgb[b].g + 63 < 0x100 ? rgb[b].g + 15 : 0xff;
-        qrgb[b].b = rgb[b].b + 63 < 0x100 ? rgb[b].b + 15 : 0xff;
-    }
-
-    for (int b = 0; b < 4; b++)
-    {
-        qrgb[b].r = ((((qrgb[b].r) >> 6) & 0x3) << 2) | (((qrgb[b].r) >> 6) & 0x3);
-        qrgb[b].g = ((((qrgb[b].g) >> 6) & 0x3) << 2) | (((qrgb[b].r) >> 6) & 0x3);
-        qrgb[b].b = ((((qrgb[b].b) >> 6) & 0x3) << 2) | (((qrgb[b].r) >> 6) & 0x3);
-    }
-
-    for (int b = 0; b < 4; b++)
-    {
-        int best      = -1;
-        int best_dist = 99999;
-        for (int c = 0; c < 16; c++)
-        {
-            int dist = (((palette[c] & 0xf00) >> 8) - qrgb[b].r) * (((palette[c] & 0xf00) >> 8) - qrgb[b].r) +
-                       (((palette[c] & 0x0f0) >> 4) - qrgb[b].g) * (((palette[c] & 0x0f0) >> 4) - qrgb[b].g) +
-                       (((palette[c] & 0x00f) >> 0) - qrgb[b].b) * (((palette[c] & 0x00f) >> 0) - qrgb[b].b);
-
-            if (dist < best_dist)
-            {
-                best      = c;
-                best_dist = dist;
-            }
-        }
-        irgb[b] = best;
-    }
-
-    *ptr++ = ((irgb[0] & 0xf) << 4) | irgb[1];
-    *ptr++ = ((irgb[2] & 0xf) << 4) | irgb[3];
-}
\ No newline at end of file
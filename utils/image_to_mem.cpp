@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "xosera_image.h"
+
 bool   word_mode = false;
 bool   c_mode    = false;
 bool   invert    = false;
@@ -15,8 +17,6 @@ char * out_file  = nullptr;
 int font_height = 0;
 int font_chars  = 0;
 
-Uint32 getpixel(SDL_Surface * surface, int x, int y);
-
 int main(int argc, char ** argv)
 {
     printf("Xosera image to Verilog mem utility for 8x8 or 8x16 monochrome fonts - Xark\n\n");
@@ -119,14 +119,16 @@ int main(int argc, char ** argv)
         SDL_Quit();
     }
 
-    SDL_Surface * image = IMG_Load(in_file);
+    xosera_image  img;
+    std::string   error;
+    SDL_Surface * image = xosera_image_load(in_file, img, error) ? xosera_image_surface(img) : nullptr;
 
     int w = 0;
     int h = 0;
 
     if (!image)
     {
-        printf("*** Unable to load \"%s\"\n", in_file);
+        printf("*** %s\n", error.c_str());
         quit = true;
     }
     else
@@ -232,9 +234,7 @@ int main(int argc, char ** argv)
                         }
                         for (int x = 0; x < 8; x++)
                         {
-                            SDL_Color rgb;
-                            Uint32    data = getpixel(image, cx + x, cy + y);
-                            SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
+                            SDL_Color rgb = img.color(cx + x, cy + y);
                             int v = (rgb.r + rgb.g + rgb.b) / 3;
 
                             bool pixel = (v >= 128);
@@ -253,9 +253,7 @@ int main(int argc, char ** argv)
                             fprintf(fp, "    // ");
                             for (int x = 0; x < 8; x++)
                             {
-                                SDL_Color rgb;
-                                Uint32    data = getpixel(image, cx + x, cy + y);
-                                SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
+                                SDL_Color rgb = img.color(cx + x, cy + y);
                                 int v = (rgb.r + rgb.g + rgb.b) / 3;
 
                                 bool pixel = (v >= 128);
@@ -307,35 +305,3 @@ int main(int argc, char ** argv)
 
     return 0;
 }
-
-Uint32 getpixel(SDL_Surface * surface, int x, int y)
-{
-    int bpp = surface->format->BytesPerPixel;
-    /* Here p is the address to the pixel we want to retrieve */
-    Uint8 * p = (Uint8 *)surface->pixels + y * surface->pitch + x * bpp;
-
-    switch (bpp)
-    {
-        case 1:
-            return *p;
-            break;
-
-        case 2:
-            return *(Uint16 *)p;
-            break;
-
-        case 3:
-            if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
-                return p[0] << 16 | p[1] << 8 | p[2];
-            else
-                return p[0] | p[1] << 8 | p[2] << 16;
-            break;
-
-        case 4:
-            return *(Uint32 *)p;
-            break;
-
-        default:
-            return 0; /* shouldn't happen, but avoids warnings */
-    }
-}
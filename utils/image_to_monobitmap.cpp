@@ -8,6 +8,9 @@
 
 #include <algorithm>
 
+#include "xosera_image.h"
+#include "xosera_quant.h"
+
 bool   word_mode = false;
 bool   c_mode    = false;
 bool   invert    = false;
@@ -37,7 +40,8 @@ uint16_t palette[16] = {0x0000,
                         0x0FF5,
                         0x0FFF};
 
-Uint32 getpixel(SDL_Surface * surface, int x, int y);
+xosera_quant quant(palette, 16);        // nearest palette color lookup
+
 
 void matchmonocolors(uint8_t *& ptr, const SDL_Color rgb[8]);
 void matchcolors(uint8_t *& ptr, const SDL_Color * rgb);
@@ -138,14 +142,16 @@ int main(int argc, char ** argv)
         SDL_Quit();
     }
 
-    SDL_Surface * image = IMG_Load(in_file);
+    xosera_image  img;
+    std::string   error;
+    SDL_Surface * image = xosera_image_load(in_file, img, error) ? xosera_image_surface(img) : nullptr;
 
     int w = 0;
     int h = 0;
 
     if (!image)
     {
-        printf("*** Unable to load \"%s\"\n", in_file);
+        printf("*** %s\n", error.c_str());
         quit = true;
     }
     else
@@ -204,15 +210,16 @@ int main(int argc, char ** argv)
         }
 
         memset(out_pixels, 0, out_size);
-        uint8_t * pptr = out_pixels;
 
         FILE * fp = fopen(out_file, "w");
         if (fp != nullptr)
         {
             printf("Writing output: \"%s\" %d x %d...\n", out_file, out_width, out_height);
 
-            for (int y = 0; y < out_height; y++)
-            {
+            // output rows are independent (fixed size), so convert them in parallel
+            int row_bytes = out_size / out_height;
+            xosera_parallel_rows(out_height, [&](int y) {
+                uint8_t * pptr = out_pixels + y * row_bytes;
                 for (int x = 0; x < out_width; x += 8)
                 {
                     uint16_t  val            = 0;
@@ -221,9 +228,7 @@ int main(int argc, char ** argv)
                     {
                         for (int b = 0; b < 8; b++)
                         {
-                            SDL_Color rgb;
-                            Uint32    data = getpixel(image, x + b, y);
-                            SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
+                            SDL_Color rgb = img.color(x + b, y);
                             byte_pixels[b] = rgb;
                             int v          = (rgb.r + rgb.g + rgb.b) / 3;
 
@@ -255,7 +260,7 @@ int main(int argc, char ** argv)
                         *pptr++ = color_byte;
                     }
                 }
-            }
+            });
 
             bool good = (fwrite(out_pixels, out_size, 1, fp) == 1);
 
@@ -283,38 +288,6 @@ int main(int argc, char ** argv)
     return 0;
 }
 
-Uint32 getpixel(SDL_Surface * surface, int x, int y)
-{
-    int bpp = surface->format->BytesPerPixel;
-    /* Here p is the address to the pixel we want to retrieve */
-    Uint8 * p = (Uint8 *)surface->pixels + y * surface->pitch + x * bpp;
-
-    switch (bpp)
-    {
-        case 1:
-            return *p;
-            break;
-
-        case 2:
-            return *(Uint16 *)p;
-            break;
-
-        case 3:
-            if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
-                return p[0] << 16 | p[1] << 8 | p[2];
-            else
-                return p[0] | p[1] << 8 | p[2] << 16;
-            break;
-
-        case 4:
-            return *(Uint32 *)p;
-            break;
-
-        default:
-            return 0; /* shouldn't happen, but avoids warnings */
-    }
-}
-
 void matchmonocolors(uint8_t *& ptr, const SDL_Color rgb[8])
 {
     SDL_Color qrgb[8]  = {};
@@ -342,20 +315,7 @@ void matchmonocolors(uint8_t *& ptr, const SDL_Color rgb[8])
 
     for (int b = 0; b < 8; b++)
     {
-        int best      = -1;
-        int best_dist = 99999;
-        for (int c = 0; c < 16; c++)
-        {
-            int dist = (((palette[c] & 0xf00) >> 8) - qrgb[b].r) * (((palette[c] & 0xf00) >> 8) - qrgb[b].r) +
-                       (((palette[c] & 0x0f0) >> 4) - qrgb[b].g) * (((palette[c] & 0x0f0) >> 4) - qrgb[b].g) +
-                       (((palette[c] & 0x00f) >> 0) - qrgb[b].b) * (((palette[c] & 0x00f) >> 0) - qrgb[b].b);
-
-            if (dist < best_dist)
-            {
-                best      = c;
-                best_dist = dist;
-            }
-        }
+        int best = quant.nearest(qrgb[b].r, qrgb[b].g, qrgb[b].b);
         irgb[b] = best;
         icnt[best] += 1;
     }
@@ -423,23 +383,10 @@ void matchcolors(uint8_t *& ptr, const SDL_Color * rgb)
 
     for (int b = 0; b < 4; b++)
     {
-        int best      = -1;
-        int best_dist = 99999;
-        for (int c = 0; c < 16; c++)
-        {
-            int dist = (((palette[c] & 0xf00) >> 8) - qrgb[b].r) * (((palette[c] & 0xf00) >> 8) - qrgb[b].r) +
-                       (((palette[c] & 0x0f0) >> 4) - qrgb[b].g) * (((palette[c] & 0x0f0) >> 4) - qrgb[b].g) +
-                       (((palette[c] & 0x00f) >> 0) - qrgb[b].b) * (((palette[c] & 0x00f) >> 0) - qrgb[b].b);
-
-            if (dist < best_dist)
-            {
-                best      = c;
-                best_dist = dist;
-            }
-        }
+        int best = quant.nearest(qrgb[b].r, qrgb[b].g, qrgb[b].b);
         irgb[b] = best;
     }
 
     *ptr++ = ((irgb[0] & 0xf) << 4) | irgb[1];
     *ptr++ = ((irgb[2] & 0xf) << 4) | irgb[3];
-}
\ No newline at end of file
+}
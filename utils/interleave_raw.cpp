@@ -6,17 +6,16 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
+#include "xosera_mmap.h"
+
 char * in_file1 = nullptr;
 char * in_file2 = nullptr;
 char * out_file = nullptr;
 
 int chunk_size = 4096;
 
-uint8_t buffer1[32768];
-uint8_t buffer2[32768];
-
-// WIP
-
 int main(int argc, char ** argv)
 {
     printf("Convert two raw 8-bit audio files into one file interleaved in %d byte chunks\n", chunk_size);
@@ -69,49 +68,43 @@ int main(int argc, char ** argv)
     printf("Input R track file 2      : \"%s\"\n", in_file2);
     printf("Output interleaved LR file: \"%s\"\n", out_file);
 
-    FILE * fp1 = fopen(in_file1, "r");
-    if (fp1 == nullptr)
+    xosera_mmap_in in1;
+    xosera_mmap_in in2;
+    if (!in1.open(in_file1) || !in2.open(in_file2))
     {
-        printf("*** Unable to open input file \"%s\"\n", in_file1);
         exit(EXIT_FAILURE);
     }
-    FILE * fp2 = fopen(in_file1, "r");
-    if (fp2 == nullptr)
+
+    // chunks from both files, until the longer one ends (the shorter one is padded with silence)
+    size_t num_chunks = (std::max(in1.size, in2.size) + chunk_size - 1) / chunk_size;
+
+    xosera_mmap_out out;
+    if (!out.create(out_file, num_chunks * 2 * chunk_size))
     {
-        printf("*** Unable to open input file \"%s\"\n", in_file2);
         exit(EXIT_FAILURE);
     }
 
-    FILE * ofp = fopen(out_file, "w");
-    if (ofp == nullptr)
+    uint8_t * optr = out.data;
+    for (size_t chunk = 0; chunk < num_chunks; chunk++)
     {
-        printf("*** Unable to open output file \"%s\"\n", out_file);
-        exit(EXIT_FAILURE);
+        size_t offset = chunk * chunk_size;
+        for (const xosera_mmap_in * in : {&in1, &in2})
+        {
+            size_t len = offset < in->size ? std::min(in->size - offset, static_cast<size_t>(chunk_size)) : 0;
+            if (len)
+            {
+                memcpy(optr, in->data + offset, len);        // rest of chunk is already zero (new file)
+            }
+            optr += chunk_size;
+        }
     }
 
-    int num1  = 0;
-    int num2  = 0;
-    int num3  = 0;
-    int chunk = 0;
-    do
+    if (!out.close())
     {
-        memset(buffer1, 0, chunk_size);
-        num1 = fread(buffer1, chunk_size, 1, fp1);
-        memset(buffer2, 0, chunk_size);
-        num2 = fread(buffer2, chunk_size, 1, fp2);
-
-        num3 = fwrite(buffer1, chunk_size, 1, ofp);
-
-        num3 &= fwrite(buffer2, chunk_size, 1, ofp);
-
-        printf("Wrote chunk %d   \r", chunk++);
-
-    } while (num1 && num2 && num3);
-
-    fclose(fp1);
-    fclose(fp2);
-    fclose(ofp);
-    printf("Wrote %d chunks of 2 x %d bytes\n", chunk, chunk_size);
+        printf("*** Error writing output file \"%s\"\n", out_file);
+        exit(EXIT_FAILURE);
+    }
+    printf("Wrote %zu chunks of 2 x %d bytes\n", num_chunks, chunk_size);
 
     return EXIT_SUCCESS;
 }
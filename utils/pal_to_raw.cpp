@@ -6,13 +6,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "xosera_mmap.h"
+
 char * in_file  = nullptr;
 char * out_file = nullptr;
 
-
-char    line[4096];
-uint8_t out_buffer[128 * 1024];
-
 bool round_up = false;
 
 int main(int argc, char ** argv)
@@ -53,7 +51,7 @@ int main(int argc, char ** argv)
 
     if (!in_file || !out_file)
     {
-        printf("pal_to_raw: Extract low nibble from file\n");
+        printf("pal_to_raw: Convert Gimp palette into Xosera binary palette\n");
         printf("Usage:  pal_to_raw <input file> <output file>\n");
         printf(" -r   round colors to 4-bit (vs truncate)\n");
         exit(EXIT_FAILURE);
@@ -66,80 +64,78 @@ int main(int argc, char ** argv)
         printf("[Rounding color values to 4-bit]\n");
     }
 
-    size_t in_length = 0;
+    xosera_mmap_in in;
+    if (!in.open(in_file))
     {
-        FILE * fp = fopen(in_file, "r");
-        if (fp != nullptr)
-        {
-            while (fgets(line, sizeof(line) - 1, fp) != nullptr)
-            {
-                if (line[0] == '#')
-                {
-                    break;
-                }
-            }
-            int i = 0;
-            while (i < 256 && fgets(line, sizeof(line) - 1, fp) != nullptr)
-            {
-                int r = 0, g = 0, b = 0;
-
-                if (sscanf(line, "%u %u %u", &r, &g, &b) != 3)
-                {
-                    printf("error parsing: %s\n", line);
-                    exit(EXIT_FAILURE);
-                }
-
-                printf("[%02x] R=0x%02x, G=0x%02x, B=0x%02x\n", i, r, g, b);
+        exit(EXIT_FAILURE);
+    }
 
-                //   *out = (r >> 4) & 0xf;
+    // parse color lines directly from mapped file (header ends with a line starting with '#')
+    uint16_t     palette[256];
+    int          num_colors = 0;
+    bool         in_header  = true;
+    const char * ptr        = reinterpret_cast<const char *>(in.data);
+    const char * end        = ptr + in.size;
+    while (ptr < end && num_colors < 256)
+    {
+        const char * eol = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+        if (!eol)
+        {
+            eol = end;
+        }
+        char line[256];
+        snprintf(line, sizeof(line), "%.*s", static_cast<int>(eol - ptr), ptr);
+        ptr = eol + 1;
 
-                i++;
-            }
-            fclose(fp);
-            printf("Success, %zd bytes.\n", in_length);
+        if (in_header)
+        {
+            in_header = line[0] != '#';
+            continue;
         }
-        else
+
+        int r = 0, g = 0, b = 0;
+        if (sscanf(line, "%d %d %d", &r, &g, &b) != 3)
         {
-            printf("*** Unable to open input file\n");
+            if (line[strspn(line, " \t\r")] == '\0')
+            {
+                continue;        // ignore blank line
+            }
+            printf("error parsing: %s\n", line);
             exit(EXIT_FAILURE);
         }
-    }
-#if 0
-    uint8_t * ptr        = out_buffer;
-    size_t    out_length = 0;
-    if (!pal)
-    {
-        for (size_t i = 0; i < in_length; i += 2)
+
+        printf("[%02x] R=0x%02x, G=0x%02x, B=0x%02x\n", num_colors, r, g, b);
+
+        if (round_up)
         {
-            *ptr++ = ((in_buffer[i + 0] & 0xf) << 4) | (in_buffer[i + 1] & 0xf);
-            out_length++;
+            r = (r * 15 + 127) / 255;
+            g = (g * 15 + 127) / 255;
+            b = (b * 15 + 127) / 255;
         }
-    }
-    else
-    {
-        for (size_t i = 0; i < in_length; i += 3)
+        else
         {
-            *ptr++ = (in_buffer[i + 0] & 0xf);
-            *ptr++ = ((in_buffer[i + 1] & 0xf) << 4) | (in_buffer[i + 2] & 0xf);
-            out_length += 2;
+            r >>= 4;
+            g >>= 4;
+            b >>= 4;
         }
+        palette[num_colors++] = ((r & 0xf) << 8) | ((g & 0xf) << 4) | (b & 0xf);
     }
+    in.close();
 
-    FILE * fp = fopen(out_file, "w");
-    if (fp != nullptr)
+    // big-endian 0x0RGB colormem words
+    xosera_mmap_out out;
+    if (!out.create(out_file, num_colors * 2))
     {
-        printf("Writing output...\n");
-        size_t wrote_length = fwrite(out_buffer, 1, out_length, fp);
-
-
-        fclose(fp);
-        printf("Wrote %zd bytes, %s\n", wrote_length, (wrote_length == out_length) ? "Success" : "Fail");
+        exit(EXIT_FAILURE);
     }
-    else
+    for (int i = 0; i < num_colors; i++)
     {
-        printf("*** Unable to open to output file\n");
-        exit(EXIT_FAILURE);
+        out.data[i * 2 + 0] = palette[i] >> 8;
+        out.data[i * 2 + 1] = palette[i] & 0xff;
     }
-#endif
+
+    bool good = out.close();
+    printf("Wrote %d colors (%d bytes), %s\n", num_colors, num_colors * 2, good ? "Success" : "Fail");
+
     return EXIT_SUCCESS;
 }
@@ -6,13 +6,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "xosera_mmap.h"
+
 char * in_file  = nullptr;
 char * out_file = nullptr;
 
-
-uint8_t out_buffer[128 * 1024];
-uint8_t in_buffer[128 * 1024];
-
 bool pal = false;
 
 int main(int argc, char ** argv)
@@ -66,60 +64,49 @@ int main(int argc, char ** argv)
         printf("Padding for 16-bit palette\n");
     }
 
-    size_t in_length = 0;
+    xosera_mmap_in in;
+    if (!in.open(in_file))
     {
-        FILE * fp = fopen(in_file, "rb");
-        if (fp != nullptr)
-        {
-            printf("Reading input...\n");
-
-            in_length = fread(in_buffer, 1, 128 * 1024, fp);
+        exit(EXIT_FAILURE);
+    }
+    printf("Input %zu bytes.\n", in.size);
 
-            fclose(fp);
-            printf("Success, %zd bytes.\n", in_length);
-        }
-        else
-        {
-            printf("*** Unable to open input file\n");
-            exit(EXIT_FAILURE);
-        }
+    // two pixel bytes to one byte, or three palette bytes to one word (partial input padded with zero)
+    size_t          in_length  = in.size;
+    size_t          out_length = pal ? (in_length + 2) / 3 * 2 : (in_length + 1) / 2;
+    xosera_mmap_out out;
+    if (!out.create(out_file, out_length))
+    {
+        exit(EXIT_FAILURE);
     }
 
-    uint8_t * ptr        = out_buffer;
-    size_t    out_length = 0;
+    const uint8_t * iptr = in.data;
+    uint8_t *       ptr  = out.data;
     if (!pal)
     {
-        for (size_t i = 0; i < in_length; i += 2)
+        for (size_t i = 0; i + 1 < in_length; i += 2)
+        {
+            *ptr++ = ((iptr[i + 0] & 0xf) << 4) | (iptr[i + 1] & 0xf);
+        }
+        if (in_length & 1)
         {
-            *ptr++ = ((in_buffer[i + 0] & 0xf) << 4) | (in_buffer[i + 1] & 0xf);
-            out_length++;
+            *ptr++ = (iptr[in_length - 1] & 0xf) << 4;
         }
     }
     else
     {
         for (size_t i = 0; i < in_length; i += 3)
         {
-            *ptr++ = ((in_buffer[i + 0] >> 4) & 0xf);
-            *ptr++ = (((in_buffer[i + 1] >> 4) & 0xf) << 4) | ((in_buffer[i + 2] >> 4) & 0xf);
-            out_length += 2;
+            uint8_t r = iptr[i + 0];
+            uint8_t g = i + 1 < in_length ? iptr[i + 1] : 0;
+            uint8_t b = i + 2 < in_length ? iptr[i + 2] : 0;
+            *ptr++    = ((r >> 4) & 0xf);
+            *ptr++    = (((g >> 4) & 0xf) << 4) | ((b >> 4) & 0xf);
         }
     }
 
-    FILE * fp = fopen(out_file, "w");
-    if (fp != nullptr)
-    {
-        printf("Writing output...\n");
-        size_t wrote_length = fwrite(out_buffer, 1, out_length, fp);
-
-
-        fclose(fp);
-        printf("Wrote %zd bytes, %s\n", wrote_length, (wrote_length == out_length) ? "Success" : "Fail");
-    }
-    else
-    {
-        printf("*** Unable to open to output file\n");
-        exit(EXIT_FAILURE);
-    }
+    bool good = out.close();
+    printf("Wrote %zu bytes, %s\n", out_length, good ? "Success" : "Fail");
 
     return EXIT_SUCCESS;
 }
@@ -7,6 +7,11 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include <vector>
+
+#include "xosera_dither.h"
+#include "xosera_image.h"
+
 bool   noise_mode      = false;
 bool   create_pal      = false;
 bool   batch_mode      = false;
@@ -16,11 +21,12 @@ char * out_file        = nullptr;
 char   out_file8[4096];
 char   out_file4[4096];
 
+xosera_dither_mode    dither_mode = XOSERA_DITHER_NONE;
+std::vector<uint16_t> dithered;        // RGB444 pixels (when dithering)
+
 #define NOISE_MOD 13        // r = rand % NOISE_MOD
 #define NOISE_SUB 6         // n = r - NOISE_SUB
 
-Uint32 getpixel(SDL_Surface * surface, int x, int y);
-
 int main(int argc, char ** argv)
 {
     printf("true_color_hack: PNG to Xosera raw 12-bit (8-bit RG + 4-bit B) - Xark\n\n");
@@ -45,6 +51,14 @@ int main(int argc, char ** argv)
             {
                 interleave_mode = true;
             }
+            else if (strcmp("-D", argv[a]) == 0 && a + 1 < argc)
+            {
+                if (!xosera_dither_name(argv[++a], dither_mode))
+                {
+                    printf("Unrecognized dither: '%s'\n", argv[a]);
+                    exit(EXIT_FAILURE);
+                }
+            }
             else
             {
                 printf("Unexpected option: '%s'\n", argv[a]);
@@ -78,6 +92,7 @@ int main(int argc, char ** argv)
 
         printf("   -b   Batch mode, don't draw image\n");
         printf("   -n   Add some random noise to output to reduce 12-bit banding\n");
+        printf("   -D x Dither with fs (Floyd-Steinberg), atkinson or bayer to reduce 12-bit banding\n");
         printf("   -i   Interlave RG and B lines (each line has RG bytes, followed by B)\n");
         printf("   -p   Write raw COLORMEM data 256 RG + 16 B words (with ADD set in alpha)\n");
 
@@ -92,6 +107,10 @@ int main(int argc, char ** argv)
     {
         printf("Noise will be added to reduce banding\n");
     }
+    if (dither_mode != XOSERA_DITHER_NONE)
+    {
+        printf("Output will be dithered to reduce banding\n");
+    }
     if (create_pal)
     {
         printf("A COLORMEM 12-bit identity palette will be saved (256 RG then 16 B)\n");
@@ -123,14 +142,16 @@ int main(int argc, char ** argv)
     IMG_Init(IMG_INIT_PNG);
 
 
-    SDL_Surface * image = IMG_Load(in_file);
+    xosera_image  img;
+    std::string   error;
+    SDL_Surface * image = xosera_image_load(in_file, img, error) ? xosera_image_surface(img) : nullptr;
 
     int w = 0;
     int h = 0;
 
     if (!image)
     {
-        printf("*** Unable to load \"%s\"\n", in_file);
+        printf("*** %s\n", error.c_str());
         quit = true;
     }
     else
@@ -157,6 +178,18 @@ int main(int argc, char ** argv)
         {
             printf("\nWARNING: Will not fit in Xosera 128KB VRAM\n");
         }
+
+        if (dither_mode != XOSERA_DITHER_NONE)
+        {
+            dithered.resize(w * h);
+            xosera_dither(
+                dither_mode,
+                w,
+                h,
+                [&](int x, int y) { return img.pixel(x, y) & 0xffffff; },
+                xosera_dither_rgb444(),
+                [&](int x, int y, int value) { dithered[y * w + x] = value; });
+        }
     }
 
     if (!batch_mode)
@@ -235,9 +268,7 @@ int main(int argc, char ** argv)
                 {
                     for (int x = 0; x < w; x++)
                     {
-                        SDL_Color rgb;
-                        Uint32    data = getpixel(image, x, y);
-                        SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
+                        SDL_Color rgb = img.color(x, y);
 
                         int tr = 8, tg = 8;
                         if (noise_mode)
@@ -256,6 +287,11 @@ int main(int argc, char ** argv)
                             green = 0;
                         else if (green > 15)
                             green = 15;
+                        if (dithered.size())
+                        {
+                            red   = (dithered[y * w + x] >> 8) & 0xf;
+                            green = (dithered[y * w + x] >> 4) & 0xf;
+                        }
 
                         fputc(red << 4 | green, fp8);
                     }
@@ -264,9 +300,7 @@ int main(int argc, char ** argv)
                         int lastblue = 0;
                         for (int x = 0; x < w; x++)
                         {
-                            SDL_Color rgb;
-                            Uint32    data = getpixel(image, x, y);
-                            SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
+                            SDL_Color rgb = img.color(x, y);
 
                             int tb = 8;
                             if (noise_mode)
@@ -279,6 +313,10 @@ int main(int argc, char ** argv)
                                 blue = 0;
                             if (blue > 15)
                                 blue = 15;
+                            if (dithered.size())
+                            {
+                                blue = dithered[y * w + x] & 0xf;
+                            }
 
                             if (x & 1)
                             {
@@ -314,9 +352,7 @@ int main(int argc, char ** argv)
                     int lastblue = 0;
                     for (int x = 0; x < w; x++)
                     {
-                        SDL_Color rgb;
-                        Uint32    data = getpixel(image, x, y);
-                        SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
+                        SDL_Color rgb = img.color(x, y);
 
                         int tb = 8;
                         if (noise_mode)
@@ -329,6 +365,10 @@ int main(int argc, char ** argv)
                             blue = 0;
                         if (blue > 15)
                             blue = 15;
+                        if (dithered.size())
+                        {
+                            blue = dithered[y * w + x] & 0xf;
+                        }
 
                         if (x & 1)
                         {
@@ -393,35 +433,3 @@ int main(int argc, char ** argv)
 
     return 0;
 }
-
-Uint32 getpixel(SDL_Surface * surface, int x, int y)
-{
-    int bpp = surface->format->BytesPerPixel;
-    /* Here p is the address to the pixel we want to retrieve */
-    Uint8 * p = (Uint8 *)surface->pixels + y * surface->pitch + x * bpp;
-
-    switch (bpp)
-    {
-        case 1:
-            return *p;
-            break;
-
-        case 2:
-            return *(Uint16 *)p;
-            break;
-
-        case 3:
-            if (SDL_BYTEORDER == SDL_BIG_ENDIAN)
-                return p[0] << 16 | p[1] << 8 | p[2];
-            else
-                return p[0] | p[1] << 8 | p[2] << 16;
-            break;
-
-        case 4:
-            return *(Uint32 *)p;
-            break;
-
-        default:
-            return 0; /* shouldn't happen, but avoids warnings */
-    }
-}
@@ -0,0 +1,559 @@
+// Xosera audio sample bank converter
+// See top-level LICENSE file for license information. (Hint: MIT)
+// vim: set et ts=4 sw=4
+//
+// Converts WAV files and MOD file samples to Xosera 8-bit signed PCM words (two samples per word, first sample in
+// the high byte), ready to upload to VRAM and play with audio DMA, so no sample conversion is needed on the 68K.
+//
+// Samples are resampled to the requested rate with a Kaiser windowed sinc filter (band-limited to the lower of the
+// two rates).  Xosera plays whole words, so looped samples are resampled at a slightly adjusted rate that makes the
+// loop an even number of samples, the loop start is moved to a word boundary, and filtering wraps around the loop so
+// the loop point is seamless.
+//
+// Output is one bank file of big-endian words: a header, one entry per sample with values for the AUDx_START,
+// AUDx_LENGTH, AUDx_PERIOD and AUDx_VOL registers, then the sample words (to upload to VRAM at the -a address).
+//
+//   header:  XSB_MAGIC, XSB_VERSION, number of samples, sample data words
+//   entry:   start (VRAM address), length (words - 1, AUDx_LENGTH), loop start (VRAM address), loop length
+//            (words - 1, 0xFFFF if not looped), period at 640x480 clock, period at 848x480 clock, volume (L/R),
+//            MOD finetune
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../xosera_m68k_api/xosera_m68k_defs.h"        // for AUDIO_PERIOD_HZ_640 and AUDIO_PERIOD_HZ_848
+#include "xosera_mmap.h"
+
+#define XSB_MAGIC       0x5853              // "XS"
+#define XSB_VERSION     0x4201              // "B" + version 1
+#define XSB_HEADER      4                   // header words
+#define XSB_ENTRY       8                   // words per sample entry
+#define MOD_RATE        8287.0              // MOD sample rate for C-2 (PAL Amiga period 428)
+#define MAX_WORDS       0x8000              // AUDx_LENGTH is 15-bit words - 1
+#define SINC_ZEROS      16                  // sinc filter zero crossings each side
+#define SINC_PHASES     256                 // filter table phases (linear interpolation between)
+#define KAISER_BETA     8.0                 // Kaiser window shape (about 80dB stopband)
+
+// decoded sample (mono, -1.0 to 1.0)
+struct sample_t
+{
+    std::string        name;
+    std::vector<float> pcm;
+    double             rate       = 0.0;
+    long               loop_start = -1;        // in samples (-1 if not looped)
+    long               loop_end   = -1;        // exclusive
+    int                volume     = 0x80;      // 0x80 = 100%
+    int                finetune   = 0;         // MOD finetune (-8 to 7)
+};
+
+// converted sample (8-bit signed bytes, even length)
+struct converted_t
+{
+    std::vector<int8_t> data;
+    double              rate       = 0.0;
+    long                loop_start = -1;        // in samples (even, -1 if not looped)
+};
+
+const char * out_file    = nullptr;
+double       target_rate = 0.0;               // 0 = keep source rate
+int          vram_addr   = 0x0000;            // VRAM address of sample data
+bool         add_dither  = false;             // TPDF dither when reducing to 8-bit
+bool         normalize   = false;             // scale each sample to full range
+long         loop_opt[2] = {-1, -1};          // loop start, end for WAV files without smpl loop
+bool         verbose     = false;
+
+static void help()
+{
+    printf("xosera_audio: Convert WAV/MOD samples to Xosera 8-bit audio sample bank\n");
+    printf("Usage:  xosera_audio [options ...] <out_bank.raw> <input_files ...>\n");
+    printf("Options:\n");
+    printf(" -r n   Resample to n Hz (default source rate, MOD samples %.0f Hz)\n", MOD_RATE);
+    printf(" -a n   VRAM address sample data will be uploaded to (default 0x0000)\n");
+    printf(" -l s,e Loop WAV from sample s to e (exclusive, if no WAV smpl loop)\n");
+    printf(" -d     Dither (TPDF) when reducing to 8-bit\n");
+    printf(" -n     Normalize each sample to full range\n");
+    printf(" -v     Verbose (list each sample)\n");
+    printf("Input files: WAV (8/16/24/32-bit PCM or float, smpl loop used) or MOD (31 sample)\n");
+
+    exit(EXIT_FAILURE);
+}
+
+static inline uint32_t le16(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline uint32_t be16(const uint8_t * p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+// load WAV (PCM or float, channels mixed to mono, smpl chunk loop)
+static bool load_wav(const char * file_name, const xosera_mmap_in & in, std::vector<sample_t> & samples)
+{
+    const uint8_t * p   = in.data;
+    size_t          len = in.size;
+    if (len < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0)
+    {
+        printf("*** \"%s\" is not a WAV file\n", file_name);
+        return false;
+    }
+
+    int             format = 0, channels = 0, bits = 0;
+    double          rate = 0.0;
+    const uint8_t * data = nullptr;
+    size_t          data_len = 0;
+    sample_t        s;
+    s.name = file_name;
+
+    for (size_t pos = 12; pos + 8 <= len;)
+    {
+        const uint8_t * chunk = p + pos;
+        size_t          size  = std::min<size_t>(le32(chunk + 4), len - pos - 8);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16)
+        {
+            format   = le16(chunk + 8);
+            channels = le16(chunk + 10);
+            rate     = le32(chunk + 12);
+            bits     = le16(chunk + 22);
+            if (format == 0xFFFE && size >= 40)        // WAVE_FORMAT_EXTENSIBLE (sub-format GUID starts with format)
+            {
+                format = le16(chunk + 32);
+            }
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            data     = chunk + 8;
+            data_len = size;
+        }
+        else if (memcmp(chunk, "smpl", 4) == 0 && size >= 36 + 24 && le32(chunk + 8 + 28) > 0)
+        {
+            s.loop_start = le32(chunk + 8 + 36 + 8);
+            s.loop_end   = static_cast<long>(le32(chunk + 8 + 36 + 12)) + 1;        // smpl end is inclusive
+        }
+        pos += 8 + size + (size & 1);
+    }
+
+    bool pcm_ok   = format == 1 && bits >= 8 && bits <= 32 && !(bits & 7);
+    bool float_ok = format == 3 && bits == 32;
+    if (!data || channels < 1 || !(pcm_ok || float_ok))
+    {
+        printf("*** \"%s\" unsupported WAV format (need 8/16/24/32-bit PCM or 32-bit float)\n", file_name);
+        return false;
+    }
+
+    int    bytes  = bits / 8;
+    size_t frames = data_len / (bytes * channels);
+    s.rate        = rate;
+    s.pcm.resize(frames);
+    for (size_t f = 0; f < frames; f++)
+    {
+        double sum = 0.0;
+        for (int c = 0; c < channels; c++)
+        {
+            const uint8_t * v = data + (f * channels + c) * bytes;
+            if (format == 3)
+            {
+                uint32_t u = le32(v);
+                float    fv;
+                memcpy(&fv, &u, sizeof(fv));
+                sum += fv;
+            }
+            else if (bytes == 1)
+            {
+                sum += (v[0] - 128) / 128.0;        // 8-bit WAV is unsigned
+            }
+            else
+            {
+                int32_t iv = 0;
+                for (int b = 0; b < bytes; b++)
+                {
+                    iv |= v[b] << (32 - bytes * 8 + b * 8);
+                }
+                sum += iv / 2147483648.0;
+            }
+        }
+        s.pcm[f] = static_cast<float>(sum / channels);
+    }
+
+    if (s.loop_start < 0 && loop_opt[0] >= 0)
+    {
+        s.loop_start = loop_opt[0];
+        s.loop_end   = loop_opt[1] > loop_opt[0] ? loop_opt[1] : static_cast<long>(frames);
+    }
+    if (s.loop_start >= 0 && (s.loop_end > static_cast<long>(frames) || s.loop_end - s.loop_start < 2))
+    {
+        printf("WARNING: \"%s\" loop %ld-%ld outside of sample, not looped\n", file_name, s.loop_start, s.loop_end);
+        s.loop_start = s.loop_end = -1;
+    }
+
+    samples.push_back(s);
+    return true;
+}
+
+// load every non-empty sample from 31 sample MOD file
+static bool load_mod(const char * file_name, const xosera_mmap_in & in, std::vector<sample_t> & samples)
+{
+    const uint8_t * p = in.data;
+    if (in.size < 1084)
+    {
+        printf("*** \"%s\" is not a MOD file\n", file_name);
+        return false;
+    }
+
+    int channels = 4;
+    if (memcmp(p + 1080, "6CHN", 4) == 0)
+        channels = 6;
+    else if (memcmp(p + 1080, "8CHN", 4) == 0)
+        channels = 8;
+    else if (memcmp(p + 1080, "M.K.", 4) != 0 && memcmp(p + 1080, "M!K!", 4) != 0 &&
+             memcmp(p + 1080, "FLT4", 4) != 0 && memcmp(p + 1080, "4CHN", 4) != 0)
+    {
+        printf("*** \"%s\" is not a 31 sample MOD file (unrecognized signature)\n", file_name);
+        return false;
+    }
+
+    int num_patterns = 0;
+    for (int i = 0; i < 128; i++)
+    {
+        num_patterns = std::max(num_patterns, p[952 + i] + 1);
+    }
+
+    size_t pos = 1084 + static_cast<size_t>(num_patterns) * 64 * channels * 4;
+    for (int i = 0; i < 31; i++)
+    {
+        const uint8_t * hdr    = p + 20 + i * 30;
+        size_t          length = be16(hdr + 22) * 2;        // lengths and loop are in words
+        size_t          repeat = be16(hdr + 26) * 2;
+        size_t          replen = be16(hdr + 28) * 2;
+        if (!length)
+        {
+            continue;
+        }
+        if (pos + length > in.size)
+        {
+            printf("WARNING: \"%s\" sample %d truncated\n", file_name, i + 1);
+            length = pos < in.size ? in.size - pos : 0;
+        }
+
+        sample_t s;
+        char     name[23] = {};
+        memcpy(name, hdr, 22);
+        s.name     = std::string(file_name) + ":" + std::to_string(i + 1) + (name[0] ? " " + std::string(name) : "");
+        s.rate     = MOD_RATE;
+        s.volume   = std::min<int>(hdr[25], 64) * 2;
+        s.finetune = (hdr[24] & 0x8) ? (hdr[24] & 0xf) - 16 : hdr[24] & 0x7;
+        for (size_t b = 0; b < length; b++)
+        {
+            s.pcm.push_back(static_cast<int8_t>(p[pos + b]) / 128.0f);
+        }
+        if (replen > 2 && repeat + replen <= length)
+        {
+            s.loop_start = static_cast<long>(repeat);
+            s.loop_end   = static_cast<long>(repeat + replen);
+        }
+        pos += be16(hdr + 22) * 2;
+
+        samples.push_back(s);
+    }
+
+    return true;
+}
+
+// zeroth order modified Bessel function (for Kaiser window)
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// resample to rate (loop made an even number of samples starting on a word) and reduce to 8-bit
+static converted_t convert_sample(const sample_t & s, double rate, std::minstd_rand & rng)
+{
+    converted_t out;
+    bool        looped = s.loop_start >= 0;
+    double      ratio  = rate / s.rate;
+    long        pad    = 0;        // output samples before source start (to put loop start on a word)
+    long        length = 0;
+
+    if (looped)
+    {
+        long loop_len  = s.loop_end - s.loop_start;
+        long out_loop  = std::max(2L, 2 * lround(loop_len * ratio / 2.0));
+        ratio          = static_cast<double>(out_loop) / loop_len;
+        long out_start = lround(s.loop_start * ratio);
+        pad            = out_start & 1;
+        out.loop_start = out_start + pad;
+        length         = out.loop_start + out_loop;        // nothing after the loop is ever played
+    }
+    else
+    {
+        length = (lround(s.pcm.size() * ratio) + 1) & ~1L;
+    }
+    out.rate = s.rate * ratio;
+
+    // source sample, wrapping past loop end back to loop start (so filtering across the loop point is seamless)
+    long n      = static_cast<long>(s.pcm.size());
+    auto source = [&](long i) -> float {
+        if (looped && i >= s.loop_end)
+        {
+            i = s.loop_start + (i - s.loop_end) % (s.loop_end - s.loop_start);
+        }
+        return i >= 0 && i < n ? s.pcm[i] : 0.0f;
+    };
+
+    std::vector<float> pcm(length);
+    if (fabs(ratio - 1.0) < 1e-9)
+    {
+        for (long i = 0; i < length; i++)
+        {
+            pcm[i] = source(i - pad);
+        }
+    }
+    else
+    {
+        // windowed sinc table (one side, SINC_PHASES per zero crossing), scaled to lower cutoff when downsampling
+        double             cutoff = std::min(1.0, ratio);
+        int                table  = SINC_ZEROS * SINC_PHASES;
+        std::vector<float> sinc(table + 2, 0.0f);
+        double             i0beta = bessel_i0(KAISER_BETA);
+        for (int t = 0; t <= table; t++)
+        {
+            double x = static_cast<double>(t) / SINC_PHASES;
+            double w = bessel_i0(KAISER_BETA * sqrt(std::max(0.0, 1.0 - (x / SINC_ZEROS) * (x / SINC_ZEROS)))) / i0beta;
+            sinc[t]  = static_cast<float>((t ? sin(M_PI * x) / (M_PI * x) : 1.0) * w);
+        }
+        auto kernel = [&](double x) {
+            double pos = fabs(x) * SINC_PHASES;
+            int    i   = static_cast<int>(pos);
+            if (i >= table)
+            {
+                return 0.0f;
+            }
+            float f = static_cast<float>(pos - i);
+            return sinc[i] + (sinc[i + 1] - sinc[i]) * f;
+        };
+
+        double radius = SINC_ZEROS / cutoff;        // source samples each side
+        for (long i = 0; i < length; i++)
+        {
+            double center = (i - pad) / ratio;
+            long   first  = static_cast<long>(ceil(center - radius));
+            long   last   = static_cast<long>(floor(center + radius));
+            double sum    = 0.0;
+            for (long j = first; j <= last; j++)
+            {
+                sum += source(j) * kernel((j - center) * cutoff);
+            }
+            pcm[i] = static_cast<float>(sum * cutoff);
+        }
+    }
+
+    float scale = 127.0f;
+    if (normalize)
+    {
+        float peak = 0.0f;
+        for (float v : pcm)
+        {
+            peak = std::max(peak, fabsf(v));
+        }
+        scale = peak > 0.0f ? 127.0f / peak : scale;
+    }
+
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    out.data.resize(length);
+    for (long i = 0; i < length; i++)
+    {
+        float v     = pcm[i] * scale + (add_dither ? noise(rng) + noise(rng) : 0.0f);
+        out.data[i] = static_cast<int8_t>(std::clamp(lrintf(v), -128L, 127L));
+    }
+
+    return out;
+}
+
+static uint16_t period_for(double clk_hz, double rate)
+{
+    return static_cast<uint16_t>(std::clamp(lround(clk_hz / rate), 1L, 0x7FFFL));
+}
+
+int main(int argc, char ** argv)
+{
+    std::vector<const char *> files;
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (argv[a][0] == '-')
+        {
+            if (strcmp("-r", argv[a]) == 0 && a + 1 < argc)
+            {
+                target_rate = atof(argv[++a]);
+            }
+            else if (strcmp("-a", argv[a]) == 0 && a + 1 < argc)
+            {
+                vram_addr = static_cast<int>(strtoul(argv[++a], nullptr, 0));
+            }
+            else if (strcmp("-l", argv[a]) == 0 && a + 1 < argc)
+            {
+                if (sscanf(argv[++a], "%ld,%ld", &loop_opt[0], &loop_opt[1]) < 1)
+                {
+                    printf("Error: Bad loop \"%s\" (expected start,end)\n", argv[a]);
+                    help();
+                }
+            }
+            else if (strcmp("-d", argv[a]) == 0)
+            {
+                add_dither = true;
+            }
+            else if (strcmp("-n", argv[a]) == 0)
+            {
+                normalize = true;
+            }
+            else if (strcmp("-v", argv[a]) == 0)
+            {
+                verbose = true;
+            }
+            else
+            {
+                printf("Unexpected option: '%s'\n", argv[a]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!out_file)
+        {
+            out_file = argv[a];
+        }
+        else
+        {
+            files.push_back(argv[a]);
+        }
+    }
+
+    if (!out_file || files.empty())
+    {
+        help();
+    }
+
+    std::vector<sample_t> samples;
+    for (auto f : files)
+    {
+        xosera_mmap_in in;
+        if (!in.open(f))
+        {
+            exit(EXIT_FAILURE);
+        }
+        size_t len = strlen(f);
+        bool   mod = len > 4 && strcasecmp(f + len - 4, ".mod") == 0;
+        if (!(mod ? load_mod(f, in, samples) : load_wav(f, in, samples)))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // convert every sample and build bank entries
+    std::minstd_rand      rng(1);
+    std::vector<uint16_t> entries;
+    std::vector<int8_t>   data;
+    size_t                source_bytes = 0;
+    for (auto & s : samples)
+    {
+        converted_t c     = convert_sample(s, target_rate > 0.0 ? target_rate : s.rate, rng);
+        size_t      words = c.data.size() / 2;
+        if (words == 0 || words > MAX_WORDS)
+        {
+            printf("*** \"%s\" is %zu words (must be 1 to %d words for AUDx_LENGTH)\n",
+                   s.name.c_str(),
+                   words,
+                   MAX_WORDS);
+            exit(EXIT_FAILURE);
+        }
+
+        uint16_t start = static_cast<uint16_t>(vram_addr + data.size() / 2);
+        entries.push_back(start);
+        entries.push_back(static_cast<uint16_t>(words - 1));
+        entries.push_back(c.loop_start >= 0 ? static_cast<uint16_t>(start + c.loop_start / 2) : start);
+        entries.push_back(c.loop_start >= 0 ? static_cast<uint16_t>(words - c.loop_start / 2 - 1) : 0xFFFF);
+        entries.push_back(period_for(AUDIO_PERIOD_HZ_640, c.rate));
+        entries.push_back(period_for(AUDIO_PERIOD_HZ_848, c.rate));
+        entries.push_back(static_cast<uint16_t>((s.volume << 8) | s.volume));
+        entries.push_back(static_cast<uint16_t>(s.finetune));
+        data.insert(data.end(), c.data.begin(), c.data.end());
+        source_bytes += s.pcm.size();
+
+        if (verbose)
+        {
+            printf("%3zu: %-40.40s %6zu words @ 0x%04x  %8.1f Hz (PERIOD %u/%u)",
+                   entries.size() / XSB_ENTRY - 1,
+                   s.name.c_str(),
+                   words,
+                   start,
+                   c.rate,
+                   entries[entries.size() - 4],
+                   entries[entries.size() - 3]);
+            if (c.loop_start >= 0)
+            {
+                printf("  loop @ 0x%04x %zu words", entries[entries.size() - 6], words - c.loop_start / 2);
+            }
+            printf("\n");
+        }
+    }
+
+    size_t data_words = data.size() / 2;
+    if (vram_addr + data_words > 0x10000)
+    {
+        printf("*** %zu words of samples at VRAM 0x%04x will not fit in Xosera 128KB VRAM\n", data_words, vram_addr);
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<uint16_t> bank = {XSB_MAGIC,
+                                  XSB_VERSION,
+                                  static_cast<uint16_t>(samples.size()),
+                                  static_cast<uint16_t>(data_words)};
+    bank.insert(bank.end(), entries.begin(), entries.end());
+
+    xosera_mmap_out out;
+    if (!out.create(out_file, bank.size() * 2 + data.size()))
+    {
+        exit(EXIT_FAILURE);
+    }
+    uint8_t * wp = out.data;
+    for (auto w : bank)
+    {
+        *wp++ = w >> 8;
+        *wp++ = w & 0xff;
+    }
+    memcpy(wp, data.data(), data.size());        // bytes are already in play order (high byte first)
+    if (!out.close())
+    {
+        printf("*** Error writing output file \"%s\"\n", out_file);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Wrote \"%s\": %zu samples, %zu header words, %zu sample words for VRAM 0x%04x (from %zu source samples)\n",
+           out_file,
+           samples.size(),
+           bank.size(),
+           data_words,
+           vram_addr,
+           source_bytes);
+
+    return EXIT_SUCCESS;
+}
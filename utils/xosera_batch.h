@@ -0,0 +1,65 @@
+// Batch job pool shared by Xosera utilities
+// See top-level LICENSE file for license information. (Hint: MIT)
+//
+// xosera_batch() runs a job for each input (e.g., one image file) on a pool of threads.  Each job writes its output
+// to its own log string, and logs are printed in input order as soon as a job and all jobs before it are done, so
+// output reads the same as a single threaded run.
+#pragma once
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// threads used for count jobs (requested <= 0 for one per CPU)
+inline int xosera_batch_threads(size_t count, int requested = 0)
+{
+    int threads = requested > 0 ? requested : static_cast<int>(std::thread::hardware_concurrency());
+    return std::clamp(threads, 1, static_cast<int>(std::max<size_t>(count, 1)));
+}
+
+// run fn(job, log) for jobs 0 to count-1 (fn returns false on failure), returns number of failed jobs
+template <typename F>
+int xosera_batch(size_t count, int threads, F fn)
+{
+    threads = xosera_batch_threads(count, threads);
+
+    std::vector<std::string> logs(count);
+    std::vector<char>        results(count, 0);
+    std::vector<char>        done(count, 0);
+    std::atomic<size_t>      next_job(0);
+    std::mutex               print_mutex;
+    size_t                   next_print = 0;
+
+    auto worker = [&]() {
+        for (size_t j = next_job++; j < count; j = next_job++)
+        {
+            results[j] = fn(j, logs[j]);
+
+            std::lock_guard<std::mutex> lock(print_mutex);
+            done[j] = true;
+            while (next_print < count && done[next_print])
+            {
+                printf("%s\n", logs[next_print++].c_str());
+            }
+            fflush(stdout);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto & t : pool)
+    {
+        t.join();
+    }
+
+    return static_cast<int>(std::count(results.begin(), results.end(), 0));
+}
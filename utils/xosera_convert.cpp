@@ -1,431 +1,2198 @@
 // Xosera PNG conversion utility (aka cruncher)
 // See top-level LICENSE file for license information. (Hint: MIT)
 // vim: set et ts=4 sw=4
+//
+// Each input image is decoded once into memory, converted for the selected mode and then written to every
+// requested output format (so one run replaces chaining true_color_hack, image_to_mem, pal_to_raw etc.).  With -o
+// many input images can be converted in one run, using a thread per CPU.
 
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
+#include <strings.h>
 #include <time.h>
 
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <SDL.h>
 #include <SDL_image.h>
 
-bool display_pic = false;
-bool add_noise = false;
-bool interleave_RG_B = false;
-bool write_palette = false;
+#include "xosera_batch.h"
+#include "xosera_dither.h"
+#include "xosera_image.h"
+#include "xosera_mmap.h"
+#include "xosera_palette.h"
+#include "xosera_quant.h"
+
+bool               display_pic     = false;
+bool               add_noise       = false;
+bool               interleave_RG_B = false;
+bool               write_palette   = false;
+bool               opt_palette     = false;
+bool               out_raw         = false;
+bool               out_ch          = false;
+bool               out_as          = false;
+bool               out_memh        = false;
+int                num_colors      = 16;
+xosera_dither_mode dither_mode     = XOSERA_DITHER_NONE;
+int                font_height     = 0;        // 0 = auto-detect
+const char *       glyph_ranges    = nullptr;  // font subset glyph codes (e.g., "32-126,0xA9")
+const char *       glyph_text      = nullptr;  // font subset of glyphs used in text file
+bool               glyph_widths    = false;    // write proportional glyph width table
+int                glyph_base      = 0;        // tile index of first subset glyph (for remap table)
+bool               preshift        = false;    // cut images pre-shifted for each nibble shift (with blit table)
+int                dest_line_words = 80;       // destination line length for preshift MOD_D
+int                vram_addr       = 0;        // VRAM address of animation frame bitmap
+int                num_threads     = 0;        // 0 = one per CPU
+bool               row_threads     = true;     // convert image rows in parallel (unless converting files in parallel)
+
+#define NOISE_MOD 13        // r = rand % NOISE_MOD
+#define NOISE_SUB 6         // n = r - NOISE_SUB
+
+#define DELTA_MAX_RUN   0xffff        // maximum words in one animation delta record
+#define DELTA_MERGE_GAP 1             // unchanged words sent to join two runs (1 word gap is 2 bus bytes like a new
+                                      // record WR_ADDR write, but 2 stream bytes instead of a 4 byte record header)
+
+// NOTE: keep in sync with xosera_m68k_api.h xosera_blit_list()
+#define XR_BLIT_REGS   0x40          // XR_BLIT_CTRL, first of the blitter registers
+#define BLIT_REGS      10            // XR_BLIT_CTRL to XR_BLIT_WORDS (written last, starts blit)
+#define BLIT_LIST_WAIT 0x8000        // blit list run flag, wait for blitter ready (first run of each blit)
+
+// default 16 color palette (same as image_pal)
+const uint16_t default_pal16[16] = {0x0000,
+                                    0x000A,
+                                    0x00A0,
+                                    0x00AA,
+                                    0x0A00,
+                                    0x0A0A,
+                                    0x0AA0,
+                                    0x0AAA,
+                                    0x0555,
+                                    0x055F,
+                                    0x05F5,
+                                    0x05FF,
+                                    0x0F55,
+                                    0x0F5F,
+                                    0x0FF5,
+                                    0x0FFF};
+
+enum convert_mode
+{
+    MODE_FONT,
+    MODE_BITMAP,
+    MODE_CUT,
+    MODE_TILE,
+    MODE_ANIM,
+    MODE_SCENE,
+    MODE_PAL
+};
+
+// decoded input image (read once, used for every output)
+struct image_t
+{
+    std::string           name;            // input file name
+    int                   w = 0;
+    int                   h = 0;
+    std::vector<uint32_t> rgb;             // 0x00RRGGBB per pixel
+    std::vector<uint8_t>  index;           // palette index per pixel (if indexed image)
+    std::vector<uint16_t> palette;         // RGB444 palette (if indexed image)
+    std::vector<int>      advance;         // font glyph advance widths (if BDF font)
+
+    uint32_t pixel(int x, int y) const
+    {
+        return rgb[y * w + x];
+    }
+};
+
+// converted data for one output file (written in each requested format)
+struct output_t
+{
+    std::string          suffix;                 // appended to output basename (e.g., "_pal")
+    std::string          desc;                   // description for comments
+    std::vector<uint8_t> data;                   // big-endian bytes (padded to whole words when written)
+    int                  width_words = 0;        // words per line (0 if not an image)
+    int                  height      = 0;        // lines (0 if not an image)
+};
 
 static void help()
 {
     printf("xosera_convert: PNG to various Xosera image formats\n");
     printf("Usage:  xosera_convert [options ...] <mode> <input_file> <out_basename>\n");
+    printf("        xosera_convert [options ...] -o <out_dir> <mode> <input_files ...>\n");
+    printf("        xosera_convert [options ...] anim <frame_files ...> <out_basename>\n");
+    printf("        xosera_convert [options ...] scene <scene_file> <out_basename>\n");
     printf("Options:\n");
-    printf(" -c     Number of colors (2, 16, 256 or 4096)\n");
-    printf(" -d     Display input and output images\n");
+    printf(" -c n   Number of colors (2, 16, 256 or 4096, default 16)\n");
+    printf(" -d     Display input image\n");
     printf(" -i     Interleave RG and B with 4096 colors\n");
+    printf(" -D x   Dither with fs (Floyd-Steinberg), atkinson or bayer (default none)\n");
+    printf(" -m     Generate optimized palette for image (median cut + k-means, 16 or 256 colors)\n");
     printf(" -n     Add random noise to reduce 12-bit color banding\n");
     printf(" -p     Also write out colormem palette file\n");
+    printf(" -s     Pre-shift cut images to every nibble alignment (with blit register table)\n");
+    printf(" -l n   Destination line length in words for pre-shift or scene MOD_D (default 80)\n");
+    printf(" -a n   VRAM address of anim frame bitmap or scene images (default 0x0000)\n");
+    printf(" -8     Font is 8x8 (default auto-detect)\n");
+    printf(" -16    Font is 8x16 (default auto-detect)\n");
+    printf(" -g r   Font subset of glyph codes r (e.g., 32-126,0xA9), writes glyph remap table\n");
+    printf(" -G f   Font subset of glyphs used in text file f, writes glyph remap table\n");
+    printf(" -b n   Tile index of first subset glyph in remap table (default 0)\n");
+    printf(" -w     Write font glyph width table (for proportional text)\n");
+    printf(" -o dir Batch convert input files (output basenames are input names in <dir>)\n");
+    printf(" -j n   Number of batch threads (default one per CPU)\n");
     printf(" -raw   Output raw headerless binary (*default)\n");
     printf(" -ch    Output C source/header file\n");
     printf(" -as    Output asm source file\n");
     printf(" -memh  Output Verilog hex memory file (16-bit width)\n");
     printf("Conversion mode : <mode>\n");
-    printf(" font   Convert PNG to font\n");
+    printf(" font   Convert PNG (or BDF) to font\n");
     printf(" bitmap Convert PNG to bitmap image\n");
     printf(" cut    Convert PNG with outlined images to blit images\n");
+    printf(" tile   Convert PNG to unique 8x8 tiles (8x16 with -c 2 -16) and tilemap\n");
+    printf(" anim   Convert PNG frames (in order) to bitmap VRAM delta update stream\n");
+    printf(" scene  Convert scene file images to VRAM and compile blits placing them into blit list\n");
+    printf("        (scene file lines: <image_file> <x> <y> [transparent_color] or dest <vram_addr> <line_words>)\n");
     printf(" pal    Write out palette (use -c to specify colors)\n");
     printf("Input file:   <input_file> (PNG format)\n");
     printf("Output base name: <out_basename>\n");
+    printf("Decoded images are cached in ~/.cache/xosera (XOSERA_IMAGE_CACHE=<dir>, or 0 to disable)\n");
 
     exit(EXIT_FAILURE);
 }
 
-inline Uint32 getpixel(SDL_Surface * surface, int x, int y)
+// print to log string (output for each image is printed together, even when converting in parallel)
+static void log_printf(std::string & log, const char * fmt, ...) __attribute__((format(printf, 2, 3)));
+static void log_printf(std::string & log, const char * fmt, ...)
 {
-    int bpp = surface->format->BytesPerPixel;
-    /* Here p is the address to the pixel we want to retrieve */
-    Uint8 * p = (Uint8 *)surface->pixels + y * surface->pitch + x * bpp;
+    char    buf[4096];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    log += buf;
+}
 
-    switch (bpp)
+// decode image file into memory as RGB888 (and palette indices if indexed)
+static bool load_image(const char * file_name, image_t & img, std::string & log)
+{
+    xosera_image src;
+    std::string  error;
+    if (!xosera_image_load(file_name, src, error))
     {
-        case 1:
-            return *p;
-            break;
-
-        case 2:
-            return *(Uint16 *)p;
-            break;
+        log_printf(log, "*** %s\n", error.c_str());
+        return false;
+    }
 
-        case 3:
-            return p[0] | p[1] << 8 | p[2] << 16;
-            break;
+    img.name = file_name;
+    img.w    = src.w;
+    img.h    = src.h;
+    img.rgb  = std::move(src.argb);
+    for (auto & p : img.rgb)
+    {
+        p &= 0xffffff;
+    }
+    img.index = std::move(src.index);
+    for (auto c : src.palette)
+    {
+        img.palette.push_back(((c >> 12) & 0xf00) | ((c >> 8) & 0x0f0) | ((c >> 4) & 0x00f));
+    }
 
-        case 4:
-            return *(Uint32 *)p;
-            break;
+    log_printf(log,
+               "Input image \"%s\": %d x %d%s%s\n",
+               file_name,
+               img.w,
+               img.h,
+               img.index.size() ? " (indexed)" : "",
+               src.cached ? " (cached)" : "");
 
-        default:
-            return 0; /* shouldn't happen, but avoids warnings */
-    }
+    return true;
 }
 
-int main(int argc, char ** argv)
+// render BDF bitmap font as 16 x 16 grid of 8 pixel wide glyph cells (by ENCODING 0-255, clipped to 8 x cell
+// height with the baseline at FONT_ASCENT), keeping each glyph DWIDTH for proportional width
+static bool load_bdf(const char * file_name, image_t & img, std::string & log)
 {
-    bool quit = false;
-    char *mode = nullptr;
-    char *in_file = nullptr;
-    char *out_basename = nullptr;
-
-    if (argc == 1)
+    xosera_mmap_in in;
+    std::string    error;
+    if (!in.open(file_name, &error))
     {
-        help();
+        log_printf(log, "*** %s\n", error.c_str());
+        return false;
     }
 
-    for (int a = 1; a < argc; a++)
+    const char * ptr      = reinterpret_cast<const char *>(in.data);
+    const char * end      = ptr + in.size;
+    int          fbb_h    = 0;
+    int          fbb_y    = 0;
+    int          ascent   = -1;
+    int          encoding = -1;
+    int          dwidth   = 0;
+    int          bbx[4]   = {};
+    int          row      = -1;        // BITMAP row (-1 if not in bitmap)
+    int          glyphs   = 0;
+
+    auto cell_height = [&]() { return font_height ? font_height : fbb_h <= 8 ? 8 : 16; };
+
+    while (ptr < end)
     {
-        if (argv[a][0] == '-')
+        const char * eol = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+        std::string  line(ptr, eol ? eol : end);
+        ptr = eol ? eol + 1 : end;
+
+        if (row >= 0)
         {
-            if (strcmp("-n", argv[a]) == 0)
+            if (line.compare(0, 7, "ENDCHAR") == 0)
             {
-                add_noise = true;
-            }
-            else if (strcmp("-b", argv[a]) == 0)
-            {
-                display_pic = true;
-            }
-            else if (strcmp("-i", argv[a]) == 0)
-            {
-                interleave_RG_B = true;
+                row = -1;
+                glyphs += encoding >= 0 && encoding < 256;
+                continue;
             }
-            else if (strcmp("-p", argv[a]) == 0)
+            int fh  = cell_height();
+            int top = (ascent >= 0 ? ascent : fbb_h + fbb_y) - (bbx[1] + bbx[3]);        // cell row of glyph top
+            int y   = top + row++;
+            if (encoding < 0 || encoding > 255 || y < 0 || y >= fh)
             {
-                write_palette = true;
+                continue;
             }
-            else
+            // decode row a hex digit at a time (rows can be wider than any integer type)
+            int nb = static_cast<int>(line.find_first_not_of("0123456789abcdefABCDEF")) * 4;
+            nb     = nb < 0 ? static_cast<int>(line.size()) * 4 : nb;
+            for (int x = 0; x < bbx[0] && x < nb; x++)
             {
-                printf("Unexpected option: '%s'\n", argv[a]);
-                exit(EXIT_FAILURE);
+                int cx     = bbx[2] + x;
+                int digit  = line[x / 4];
+                int nibble = isdigit(digit) ? digit - '0' : (tolower(digit) - 'a' + 10);
+                if (cx >= 0 && cx < 8 && (nibble >> (3 - (x & 3))) & 1)
+                {
+                    img.rgb[((encoding / 16) * fh + y) * img.w + (encoding % 16) * 8 + cx] = 0xffffff;
+                }
             }
         }
-        else
+        else if (sscanf(line.c_str(), "FONTBOUNDINGBOX %*d %d %*d %d", &fbb_h, &fbb_y) == 2)
         {
-            if (!mode)
-            {
-                mode = argv[a];
-            }
-            if (!in_file)
-            {
-                in_file = argv[a];
-            }
-            else if (!out_basename)
+        }
+        else if (sscanf(line.c_str(), "FONT_ASCENT %d", &ascent) == 1)
+        {
+        }
+        else if (line.compare(0, 9, "STARTCHAR") == 0)
+        {
+            if (img.rgb.empty())
             {
-                out_basename = argv[a];
+                img.name = file_name;
+                img.w    = 16 * 8;
+                img.h    = 16 * cell_height();
+                img.rgb.assign(img.w * img.h, 0);
+                img.advance.assign(256, -1);
             }
-            else
+            encoding = -1;
+            dwidth   = 8;
+            memset(bbx, 0, sizeof(bbx));
+        }
+        else if (sscanf(line.c_str(), "ENCODING %d", &encoding) == 1)
+        {
+        }
+        else if (sscanf(line.c_str(), "DWIDTH %d", &dwidth) == 1)
+        {
+        }
+        else if (sscanf(line.c_str(), "BBX %d %d %d %d", &bbx[0], &bbx[1], &bbx[2], &bbx[3]) == 4)
+        {
+        }
+        else if (line.compare(0, 6, "BITMAP") == 0)
+        {
+            row = 0;
+            if (encoding >= 0 && encoding < 256)
             {
-                printf("Unexpected extra argument: '%s'\n", argv[a]);
-                exit(EXIT_FAILURE);
+                img.advance[encoding] = dwidth;
             }
         }
     }
 
-    if (!mode)
+    if (img.rgb.empty())
     {
-        printf("Error: A conversion <mode> is required.\n");
-        help();
+        log_printf(log, "*** No glyphs in BDF font \"%s\"\n", file_name);
+        return false;
     }
 
-    if (!in_file)
+    log_printf(log, "Input BDF font \"%s\": %d glyphs in 8x%d cells\n", file_name, glyphs, img.h / 16);
+
+    return true;
+}
+
+// call fn(y) for each image row (in parallel, unless already converting several files in parallel)
+template <typename F>
+static void for_rows(int height, F fn)
+{
+    if (row_threads)
     {
-        printf("Error: An <input_file> is required.\n");
-        help();
+        xosera_parallel_rows(height, fn);
     }
-
-    if (!out_basename)
+    else
     {
-        printf("Error: An <out_basename> is required.\n");
-        help();
+        for (int y = 0; y < height; y++)
+        {
+            fn(y);
+        }
     }
+}
 
-    printf("Input image file     : \"%s\"\n", in_file);
-
-    SDL_Init(SDL_INIT_VIDEO);
-    IMG_Init(IMG_INIT_PNG);
-
-    SDL_Surface * image = IMG_Load(in_file);
+// 8-bit channel to 4-bit with rounding (or random noise to reduce banding)
+static inline int channel4(int v, std::minstd_rand & rng)
+{
+    int t = add_noise ? static_cast<int>(rng() % NOISE_MOD) - NOISE_SUB : 8;
+    return std::clamp((v + t) / 16, 0, 15);
+}
 
-    int w = 0;
-    int h = 0;
+// monochrome pixel (average brightness)
+static inline bool mono_pixel(uint32_t rgb)
+{
+    int v = (((rgb >> 16) & 0xff) + ((rgb >> 8) & 0xff) + (rgb & 0xff)) / 3;
+    return v >= 128;
+}
 
-    if (!image)
+// palette for indexed output of count images (from indexed images when they share a palette that fits, optimized
+// for all images with -m, otherwise default)
+static std::vector<uint16_t> color_palette(const image_t * imgs, size_t count = 1)
+{
+    std::vector<uint16_t> pal;
+    bool                  shared = imgs[0].palette.size() && static_cast<int>(imgs[0].palette.size()) <= num_colors;
+    for (size_t i = 1; i < count && shared; i++)
+    {
+        shared = imgs[i].palette == imgs[0].palette;
+    }
+    if (shared)
+    {
+        pal = imgs[0].palette;
+    }
+    else if (opt_palette)
+    {
+        xosera_palette gen;
+        for (size_t i = 0; i < count; i++)
+        {
+            for (auto rgb : imgs[i].rgb)
+            {
+                gen.add((rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
+            }
+        }
+        pal = gen.generate(num_colors);
+    }
+    else if (num_colors == 16)
     {
-        printf("*** Unable to load \"%s\"\n", in_file);
-        quit = true;
+        pal.assign(default_pal16, default_pal16 + 16);
     }
     else
     {
-        w = image->w;
-        h = image->h;
-        printf("\nInput image size        : %d x %d\n", w, h);
-        // if (!interleave_mode)
-        // {
-        //     printf("Output 8-bpp RG raw size: %6d bytes (%6.1f KB)\n", w * h, (w * h) / 1024.0f);
-        //     printf("Output 4-bpp B  raw size: %6d bytes (%6.1f KB)\n", (w / 2) * h, ((w / 2) * h) / 1024.0f);
-        //     printf("   12-bpp RGB total size: %6d bytes (%6.1f KB)\n",
-        //            ((w * h) + ((w / 2) * h)),
-        //            ((w * h) + ((w / 2) * h)) / 1024.0f);
-        // }
-        // else
-        // {
-        //     printf("Output 12-bpp RG+B raw size: %6d bytes (%6.1f KB)\n",
-        //            ((w * h) + ((w / 2) * h)),
-        //            ((w * h) + ((w / 2) * h)) / 1024.0f);
-        // }
-
-        if (((w * h) + ((w / 2) * h)) > (128 * 1024))
+        for (int i = 0; i < 256; i++)        // RGB 3-3-2
         {
-            printf("\nWARNING: Will not fit in Xosera 128KB VRAM\n");
+            int r = (i >> 5) & 7;
+            int g = (i >> 2) & 7;
+            int b = i & 3;
+            pal.push_back((((r * 15 + 3) / 7) << 8) | (((g * 15 + 3) / 7) << 4) | (b * 5));
         }
     }
+    pal.resize(num_colors, 0);
+    return pal;
+}
 
-    printf("WIP...\n");
-    (void)quit;
-    exit(EXIT_FAILURE);
-#if 0
+// quantize rectangle of image for current number of colors (2 colors 0 or 1, 16 or 256 colors palette index,
+// otherwise 0x0RGB), dithered if requested
+static std::vector<uint16_t> quantize_pixels(const image_t &               img,
+                                             int                           x0,
+                                             int                           y0,
+                                             int                           w,
+                                             int                           h,
+                                             const std::vector<uint16_t> & pal,
+                                             const xosera_quant *          quant)
+{
+    std::vector<uint16_t> pixels(static_cast<size_t>(w) * h);
+    bool                  use_index = img.index.size() && pal == img.palette && num_colors != 2;
 
-    if (!batch_mode)
+    if (use_index)
     {
-        SDL_Window * window = SDL_CreateWindow("SDL2 Displaying Image",
-                                               SDL_WINDOWPOS_CENTERED,
-                                               SDL_WINDOWPOS_CENTERED,
-                                               w < 320 ? 320 + 32 : w + 32,
-                                               h < 240 ? 240 + 32 : h + 32,
-                                               0);
-
-        if (!window)
+        for (int y = 0; y < h; y++)
         {
-            printf("*** Can't open SDL window\n");
-            exit(EXIT_FAILURE);
+            for (int x = 0; x < w; x++)
+            {
+                pixels[y * w + x] = img.index[(y0 + y) * img.w + x0 + x];
+            }
         }
-
-        SDL_Surface * screen = SDL_GetWindowSurface(window);
-        if (!screen)
+    }
+    else if (dither_mode != XOSERA_DITHER_NONE)
+    {
+        auto get = [&](int x, int y) { return img.pixel(x0 + x, y0 + y); };
+        auto put = [&](int x, int y, int value) { pixels[y * w + x] = value; };
+        if (num_colors == 2)
         {
-            printf("*** Can't open SDL window\n");
-            SDL_DestroyWindow(window);
-            SDL_Quit();
+            auto mono = [](int rgb[3]) {
+                int value = (rgb[0] + rgb[1] + rgb[2]) / 3 >= 128;
+                rgb[0] = rgb[1] = rgb[2] = value ? 255 : 0;
+                return value;
+            };
+            xosera_dither(dither_mode, w, h, get, mono, put, 255);
         }
-
-        // process the image
-        if (!quit)
+        else if (num_colors == 4096)
+        {
+            xosera_dither(dither_mode, w, h, get, xosera_dither_rgb444(), put, 17);
+        }
+        else
         {
-            // show image for a moment
-            int spincount = 120;
-            while (!quit)
+            auto nearest = [&](int rgb[3]) {
+                int      ci = quant->nearest(std::min((rgb[0] + 8) / 17, 15),
+                                        std::min((rgb[1] + 8) / 17, 15),
+                                        std::min((rgb[2] + 8) / 17, 15));
+                uint16_t c  = pal[ci];
+                rgb[0]      = ((c >> 8) & 0xf) * 17;
+                rgb[1]      = ((c >> 4) & 0xf) * 17;
+                rgb[2]      = (c & 0xf) * 17;
+                return ci;
+            };
+            xosera_dither(dither_mode, w, h, get, nearest, put, num_colors == 16 ? 64 : 32);
+        }
+    }
+    else
+    {
+        for_rows(h, [&](int y) {
+            std::minstd_rand rng(y + 1);
+            for (int x = 0; x < w; x++)
             {
-                SDL_Rect dstrect;
-                dstrect.x = 16;
-                dstrect.y = 16;
-                dstrect.w = w;
-                dstrect.w = h;
-                SDL_BlitSurface(image, NULL, screen, &dstrect);
-                SDL_UpdateWindowSurface(window);
-
-                SDL_Event event;
-                SDL_PollEvent(&event);
-
-                switch (event.type)
+                uint32_t rgb = img.pixel(x0 + x, y0 + y);
+                int      v   = 0;
+                if (num_colors == 2)
                 {
-                    case SDL_QUIT:
-                        quit = true;
-                        break;
-
-                    case SDL_KEYDOWN:
-                        quit = true;
-                        break;
+                    v = mono_pixel(rgb);
                 }
-
-                SDL_Delay(17);
-                if (--spincount == 0)
+                else
                 {
-                    quit = true;
-                    break;
+                    int r = channel4((rgb >> 16) & 0xff, rng);
+                    int g = channel4((rgb >> 8) & 0xff, rng);
+                    int b = channel4(rgb & 0xff, rng);
+                    v     = num_colors == 4096 ? (r << 8 | g << 4 | b) : quant->nearest(r, g, b);
                 }
+                pixels[y * w + x] = v;
             }
+        });
+    }
 
-            SDL_DestroyWindow(window);
-        }
+    return pixels;
+}
+
+// convert rectangle of image to bitmap pixels for current number of colors (lines padded to whole words)
+static output_t convert_bitmap(const image_t &               img,
+                               int                           x0,
+                               int                           y0,
+                               int                           w,
+                               int                           h,
+                               const std::vector<uint16_t> & pal,
+                               const xosera_quant *          quant)
+{
+    output_t out;
+    int      ppw    = num_colors == 2 ? 8 : num_colors == 16 ? 4 : 2;        // pixels per word
+    auto     pixels = quantize_pixels(img, x0, y0, w, h, pal, quant);
 
-        srand(time(nullptr));
+    out.width_words = (w + ppw - 1) / ppw;
+    out.height      = h;
+    out.data.resize(static_cast<size_t>(out.width_words) * 2 * h);
 
+    for_rows(h, [&](int y) {
+        uint8_t * ptr = &out.data[static_cast<size_t>(y) * out.width_words * 2];
+        for (int x = 0; x < out.width_words * ppw; x++)
         {
-            FILE * fp8 = fopen(out_file8, "w");
-            if (fp8 != nullptr)
+            int ci = x < w ? pixels[y * w + x] : 0;
+            switch (num_colors)
             {
-                printf("Writing output file: \"%s\"...", out_file8);
-                fflush(stdout);
-
-                for (int y = 0; y < h; y++)
-                {
-                    for (int x = 0; x < w; x++)
+                case 2:        // background 0x0 [15:12], foreground 0xF [11:8], 8 pixels MSB on left [7:0]
+                    if ((x & 7) == 0)
                     {
-                        SDL_Color rgb;
-                        Uint32    data = getpixel(image, x, y);
-                        SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
-
-                        int tr = 8, tg = 8;
-                        if (noise_mode)
-                        {
-                            tr = (rand() % NOISE_MOD) - NOISE_SUB;
-                            tg = (rand() % NOISE_MOD) - NOISE_SUB;
-                        }
-
-                        int red   = ((rgb.r + tr) / 16);
-                        int green = ((rgb.g + tg) / 16);
-                        if (red < 0)
-                            red = 0;
-                        else if (red > 15)
-                            red = 15;
-                        if (green < 0)
-                            green = 0;
-                        else if (green > 15)
-                            green = 15;
-
-                        fputc(red << 4 | green, fp8);
+                        *ptr++ = 0x0F;
+                        *ptr++ = 0x00;
                     }
-                    if (interleave_mode)
+                    if (ci)
                     {
-                        int lastblue = 0;
-                        for (int x = 0; x < w; x++)
-                        {
-                            SDL_Color rgb;
-                            Uint32    data = getpixel(image, x, y);
-                            SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
-
-                            int tb = 8;
-                            if (noise_mode)
-                            {
-                                tb = (rand() % NOISE_MOD) - NOISE_SUB;
-                            }
-
-                            int blue = ((rgb.b + tb) / 16);
-                            if (blue < 0)
-                                blue = 0;
-                            if (blue > 15)
-                                blue = 15;
-
-                            if (x & 1)
-                            {
-                                fputc(lastblue << 4 | blue, fp8);
-                            }
-                            else
-                            {
-                                lastblue = blue;
-                            }
-                        }
+                        ptr[-1] |= 0x80 >> (x & 7);
                     }
-                }
-                printf("success\n");
+                    break;
+                case 16:
+                    if (x & 1)
+                    {
+                        *ptr++ |= ci;
+                    }
+                    else
+                    {
+                        *ptr = ci << 4;
+                    }
+                    break;
+                case 256:
+                    *ptr++ = ci;
+                    break;
             }
-            else
+        }
+    });
+
+    return out;
+}
+
+// convert image to 12-bit RG8 + B4 bitmap(s) (like true_color_hack)
+static void convert_truecolor(const image_t & img, std::vector<output_t> & outputs)
+{
+    int      rg_bytes = (img.w + 1) & ~1;              // RG 8-bpp bytes per line (whole words)
+    int      b_bytes  = ((img.w + 3) & ~3) / 2;        // B 4-bpp bytes per line (whole words)
+    auto     pixels   = quantize_pixels(img, 0, 0, img.w, img.h, {}, nullptr);
+    output_t rg8;
+    output_t b4;
+
+    rg8.suffix      = interleave_RG_B ? "_RG8B4" : "_RG8";
+    rg8.desc        = interleave_RG_B ? "12-bpp interleaved RG8 and B4 lines" : "8-bpp RG";
+    rg8.width_words = (rg_bytes + (interleave_RG_B ? b_bytes : 0)) / 2;
+    rg8.height      = img.h;
+    rg8.data.resize(static_cast<size_t>(rg8.width_words) * 2 * img.h);
+    b4.suffix      = "_B4";
+    b4.desc        = "4-bpp B";
+    b4.width_words = b_bytes / 2;
+    b4.height      = img.h;
+    b4.data.resize(interleave_RG_B ? 0 : static_cast<size_t>(b_bytes) * img.h);
+
+    for_rows(img.h, [&](int y) {
+        uint8_t * rgp = &rg8.data[static_cast<size_t>(y) * rg8.width_words * 2];
+        uint8_t * bp  = interleave_RG_B ? rgp + rg_bytes : &b4.data[static_cast<size_t>(y) * b_bytes];
+        for (int x = 0; x < img.w; x++)
+        {
+            int rgb = pixels[y * img.w + x];
+            int b   = rgb & 0xf;
+            rgp[x]  = rgb >> 4;
+            bp[x >> 1] |= (x & 1) ? b : b << 4;
+        }
+    });
+
+    outputs.push_back(rg8);
+    if (!interleave_RG_B)
+    {
+        outputs.push_back(b4);
+    }
+}
+
+// font subset glyph codes from -g ranges and -G text file (in code order, empty for all glyphs)
+static bool font_subset(int num_glyphs, std::vector<int> & codes, std::string & log)
+{
+    std::vector<char> used(num_glyphs, 0);
+
+    for (const char * r = glyph_ranges; r && *r;)
+    {
+        char * next  = nullptr;
+        long   first = strtol(r, &next, 0);
+        long   last  = first;
+        if (next != r && *next == '-')
+        {
+            r    = next + 1;
+            last = strtol(r, &next, 0);
+        }
+        if (next == r || (*next && *next != ',') || first < 0 || last < first)
+        {
+            log_printf(log, "*** Bad glyph range \"%s\" (expected e.g., 32-126,0xA9)\n", glyph_ranges);
+            return false;
+        }
+        for (long c = first; c <= last && c < num_glyphs; c++)
+        {
+            used[c] = 1;
+        }
+        r = *next ? next + 1 : next;
+    }
+
+    if (glyph_text)
+    {
+        xosera_mmap_in text;
+        std::string    error;
+        if (!text.open(glyph_text, &error))
+        {
+            log_printf(log, "*** Unable to read glyph text file: %s\n", error.c_str());
+            return false;
+        }
+        for (size_t i = 0; i < text.size; i++)
+        {
+            uint8_t c = text.data[i];
+            if (c != '\n' && c != '\r' && c != '\t' && c < num_glyphs)
             {
-                printf("*** Unable to open \"%s\" ", out_file8);
-                perror("error");
+                used[c] = 1;
             }
-            fclose(fp8);
         }
+    }
+
+    for (int c = 0; c < num_glyphs; c++)
+    {
+        if (used[c])
+        {
+            codes.push_back(c);
+        }
+    }
+    if ((glyph_ranges || glyph_text) && codes.empty())
+    {
+        log_printf(log, "*** Font subset has no glyphs\n");
+        return false;
+    }
+    return true;
+}
 
-        if (!interleave_mode)
+// proportional width of glyph (BDF advance, otherwise inked columns plus one pixel space, blank is half width)
+static int glyph_width(const image_t & img, int glyph, int fh)
+{
+    if (img.advance.size() > static_cast<size_t>(glyph) && img.advance[glyph] >= 0)
+    {
+        return std::clamp(img.advance[glyph], 1, 8);
+    }
+
+    int cx    = (glyph % (img.w / 8)) * 8;
+    int cy    = (glyph / (img.w / 8)) * fh;
+    int width = 0;
+    for (int y = 0; y < fh; y++)
+    {
+        for (int x = width; x < 8; x++)
         {
-            FILE * fp4 = fopen(out_file4, "w");
-            if (fp4 != nullptr)
+            if (mono_pixel(img.pixel(cx + x, cy + y)))
             {
-                printf("Writing output file: \"%s\"...", out_file4);
-                fflush(stdout);
+                width = x + 1;
+            }
+        }
+    }
+    return width ? std::min(width + 1, 8) : 4;
+}
+
+// convert image of 8 pixel wide glyphs to 1-bpp font (two lines per word, even line in high byte), optionally only
+// a subset of glyphs (with a table remapping glyph codes to tile indices) and glyph width table
+static bool convert_font(const image_t & img, std::vector<output_t> & outputs, std::string & log)
+{
+    int fh = font_height;
+    if (!fh)
+    {
+        fh = ((img.w / 8) * (img.h / 16) == 256 && (img.h % 16) == 0) ? 16 : 8;
+    }
+    if ((img.w & 7) != 0 || (img.h % fh) != 0)
+    {
+        log_printf(log, "*** Unsupported font image size (width multiple of 8, height multiple of %d)\n", fh);
+        return false;
+    }
+
+    int              num_glyphs = (img.w / 8) * (img.h / fh);
+    std::vector<int> codes;
+    if (!font_subset(num_glyphs, codes, log))
+    {
+        return false;
+    }
+    bool subset = !codes.empty();
+    if (!subset)
+    {
+        for (int c = 0; c < num_glyphs; c++)
+        {
+            codes.push_back(c);
+        }
+    }
+    if (subset && glyph_base + codes.size() > 256)
+    {
+        log_printf(log, "*** Subset of %zu glyphs at tile %d exceeds 256 tile indices\n", codes.size(), glyph_base);
+        return false;
+    }
 
-                for (int y = 0; y < h; y++)
+    output_t out;
+    out.suffix = "";
+    out.desc   = std::to_string(codes.size()) + " glyph 8x" + std::to_string(fh) + " 1-bpp font";
+    for (int c : codes)
+    {
+        int cx = (c % (img.w / 8)) * 8;
+        int cy = (c / (img.w / 8)) * fh;
+        for (int y = 0; y < fh; y++)
+        {
+            uint8_t bits = 0;
+            for (int x = 0; x < 8; x++)
+            {
+                if (mono_pixel(img.pixel(cx + x, cy + y)))
                 {
-                    int lastblue = 0;
-                    for (int x = 0; x < w; x++)
-                    {
-                        SDL_Color rgb;
-                        Uint32    data = getpixel(image, x, y);
-                        SDL_GetRGB(data, image->format, &rgb.r, &rgb.g, &rgb.b);
-
-                        int tb = 8;
-                        if (noise_mode)
-                        {
-                            tb = (rand() % NOISE_MOD) - NOISE_SUB;
-                        }
-
-                        int blue = ((rgb.b + tb) / 16);
-                        if (blue < 0)
-                            blue = 0;
-                        if (blue > 15)
-                            blue = 15;
-
-                        if (x & 1)
-                        {
-                            fputc(lastblue << 4 | blue, fp4);
-                        }
-                        else
-                        {
-                            lastblue = blue;
-                        }
-                    }
+                    bits |= 0x80 >> x;
                 }
-                printf("success\n");
-            }
-            else
-            {
-                printf("*** Unable to open \"%s\" ", out_file4);
-                perror("error");
             }
-            fclose(fp4);
+            out.data.push_back(bits);
         }
+    }
+    outputs.push_back(out);
 
-        if (create_pal)
+    if (subset)
+    {
+        // glyph code to tile index (glyphs not in subset use '?' if present, otherwise first glyph)
+        auto     question = std::find(codes.begin(), codes.end(), '?');
+        uint8_t  missing  = glyph_base + (question != codes.end() ? question - codes.begin() : 0);
+        output_t map;
+        map.suffix = "_map";
+        map.desc   = "glyph code to tile index byte table";
+        map.data.assign(num_glyphs, missing);
+        for (size_t i = 0; i < codes.size(); i++)
         {
-            snprintf(out_file8, sizeof(out_file8), "%s_pal.raw", out_file);
+            map.data[codes[i]] = static_cast<uint8_t>(glyph_base + i);
+        }
+        outputs.push_back(map);
 
-            FILE * fpc = fopen(out_file8, "w");
-            if (fpc != nullptr)
-            {
-                printf("Writing output file: \"%s\"...", out_file8);
-                fflush(stdout);
+        log_printf(log,
+                   "Converted %zu of %d 8x%d glyphs (tiles %d-%zu), %zu words of tilemem free\n",
+                   codes.size(),
+                   num_glyphs,
+                   fh,
+                   glyph_base,
+                   glyph_base + codes.size() - 1,
+                   (num_glyphs - codes.size()) * fh / 2);
+    }
+    else
+    {
+        log_printf(log, "Converted %d 8x%d glyphs\n", num_glyphs, fh);
+    }
 
-                for (int i = 0; i < 256; i++)
+    if (glyph_widths)
+    {
+        output_t widths;
+        widths.suffix = "_width";
+        widths.desc   = "glyph pixel width byte table (in tile order)";
+        for (int c : codes)
+        {
+            widths.data.push_back(static_cast<uint8_t>(glyph_width(img, c, fh)));
+        }
+        outputs.push_back(widths);
+    }
+
+    return true;
+}
+
+// convert rectangle of image to a copy pre-shifted right for each pixel alignment in a word, so any x position can be
+// blitted without the nibble shifter (which costs an extra word per line).  Also outputs a blit table with 6 words
+// per variant: word offset, BLIT_SHIFT, BLIT_WORDS, BLIT_LINES, BLIT_MOD_S and BLIT_MOD_D (select with dest x & 3
+// for 4-bpp, or dest x & 1 for 8-bpp).
+static void convert_preshift(const image_t &               img,
+                             int                           x0,
+                             int                           y0,
+                             int                           w,
+                             int                           h,
+                             const std::vector<uint16_t> & pal,
+                             const xosera_quant *          quant,
+                             output_t &                    images,
+                             output_t &                    table)
+{
+    const int ppw    = num_colors == 16 ? 4 : 2;        // pixels per word (also number of variants)
+    const int nibs   = 4 / ppw;                         // nibbles per pixel
+    auto      pixels = quantize_pixels(img, x0, y0, w, h, pal, quant);
+
+    images.width_words = 0;        // variants differ in width (see blit table)
+    images.height      = 0;
+    table.suffix       = images.suffix + "_blit";
+    table.desc         = "blit table for " + images.desc + " (offset, SHIFT, WORDS, LINES, MOD_S, MOD_D)";
+    table.width_words  = 6;
+    table.height       = ppw;
+
+    for (int shift = 0; shift < ppw; shift++)
+    {
+        int words      = (w + shift + ppw - 1) / ppw;
+        int last_nibs  = ((w + shift) * nibs) % 4;
+        int first_mask = 0xF >> (shift * nibs);
+        int last_mask  = last_nibs ? (0xF << (4 - last_nibs)) & 0xF : 0xF;
+        int offset     = static_cast<int>(images.data.size() / 2);
+
+        for (int y = 0; y < h; y++)
+        {
+            for (int x = -shift; x < words * ppw - shift; x += 2)
+            {
+                int p0 = x >= 0 && x < w ? pixels[y * w + x] : 0;
+                int p1 = x + 1 >= 0 && x + 1 < w ? pixels[y * w + x + 1] : 0;
+                if (num_colors == 16)
                 {
-                    // 0x4RG0
-                    fputc(0x40 | ((i >> 4) & 0xf), fpc);
-                    fputc(0x00 | ((i << 4) & 0xf0), fpc);
+                    images.data.push_back(p0 << 4 | p1);
                 }
-                for (int i = 0; i < 16; i++)
+                else
                 {
-                    // 0xF00B
-                    fputc(0xF0, fpc);
-                    fputc(i, fpc);
+                    images.data.push_back(p0);
+                    images.data.push_back(p1);
                 }
-                printf("success\n");
-            }
-            else
-            {
-                printf("*** Unable to open \"%s\" ", out_file8);
-                perror("error");
             }
-            fclose(fpc);
         }
+
+        uint16_t entry[6] = {static_cast<uint16_t>(offset),
+                             static_cast<uint16_t>(first_mask << 12 | last_mask << 8),        // no nibble shift
+                             static_cast<uint16_t>(words - 1),
+                             static_cast<uint16_t>(h - 1),
+                             0,        // MOD_S (lines are contiguous)
+                             static_cast<uint16_t>(dest_line_words - words)};
+        for (auto v : entry)
+        {
+            table.data.push_back(v >> 8);
+            table.data.push_back(v & 0xff);
+        }
+    }
+}
+
+// find rectangles outlined with the color of the top left pixel, and convert the inside of each
+static void convert_cut(const image_t &               img,
+                        const std::vector<uint16_t> & pal,
+                        const xosera_quant *          quant,
+                        std::vector<output_t> &       outputs,
+                        std::string &                 log)
+{
+    uint32_t outline  = img.pixel(0, 0);
+    int      num_cuts = 0;
+    auto     is_line  = [&](int x, int y) { return x < img.w && y < img.h && img.pixel(x, y) == outline; };
+
+    if (preshift && num_colors == 2)
+    {
+        log_printf(log, "WARNING: 1-bpp images can't be nibble shifted, -s ignored\n");
     }
 
-    if (image)
+    for (int y = 0; y + 2 < img.h; y++)
+    {
+        for (int x = 0; x + 2 < img.w; x++)
+        {
+            // top left corner of outline box
+            if (!is_line(x, y) || !is_line(x + 1, y) || !is_line(x, y + 1) || is_line(x + 1, y + 1))
+                continue;
+            if (x > 0 && y > 0 && is_line(x - 1, y + 1) && is_line(x + 1, y - 1) && !is_line(x - 1, y - 1))
+                continue;        // inside corner of another box
+
+            int x2 = x + 1;
+            while (x2 < img.w && !is_line(x2, y + 1))
+                x2++;
+            int y2 = y + 1;
+            while (y2 < img.h && !is_line(x + 1, y2))
+                y2++;
+            if (x2 >= img.w || y2 >= img.h)
+                continue;
+
+            bool closed = true;
+            for (int bx = x; bx <= x2 && closed; bx++)
+                closed = is_line(bx, y) && is_line(bx, y2);
+            for (int by = y; by <= y2 && closed; by++)
+                closed = is_line(x, by) && is_line(x2, by);
+            if (!closed)
+                continue;
+
+            std::string desc = std::to_string(x2 - x - 1) + "x" + std::to_string(y2 - y - 1) + " image cut at " +
+                               std::to_string(x + 1) + "," + std::to_string(y + 1);
+            if (preshift && num_colors != 2)
+            {
+                output_t images;
+                output_t table;
+                images.suffix = "_" + std::to_string(num_cuts);
+                images.desc   = desc + " pre-shifted";
+                convert_preshift(img, x + 1, y + 1, x2 - x - 1, y2 - y - 1, pal, quant, images, table);
+                log_printf(log,
+                           "Cut image %d: %s (%zu words)\n",
+                           num_cuts,
+                           images.desc.c_str(),
+                           images.data.size() / 2);
+                outputs.push_back(images);
+                outputs.push_back(table);
+            }
+            else
+            {
+                output_t out = convert_bitmap(img, x + 1, y + 1, x2 - x - 1, y2 - y - 1, pal, quant);
+                out.suffix   = "_" + std::to_string(num_cuts);
+                out.desc     = desc;
+                log_printf(log, "Cut image %d: %s\n", num_cuts, out.desc.c_str());
+                outputs.push_back(out);
+            }
+            num_cuts++;
+        }
+    }
+    if (num_cuts == 0)
+    {
+        log_printf(log, "*** No outlined images found (outline color is top left pixel)\n");
+    }
+}
+
+// cut image into tiles, keep only unique tiles (and mirrored tiles with 4 or 8-bpp) and write tileset and tilemap
+static bool convert_tiles(const image_t &               img,
+                          const std::vector<uint16_t> & pal,
+                          const xosera_quant *          quant,
+                          std::vector<output_t> &       outputs,
+                          std::string &                 log)
+{
+    const int tw        = 8;
+    const int th        = num_colors == 2 && font_height == 16 ? 16 : 8;        // only 1-bpp tiles can be 8x16
+    const int cols      = (img.w + tw - 1) / tw;
+    const int rows      = (img.h + th - 1) / th;
+    const int max_tiles = num_colors == 2 ? 256 : 1024;
+    const int ppw       = num_colors == 2 ? 16 : num_colors == 16 ? 4 : 2;        // pixels per word (two lines 1-bpp)
+    const int tile_size = tw * th / ppw;                                          // words per tile
+    auto      pixels    = quantize_pixels(img, 0, 0, img.w, img.h, pal, quant);
+
+    using tile_t = std::vector<uint16_t>;
+    auto get_tile = [&](int tx, int ty) {
+        tile_t tile(tw * th, 0);
+        for (int y = 0; y < th; y++)
+        {
+            for (int x = 0; x < tw; x++)
+            {
+                int px = tx * tw + x;
+                int py = ty * th + y;
+                if (px < img.w && py < img.h)
+                {
+                    tile[y * tw + x] = pixels[py * img.w + px];
+                }
+            }
+        }
+        return tile;
+    };
+    auto mirror = [&](const tile_t & tile, bool h_rev, bool v_rev) {
+        tile_t out(tw * th);
+        for (int y = 0; y < th; y++)
+        {
+            for (int x = 0; x < tw; x++)
+            {
+                out[y * tw + x] = tile[(v_rev ? th - 1 - y : y) * tw + (h_rev ? tw - 1 - x : x)];
+            }
+        }
+        return out;
+    };
+    auto hash = [](const tile_t & tile) {
+        uint64_t h = 0xcbf29ce484222325ULL;        // FNV-1a
+        for (auto v : tile)
+        {
+            h = (h ^ v) * 0x100000001b3ULL;
+        }
+        return h;
+    };
+
+    std::vector<tile_t>                            tiles;
+    std::unordered_map<uint64_t, std::vector<int>> tile_hash;        // tile hash to tile numbers
+    std::vector<uint16_t>                          map;
+    int                                            num_mirrored = 0;
+    auto find_tile = [&](const tile_t & tile) {
+        auto it = tile_hash.find(hash(tile));
+        if (it != tile_hash.end())
+        {
+            for (int t : it->second)
+            {
+                if (tiles[t] == tile)
+                {
+                    return t;
+                }
+            }
+        }
+        return -1;
+    };
+
+    for (int ty = 0; ty < rows; ty++)
+    {
+        for (int tx = 0; tx < cols; tx++)
+        {
+            tile_t   tile = get_tile(tx, ty);
+            int      t    = find_tile(tile);
+            uint16_t attr = 0;
+            // 2 and 4-bpp tiles can be mirrored with HREV [11] and VREV [10] tilemap bits
+            for (int m = 1; m < 4 && t < 0 && num_colors != 2; m++)
+            {
+                t = find_tile(mirror(tile, m & 1, m & 2));
+                if (t >= 0)
+                {
+                    attr = ((m & 1) ? 0x0800 : 0) | ((m & 2) ? 0x0400 : 0);
+                    num_mirrored++;
+                }
+            }
+            if (t < 0)
+            {
+                t = static_cast<int>(tiles.size());
+                tiles.push_back(tile);
+                tile_hash[hash(tile)].push_back(t);
+            }
+            // 1-bpp tiles have background [15:12] and foreground [11:8] color
+            map.push_back((num_colors == 2 ? 0x0F00 : attr) | (t & 0x3ff));
+        }
+    }
+
+    if (static_cast<int>(tiles.size()) > max_tiles)
+    {
+        log_printf(log, "*** %zu unique tiles exceeds %d tile limit\n", tiles.size(), max_tiles);
+        return false;
+    }
+
+    output_t tileset;
+    tileset.suffix      = "_tiles";
+    tileset.desc        = std::to_string(tiles.size()) + " " + std::to_string(tw) + "x" + std::to_string(th) + " " +
+                          (num_colors == 2 ? "1" : num_colors == 16 ? "4" : "8") + "-bpp tiles";
+    tileset.width_words = tile_size;
+    tileset.height      = static_cast<int>(tiles.size());
+    for (auto & tile : tiles)
+    {
+        for (int i = 0; i < tw * th; i += 8)
+        {
+            switch (num_colors)
+            {
+                case 2:        // 8 pixels per byte (even line in high byte, odd line in low)
+                {
+                    uint8_t bits = 0;
+                    for (int b = 0; b < 8; b++)
+                    {
+                        bits |= tile[i + b] ? 0x80 >> b : 0;
+                    }
+                    tileset.data.push_back(bits);
+                    break;
+                }
+                case 16:
+                    for (int b = 0; b < 8; b += 2)
+                    {
+                        tileset.data.push_back(tile[i + b] << 4 | tile[i + b + 1]);
+                    }
+                    break;
+                default:
+                    for (int b = 0; b < 8; b++)
+                    {
+                        tileset.data.push_back(tile[i + b]);
+                    }
+                    break;
+            }
+        }
+    }
+
+    output_t tilemap;
+    tilemap.suffix      = "_map";
+    tilemap.desc        = std::to_string(cols) + "x" + std::to_string(rows) + " tilemap";
+    tilemap.width_words = cols;
+    tilemap.height      = rows;
+    for (auto v : map)
+    {
+        tilemap.data.push_back(v >> 8);
+        tilemap.data.push_back(v & 0xff);
+    }
+
+    int bitmap_words = ((img.w + (num_colors == 2 ? 8 : ppw) - 1) / (num_colors == 2 ? 8 : ppw)) * img.h;
+    int tile_words   = static_cast<int>(tiles.size()) * tile_size + cols * rows;
+    int align        = tile_size;
+    while (align < static_cast<int>(tiles.size()) * tile_size)
+    {
+        align <<= 1;
+    }
+    log_printf(log,
+               "%d tiles, %zu unique (%d mirrored), tileset %zu + tilemap %d words (tileset alignment 0x%04x)\n",
+               cols * rows,
+               tiles.size(),
+               num_mirrored,
+               tiles.size() * tile_size,
+               cols * rows,
+               align);
+    log_printf(log,
+               "VRAM %d words (%.1f KiB) vs. bitmap %d words (%.1f KiB), saved %.1f KiB\n",
+               tile_words,
+               tile_words / 512.0,
+               bitmap_words,
+               bitmap_words / 512.0,
+               (bitmap_words - tile_words) / 512.0);
+
+    outputs.push_back(tileset);
+    outputs.push_back(tilemap);
+    return true;
+}
+
+// colormem palette output
+static output_t convert_palette(const std::vector<uint16_t> & pal)
+{
+    output_t out;
+    out.suffix = "_pal";
+    if (num_colors == 4096)        // identity palette, 256 RG then 16 B (with ADD set in alpha)
+    {
+        out.desc = "12-bit RG8 + B4 colormem palette";
+        for (int i = 0; i < 256; i++)
+        {
+            out.data.push_back(0x40 | ((i >> 4) & 0xf));        // 0x4RG0
+            out.data.push_back(0x00 | ((i << 4) & 0xf0));
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            out.data.push_back(0xF0);        // 0xF00B
+            out.data.push_back(i);
+        }
+    }
+    else
+    {
+        out.desc = std::to_string(pal.size()) + " color colormem palette";
+        for (auto c : pal)
+        {
+            out.data.push_back(c >> 8);
+            out.data.push_back(c & 0xff);
+        }
+    }
+    return out;
+}
+
+// C identifier from file name
+static std::string c_name(const std::string & base)
+{
+    std::string name = base.substr(base.find_last_of("/\\") == std::string::npos ? 0 : base.find_last_of("/\\") + 1);
+    for (auto & c : name)
+    {
+        if (!isalnum(static_cast<unsigned char>(c)))
+            c = '_';
+    }
+    if (name.empty() || isdigit(static_cast<unsigned char>(name[0])))
+        name = "_" + name;
+    return name;
+}
+
+static bool write_output(const std::string & base, const output_t & out, const char * mode, std::string & log)
+{
+    std::string          name = c_name(base + out.suffix);
+    std::vector<uint8_t> data = out.data;
+    if (data.size() & 1)
+    {
+        data.push_back(0);
+    }
+    size_t words = data.size() / 2;
+
+    enum
+    {
+        FMT_RAW,
+        FMT_CH,
+        FMT_AS,
+        FMT_MEMH,
+        NUM_FMTS
+    };
+    const bool   enabled[NUM_FMTS] = {out_raw, out_ch, out_as, out_memh};
+    const char * ext[NUM_FMTS]     = {".raw", ".h", ".asm", ".mem"};
+
+    for (int f = 0; f < NUM_FMTS; f++)
+    {
+        if (!enabled[f])
+            continue;
+
+        std::string file_name = base + out.suffix + ext[f];
+        FILE *      fp        = fopen(file_name.c_str(), f == FMT_RAW ? "wb" : "w");
+        if (!fp)
+        {
+            log_printf(log, "*** Unable to open \"%s\": %s\n", file_name.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (f == FMT_RAW)
+        {
+            fwrite(data.data(), 1, data.size(), fp);
+        }
+        else if (f == FMT_CH)
+        {
+            fprintf(fp, "// Generated by xosera_convert %s: %s\n", mode, out.desc.c_str());
+            fprintf(fp, "#if !defined(INC_%s_H)\n", name.c_str());
+            fprintf(fp, "#define INC_%s_H\n", name.c_str());
+            fprintf(fp, "#include <stdint.h>\n\n");
+            if (out.height)
+            {
+                fprintf(fp, "static const uint16_t %s_width  __attribute__ ((unused)) = %d;    // words\n",
+                        name.c_str(),
+                        out.width_words);
+                fprintf(fp,
+                        "static const uint16_t %s_height __attribute__ ((unused)) = %d;\n",
+                        name.c_str(),
+                        out.height);
+            }
+            fprintf(fp, "static const uint32_t %s_size   __attribute__ ((unused)) = %zu;    // words\n",
+                    name.c_str(),
+                    words);
+            fprintf(fp, "static const uint16_t %s[%zu] __attribute__ ((unused)) =\n{\n", name.c_str(), words);
+            for (size_t i = 0; i < words; i++)
+            {
+                fprintf(fp, "%s0x%02x%02x%s", (i & 7) == 0 ? "    " : "", data[i * 2], data[i * 2 + 1],
+                        i + 1 == words ? "\n" : (i & 7) == 7 ? ",\n" : ", ");
+            }
+            fprintf(fp, "};\n");
+            fprintf(fp, "#endif // INC_%s_H\n", name.c_str());
+        }
+        else if (f == FMT_AS)
+        {
+            fprintf(fp, "; Generated by xosera_convert %s: %s\n", mode, out.desc.c_str());
+            if (out.height)
+            {
+                fprintf(fp, "%s_width\tequ\t%d\t\t; words\n", name.c_str(), out.width_words);
+                fprintf(fp, "%s_height\tequ\t%d\n", name.c_str(), out.height);
+            }
+            fprintf(fp, "%s_size\tequ\t%zu\t\t; words\n", name.c_str(), words);
+            fprintf(fp, "%s:\n", name.c_str());
+            for (size_t i = 0; i < words; i++)
+            {
+                fprintf(fp, "%s$%02x%02x%s", (i & 7) == 0 ? "\t\tdc.w\t" : "", data[i * 2], data[i * 2 + 1],
+                        (i & 7) == 7 || i + 1 == words ? "\n" : ",");
+            }
+        }
+        else
+        {
+            fprintf(fp, "// Generated by xosera_convert %s: %s\n", mode, out.desc.c_str());
+            for (size_t i = 0; i < words; i++)
+            {
+                fprintf(fp, "%02x%02x", data[i * 2], data[i * 2 + 1]);
+                if ((i & 7) == 0)
+                {
+                    fprintf(fp, "        // @ 0x%04zx", i);
+                }
+                fprintf(fp, "\n");
+            }
+        }
+
+        bool good = !ferror(fp);
+        fclose(fp);
+        if (!good)
+        {
+            log_printf(log, "*** Error writing \"%s\"\n", file_name.c_str());
+            return false;
+        }
+        log_printf(log, "Wrote \"%s\" (%zu words)\n", file_name.c_str(), words);
+    }
+
+    return true;
+}
+
+// one image placement in a scene
+struct scene_blit_t
+{
+    int      image;                      // index of scene image
+    int      x, y;                       // destination pixel position
+    int      transp;                     // transparent color (-1 for none)
+    int      dst_x, words, lines;        // destination word column, words per line and lines
+    uint16_t regs[BLIT_REGS];            // XR_BLIT_CTRL to XR_BLIT_WORDS values
+};
+
+// read scene file (image file, x, y and optional transparent color per line, or "dest <vram_addr> <line_words>",
+// which sets dest_addr and line_words for this scene)
+static bool read_scene(const char *                     file_name,
+                       std::vector<std::string> &       image_files,
+                       std::vector<scene_blit_t> &      blits,
+                       int &                            dest_addr,
+                       int &                            line_words,
+                       std::string &                    log)
+{
+    FILE * fp = fopen(file_name, "r");
+    if (!fp)
+    {
+        log_printf(log, "*** Unable to open scene \"%s\": %s\n", file_name, strerror(errno));
+        return false;
+    }
+
+    std::string dir  = file_name;
+    size_t      last = dir.find_last_of("/\\");
+    dir              = last == std::string::npos ? "" : dir.substr(0, last + 1);
+
+    char line[1024];
+    int  line_num = 0;
+    bool ok       = true;
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        line_num++;
+        char name[1024];
+        char extra[2];
+        int  x = 0, y = 0, t = -1;
+        int  n = sscanf(line, " %1023s %i %i %i %1s", name, &x, &y, &t, extra);
+        if (n <= 0 || name[0] == '#')
+        {
+            continue;
+        }
+        if (strcmp(name, "dest") == 0 && n == 3)
+        {
+            dest_addr  = x;
+            line_words = y;
+            continue;
+        }
+        if (n < 3 || n > 4 || x < 0 || y < 0 || t >= num_colors)
+        {
+            log_printf(log, "*** %s:%d: expected <image_file> <x> <y> [transparent_color]\n", file_name, line_num);
+            ok = false;
+            break;
+        }
+
+        std::string path = name[0] == '/' ? std::string(name) : dir + name;
+        auto        it   = std::find(image_files.begin(), image_files.end(), path);
+        if (it == image_files.end())
+        {
+            it = image_files.insert(image_files.end(), path);
+        }
+
+        scene_blit_t b = {};
+        b.image        = static_cast<int>(it - image_files.begin());
+        b.x            = x;
+        b.y            = y;
+        b.transp       = t;
+        blits.push_back(b);
+    }
+    fclose(fp);
+
+    if (ok && blits.empty())
+    {
+        log_printf(log, "*** Scene \"%s\" has no images\n", file_name);
+        ok = false;
+    }
+    return ok;
+}
+
+// blit register writes (as runs of consecutive registers) needed to change blitter state to blit b, unknown
+// registers in state are always written.  Each run costs one WR_XADDR write plus its XDATA writes, so runs are
+// joined over a single unchanged register (same bus writes, fewer list words).
+static int blit_runs(const scene_blit_t &                 b,
+                     const uint16_t *                     state,
+                     const bool *                         known,
+                     std::vector<std::pair<int, int>> *   runs = nullptr)
+{
+    int writes = 0;
+    for (int r = 0; r < BLIT_REGS;)
+    {
+        if (r != BLIT_REGS - 1 && known[r] && state[r] == b.regs[r])
+        {
+            r++;
+            continue;
+        }
+        int first = r;
+        int end   = r + 1;
+        while (end < BLIT_REGS)
+        {
+            bool change      = end == BLIT_REGS - 1 || !known[end] || state[end] != b.regs[end];
+            bool next_change = end + 1 < BLIT_REGS &&
+                               (end + 1 == BLIT_REGS - 1 || !known[end + 1] || state[end + 1] != b.regs[end + 1]);
+            if (change || next_change)
+            {
+                end += change ? 1 : 2;
+            }
+            else
+            {
+                break;
+            }
+        }
+        if (runs)
+        {
+            runs->push_back({first, end - first});
+        }
+        writes += 1 + end - first;
+        r = end;
+    }
+    return writes;
+}
+
+// convert scene images to one VRAM image block (with shared palette), then compile the blits that draw them into
+// a blit list for xosera_blit_list().  Blits are reordered to minimize register writes (the blitter keeps register
+// values between blits), except that a blit is never moved before an earlier blit it overlaps.
+static bool convert_scene(const char * file_name, const std::string & base, const char * mode_name, std::string & log)
+{
+    if (num_colors != 16 && num_colors != 256)
+    {
+        log_printf(log, "*** scene mode needs 16 or 256 colors\n");
+        return false;
+    }
+
+    std::vector<std::string>  image_files;
+    std::vector<scene_blit_t> blits;
+    int                       dest_addr  = 0x0000;
+    int                       line_words = dest_line_words;        // scene "dest" overrides only for this scene
+    if (!read_scene(file_name, image_files, blits, dest_addr, line_words, log))
+    {
+        return false;
+    }
+
+    int                      num_images = static_cast<int>(image_files.size());
+    std::vector<image_t> images(num_images);
+    for (int i = 0; i < num_images; i++)
+    {
+        if (!load_image(image_files[i].c_str(), images[i], log))
+        {
+            return false;
+        }
+    }
+
+    auto pal   = color_palette(images.data(), images.size());
+    auto quant = std::make_unique<xosera_quant>(pal.data(), static_cast<int>(pal.size()));
+
+    // image bitmaps are placed one after another in VRAM
+    output_t vram;
+    vram.suffix = "_vram";
+    vram.desc   = std::to_string(num_images) + " scene image " + std::to_string(num_colors) + " color bitmaps";
+    std::vector<int> image_addr(num_images), image_words(num_images);
+    for (int i = 0; i < num_images; i++)
+    {
+        output_t bitmap = convert_bitmap(images[i], 0, 0, images[i].w, images[i].h, pal, quant.get());
+        image_addr[i]   = vram_addr + static_cast<int>(vram.data.size() / 2);
+        image_words[i]  = bitmap.width_words;
+        vram.data.insert(vram.data.end(), bitmap.data.begin(), bitmap.data.end());
+    }
+    int vram_words = static_cast<int>(vram.data.size() / 2);
+
+    // blit register values for each placement (nibble shifted to any pixel, with edge masks)
+    const int ppw      = num_colors == 16 ? 4 : 2;        // pixels per word
+    const int nibs     = 4 / ppw;                         // nibbles per pixel
+    int       dest_end = dest_addr;
+    for (auto & b : blits)
+    {
+        const image_t & img = images[b.image];
+        if (b.x + img.w > line_words * ppw)
+        {
+            log_printf(log, "*** \"%s\" at %d, %d is outside %d pixel wide destination\n",
+                       image_files[b.image].c_str(),
+                       b.x,
+                       b.y,
+                       line_words * ppw);
+            return false;
+        }
+        int shift      = (b.x * nibs) % 4;
+        int last_nibs  = (shift + img.w * nibs) % 4;
+        int first_mask = 0xF >> shift;
+        int last_mask  = last_nibs ? (0xF << (4 - last_nibs)) & 0xF : 0xF;
+        int tv         = b.transp < 0 ? 0 : num_colors == 16 ? (b.transp << 4 | b.transp) : b.transp;
+        b.dst_x        = b.x / ppw;
+        b.words        = (shift + img.w * nibs + 3) / 4;
+        b.lines        = img.h;
+
+        uint16_t * regs = b.regs;
+        regs[0]         = static_cast<uint16_t>(b.transp < 0 ? 0 : tv << 8 | (num_colors == 256) << 5 | 1 << 4);
+        regs[1]         = 0x0000;                                                              // ANDC
+        regs[2]         = 0x0000;                                                              // XOR
+        regs[3]         = static_cast<uint16_t>(image_words[b.image] - b.words);               // MOD_S
+        regs[4]         = static_cast<uint16_t>(image_addr[b.image]);                          // SRC_S
+        regs[5]         = static_cast<uint16_t>(line_words - b.words);                         // MOD_D
+        regs[6]         = static_cast<uint16_t>(dest_addr + b.y * line_words + b.dst_x);       // DST_D
+        regs[7]         = static_cast<uint16_t>(first_mask << 12 | last_mask << 8 | shift);    // SHIFT
+        regs[8]         = static_cast<uint16_t>(b.lines - 1);                                  // LINES
+        regs[9]         = static_cast<uint16_t>(b.words - 1);                                  // WORDS
+        dest_end        = std::max(dest_end, dest_addr + (b.y + b.lines) * line_words);
+    }
+
+    if (vram_addr < dest_end && dest_addr < vram_addr + vram_words)
+    {
+        log_printf(log, "*** Scene images at VRAM 0x%04x-0x%04x overlap destination 0x%04x-0x%04x (use -a)\n",
+                   vram_addr,
+                   vram_addr + vram_words - 1,
+                   dest_addr,
+                   dest_end - 1);
+        return false;
+    }
+    if (vram_addr + vram_words > 0x10000 || dest_end > 0x10000)
+    {
+        log_printf(log, "*** Scene will not fit in Xosera 128KB VRAM\n");
+        return false;
+    }
+
+    // a blit must stay after every earlier blit that writes any of the same destination words
+    size_t                           num_blits = blits.size();
+    std::vector<std::vector<size_t>> after(num_blits);
+    std::vector<int>                 waiting(num_blits, 0);
+    for (size_t i = 0; i < num_blits; i++)
+    {
+        for (size_t j = i + 1; j < num_blits; j++)
+        {
+            const scene_blit_t & a = blits[i];
+            const scene_blit_t & b = blits[j];
+            if (a.dst_x < b.dst_x + b.words && b.dst_x < a.dst_x + a.words && a.y < b.y + b.lines &&
+                b.y < a.y + a.lines)
+            {
+                after[i].push_back(j);
+                waiting[j]++;
+            }
+        }
+    }
+
+    // greedy order: next ready blit needing the fewest register writes (earliest in scene on a tie)
+    output_t list;
+    list.suffix = "_blit";
+    list.desc   = std::to_string(num_blits) + " blit list for scene images";
+    auto put_word = [&](uint16_t w) {
+        list.data.push_back(w >> 8);
+        list.data.push_back(w & 0xff);
+    };
+
+    uint16_t          state[BLIT_REGS] = {};
+    bool              known[BLIT_REGS] = {};
+    std::vector<char> done(num_blits, 0);
+    int               total_writes  = 0;
+    int               reordered     = 0;
+    size_t            next_in_order = 0;
+    for (size_t n = 0; n < num_blits; n++)
+    {
+        size_t best      = num_blits;
+        int    best_cost = 0;
+        for (size_t i = 0; i < num_blits; i++)
+        {
+            if (done[i] || waiting[i])
+            {
+                continue;
+            }
+            int cost = blit_runs(blits[i], state, known);
+            if (best == num_blits || cost < best_cost)
+            {
+                best      = i;
+                best_cost = cost;
+            }
+        }
+
+        while (next_in_order < num_blits && done[next_in_order])
+        {
+            next_in_order++;
+        }
+        reordered += best != next_in_order;
+
+        std::vector<std::pair<int, int>> runs;
+        total_writes += blit_runs(blits[best], state, known, &runs);
+        bool first = true;
+        for (auto & run : runs)
+        {
+            int wait = first ? BLIT_LIST_WAIT : 0;
+            put_word(static_cast<uint16_t>(wait | (XR_BLIT_REGS + run.first) << 8 | run.second));
+            for (int r = run.first; r < run.first + run.second; r++)
+            {
+                put_word(blits[best].regs[r]);
+                state[r] = blits[best].regs[r];
+                known[r] = true;
+            }
+            first = false;
+        }
+
+        done[best] = true;
+        for (auto j : after[best])
+        {
+            waiting[j]--;
+        }
+    }
+    put_word(0x0000);
+
+    int naive_writes = static_cast<int>(num_blits) * (BLIT_REGS * 2);        // xreg_setw() of every register
+    log_printf(log, "Scene images: %d in %d words at VRAM 0x%04x, destination 0x%04x (%d words per line)\n",
+               num_images,
+               vram_words,
+               vram_addr,
+               dest_addr,
+               line_words);
+    log_printf(log, "Blit list: %zu blits (%d reordered), %zu words, %d bus writes (%.1f per blit, %.1f%% of %d)\n",
+               num_blits,
+               reordered,
+               list.data.size() / 2,
+               total_writes,
+               static_cast<double>(total_writes) / num_blits,
+               100.0 * total_writes / naive_writes,
+               naive_writes);
+
+    std::vector<output_t> outputs = {vram, list};
+    if (write_palette)
+    {
+        outputs.push_back(convert_palette(pal));
+    }
+    for (auto & o : outputs)
+    {
+        if (!write_output(base, o, mode_name, log))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// decode, convert and write all outputs for one input image
+static bool convert_file(convert_mode mode, const char * mode_name, const char * in_file, const std::string & base,
+                         std::string & log)
+{
+    if (mode == MODE_SCENE)
+    {
+        return convert_scene(in_file, base, mode_name, log);
+    }
+
+    image_t img;
+    size_t  len = strlen(in_file);
+    bool    bdf = len > 4 && strcasecmp(in_file + len - 4, ".bdf") == 0;
+    if (!(bdf ? load_bdf(in_file, img, log) : load_image(in_file, img, log)))
+    {
+        return false;
+    }
+
+    if (((img.w * img.h) + ((img.w / 2) * img.h)) > (128 * 1024) && num_colors == 4096)
+    {
+        log_printf(log, "WARNING: Will not fit in Xosera 128KB VRAM\n");
+    }
+
+    std::vector<uint16_t>         pal;
+    std::unique_ptr<xosera_quant> quant;
+    if (num_colors == 16 || num_colors == 256)
+    {
+        pal   = color_palette(&img);
+        quant = std::make_unique<xosera_quant>(pal.data(), static_cast<int>(pal.size()));
+    }
+
+    std::vector<output_t> outputs;
+    bool                  ok = true;
+    switch (mode)
+    {
+        case MODE_FONT:
+            ok = convert_font(img, outputs, log);
+            break;
+        case MODE_BITMAP:
+            if (num_colors == 4096)
+            {
+                convert_truecolor(img, outputs);
+            }
+            else
+            {
+                outputs.push_back(convert_bitmap(img, 0, 0, img.w, img.h, pal, quant.get()));
+                outputs.back().desc = std::to_string(img.w) + "x" + std::to_string(img.h) + " " +
+                                      std::to_string(num_colors) + " color bitmap";
+            }
+            break;
+        case MODE_CUT:
+            if (num_colors == 4096)
+            {
+                log_printf(log, "*** cut mode needs 2, 16 or 256 colors\n");
+                ok = false;
+                break;
+            }
+            convert_cut(img, pal, quant.get(), outputs, log);
+            break;
+        case MODE_TILE:
+            if (num_colors == 4096)
+            {
+                log_printf(log, "*** tile mode needs 2, 16 or 256 colors\n");
+                ok = false;
+                break;
+            }
+            ok = convert_tiles(img, pal, quant.get(), outputs, log);
+            break;
+        case MODE_ANIM:         // converted by convert_anim
+        case MODE_SCENE:        // converted by convert_scene
+        case MODE_PAL:
+            break;
+    }
+
+    if (ok && (write_palette || mode == MODE_PAL) && num_colors != 2)
+    {
+        outputs.push_back(convert_palette(pal));
+    }
+
+    for (auto & out : outputs)
+    {
+        if (!ok)
+            break;
+        ok = write_output(base, out, mode_name, log);
+    }
+
+    return ok;
+}
+
+// VRAM words of one animation frame in the current bitmap format (all bitmap outputs back to back, as uploaded)
+static std::vector<uint16_t> frame_words(const image_t &               img,
+                                         const std::vector<uint16_t> & pal,
+                                         const xosera_quant *          quant)
+{
+    std::vector<output_t> outputs;
+    if (num_colors == 4096)
+    {
+        convert_truecolor(img, outputs);
+    }
+    else
+    {
+        outputs.push_back(convert_bitmap(img, 0, 0, img.w, img.h, pal, quant));
+    }
+
+    std::vector<uint16_t> words;
+    for (auto & out : outputs)
+    {
+        for (size_t i = 0; i + 1 < out.data.size(); i += 2)
+        {
+            words.push_back((out.data[i] << 8) | out.data[i + 1]);
+        }
+    }
+    return words;
+}
+
+// append one frame of delta records that update VRAM from prev to cur (all of cur if prev is empty), returns number
+// of records.  Frame is a record count word, then each record is VRAM address, word count and the words to write
+// (with WR_INCR 1, so a record is one WR_ADDR write followed by count XM_DATA writes).
+static int encode_delta(const std::vector<uint16_t> & prev,
+                        const std::vector<uint16_t> & cur,
+                        std::vector<uint8_t> &        out)
+{
+    auto put_word = [&](uint16_t w) {
+        out.push_back(w >> 8);
+        out.push_back(w & 0xff);
+    };
+    auto changed = [&](size_t i) { return prev.empty() || prev[i] != cur[i]; };
+
+    size_t count_pos = out.size();
+    int    records   = 0;
+    put_word(0);
+
+    for (size_t i = 0; i < cur.size();)
+    {
+        if (!changed(i))
+        {
+            i++;
+            continue;
+        }
+
+        // extend run over changed words, and over short gaps of unchanged words when another change follows
+        size_t end  = i + 1;
+        size_t next = end;
+        while (next < cur.size() && next - i < DELTA_MAX_RUN)
+        {
+            if (changed(next))
+            {
+                end = ++next;
+            }
+            else if (next - end < DELTA_MERGE_GAP)
+            {
+                next++;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        put_word(static_cast<uint16_t>(vram_addr + i));
+        put_word(static_cast<uint16_t>(end - i));
+        for (; i < end; i++)
+        {
+            put_word(cur[i]);
+        }
+        records++;
+    }
+
+    out[count_pos]     = records >> 8;
+    out[count_pos + 1] = records & 0xff;
+
+    return records;
+}
+
+// decode animation frames, convert to bitmaps with a shared palette and write delta update stream (frame count word,
+// then first frame in full followed by changes from each previous frame)
+static bool convert_anim(const std::vector<const char *> & files,
+                         const std::string &               base,
+                         const char *                      mode_name,
+                         std::string &                     log)
+{
+    int                      num_frames = static_cast<int>(files.size());
+    std::vector<image_t>     frames(num_frames);
+    std::vector<std::string> logs(num_frames);
+    std::vector<char>        loaded(num_frames, 0);
+
+    // frames are converted in parallel (rather than rows of each frame)
+    row_threads = false;
+    xosera_parallel_rows(num_frames, [&](int f) { loaded[f] = load_image(files[f], frames[f], logs[f]); });
+    for (int f = 0; f < num_frames; f++)
+    {
+        if (!loaded[f] || f == 0)
+        {
+            log += logs[f];
+        }
+        if (!loaded[f])
+        {
+            return false;
+        }
+        if (frames[f].w != frames[0].w || frames[f].h != frames[0].h)
+        {
+            log_printf(log, "*** Frame \"%s\" is %d x %d (expected %d x %d)\n",
+                       files[f],
+                       frames[f].w,
+                       frames[f].h,
+                       frames[0].w,
+                       frames[0].h);
+            return false;
+        }
+    }
+
+    std::vector<uint16_t>         pal;
+    std::unique_ptr<xosera_quant> quant;
+    if (num_colors == 16 || num_colors == 256)
+    {
+        pal   = color_palette(frames.data(), frames.size());
+        quant = std::make_unique<xosera_quant>(pal.data(), static_cast<int>(pal.size()));
+    }
+
+    std::vector<std::vector<uint16_t>> words(num_frames);
+    xosera_parallel_rows(num_frames, [&](int f) { words[f] = frame_words(frames[f], pal, quant.get()); });
+
+    size_t frame_size = words[0].size();        // words
+    if (vram_addr < 0 || vram_addr + frame_size > 0x10000)
+    {
+        log_printf(log, "*** Frame of %zu words at VRAM 0x%04x will not fit in Xosera 128KB VRAM\n",
+                   frame_size,
+                   vram_addr);
+        return false;
+    }
+
+    // each frame delta only depends on the frame before, so encode in parallel and then concatenate
+    std::vector<std::vector<uint8_t>> deltas(num_frames);
+    std::vector<int>                  records(num_frames);
+    xosera_parallel_rows(num_frames, [&](int f) {
+        records[f] = encode_delta(f ? words[f - 1] : std::vector<uint16_t>(), words[f], deltas[f]);
+    });
+
+    output_t out;
+    out.suffix = "_anim";
+    out.desc   = std::to_string(num_frames) + " frame " + std::to_string(frames[0].w) + "x" +
+               std::to_string(frames[0].h) + " " + std::to_string(num_colors) + " color VRAM delta stream";
+    out.data.push_back(num_frames >> 8);
+    out.data.push_back(num_frames & 0xff);
+
+    size_t total_records = 0;
+    size_t max_bytes     = 0;
+    int    max_frame     = 0;
+    for (int f = 0; f < num_frames; f++)
+    {
+        out.data.insert(out.data.end(), deltas[f].begin(), deltas[f].end());
+        total_records += records[f];
+        if (f && deltas[f].size() > max_bytes)
+        {
+            max_bytes = deltas[f].size();
+            max_frame = f;
+        }
+    }
+
+    // bus writes: each record is a WR_ADDR word write and its words to XM_DATA (full frame is one WR_ADDR write)
+    size_t full_bytes   = frame_size * 2 * num_frames;
+    size_t header_bytes = 2 + num_frames * 2 + total_records * 4;
+    size_t data_bytes   = out.data.size() - header_bytes;
+    size_t bus_bytes    = data_bytes + total_records * 2;
+    log_printf(log, "Frames: %d of %zu words, %zu records (%.1f per frame)\n",
+               num_frames,
+               frame_size,
+               total_records,
+               static_cast<double>(total_records) / num_frames);
+    log_printf(log, "Stream: %zu bytes (%zu data + %zu header), full frames %zu bytes (%.1f%%)\n",
+               out.data.size(),
+               data_bytes,
+               header_bytes,
+               full_bytes,
+               100.0 * out.data.size() / full_bytes);
+    log_printf(log, "Bus writes: %zu bytes, full frames %zu bytes (%.1f%%)\n",
+               bus_bytes,
+               full_bytes + num_frames * 2,
+               100.0 * bus_bytes / (full_bytes + num_frames * 2));
+    if (num_frames > 1)
+    {
+        log_printf(log, "Delta frames: average %zu bytes, largest %zu bytes (frame %d)\n",
+                   (out.data.size() - 2 - deltas[0].size()) / (num_frames - 1),
+                   max_bytes,
+                   max_frame);
+    }
+
+    std::vector<output_t> outputs = {out};
+    if (write_palette && num_colors != 2)
+    {
+        outputs.push_back(convert_palette(pal));
+    }
+    for (auto & o : outputs)
+    {
+        if (!write_output(base, o, mode_name, log))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// show image in a window for a moment
+static void show_image(const char * in_file)
+{
+    xosera_image  img;
+    std::string   error;
+    SDL_Surface * image = xosera_image_load(in_file, img, error) ? xosera_image_surface(img) : nullptr;
+    if (!image)
+    {
+        printf("*** %s\n", error.c_str());
+        return;
+    }
+    int          w      = image->w;
+    int          h      = image->h;
+    SDL_Window * window = SDL_CreateWindow("SDL2 Displaying Image",
+                                           SDL_WINDOWPOS_CENTERED,
+                                           SDL_WINDOWPOS_CENTERED,
+                                           w < 320 ? 320 + 32 : w + 32,
+                                           h < 240 ? 240 + 32 : h + 32,
+                                           0);
+    SDL_Surface * screen = window ? SDL_GetWindowSurface(window) : nullptr;
+    if (screen)
+    {
+        bool quit      = false;
+        int  spincount = 120;
+        while (!quit && --spincount)
+        {
+            SDL_Rect dstrect;
+            dstrect.x = 16;
+            dstrect.y = 16;
+            dstrect.w = w;
+            dstrect.h = h;
+            SDL_BlitSurface(image, NULL, screen, &dstrect);
+            SDL_UpdateWindowSurface(window);
+
+            SDL_Event event;
+            SDL_PollEvent(&event);
+            quit = event.type == SDL_QUIT || event.type == SDL_KEYDOWN;
+
+            SDL_Delay(17);
+        }
+    }
+    if (window)
+    {
+        SDL_DestroyWindow(window);
+    }
+    SDL_FreeSurface(image);
+}
+
+int main(int argc, char ** argv)
+{
+    char *                    mode_name = nullptr;
+    const char *              out_dir   = nullptr;
+    std::vector<const char *> files;
+
+    if (argc == 1)
+    {
+        help();
+    }
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (argv[a][0] == '-')
+        {
+            if (strcmp("-n", argv[a]) == 0)
+            {
+                add_noise = true;
+            }
+            else if (strcmp("-d", argv[a]) == 0)
+            {
+                display_pic = true;
+            }
+            else if (strcmp("-i", argv[a]) == 0)
+            {
+                interleave_RG_B = true;
+            }
+            else if (strcmp("-p", argv[a]) == 0)
+            {
+                write_palette = true;
+            }
+            else if (strcmp("-m", argv[a]) == 0)
+            {
+                opt_palette = true;
+            }
+            else if (strcmp("-s", argv[a]) == 0)
+            {
+                preshift = true;
+            }
+            else if (strcmp("-l", argv[a]) == 0 && a + 1 < argc)
+            {
+                dest_line_words = atoi(argv[++a]);
+            }
+            else if (strcmp("-a", argv[a]) == 0 && a + 1 < argc)
+            {
+                vram_addr = static_cast<int>(strtoul(argv[++a], nullptr, 0));
+            }
+            else if (strcmp("-8", argv[a]) == 0)
+            {
+                font_height = 8;
+            }
+            else if (strcmp("-16", argv[a]) == 0)
+            {
+                font_height = 16;
+            }
+            else if (strcmp("-g", argv[a]) == 0 && a + 1 < argc)
+            {
+                glyph_ranges = argv[++a];
+            }
+            else if (strcmp("-G", argv[a]) == 0 && a + 1 < argc)
+            {
+                glyph_text = argv[++a];
+            }
+            else if (strcmp("-b", argv[a]) == 0 && a + 1 < argc)
+            {
+                glyph_base = static_cast<int>(strtoul(argv[++a], nullptr, 0));
+            }
+            else if (strcmp("-w", argv[a]) == 0)
+            {
+                glyph_widths = true;
+            }
+            else if (strcmp("-c", argv[a]) == 0 && a + 1 < argc)
+            {
+                num_colors = atoi(argv[++a]);
+                if (num_colors != 2 && num_colors != 16 && num_colors != 256 && num_colors != 4096)
+                {
+                    printf("Error: Unsupported number of colors %d\n", num_colors);
+                    help();
+                }
+            }
+            else if (strcmp("-D", argv[a]) == 0 && a + 1 < argc)
+            {
+                if (!xosera_dither_name(argv[++a], dither_mode))
+                {
+                    printf("Error: Unrecognized dither \"%s\"\n", argv[a]);
+                    help();
+                }
+            }
+            else if (strcmp("-j", argv[a]) == 0 && a + 1 < argc)
+            {
+                num_threads = atoi(argv[++a]);
+            }
+            else if (strcmp("-o", argv[a]) == 0 && a + 1 < argc)
+            {
+                out_dir = argv[++a];
+            }
+            else if (strcmp("-raw", argv[a]) == 0)
+            {
+                out_raw = true;
+            }
+            else if (strcmp("-ch", argv[a]) == 0)
+            {
+                out_ch = true;
+            }
+            else if (strcmp("-as", argv[a]) == 0)
+            {
+                out_as = true;
+            }
+            else if (strcmp("-memh", argv[a]) == 0)
+            {
+                out_memh = true;
+            }
+            else
+            {
+                printf("Unexpected option: '%s'\n", argv[a]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!mode_name)
+        {
+            mode_name = argv[a];
+        }
+        else
+        {
+            files.push_back(argv[a]);
+        }
+    }
+
+    if (!mode_name)
+    {
+        printf("Error: A conversion <mode> is required.\n");
+        help();
+    }
+
+    convert_mode mode = MODE_BITMAP;
+    if (strcmp(mode_name, "font") == 0)
+    {
+        mode = MODE_FONT;
+    }
+    else if (strcmp(mode_name, "bitmap") == 0)
+    {
+        mode = MODE_BITMAP;
+    }
+    else if (strcmp(mode_name, "cut") == 0)
+    {
+        mode = MODE_CUT;
+    }
+    else if (strcmp(mode_name, "tile") == 0)
+    {
+        mode = MODE_TILE;
+    }
+    else if (strcmp(mode_name, "anim") == 0)
+    {
+        mode = MODE_ANIM;
+    }
+    else if (strcmp(mode_name, "scene") == 0)
+    {
+        mode = MODE_SCENE;
+    }
+    else if (strcmp(mode_name, "pal") == 0)
+    {
+        mode = MODE_PAL;
+    }
+    else
+    {
+        printf("Error: Unrecognized conversion <mode> \"%s\".\n", mode_name);
+        help();
+    }
+
+    if (!files.size())
+    {
+        printf("Error: An <input_file> is required.\n");
+        help();
+    }
+
+    // input and output basename pairs
+    std::vector<std::pair<const char *, std::string>> jobs;
+    if (out_dir)
+    {
+        for (auto f : files)
+        {
+            std::string base = f;
+            size_t      dir  = base.find_last_of("/\\");
+            if (dir != std::string::npos)
+                base = base.substr(dir + 1);
+            size_t ext = base.rfind('.');
+            if (ext != std::string::npos && ext != 0)
+                base.resize(ext);
+            jobs.push_back({f, std::string(out_dir) + "/" + base});
+        }
+    }
+    else if (mode == MODE_ANIM && files.size() >= 2)
+    {
+        for (size_t f = 0; f + 1 < files.size(); f++)
+        {
+            jobs.push_back({files[f], files.back()});
+        }
+    }
+    else if (files.size() == 2)
+    {
+        jobs.push_back({files[0], files[1]});
+    }
+    else
+    {
+        printf("Error: Expected <input_file> and <out_basename> (or -o <out_dir> for multiple files).\n");
+        help();
+    }
+
+    if (!out_raw && !out_ch && !out_as && !out_memh)
+    {
+        out_raw = true;
+    }
+
+    if (mode == MODE_FONT)
+    {
+        num_colors = 2;
+    }
+
+    SDL_Init(display_pic ? SDL_INIT_VIDEO : 0);
+    IMG_Init(IMG_INIT_PNG);
+
+    if (display_pic && jobs.size() == 1)
+    {
+        show_image(jobs[0].first);
+    }
+
+    // animation frames are converted together to one stream (named for the first frame with -o)
+    if (mode == MODE_ANIM)
+    {
+        std::vector<const char *> frame_files;
+        for (auto & job : jobs)
+        {
+            frame_files.push_back(job.first);
+        }
+        std::string log;
+        bool        ok = convert_anim(frame_files, jobs[0].second, mode_name, log);
+        printf("%s\n", log.c_str());
+
+        IMG_Quit();
+        SDL_Quit();
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // convert each input on a pool of threads (output log printed per file, in input order)
+    int threads = xosera_batch_threads(jobs.size(), num_threads);
+    row_threads = threads == 1;
+    int failed  = xosera_batch(jobs.size(), threads, [&](size_t j, std::string & log) {
+        return convert_file(mode, mode_name, jobs[j].first, jobs[j].second, log);
+    });
+
+    if (jobs.size() > 1)
     {
-        SDL_FreeSurface(image);
+        printf("Converted %zu of %zu files using %d thread%s.\n",
+               jobs.size() - failed,
+               jobs.size(),
+               threads,
+               threads == 1 ? "" : "s");
     }
-#endif
 
     IMG_Quit();
     SDL_Quit();
 
-    return 0;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,151 @@
+// Error diffusion and ordered dithering shared by Xosera image utilities
+// See top-level LICENSE file for license information. (Hint: MIT)
+//
+// xosera_dither() walks the image once, top to bottom, quantizing each pixel with a caller supplied function (to
+// RGB444 levels or a palette index) and spreading the quantization error to neighbors.  Error diffusion uses serpentine
+// scanning (alternate rows right to left) to avoid directional artifacts, and only keeps three rows of integer error
+// (the current row and the two below it), so it stays in cache for any image size.
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+enum xosera_dither_mode
+{
+    XOSERA_DITHER_NONE,            // nearest color
+    XOSERA_DITHER_FLOYD,           // Floyd-Steinberg error diffusion (7/16, 3/16, 5/16, 1/16)
+    XOSERA_DITHER_ATKINSON,        // Atkinson error diffusion (1/8 to six neighbors, 3/4 of error total)
+    XOSERA_DITHER_BAYER            // 8x8 Bayer ordered dither
+};
+
+// dither option name ("fs", "atkinson" or "bayer") to mode (returns false if not recognized)
+inline bool xosera_dither_name(const char * name, xosera_dither_mode & mode)
+{
+    if (strcmp(name, "none") == 0)
+        mode = XOSERA_DITHER_NONE;
+    else if (strcmp(name, "fs") == 0)
+        mode = XOSERA_DITHER_FLOYD;
+    else if (strcmp(name, "atkinson") == 0)
+        mode = XOSERA_DITHER_ATKINSON;
+    else if (strcmp(name, "bayer") == 0)
+        mode = XOSERA_DITHER_BAYER;
+    else
+        return false;
+    return true;
+}
+
+// RGB444 quantizer for xosera_dither (8-bit channels to nearest 4-bit level, as displayed by Xosera)
+struct xosera_dither_rgb444
+{
+    int operator()(int rgb[3]) const
+    {
+        int value = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            int level = std::min((rgb[c] + 8) / 17, 15);
+            rgb[c]    = level * 17;
+            value     = (value << 4) | level;
+        }
+        return value;        // 0x0RGB
+    }
+};
+
+// Dither w x h image.  get(x, y) returns 0xRRGGBB, quant(int rgb[3]) returns output value (and replaces rgb with the
+// displayed 8-bit color), and put(x, y, value) stores it.  Bayer threshold amplitude is spread (roughly the distance
+// between output colors in 8-bit units, e.g., 17 for RGB444).
+template <typename GET, typename QUANT, typename PUT>
+void xosera_dither(xosera_dither_mode mode, int w, int h, GET get, QUANT quant, PUT put, int spread = 17)
+{
+    static const uint8_t bayer8[8][8] = {{0, 32, 8, 40, 2, 34, 10, 42},
+                                         {48, 16, 56, 24, 50, 18, 58, 26},
+                                         {12, 44, 4, 36, 14, 46, 6, 38},
+                                         {60, 28, 52, 20, 62, 30, 54, 22},
+                                         {3, 35, 11, 43, 1, 33, 9, 41},
+                                         {51, 19, 59, 27, 49, 17, 57, 25},
+                                         {15, 47, 7, 39, 13, 45, 5, 37},
+                                         {63, 31, 55, 23, 61, 29, 53, 21}};
+
+    // error kernel taps (dx, dy, weight) and divisor
+    struct tap_t
+    {
+        int dx, dy, weight;
+    };
+    static const tap_t floyd[]    = {{1, 0, 7}, {-1, 1, 3}, {0, 1, 5}, {1, 1, 1}};
+    static const tap_t atkinson[] = {{1, 0, 1}, {2, 0, 1}, {-1, 1, 1}, {0, 1, 1}, {1, 1, 1}, {0, 2, 1}};
+
+    const tap_t * taps     = mode == XOSERA_DITHER_FLOYD ? floyd : atkinson;
+    int           num_taps = mode == XOSERA_DITHER_FLOYD ? 4 : 6;
+    int           divisor  = mode == XOSERA_DITHER_FLOYD ? 16 : 8;
+    bool          diffuse  = mode == XOSERA_DITHER_FLOYD || mode == XOSERA_DITHER_ATKINSON;
+
+    // three rows of RGB error (scaled by divisor), with two pixel border on each side
+    const int        pad    = 2;
+    const int        stride = (w + pad * 2) * 3;
+    std::vector<int> err_rows(diffuse ? stride * 3 : 0, 0);
+    int *            rows[3] = {nullptr, nullptr, nullptr};
+    if (diffuse)
+    {
+        rows[0] = &err_rows[0];
+        rows[1] = &err_rows[stride];
+        rows[2] = &err_rows[stride * 2];
+    }
+
+    for (int y = 0; y < h; y++)
+    {
+        int dir    = (diffuse && (y & 1)) ? -1 : 1;        // serpentine
+        int x      = dir > 0 ? 0 : w - 1;
+        int x_stop = dir > 0 ? w : -1;
+        for (; x != x_stop; x += dir)
+        {
+            uint32_t pixel  = get(x, y);
+            int      rgb[3] = {static_cast<int>((pixel >> 16) & 0xff),
+                               static_cast<int>((pixel >> 8) & 0xff),
+                               static_cast<int>(pixel & 0xff)};
+            int      want[3];
+
+            if (diffuse)
+            {
+                const int * e = &rows[0][(x + pad) * 3];
+                for (int c = 0; c < 3; c++)
+                {
+                    rgb[c] = std::clamp(rgb[c] + e[c] / divisor, 0, 255);
+                }
+            }
+            else if (mode == XOSERA_DITHER_BAYER)
+            {
+                int t = ((bayer8[y & 7][x & 7] * 2 + 1 - 64) * spread) / 128;
+                for (int c = 0; c < 3; c++)
+                {
+                    rgb[c] = std::clamp(rgb[c] + t, 0, 255);
+                }
+            }
+
+            memcpy(want, rgb, sizeof(want));
+            put(x, y, quant(rgb));
+
+            if (diffuse)
+            {
+                for (int t = 0; t < num_taps; t++)
+                {
+                    int * e = &rows[taps[t].dy][(x + taps[t].dx * dir + pad) * 3];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        e[c] += (want[c] - rgb[c]) * taps[t].weight;
+                    }
+                }
+            }
+        }
+
+        if (diffuse)
+        {
+            int * done = rows[0];
+            rows[0]    = rows[1];
+            rows[1]    = rows[2];
+            rows[2]    = done;
+            memset(done, 0, stride * sizeof(int));
+        }
+    }
+}
@@ -0,0 +1,311 @@
+// Image decode (with persistent decoded image cache) shared by Xosera image utilities
+// See top-level LICENSE file for license information. (Hint: MIT)
+//
+// xosera_image_load() decodes any SDL_image format once into a canonical ARGB8888 buffer (one uint32_t 0xAARRGGBB
+// per pixel, converted by SDL in a single pass), plus palette indices for 8-bit indexed images, so tools read
+// pixels directly instead of switching on surface format for every pixel.
+//
+// Decoded images are cached on disk keyed by a hash of the input file contents (and size), so converting unchanged
+// inputs again only maps the cached pixels.  The cache is in $XOSERA_IMAGE_CACHE (set to "" or "0" to disable),
+// else $XDG_CACHE_HOME/xosera or ~/.cache/xosera.  Cache files are host native and can be deleted at any time.
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include "xosera_mmap.h"
+
+#define XOSERA_IMAGE_CACHE_MAGIC   0x474D4958        // "XIMG"
+#define XOSERA_IMAGE_CACHE_VERSION 1
+
+// decoded image
+struct xosera_image
+{
+    std::string           name;            // input file name
+    int                   w = 0;
+    int                   h = 0;
+    std::vector<uint32_t> argb;            // 0xAARRGGBB per pixel
+    std::vector<uint8_t>  index;           // palette index per pixel (if indexed image)
+    std::vector<uint32_t> palette;         // 0x00RRGGBB palette colors (if indexed image)
+    bool                  cached = false;        // loaded from decoded image cache
+
+    uint32_t pixel(int x, int y) const
+    {
+        return argb[y * w + x];
+    }
+
+    SDL_Color color(int x, int y) const
+    {
+        uint32_t p = argb[y * w + x];
+        return SDL_Color{static_cast<Uint8>(p >> 16),
+                         static_cast<Uint8>(p >> 8),
+                         static_cast<Uint8>(p),
+                         static_cast<Uint8>(p >> 24)};
+    }
+};
+
+// decoded image cache file header (followed by palette, pixels and indices)
+struct xosera_image_cache_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;                  // input file contents hash
+    uint64_t file_size;             // input file size
+    int32_t  w;
+    int32_t  h;
+    uint32_t palette_colors;
+    uint32_t indexed;
+};
+
+// 64-bit hash of file contents (eight bytes per step, final avalanche mix)
+inline uint64_t xosera_image_hash(const uint8_t * data, size_t size)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ (size * 0xFF51AFD7ED558CCDull);
+    size_t   i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t v;
+        memcpy(&v, data + i, sizeof(v));
+        h = (h ^ v) * 0x100000001B3ull;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++)
+    {
+        h = (h ^ data[i]) * 0x100000001B3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// cache directory (created if needed), empty if cache disabled or unavailable
+inline std::string xosera_image_cache_dir()
+{
+    std::string  dir;
+    const char * env = getenv("XOSERA_IMAGE_CACHE");
+    if (env)
+    {
+        if (!env[0] || strcmp(env, "0") == 0)
+        {
+            return dir;
+        }
+        dir = env;
+    }
+    else if ((env = getenv("XDG_CACHE_HOME")) && env[0])
+    {
+        dir = std::string(env) + "/xosera";
+    }
+    else if ((env = getenv("HOME")) && env[0])
+    {
+        dir = std::string(env) + "/.cache/xosera";
+    }
+    else
+    {
+        return dir;
+    }
+
+    // create each missing path component
+    for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1))
+    {
+        std::string part = dir.substr(0, slash);
+        if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            return std::string();
+        }
+        if (slash == std::string::npos)
+        {
+            break;
+        }
+    }
+    return dir;
+}
+
+inline std::string xosera_image_cache_file(const std::string & dir, uint64_t hash)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.ximg", static_cast<unsigned long long>(hash));
+    return dir + name;
+}
+
+// load decoded image from cache (false if not cached or cache file is not valid)
+inline bool xosera_image_cache_load(const std::string & cache_file, uint64_t hash, size_t size, xosera_image & img)
+{
+    if (access(cache_file.c_str(), R_OK) != 0)
+    {
+        return false;
+    }
+    xosera_mmap_in in;
+    std::string    error;        // not cached (not an error)
+    if (!in.open(cache_file.c_str(), &error) || in.size < sizeof(xosera_image_cache_header))
+    {
+        return false;
+    }
+    xosera_image_cache_header hdr;
+    memcpy(&hdr, in.data, sizeof(hdr));
+    size_t pixels = static_cast<size_t>(hdr.w) * hdr.h;
+    if (hdr.magic != XOSERA_IMAGE_CACHE_MAGIC || hdr.version != XOSERA_IMAGE_CACHE_VERSION || hdr.hash != hash ||
+        hdr.file_size != size || hdr.w <= 0 || hdr.h <= 0 || hdr.palette_colors > 256 ||
+        in.size != sizeof(hdr) + hdr.palette_colors * 4 + pixels * 4 + (hdr.indexed ? pixels : 0))
+    {
+        return false;
+    }
+
+    const uint8_t * p = in.data + sizeof(hdr);
+    img.w             = hdr.w;
+    img.h             = hdr.h;
+    img.palette.resize(hdr.palette_colors);
+    memcpy(img.palette.data(), p, hdr.palette_colors * 4);
+    p += hdr.palette_colors * 4;
+    img.argb.resize(pixels);
+    memcpy(img.argb.data(), p, pixels * 4);
+    p += pixels * 4;
+    img.index.assign(p, p + (hdr.indexed ? pixels : 0));
+    img.cached = true;
+    return true;
+}
+
+// write decoded image to cache (written to a temporary file and renamed, so concurrent runs never see partial files)
+inline void xosera_image_cache_save(const std::string &  cache_file,
+                                    uint64_t             hash,
+                                    size_t               size,
+                                    const xosera_image & img)
+{
+    xosera_image_cache_header hdr = {XOSERA_IMAGE_CACHE_MAGIC,
+                                     XOSERA_IMAGE_CACHE_VERSION,
+                                     hash,
+                                     size,
+                                     img.w,
+                                     img.h,
+                                     static_cast<uint32_t>(img.palette.size()),
+                                     img.index.empty() ? 0u : 1u};
+
+    std::string temp_file = cache_file + "." + std::to_string(getpid()) + "." +
+                            std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        xosera_mmap_out out;
+        std::string     error;        // cache is optional (not saving it is not an error)
+        size_t          out_size = sizeof(hdr) + img.palette.size() * 4 + img.argb.size() * 4 + img.index.size();
+        if (!out.create(temp_file.c_str(), out_size, &error))
+        {
+            return;
+        }
+        uint8_t * p = out.data;
+        memcpy(p, &hdr, sizeof(hdr));
+        p += sizeof(hdr);
+        memcpy(p, img.palette.data(), img.palette.size() * 4);
+        p += img.palette.size() * 4;
+        memcpy(p, img.argb.data(), img.argb.size() * 4);
+        p += img.argb.size() * 4;
+        memcpy(p, img.index.data(), img.index.size());
+        if (!out.close(&error))
+        {
+            unlink(temp_file.c_str());
+            return;
+        }
+    }
+    if (rename(temp_file.c_str(), cache_file.c_str()) != 0)
+    {
+        unlink(temp_file.c_str());
+    }
+}
+
+// decode image file (or load it from cache), sets error message and returns false on failure
+inline bool xosera_image_load(const char * file_name, xosera_image & img, std::string & error)
+{
+    img      = xosera_image();
+    img.name = file_name;
+
+    xosera_mmap_in in;
+    if (access(file_name, R_OK) != 0)
+    {
+        error = std::string("Unable to open \"") + file_name + "\": " + strerror(errno);
+        return false;
+    }
+    if (!in.open(file_name, &error))
+    {
+        return false;
+    }
+
+    uint64_t    hash       = xosera_image_hash(in.data, in.size);
+    std::string cache_dir  = xosera_image_cache_dir();
+    std::string cache_file = cache_dir.empty() ? cache_dir : xosera_image_cache_file(cache_dir, hash);
+    if (!cache_file.empty() && xosera_image_cache_load(cache_file, hash, in.size, img))
+    {
+        return true;
+    }
+
+    // decode from the mapped file (extension is a type hint for formats without a signature, e.g., TGA)
+    const char *  ext   = strrchr(file_name, '.');
+    SDL_RWops *   rw    = SDL_RWFromConstMem(in.data, static_cast<int>(in.size));
+    SDL_Surface * image = rw ? IMG_LoadTyped_RW(rw, 1, ext ? ext + 1 : "") : nullptr;
+    if (!image)
+    {
+        error = std::string("Unable to load \"") + file_name + "\": " + SDL_GetError();
+        return false;
+    }
+
+    SDL_Palette * pal = image->format->palette;
+    if (pal && image->format->BitsPerPixel == 8)
+    {
+        for (int i = 0; i < pal->ncolors; i++)
+        {
+            const SDL_Color & c = pal->colors[i];
+            img.palette.push_back((c.r << 16) | (c.g << 8) | c.b);
+        }
+    }
+
+    // one conversion pass by SDL (blit to ARGB8888), then copy rows
+    SDL_Surface * argb = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_ARGB8888, 0);
+    if (!argb)
+    {
+        error = std::string("Unable to convert \"") + file_name + "\": " + SDL_GetError();
+        SDL_FreeSurface(image);
+        return false;
+    }
+
+    img.w = image->w;
+    img.h = image->h;
+    img.argb.resize(static_cast<size_t>(img.w) * img.h);
+    img.index.resize(img.palette.size() ? img.argb.size() : 0);
+    SDL_LockSurface(argb);
+    SDL_LockSurface(image);
+    for (int y = 0; y < img.h; y++)
+    {
+        memcpy(&img.argb[y * img.w], static_cast<const Uint8 *>(argb->pixels) + y * argb->pitch, img.w * 4);
+        if (img.index.size())
+        {
+            memcpy(&img.index[y * img.w], static_cast<const Uint8 *>(image->pixels) + y * image->pitch, img.w);
+        }
+    }
+    SDL_UnlockSurface(image);
+    SDL_UnlockSurface(argb);
+
+    SDL_FreeSurface(argb);
+    SDL_FreeSurface(image);
+
+    if (!cache_file.empty())
+    {
+        xosera_image_cache_save(cache_file, hash, in.size, img);
+    }
+
+    return true;
+}
+
+// SDL surface using decoded image pixels (for display, image must outlive surface)
+inline SDL_Surface * xosera_image_surface(xosera_image & img)
+{
+    return SDL_CreateRGBSurfaceWithFormatFrom(img.argb.data(), img.w, img.h, 32, img.w * 4, SDL_PIXELFORMAT_ARGB8888);
+}
@@ -0,0 +1,265 @@
+// Xosera XLZ compressed asset packer
+// See top-level LICENSE file for license information. (Hint: MIT)
+// vim: set et ts=4 sw=4
+//
+// Packs a raw big-endian word file (e.g., xosera_convert .raw bitmap, tiles or font) into an XLZ container for
+// xosera_lz_unpack() in xosera_m68k_api, or unpacks an XLZ container back to raw.  With -t the packed file is
+// decoded again and compared, and load time is compared for raw and packed files (SD card reads on rosco_m68k are
+// much slower than unpacking, so load time mostly scales with file size).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include "xosera_lz.h"
+#include "xosera_mmap.h"
+
+const char *     in_file     = nullptr;
+const char *     out_file    = nullptr;
+const char *     pal_file    = nullptr;
+bool             unpack      = false;
+bool             verify      = false;
+int              chain       = 64;
+double           sd_kb_per_s = 0.0;        // SD card read rate for load time estimate (0 = none)
+int              bpp         = -1;         // GFX_1_BPP, GFX_4_BPP, GFX_8_BPP (-1 = not an image)
+xosera_lz_header header;
+
+static void help()
+{
+    printf("xosera_lz: Pack raw Xosera data into XLZ compressed container (or unpack)\n");
+    printf("Usage:  xosera_lz [options ...] <input.raw> <output.xlz>\n");
+    printf("        xosera_lz -u <input.xlz> <output.raw>\n");
+    printf("Options:\n");
+    printf(" -a n   Target VRAM or XR address (default 0x0000)\n");
+    printf(" -x     Target is XR memory (default VRAM)\n");
+    printf(" -b n   Image bits per pixel (1, 4 or 8)\n");
+    printf(" -w n   Image width in words per line\n");
+    printf(" -h n   Image height in lines\n");
+    printf(" -p f   Include colormem palette from raw palette file\n");
+    printf(" -c n   Maximum match candidates checked per word (default 64)\n");
+    printf(" -t     Verify packed data and compare raw and packed load\n");
+    printf(" -s n   SD card read rate in KB/s for load time estimate (with -t)\n");
+    printf(" -u     Unpack XLZ container to raw file\n");
+
+    exit(EXIT_FAILURE);
+}
+
+// big-endian words from mapped file (Xosera memory is only written a word at a time, so odd length is an error)
+static std::vector<uint16_t> read_words(const char * file_name, const xosera_mmap_in & in)
+{
+    if (in.size & 1)
+    {
+        printf("*** File \"%s\" is %zu bytes (must be an even number of bytes, Xosera memory is 16-bit words)\n",
+               file_name,
+               in.size);
+        exit(EXIT_FAILURE);
+    }
+    std::vector<uint16_t> words(in.size / 2);
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        words[i] = static_cast<uint16_t>(in.data[i * 2] << 8 | in.data[i * 2 + 1]);
+    }
+    return words;
+}
+
+static bool write_words(const char * file_name, const std::vector<uint16_t> & words)
+{
+    xosera_mmap_out out;
+    if (!out.create(file_name, words.size() * 2))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        out.data[i * 2]     = words[i] >> 8;
+        out.data[i * 2 + 1] = words[i] & 0xff;
+    }
+    if (!out.close())
+    {
+        printf("*** Error writing output file \"%s\"\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    for (int a = 1; a < argc; a++)
+    {
+        if (argv[a][0] == '-')
+        {
+            if (strcmp("-a", argv[a]) == 0 && a + 1 < argc)
+            {
+                header.address = static_cast<uint16_t>(strtoul(argv[++a], nullptr, 0));
+            }
+            else if (strcmp("-x", argv[a]) == 0)
+            {
+                header.flags |= XLZ_FLAG_XR;
+            }
+            else if (strcmp("-b", argv[a]) == 0 && a + 1 < argc)
+            {
+                int bits = atoi(argv[++a]);
+                bpp      = bits == 1 ? 0 : bits == 4 ? 1 : bits == 8 ? 2 : -1;
+                if (bpp < 0)
+                {
+                    printf("Error: Unsupported bits per pixel %d\n", bits);
+                    help();
+                }
+            }
+            else if (strcmp("-w", argv[a]) == 0 && a + 1 < argc)
+            {
+                header.width = static_cast<uint16_t>(atoi(argv[++a]));
+            }
+            else if (strcmp("-h", argv[a]) == 0 && a + 1 < argc)
+            {
+                header.height = static_cast<uint16_t>(atoi(argv[++a]));
+            }
+            else if (strcmp("-p", argv[a]) == 0 && a + 1 < argc)
+            {
+                pal_file = argv[++a];
+            }
+            else if (strcmp("-c", argv[a]) == 0 && a + 1 < argc)
+            {
+                chain = std::max(1, atoi(argv[++a]));
+            }
+            else if (strcmp("-s", argv[a]) == 0 && a + 1 < argc)
+            {
+                sd_kb_per_s = atof(argv[++a]);
+            }
+            else if (strcmp("-t", argv[a]) == 0)
+            {
+                verify = true;
+            }
+            else if (strcmp("-u", argv[a]) == 0)
+            {
+                unpack = true;
+            }
+            else
+            {
+                printf("Unexpected option: '%s'\n", argv[a]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!in_file)
+        {
+            in_file = argv[a];
+        }
+        else if (!out_file)
+        {
+            out_file = argv[a];
+        }
+        else
+        {
+            printf("Unexpected extra argument: '%s'\n", argv[a]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!in_file || !out_file)
+    {
+        help();
+    }
+
+    xosera_mmap_in in;
+    if (!in.open(in_file))
+    {
+        exit(EXIT_FAILURE);
+    }
+    std::vector<uint16_t> in_words = read_words(in_file, in);
+
+    if (unpack)
+    {
+        std::vector<uint16_t> palette, words;
+        if (!xosera_lz_unpack(in_words, header, palette, words))
+        {
+            printf("*** \"%s\" is not a valid XLZ container\n", in_file);
+            exit(EXIT_FAILURE);
+        }
+        printf("Unpacked \"%s\": %zu words for %s 0x%04x (%zu palette words not written)\n",
+               in_file,
+               words.size(),
+               header.flags & XLZ_FLAG_XR ? "XR" : "VRAM",
+               header.address,
+               palette.size());
+        return write_words(out_file, words) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (bpp >= 0 || header.width || header.height)
+    {
+        header.flags |= XLZ_FLAG_IMAGE | ((bpp < 0 ? 0 : bpp) << XLZ_BPP_SHIFT);
+    }
+
+    if (header.address + in_words.size() > 0x10000)
+    {
+        printf("*** %zu words at %s 0x%04x will not fit in Xosera memory\n",
+               in_words.size(),
+               header.flags & XLZ_FLAG_XR ? "XR" : "VRAM",
+               header.address);
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<uint16_t> palette;
+    if (pal_file)
+    {
+        xosera_mmap_in pal;
+        if (!pal.open(pal_file))
+        {
+            exit(EXIT_FAILURE);
+        }
+        palette = read_words(pal_file, pal);
+    }
+
+    auto                  t0     = std::chrono::steady_clock::now();
+    std::vector<uint16_t> packed = xosera_lz_pack(header, in_words, palette, chain);
+    auto                  t1     = std::chrono::steady_clock::now();
+
+    size_t raw_bytes    = in_words.size() * 2 + palette.size() * 2;
+    size_t packed_bytes = packed.size() * 2;
+    printf("Packed \"%s\": %zu bytes to %zu bytes (%.1f%%) in %.1f ms\n",
+           in_file,
+           raw_bytes,
+           packed_bytes,
+           100.0 * packed_bytes / std::max<size_t>(raw_bytes, 1),
+           std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+    if (verify)
+    {
+        xosera_lz_header      check;
+        std::vector<uint16_t> check_pal, check_words;
+        auto                  t2 = std::chrono::steady_clock::now();
+        bool                  ok = xosera_lz_unpack(packed, check, check_pal, check_words);
+        auto                  t3 = std::chrono::steady_clock::now();
+        if (!ok || check_words != in_words || check_pal != palette || check.address != header.address ||
+            check.flags != header.flags || check.width != header.width || check.height != header.height)
+        {
+            printf("*** Verify FAILED: unpacked data does not match input\n");
+            exit(EXIT_FAILURE);
+        }
+        double ms = std::chrono::duration<double, std::milli>(t3 - t2).count();
+        printf("Verify OK: unpacked %zu words in %.2f ms (%.0f MB/s on host)\n",
+               check_words.size(),
+               ms,
+               raw_bytes / 1000.0 / std::max(ms, 0.001));
+
+        // SD card reads whole 512 byte sectors
+        size_t raw_sectors    = (raw_bytes + 511) / 512;
+        size_t packed_sectors = (packed_bytes + 511) / 512;
+        printf("SD load: %zu sectors raw, %zu sectors packed (%.1f%% of raw read time)\n",
+               raw_sectors,
+               packed_sectors,
+               100.0 * packed_sectors / std::max<size_t>(raw_sectors, 1));
+        if (sd_kb_per_s > 0.0)
+        {
+            printf("SD load at %.0f KB/s: %.2f s raw, %.2f s packed\n",
+                   sd_kb_per_s,
+                   raw_sectors * 0.5 / sd_kb_per_s,
+                   packed_sectors * 0.5 / sd_kb_per_s);
+        }
+    }
+
+    return write_words(out_file, packed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
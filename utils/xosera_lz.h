@@ -0,0 +1,220 @@
+// XLZ compressed Xosera asset container (encoder and reference decoder) shared by Xosera utilities
+// See top-level LICENSE file for license information. (Hint: MIT)
+//
+// An XLZ file is big-endian 16-bit words (as the 68K reads them): a header with the target VRAM or XR address, size
+// and image format, optional colormem palette words, then an LZ77 token stream over words (Xosera memory is written
+// a word at a time, so matching whole words keeps the 68K decoder inner loops to one move per word):
+//
+//   0x0000              end of stream
+//   0x0001-0x7FFF       n literal words follow
+//   0x8000 | n, dist    copy n words (n >= 3) starting dist words back (1 to XLZ_WINDOW, may overlap for runs)
+//
+// The streaming decoder in xosera_m68k_api (xosera_lz_unpack) keeps the last XLZ_WINDOW words in RAM for matches
+// and writes output straight to XM_DATA (or XM_XDATA), so it can unpack each SD card sector as it is read.
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+// NOTE: keep in sync with xosera_m68k_api.h
+#define XLZ_MAGIC        0x584C        // "XL"
+#define XLZ_VERSION      0x5A01        // "Z" + version 1
+#define XLZ_HEADER_WORDS 9             // magic, version, flags, address, size (2 words), width, height, palette size
+#define XLZ_WINDOW       4096          // match history words (power of two)
+#define XLZ_MIN_MATCH    3             // shortest match worth a token and distance word
+#define XLZ_MAX_RUN      0x7FFF        // maximum literal or match words per token
+
+#define XLZ_FLAG_XR    0x0001        // target is XR memory (otherwise VRAM)
+#define XLZ_FLAG_IMAGE 0x0002        // width, height and bpp are valid
+#define XLZ_BPP_SHIFT  2             // bits [3:2] image GFX_1_BPP, GFX_4_BPP or GFX_8_BPP
+
+struct xosera_lz_header
+{
+    uint16_t flags   = 0;
+    uint16_t address = 0;        // VRAM or XR address
+    uint32_t size    = 0;        // unpacked words
+    uint16_t width   = 0;        // image words per line
+    uint16_t height  = 0;        // image lines
+};
+
+// compress words into XLZ container (with optional palette), chain is maximum match candidates checked per word
+inline std::vector<uint16_t> xosera_lz_pack(const xosera_lz_header &     hdr,
+                                            const std::vector<uint16_t> & words,
+                                            const std::vector<uint16_t> & palette,
+                                            int                           chain = 64)
+{
+    std::vector<uint16_t> out = {XLZ_MAGIC,
+                                 XLZ_VERSION,
+                                 hdr.flags,
+                                 hdr.address,
+                                 static_cast<uint16_t>(words.size() >> 16),
+                                 static_cast<uint16_t>(words.size()),
+                                 hdr.width,
+                                 hdr.height,
+                                 static_cast<uint16_t>(palette.size())};
+    out.insert(out.end(), palette.begin(), palette.end());
+
+    // hash chains of word pairs (head is most recent position + 1 for each hash, 0 if none)
+    const int        hash_bits = 16;
+    const size_t     n         = words.size();
+    std::vector<int> head(1 << hash_bits, 0);
+    std::vector<int> prev(n, 0);
+    auto             hash = [&](size_t i) {
+        return ((static_cast<uint32_t>(words[i]) << 16 | words[i + 1]) * 2654435761u) >> (32 - hash_bits);
+    };
+    auto insert = [&](size_t i) {
+        if (i + 1 < n)
+        {
+            uint32_t h = hash(i);
+            prev[i]    = head[h];
+            head[h]    = static_cast<int>(i) + 1;
+        }
+    };
+    // longest match at i (returns length, sets dist)
+    auto longest = [&](size_t i, size_t & dist) {
+        size_t best = 0;
+        if (i + 1 >= n)
+        {
+            return best;
+        }
+        size_t limit = std::min(n - i, static_cast<size_t>(XLZ_MAX_RUN));
+        int    tries = chain;
+        for (int c = head[hash(i)]; c && tries--; c = prev[c - 1])
+        {
+            size_t j = static_cast<size_t>(c - 1);
+            if (i - j > XLZ_WINDOW)
+            {
+                break;
+            }
+            size_t len = 0;
+            while (len < limit && words[j + len] == words[i + len])
+            {
+                len++;
+            }
+            if (len > best)
+            {
+                best = len;
+                dist = i - j;
+                if (len == limit)
+                {
+                    break;
+                }
+            }
+        }
+        return best;
+    };
+
+    size_t lit_start = 0;
+    auto   flush     = [&](size_t end) {
+        while (lit_start < end)
+        {
+            size_t count = std::min(end - lit_start, static_cast<size_t>(XLZ_MAX_RUN));
+            out.push_back(static_cast<uint16_t>(count));
+            out.insert(out.end(), words.begin() + lit_start, words.begin() + lit_start + count);
+            lit_start += count;
+        }
+    };
+
+    for (size_t i = 0; i < n;)
+    {
+        size_t dist = 0;
+        size_t len  = longest(i, dist);
+        if (len >= XLZ_MIN_MATCH)
+        {
+            // lazy match: emit a literal instead if the match starting at the next word is longer
+            size_t next_dist = 0;
+            insert(i);
+            if (longest(i + 1, next_dist) > len + 1)
+            {
+                i++;
+                continue;
+            }
+            flush(i);
+            out.push_back(static_cast<uint16_t>(0x8000 | len));
+            out.push_back(static_cast<uint16_t>(dist));
+            for (size_t k = 1; k < len; k++)
+            {
+                insert(i + k);
+            }
+            i += len;
+            lit_start = i;
+        }
+        else
+        {
+            insert(i);
+            i++;
+        }
+    }
+    flush(n);
+    out.push_back(0x0000);
+
+    return out;
+}
+
+// reference decoder (same history window as the 68K decoder), returns false if container is not valid
+inline bool xosera_lz_unpack(const std::vector<uint16_t> & in,
+                             xosera_lz_header &            hdr,
+                             std::vector<uint16_t> &       palette,
+                             std::vector<uint16_t> &       words)
+{
+    if (in.size() < XLZ_HEADER_WORDS || in[0] != XLZ_MAGIC || in[1] != XLZ_VERSION)
+    {
+        return false;
+    }
+    hdr.flags   = in[2];
+    hdr.address = in[3];
+    hdr.size    = (static_cast<uint32_t>(in[4]) << 16) | in[5];
+    hdr.width   = in[6];
+    hdr.height  = in[7];
+
+    size_t p = XLZ_HEADER_WORDS;
+    if (p + in[8] > in.size())
+    {
+        return false;
+    }
+    palette.assign(in.begin() + p, in.begin() + p + in[8]);
+    p += in[8];
+
+    std::vector<uint16_t> hist(XLZ_WINDOW);
+    uint16_t              pos = 0;
+    words.clear();
+    while (p < in.size())
+    {
+        uint16_t token = in[p++];
+        if (token == 0)
+        {
+            return words.size() == hdr.size;
+        }
+        uint16_t count = token & 0x7FFF;
+        if (token & 0x8000)
+        {
+            if (p >= in.size() || in[p] == 0 || in[p] > XLZ_WINDOW || in[p] > words.size())
+            {
+                return false;
+            }
+            uint16_t src = pos - in[p++];
+            while (count--)
+            {
+                uint16_t w                      = hist[src++ & (XLZ_WINDOW - 1)];
+                hist[pos++ & (XLZ_WINDOW - 1)] = w;
+                words.push_back(w);
+            }
+        }
+        else
+        {
+            if (p + count > in.size())
+            {
+                return false;
+            }
+            while (count--)
+            {
+                uint16_t w                      = in[p++];
+                hist[pos++ & (XLZ_WINDOW - 1)] = w;
+                words.push_back(w);
+            }
+        }
+    }
+    return false;        // no end token
+}
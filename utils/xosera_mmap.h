@@ -0,0 +1,179 @@
+// Memory-mapped file I/O shared by Xosera raw file utilities
+// See top-level LICENSE file for license information. (Hint: MIT)
+//
+// Input files are mapped read-only (never read into heap buffers) and output files are created at their final size
+// and written through one shared mapping, so data is transformed straight from the input pages into the output pages.
+// Mappings are advised as sequential, so the kernel reads ahead and drops pages behind a streaming pass.
+// Errors are printed, or returned in *error when given (e.g., for a batch job log or a silent cache miss).
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+// set *error to msg if given, otherwise print it
+inline void xosera_mmap_error(std::string * error, const std::string & msg)
+{
+    if (error)
+    {
+        *error = msg;
+    }
+    else
+    {
+        printf("*** %s\n", msg.c_str());
+    }
+}
+
+// read-only mapping of an input file
+struct xosera_mmap_in
+{
+    const uint8_t * data = nullptr;
+    size_t          size = 0;
+
+    xosera_mmap_in() = default;
+    xosera_mmap_in(const xosera_mmap_in &) = delete;
+    xosera_mmap_in & operator=(const xosera_mmap_in &) = delete;
+
+    ~xosera_mmap_in()
+    {
+        close();
+    }
+
+    // map file (prints error or sets *error, and returns false on failure)
+    bool open(const char * file_name, std::string * error = nullptr)
+    {
+        close();
+        int fd = ::open(file_name, O_RDONLY);
+        if (fd < 0)
+        {
+            xosera_mmap_error(error,
+                              std::string("Unable to open input file \"") + file_name + "\": " + strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            xosera_mmap_error(error,
+                              std::string("Unable to stat input file \"") + file_name + "\": " + strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        if (size)        // zero length can't be mapped (but is a valid empty file)
+        {
+            void * ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED)
+            {
+                xosera_mmap_error(error,
+                                  std::string("Unable to map input file \"") + file_name + "\": " + strerror(errno));
+                ::close(fd);
+                size = 0;
+                return false;
+            }
+            madvise(ptr, size, MADV_SEQUENTIAL);
+            data = static_cast<const uint8_t *>(ptr);
+        }
+        ::close(fd);        // mapping stays valid after close
+        return true;
+    }
+
+    void close()
+    {
+        if (data)
+        {
+            munmap(const_cast<uint8_t *>(data), size);
+        }
+        data = nullptr;
+        size = 0;
+    }
+};
+
+// shared writable mapping of an output file, created (or truncated) at its final size
+struct xosera_mmap_out
+{
+    uint8_t * data = nullptr;
+    size_t    size = 0;
+
+    xosera_mmap_out() = default;
+    xosera_mmap_out(const xosera_mmap_out &) = delete;
+    xosera_mmap_out & operator=(const xosera_mmap_out &) = delete;
+
+    ~xosera_mmap_out()
+    {
+        close();
+    }
+
+    // create file of out_size bytes (zero filled) and map it (prints error or sets *error, and returns false)
+    bool create(const char * file_name, size_t out_size, std::string * error = nullptr)
+    {
+        close();
+        int fd = ::open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            xosera_mmap_error(error,
+                              std::string("Unable to open output file \"") + file_name + "\": " + strerror(errno));
+            return false;
+        }
+        if (ftruncate(fd, static_cast<off_t>(out_size)) != 0)
+        {
+            xosera_mmap_error(error,
+                              std::string("Unable to size output file \"") + file_name + "\": " + strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        // reserve blocks now (out of space writing a sparse mapped page would be SIGBUS, not an error return)
+        int rc = out_size ? posix_fallocate(fd, 0, static_cast<off_t>(out_size)) : 0;
+        if (rc != 0 && rc != EINVAL && rc != EOPNOTSUPP)        // not supported by every filesystem
+        {
+            xosera_mmap_error(error,
+                              std::string("Unable to allocate output file \"") + file_name + "\": " + strerror(rc));
+            ::close(fd);
+            return false;
+        }
+        if (out_size)
+        {
+            void * ptr = mmap(nullptr, out_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED)
+            {
+                xosera_mmap_error(error,
+                                  std::string("Unable to map output file \"") + file_name + "\": " + strerror(errno));
+                ::close(fd);
+                return false;
+            }
+            madvise(ptr, out_size, MADV_SEQUENTIAL);
+            data = static_cast<uint8_t *>(ptr);
+        }
+        size = out_size;
+        ::close(fd);
+        return true;
+    }
+
+    // flush written pages to the file and unmap, returns false on error (e.g., disk full, which mapped writes
+    // can't report until msync), printing error or setting *error
+    bool close(std::string * error = nullptr)
+    {
+        bool good = true;
+        if (data)
+        {
+            if (msync(data, size, MS_SYNC) != 0)
+            {
+                xosera_mmap_error(error, std::string("Unable to write output file: ") + strerror(errno));
+                good = false;
+            }
+            if (munmap(data, size) != 0)
+            {
+                good = false;
+            }
+        }
+        data = nullptr;
+        size = 0;
+        return good;
+    }
+};
@@ -0,0 +1,296 @@
+// Optimized 16/256 color palette generation shared by Xosera image utilities
+// See top-level LICENSE file for license information. (Hint: MIT)
+//
+// Pixels are counted in an RGB555 histogram, so clustering cost scales with the number of distinct colors rather
+// than pixels.  Distinct colors are converted to the Oklab perceptual color space, split into boxes with median cut,
+// then refined with weighted k-means.  Cluster centers are snapped to the nearest RGB444 color every iteration, so
+// the result is optimized for what colormem can actually display (not just rounded at the end).
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+struct xosera_palette
+{
+    enum
+    {
+        HIST_SIZE  = 32768,        // RGB555 histogram entries
+        RGB444_MAX = 4096,         // colormem colors
+        ITERATIONS = 16            // maximum k-means passes
+    };
+
+    struct lab_t
+    {
+        float L, a, b;
+    };
+
+    std::vector<uint32_t> hist;        // RGB555 pixel counts
+
+    xosera_palette()
+        : hist(HIST_SIZE, 0)
+    {
+    }
+
+    // count pixel with 8-bit r, g, b channels
+    void add(int r, int g, int b, uint32_t count = 1)
+    {
+        hist[((r & 0xf8) << 7) | ((g & 0xf8) << 2) | ((b & 0xf8) >> 3)] += count;
+    }
+
+    // sRGB channel (0.0-1.0) to Oklab
+    static lab_t to_lab(float r, float g, float b)
+    {
+        auto linear = [](float c) { return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f); };
+        r           = linear(r);
+        g           = linear(g);
+        b           = linear(b);
+
+        float l = cbrtf(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+        float m = cbrtf(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+        float s = cbrtf(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+
+        return {0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s,
+                1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s,
+                0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s};
+    }
+
+    static float dist(const lab_t & x, const lab_t & y)
+    {
+        float dL = x.L - y.L;
+        float da = x.a - y.a;
+        float db = x.b - y.b;
+        return dL * dL + da * da + db * db;
+    }
+
+    // generate up to num_colors RGB444 palette entries (sorted dark to light, unused entries are 0x000)
+    std::vector<uint16_t> generate(int num_colors, int iterations = ITERATIONS) const
+    {
+        struct entry_t
+        {
+            lab_t    lab;
+            float    weight;
+            uint16_t cluster;
+        };
+
+        // distinct colors (channel centered in RGB555 bin)
+        std::vector<entry_t> entries;
+        for (int i = 0; i < HIST_SIZE; i++)
+        {
+            if (hist[i])
+            {
+                lab_t lab = to_lab((((i >> 10) & 0x1f) * 8 + 4) / 255.0f,
+                                   (((i >> 5) & 0x1f) * 8 + 4) / 255.0f,
+                                   ((i & 0x1f) * 8 + 4) / 255.0f);
+                entries.push_back({lab, static_cast<float>(hist[i]), 0});
+            }
+        }
+
+        std::vector<uint16_t> palette(num_colors, 0);
+        if (entries.empty() || num_colors < 1)
+        {
+            return palette;
+        }
+
+        // Oklab of every colormem color (for snapping cluster centers)
+        std::vector<lab_t> lab444(RGB444_MAX);
+        for (int c = 0; c < RGB444_MAX; c++)
+        {
+            lab444[c] = to_lab(((c >> 8) & 0xf) / 15.0f, ((c >> 4) & 0xf) / 15.0f, (c & 0xf) / 15.0f);
+        }
+        auto snap = [&](const lab_t & lab) {
+            int   best      = 0;
+            float best_dist = dist(lab, lab444[0]);
+            for (int c = 1; c < RGB444_MAX; c++)
+            {
+                float d = dist(lab, lab444[c]);
+                if (d < best_dist)
+                {
+                    best      = c;
+                    best_dist = d;
+                }
+            }
+            return static_cast<uint16_t>(best);
+        };
+
+        // median cut: split the box with the largest weighted error at the weighted median of its widest axis
+        struct box_t
+        {
+            size_t begin, end;
+            int    axis;
+            float  error;
+        };
+        auto axis_value = [](const entry_t & e, int axis) {
+            return axis == 0 ? e.lab.L : axis == 1 ? e.lab.a : e.lab.b;
+        };
+        auto make_box = [&](size_t begin, size_t end) {
+            box_t  box    = {begin, end, 0, 0.0f};
+            double sum[3] = {}, sum2[3] = {}, w = 0.0;
+            for (size_t i = begin; i < end; i++)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    double v = axis_value(entries[i], axis);
+                    sum[axis] += v * entries[i].weight;
+                    sum2[axis] += v * v * entries[i].weight;
+                }
+                w += entries[i].weight;
+            }
+            float best_var = -1.0f;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float var = static_cast<float>(sum2[axis] - sum[axis] * sum[axis] / w);
+                box.error += var;
+                if (var > best_var)
+                {
+                    box.axis = axis;
+                    best_var = var;
+                }
+            }
+            if (end - begin < 2)
+            {
+                box.error = 0.0f;
+            }
+            return box;
+        };
+
+        std::vector<box_t> boxes = {make_box(0, entries.size())};
+        while (static_cast<int>(boxes.size()) < num_colors)
+        {
+            auto split = std::max_element(
+                boxes.begin(), boxes.end(), [](const box_t & x, const box_t & y) { return x.error < y.error; });
+            if (split->error <= 0.0f)
+            {
+                break;        // every box is a single color
+            }
+
+            box_t box = *split;
+            std::sort(entries.begin() + box.begin,
+                      entries.begin() + box.end,
+                      [&](const entry_t & x, const entry_t & y) {
+                          return axis_value(x, box.axis) < axis_value(y, box.axis);
+                      });
+            float total = 0.0f;
+            for (size_t i = box.begin; i < box.end; i++)
+            {
+                total += entries[i].weight;
+            }
+            size_t mid  = box.begin + 1;
+            float  half = entries[box.begin].weight;
+            while (mid < box.end - 1 && half + entries[mid].weight <= total / 2)
+            {
+                half += entries[mid++].weight;
+            }
+
+            *split = make_box(box.begin, mid);
+            boxes.push_back(make_box(mid, box.end));
+        }
+
+        // initial centers from median cut boxes
+        std::vector<lab_t> centers;
+        for (auto & box : boxes)
+        {
+            double L = 0.0, a = 0.0, b = 0.0, w = 0.0;
+            for (size_t i = box.begin; i < box.end; i++)
+            {
+                L += entries[i].lab.L * entries[i].weight;
+                a += entries[i].lab.a * entries[i].weight;
+                b += entries[i].lab.b * entries[i].weight;
+                w += entries[i].weight;
+            }
+            centers.push_back(
+                lab444[snap({static_cast<float>(L / w), static_cast<float>(a / w), static_cast<float>(b / w)})]);
+        }
+        int k = static_cast<int>(centers.size());
+
+        // k-means refinement (weighted by pixel count, centers snapped to RGB444)
+        for (int iter = 0; iter < iterations; iter++)
+        {
+            bool changed = false;
+            for (auto & e : entries)
+            {
+                int   best      = 0;
+                float best_dist = dist(e.lab, centers[0]);
+                for (int c = 1; c < k; c++)
+                {
+                    float d = dist(e.lab, centers[c]);
+                    if (d < best_dist)
+                    {
+                        best      = c;
+                        best_dist = d;
+                    }
+                }
+                if (e.cluster != best || iter == 0)
+                {
+                    e.cluster = static_cast<uint16_t>(best);
+                    changed   = true;
+                }
+            }
+            if (!changed)
+            {
+                break;
+            }
+
+            std::vector<double> sum(k * 4, 0.0);
+            for (auto & e : entries)
+            {
+                double * s = &sum[e.cluster * 4];
+                s[0] += e.lab.L * e.weight;
+                s[1] += e.lab.a * e.weight;
+                s[2] += e.lab.b * e.weight;
+                s[3] += e.weight;
+            }
+            for (int c = 0; c < k; c++)
+            {
+                const double * s = &sum[c * 4];
+                if (s[3] > 0.0)
+                {
+                    centers[c] = lab444[snap({static_cast<float>(s[0] / s[3]),
+                                              static_cast<float>(s[1] / s[3]),
+                                              static_cast<float>(s[2] / s[3])})];
+                }
+            }
+        }
+
+        // RGB444 palette, replacing duplicate (or empty) entries with the worst represented colors
+        std::vector<uint16_t> colors;
+        for (auto & center : centers)
+        {
+            uint16_t c = snap(center);
+            if (std::find(colors.begin(), colors.end(), c) == colors.end())
+            {
+                colors.push_back(c);
+            }
+        }
+        while (static_cast<int>(colors.size()) < k)
+        {
+            float    worst      = 0.0f;
+            uint16_t worst_color = 0;
+            for (auto & e : entries)
+            {
+                float best_dist = dist(e.lab, lab444[colors[0]]);
+                for (auto c : colors)
+                {
+                    best_dist = std::min(best_dist, dist(e.lab, lab444[c]));
+                }
+                if (best_dist * e.weight > worst)
+                {
+                    worst       = best_dist * e.weight;
+                    worst_color = snap(e.lab);
+                }
+            }
+            if (worst <= 0.0f || std::find(colors.begin(), colors.end(), worst_color) != colors.end())
+            {
+                break;        // every color already represented
+            }
+            colors.push_back(worst_color);
+        }
+
+        std::sort(colors.begin(), colors.end(), [&](uint16_t x, uint16_t y) { return lab444[x].L < lab444[y].L; });
+        std::copy(colors.begin(), colors.end(), palette.begin());
+
+        return palette;
+    }
+};
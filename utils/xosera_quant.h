@@ -0,0 +1,210 @@
+// Nearest palette color quantization shared by Xosera image utilities
+// See top-level LICENSE file for license information. (Hint: MIT)
+//
+// The palette is unpacked once from 12-bit RGB444 colormem values, and a 4096 entry lookup table maps every RGB444
+// color to its nearest palette index (squared distance, lowest index wins ties), so quantizing a pixel is a single
+// table lookup.  The table is built with SSE2 or AVX2 distance kernels when available (with a scalar fallback), and
+// xosera_parallel_rows() can be used to process image rows on all hardware threads.
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#define XOSERA_QUANT_X86 1
+#else
+#define XOSERA_QUANT_X86 0
+#endif
+
+struct xosera_quant
+{
+    enum
+    {
+        MAX_COLORS = 256,         // maximum palette entries (8-bpp)
+        LUT_SIZE   = 4096,        // RGB444 colors
+        PAD_VALUE  = 64           // channel value for unused entries (never nearest, no int16 overflow)
+    };
+
+    int     num_colors;
+    alignas(32) int16_t pal_r[MAX_COLORS];        // palette channels (0-15) unpacked from RGB444
+    alignas(32) int16_t pal_g[MAX_COLORS];
+    alignas(32) int16_t pal_b[MAX_COLORS];
+    uint8_t lut[LUT_SIZE];        // RGB444 -> nearest palette index
+
+    xosera_quant(const uint16_t * palette, int count)
+        : num_colors(std::min(std::max(count, 1), static_cast<int>(MAX_COLORS)))
+    {
+        for (int c = 0; c < MAX_COLORS; c++)
+        {
+            bool used = c < num_colors;
+            pal_r[c]  = used ? (palette[c] >> 8) & 0xf : PAD_VALUE;
+            pal_g[c]  = used ? (palette[c] >> 4) & 0xf : PAD_VALUE;
+            pal_b[c]  = used ? (palette[c] >> 0) & 0xf : PAD_VALUE;
+        }
+
+        int (*search)(const xosera_quant &, int, int, int) = nearest_scalar;
+#if XOSERA_QUANT_X86 && defined(__SSE2__)
+        search = nearest_sse2;
+#endif
+#if XOSERA_QUANT_X86 && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();        // needed if constructed before main
+        if (__builtin_cpu_supports("avx2"))
+        {
+            search = nearest_avx2;
+        }
+#endif
+
+        for (int i = 0; i < LUT_SIZE; i++)
+        {
+            lut[i] = static_cast<uint8_t>(search(*this, (i >> 8) & 0xf, (i >> 4) & 0xf, i & 0xf));
+        }
+    }
+
+    // nearest palette index for 4-bit r, g, b channels
+    uint8_t nearest(int r, int g, int b) const
+    {
+        return lut[((r & 0xf) << 8) | ((g & 0xf) << 4) | (b & 0xf)];
+    }
+
+    // nearest palette index for 8-bit r, g, b channels (truncated to RGB444, like colormem)
+    uint8_t nearest_rgb888(int r, int g, int b) const
+    {
+        return lut[((r & 0xf0) << 4) | (g & 0xf0) | ((b & 0xf0) >> 4)];
+    }
+
+    // reference search (first entry with smallest squared distance)
+    static int nearest_scalar(const xosera_quant & q, int r, int g, int b)
+    {
+        int best      = 0;
+        int best_dist = 0x7fffffff;
+        for (int c = 0; c < q.num_colors; c++)
+        {
+            int dr   = q.pal_r[c] - r;
+            int dg   = q.pal_g[c] - g;
+            int db   = q.pal_b[c] - b;
+            int dist = dr * dr + dg * dg + db * db;
+            if (dist < best_dist)
+            {
+                best      = c;
+                best_dist = dist;
+            }
+        }
+        return best;
+    }
+
+    // pick lowest distance (then lowest index) from per-lane SIMD results
+    static int reduce_lanes(const int16_t * dist, const int16_t * index, int lanes)
+    {
+        int best = 0;
+        for (int l = 1; l < lanes; l++)
+        {
+            if (dist[l] < dist[best] || (dist[l] == dist[best] && index[l] < index[best]))
+            {
+                best = l;
+            }
+        }
+        return index[best];
+    }
+
+#if XOSERA_QUANT_X86 && defined(__SSE2__)
+    // 8 palette entries per step, distance (max 3*64*64) and index fit in int16 lanes
+    static int nearest_sse2(const xosera_quant & q, int r, int g, int b)
+    {
+        const __m128i vr    = _mm_set1_epi16(static_cast<int16_t>(r));
+        const __m128i vg    = _mm_set1_epi16(static_cast<int16_t>(g));
+        const __m128i vb    = _mm_set1_epi16(static_cast<int16_t>(b));
+        const __m128i step  = _mm_set1_epi16(8);
+        __m128i       idx   = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+        __m128i       bestd = _mm_set1_epi16(0x7fff);
+        __m128i       besti = _mm_setzero_si128();
+
+        for (int c = 0; c < q.num_colors; c += 8)
+        {
+            __m128i dr   = _mm_sub_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(&q.pal_r[c])), vr);
+            __m128i dg   = _mm_sub_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(&q.pal_g[c])), vg);
+            __m128i db   = _mm_sub_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(&q.pal_b[c])), vb);
+            __m128i dist = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dr, dr), _mm_mullo_epi16(dg, dg)),
+                                         _mm_mullo_epi16(db, db));
+            __m128i less = _mm_cmplt_epi16(dist, bestd);
+            bestd        = _mm_min_epi16(dist, bestd);
+            besti        = _mm_or_si128(_mm_and_si128(less, idx), _mm_andnot_si128(less, besti));
+            idx          = _mm_add_epi16(idx, step);
+        }
+
+        alignas(16) int16_t dist[8];
+        alignas(16) int16_t index[8];
+        _mm_store_si128(reinterpret_cast<__m128i *>(dist), bestd);
+        _mm_store_si128(reinterpret_cast<__m128i *>(index), besti);
+        return reduce_lanes(dist, index, 8);
+    }
+#endif
+
+#if XOSERA_QUANT_X86 && (defined(__GNUC__) || defined(__clang__))
+    // 16 palette entries per step (selected at run-time when the CPU supports AVX2)
+    __attribute__((target("avx2"))) static int nearest_avx2(const xosera_quant & q, int r, int g, int b)
+    {
+        const __m256i vr    = _mm256_set1_epi16(static_cast<int16_t>(r));
+        const __m256i vg    = _mm256_set1_epi16(static_cast<int16_t>(g));
+        const __m256i vb    = _mm256_set1_epi16(static_cast<int16_t>(b));
+        const __m256i step  = _mm256_set1_epi16(16);
+        __m256i       idx   = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        __m256i       bestd = _mm256_set1_epi16(0x7fff);
+        __m256i       besti = _mm256_setzero_si256();
+
+        for (int c = 0; c < q.num_colors; c += 16)
+        {
+            __m256i dr   = _mm256_sub_epi16(_mm256_load_si256(reinterpret_cast<const __m256i *>(&q.pal_r[c])), vr);
+            __m256i dg   = _mm256_sub_epi16(_mm256_load_si256(reinterpret_cast<const __m256i *>(&q.pal_g[c])), vg);
+            __m256i db   = _mm256_sub_epi16(_mm256_load_si256(reinterpret_cast<const __m256i *>(&q.pal_b[c])), vb);
+            __m256i dist = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dr, dr), _mm256_mullo_epi16(dg, dg)),
+                                            _mm256_mullo_epi16(db, db));
+            __m256i less = _mm256_cmpgt_epi16(bestd, dist);
+            bestd        = _mm256_min_epi16(dist, bestd);
+            besti        = _mm256_blendv_epi8(besti, idx, less);
+            idx          = _mm256_add_epi16(idx, step);
+        }
+
+        alignas(32) int16_t dist[16];
+        alignas(32) int16_t index[16];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(dist), bestd);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(index), besti);
+        return reduce_lanes(dist, index, 16);
+    }
+#endif
+};
+
+// call fn(y) for each row 0 to height-1 using all hardware threads (rows must be independent)
+template <typename F>
+void xosera_parallel_rows(int height, F fn)
+{
+    int num_threads = std::max(1, std::min(static_cast<int>(std::thread::hardware_concurrency()), height));
+    if (num_threads == 1)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            fn(y);
+        }
+        return;
+    }
+
+    std::atomic<int>         next_row(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++)
+    {
+        threads.emplace_back([&]() {
+            for (int y = next_row++; y < height; y = next_row++)
+            {
+                fn(y);
+            }
+        });
+    }
+    for (auto & t : threads)
+    {
+        t.join();
+    }
+}
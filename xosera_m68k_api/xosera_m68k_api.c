@@ -35,7 +35,8 @@
 #endif
 #include "xosera_m68k_api.h"
 
-#define SYNC_RETRIES 250        // ~1/4 second
+#define SYNC_RETRIES       250        // ~1/4 second
+#define COPPER_UNPACK_HIST 16         // xosera_copper_unpack maximum repeat group words (power of two)
 
 // TODO: This is less than ideal (tuned for ~10MHz)
 __attribute__((noinline)) void cpu_delay(int ms)
@@ -297,6 +298,258 @@ void xosera_set_pointer(int16_t x, int16_t y, uint16_t colormap_index)
     xreg_setw(POINTER_V, colormap_index | y);
 }
 
+// upload copasm packed copper program (".pack" or ".pack.h" output) to copper memory, returns words unpacked
+// (see copasm-REFERENCE.md, words are XR address, size, commands until zero command word: 0nnn... n literal words,
+//  1nnn... k, delta[k] to output n words each equal to word k back plus delta[i % k])
+uint16_t xosera_copper_unpack(const uint16_t * packed)
+{
+    xv_prep();
+
+    uint16_t hist[COPPER_UNPACK_HIST];
+    uint16_t pos     = 0;
+    uint16_t xr_addr = *packed++;
+    packed++;        // skip unpacked size
+
+    xmem_setw_next_addr(xr_addr);
+
+    uint16_t cmd;
+    while ((cmd = *packed++) != 0)
+    {
+        uint16_t count = cmd & 0x7FFF;
+        if (cmd & 0x8000)
+        {
+            uint16_t         k     = *packed++;
+            const uint16_t * delta = packed;
+            uint16_t         d     = 0;
+            packed += k;
+
+            while (count--)
+            {
+                uint16_t w = hist[(uint16_t)(pos - k) & (COPPER_UNPACK_HIST - 1)] + delta[d];
+                if (++d == k)
+                {
+                    d = 0;
+                }
+                hist[pos++ & (COPPER_UNPACK_HIST - 1)] = w;
+                xmem_setw_next(w);
+            }
+        }
+        else
+        {
+            while (count--)
+            {
+                uint16_t w                             = *packed++;
+                hist[pos++ & (COPPER_UNPACK_HIST - 1)] = w;
+                xmem_setw_next(w);
+            }
+        }
+    }
+
+    return pos;
+}
+
+enum
+{
+    XLZ_STATE_HEADER,
+    XLZ_STATE_PALETTE,
+    XLZ_STATE_TOKEN,
+    XLZ_STATE_LITERAL,
+    XLZ_STATE_DIST,
+    XLZ_STATE_DONE,
+    XLZ_STATE_ERROR
+};
+
+// prepare to unpack new XLZ container
+void xosera_lz_init(xosera_lz_t * lz)
+{
+    lz->state = XLZ_STATE_HEADER;
+    lz->count = XLZ_HEADER_WORDS;
+    lz->match = 0;
+    lz->pos   = 0;
+    lz->addr  = 0;
+}
+
+// void xlz_setw(data_port, word_val) - set data_port register (&xosera_ptr[XM_DATA >> 2] or &xosera_ptr[XM_XDATA >> 2])
+// to word_val (like xm_setw, but with register chosen at run-time)
+#define xlz_setw(data_port, word_val)                                                                                  \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        __asm__ __volatile__("movep.w %[src],0(%[ptr])"                                                                \
+                             :                                                                                         \
+                             : [src] "d"((uint16_t)(word_val)), [ptr] "a"(data_port)                                   \
+                             :);                                                                                       \
+    } while (false)
+
+// unpack XLZ tokens from data to end, writing each word to data_port (XM_DATA for VRAM or XM_XDATA for XR memory)
+static int xosera_lz_data(xosera_lz_t *            lz,
+                          const uint16_t *         data,
+                          const uint16_t *         end,
+                          volatile xmreg_t * const data_port)
+{
+    uint16_t * hist  = lz->hist;
+    uint16_t   pos   = lz->pos;
+    uint16_t   start = pos;
+    uint16_t   state = lz->state;
+    uint16_t   count = lz->count;
+
+    while (data != end)
+    {
+        if (state == XLZ_STATE_LITERAL)
+        {
+            uint16_t avail = end - data;
+            uint16_t n     = count < avail ? count : avail;
+            count -= n;
+            while (n--)
+            {
+                uint16_t w                     = *data++;
+                hist[pos++ & (XLZ_WINDOW - 1)] = w;
+                xlz_setw(data_port, w);
+            }
+            if (count == 0)
+            {
+                state = XLZ_STATE_TOKEN;
+            }
+        }
+        else if (state == XLZ_STATE_DIST)
+        {
+            uint16_t dist = *data++;
+            if (dist == 0 || dist > XLZ_WINDOW)
+            {
+                state = XLZ_STATE_ERROR;
+                break;
+            }
+            uint16_t src = pos - dist;
+            count        = lz->match;
+            while (count--)
+            {
+                uint16_t w                     = hist[src++ & (XLZ_WINDOW - 1)];
+                hist[pos++ & (XLZ_WINDOW - 1)] = w;
+                xlz_setw(data_port, w);
+            }
+            count = 0;
+            state = XLZ_STATE_TOKEN;
+        }
+        else if (state == XLZ_STATE_TOKEN)
+        {
+            uint16_t token = *data++;
+            if (token == 0)
+            {
+                // done when every word was written
+                uint32_t size = ((uint32_t)lz->header[4] << 16) | lz->header[5];
+                state         = (uint16_t)size == pos ? XLZ_STATE_DONE : XLZ_STATE_ERROR;
+                break;
+            }
+            if (token & 0x8000)
+            {
+                lz->match = token & 0x7FFF;
+                state     = XLZ_STATE_DIST;
+            }
+            else
+            {
+                count = token;
+                state = XLZ_STATE_LITERAL;
+            }
+        }
+    }
+
+    lz->addr += (uint16_t)(pos - start);
+    lz->pos   = pos;
+    lz->count = count;
+    lz->state = state;
+
+    return state == XLZ_STATE_DONE ? XLZ_DONE : state == XLZ_STATE_ERROR ? XLZ_ERROR : XLZ_MORE;
+}
+
+// unpack next part of XLZ container (any number of whole words, e.g., each SD card sector as it is read) to VRAM or
+// XR memory, returns XLZ_MORE until the end of the container is reached (see utils/xosera_lz.h for format)
+int xosera_lz_unpack(xosera_lz_t * lz, const uint16_t * data, uint16_t words)
+{
+    xv_prep();
+
+    const uint16_t * end = data + words;
+
+    if (lz->state >= XLZ_STATE_DONE)
+    {
+        return lz->state == XLZ_STATE_DONE ? XLZ_DONE : XLZ_ERROR;        // ignore data after end of container
+    }
+
+    // header and palette (normally all in first sector)
+    while (lz->state < XLZ_STATE_TOKEN && data != end)
+    {
+        if (lz->state == XLZ_STATE_HEADER)
+        {
+            lz->header[XLZ_HEADER_WORDS - lz->count] = *data++;
+            if (--lz->count == 0)
+            {
+                if (lz->header[0] != XLZ_MAGIC || lz->header[1] != XLZ_VERSION)
+                {
+                    lz->state = XLZ_STATE_ERROR;
+                    return XLZ_ERROR;
+                }
+                lz->addr  = lz->header[3];
+                lz->count = lz->header[8];
+                lz->state = lz->count ? XLZ_STATE_PALETTE : XLZ_STATE_TOKEN;
+            }
+        }
+        else
+        {
+            xmem_setw_next_addr(XR_COLOR_ADDR + lz->header[8] - lz->count);
+            while (lz->count && data != end)
+            {
+                xmem_setw_next(*data++);
+                lz->count--;
+            }
+            if (lz->count == 0)
+            {
+                lz->state = XLZ_STATE_TOKEN;
+            }
+        }
+    }
+
+    if (lz->state < XLZ_STATE_TOKEN || data == end)
+    {
+        return XLZ_MORE;
+    }
+
+    // (re)start output at next address, in case Xosera was used between calls
+    if (lz->header[2] & XLZ_FLAG_XR)
+    {
+        xmem_setw_next_addr(lz->addr);
+        return xosera_lz_data(lz, data, end, &xosera_ptr[XM_XDATA >> 2]);
+    }
+
+    xm_setw(WR_INCR, 1);
+    xm_setw(WR_ADDR, lz->addr);
+    return xosera_lz_data(lz, data, end, &xosera_ptr[XM_DATA >> 2]);
+}
+
+// queue blits from blit list (e.g., "_blit" output from xosera_convert scene mode), only registers that differ from
+// the previous blit are in the list (blitter registers keep their value) and each blit ends writing XR_BLIT_WORDS
+uint16_t xosera_blit_list(const uint16_t * list)
+{
+    xv_prep();
+
+    uint16_t blits = 0;
+    uint16_t run;
+    while ((run = *list++) != 0)
+    {
+        if (run & BLIT_LIST_WAIT)
+        {
+            xwait_blit_ready();
+            blits++;
+        }
+
+        xm_setw(WR_XADDR, (run >> 8) & 0x7F);
+        uint16_t count = run & 0xFF;
+        while (count--)
+        {
+            xreg_setw_next(*list++);
+        }
+    }
+
+    return blits;
+}
+
 bool xosera_get_info(xosera_info_t * info)
 {
     if (!info)
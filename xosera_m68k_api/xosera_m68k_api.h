@@ -63,6 +63,7 @@
 // void     xmem_setw_next_addr(xr_addr);       // set initial xr_addr WR_XADDR address for xmem_setw_next*()
 // void     xmem_setw_next(word_val);           // set next XR address to word_val, WR_XDATA++
 // void     xmem_setw_next_wait(word_val);      // set next XR address to word_val, WR_XDATA++, wait for write
+// void     xosera_copper_upload_const(name);   // upload copasm ".const.h" copper program <name> (unrolled)
 //
 // ====  Get word value from 16-bit XR memory address xr_addr
 // uint16_t xmem_getw(xr_addr);                 // get value from xr_addr
@@ -151,6 +152,43 @@ void cpu_delay(int ms);                            // delay approx milliseconds
 void xosera_delay(uint32_t ms);                    // delay milliseconds using Xosera TIMER register
 void xosera_memclear(void * ptr, unsigned int n);        // memory zero (mostly for XANSI firmware use)
 
+uint16_t xosera_copper_unpack(const uint16_t * packed);        // upload copasm packed copper program (returns words)
+
+// XLZ compressed asset container (see utils/xosera_lz.h, keep in sync)
+#define XLZ_MAGIC        0x584C        // "XL"
+#define XLZ_VERSION      0x5A01        // "Z" + version 1
+#define XLZ_HEADER_WORDS 9             // magic, version, flags, address, size (2 words), width, height, palette size
+#define XLZ_WINDOW       4096          // match history words (power of two)
+#define XLZ_FLAG_XR      0x0001        // target is XR memory (otherwise VRAM)
+#define XLZ_FLAG_IMAGE   0x0002        // width, height and bpp are valid
+#define XLZ_BPP_SHIFT    2             // bits [3:2] image GFX_1_BPP, GFX_4_BPP or GFX_8_BPP
+
+#define XLZ_ERROR -1        // xosera_lz_unpack not a valid XLZ container
+#define XLZ_MORE  0         // xosera_lz_unpack needs more data
+#define XLZ_DONE  1         // xosera_lz_unpack finished
+
+typedef struct _xosera_lz        // xosera_lz_unpack state (keep static, hist is 8KB)
+{
+    uint16_t state;                           // decode state
+    uint16_t count;                           // words left in header, palette or literal run
+    uint16_t match;                           // match words waiting for distance word
+    uint16_t pos;                             // history position
+    uint16_t addr;                            // next VRAM or XR address
+    uint16_t header[XLZ_HEADER_WORDS];        // container header (flags, address, size, width, height etc.)
+    uint16_t hist[XLZ_WINDOW];                // last XLZ_WINDOW words written (for matches)
+} xosera_lz_t;
+
+void xosera_lz_init(xosera_lz_t * lz);        // prepare to unpack new XLZ container
+int  xosera_lz_unpack(xosera_lz_t *     lz,           // unpack next part of XLZ container to VRAM/XR memory
+                      const uint16_t * data,         // (e.g., each SD card sector as it is read)
+                      uint16_t         words);        // returns XLZ_MORE, XLZ_DONE or XLZ_ERROR
+
+// blit list (see utils/xosera_convert.cpp scene mode, keep in sync), runs of blitter register writes until zero word:
+// run word is [15] wait for blitter ready (first run of each blit), [14:8] XR register, [7:0] count, then count words
+#define BLIT_LIST_WAIT 0x8000        // wait for blitter ready before this run (starts next blit)
+
+uint16_t xosera_blit_list(const uint16_t * list);        // queue each blit in list (returns number of blits)
+
 void xosera_set_pointer(int16_t  x_pos,                  // native pixel X for pointer upper left
                         int16_t  y_pos,                  // native pixel Y for pointer upper left
                         uint16_t colormap_index);        // colormap_index = 0xi000 (upper 4-bits of pointer colorA)
@@ -420,6 +458,19 @@ typedef volatile xmreg_t * const xosera_ptr_t;
         xwait_mem_ready();                                                                                             \
     } while (false)
 
+// void xosera_copper_upload_const(name) - upload copasm ".const.h" copper program <name> to copper memory, unrolled
+// into one immediate XDATA write per word (no loop, table reads or address arithmetic, uses xosera_ptr so call
+// xv_prep() first).  NOTE: Best for small static copper lists, code size is ~6 bytes per copper word.
+#define xosera_copper_upload_const(name)                                                                               \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        xmem_setw_next_addr(name##_start);                                                                             \
+        name##_words(xosera_copper_upload_word)                                                                        \
+    } while (false)
+
+// upload single constant word for xosera_copper_upload_const (used as X-macro for "name_words(X)" list)
+#define xosera_copper_upload_word(word_val) xmem_setw_next(word_val);
+
 // uint16_t xmem_getw(xr_addr) - get value from xr_addr
 #define xmem_getw(xr_addr)                                                                                             \
     ({                                                                                                                 \
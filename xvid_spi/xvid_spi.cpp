@@ -15,6 +15,12 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "ftdi_spi.h"
 #include "../xosera_m68k_api/xosera_m68k_defs.h"
 
@@ -67,55 +73,215 @@ enum
     SPI_CMD_REGMASK = 0x0F
 };
 
-#define DEBUG_HEXDUMP 1
-
-#if 0
-#define MAX_SEND    1024
-#define FLUSH_QUEUE 1020
-#else
-#define MAX_SEND    16
-#define FLUSH_QUEUE 4
-#endif
-
-static uint8_t   send_buffer[MAX_SEND];
-static uint8_t   xmit_buffer[MAX_SEND];
-static uint8_t * send_ptr = send_buffer;
-static uint8_t   read_value;
-
-size_t spi_queue_len()
+#define DEBUG_HEXDUMP 0        // print every SPI transfer (from transfer thread)
+
+// Commands are queued in a ring buffer by any number of threads without locking (space is reserved with a CAS on
+// spi_reserved, then published in reservation order via spi_committed).  A background thread sends everything
+// committed (up to chunksize) as one MPSSE transfer per CS select, so many register writes go in each USB round trip.
+// Reply bytes are stored at the same ring position as their command, so a read is a completion token (ring position
+// of its command byte) that is waited on only until that command has been transferred.
+#define SPI_RING_SIZE 0x10000        // command and reply ring bytes (power of two)
+#define SPI_XFER_MAX  4096           // largest transfer (also limited by chunksize)
+
+// NOTE: a token's reply is only kept until SPI_RING_SIZE more command bytes have been queued after it (the ring slot
+// is reused), so get each result before queueing 64KB more commands (spi_result exits on a stale token)
+typedef uint32_t spi_token;        // ring position of queued command (free running, wraps)
+
+static uint8_t                 spi_ring[SPI_RING_SIZE];          // queued command bytes
+static uint8_t                 spi_reply[SPI_RING_SIZE];         // reply bytes (at same position as command)
+static uint8_t                 xmit_buffer[SPI_XFER_MAX];        // one transfer (in place send/receive)
+static std::atomic<uint32_t>   spi_reserved;                     // end of reserved ring bytes
+static std::atomic<uint32_t>   spi_committed;                    // end of bytes ready to send (in reserve order)
+static std::atomic<uint32_t>   spi_completed;                    // end of bytes transferred (replies valid)
+static std::atomic<bool>       spi_idle;                         // transfer thread waiting for commands
+static bool                    spi_stop;                         // transfer thread should exit when queue empty
+static uint32_t                spi_xfer_size = 2;                // transfer size limit (set from chunksize)
+static uint32_t                spi_xfers;                        // number of transfers (for stats)
+static uint64_t                spi_bytes;                        // bytes transferred (for stats)
+static std::mutex              spi_mutex;                        // only for transfer thread sleep/wakeup
+static std::condition_variable spi_queued_cv;                    // commands committed (while spi_idle)
+static std::condition_variable spi_done_cv;                      // transfer completed
+static std::thread             spi_thread;
+
+// true if position a is at or after position b
+static inline bool spi_reached(uint32_t a, uint32_t b)
 {
-    size_t len = send_ptr - send_buffer;
-    return len;
+    return static_cast<int32_t>(a - b) >= 0;
 }
 
-inline int spi_queue_flush()
+// send all committed commands, waiting when queue is empty
+static void spi_xfer_thread()
 {
-    size_t len = spi_queue_len();
-    if (len)
+    uint32_t pos = spi_completed.load();
+    while (true)
     {
+        uint32_t end;
+        {
+            std::unique_lock<std::mutex> lock(spi_mutex);
+            spi_idle = true;
+            spi_queued_cv.wait(lock, [&]() { return spi_stop || spi_committed.load() != pos; });
+            spi_idle = false;
+            end      = spi_committed.load();
+            if (end == pos)
+            {
+                return;
+            }
+        }
+
+        // commands are whole 2 byte pairs, so transfers never split one
+        uint32_t len = std::min(end - pos, spi_xfer_size);
+        uint32_t off = pos & (SPI_RING_SIZE - 1);
+        uint32_t n   = std::min(len, SPI_RING_SIZE - off);
+        memcpy(xmit_buffer, &spi_ring[off], n);
+        memcpy(xmit_buffer + n, &spi_ring[0], len - n);
+
         host_spi_cs(false);        // select
-        memcpy(xmit_buffer, send_buffer, len);
         host_spi_xfer_bytes(len, xmit_buffer);
         host_spi_cs(true);        // de-select
 
 #if DEBUG_HEXDUMP
-        printf("SENT[%02zu]: ", len);
-        hexdump(len, send_buffer);
-        printf("RCVD[%02zu]: ", len);
+        printf("SENT[%02u]: ", len);
+        for (uint32_t i = 0; i < len; i++)
+        {
+            printf("%02x%s", spi_ring[(pos + i) & (SPI_RING_SIZE - 1)], i != len - 1 ? ", " : "\n");
+        }
+        printf("RCVD[%02u]: ", len);
         hexdump(len, xmit_buffer);
 #endif
-        send_ptr = send_buffer;
+
+        memcpy(&spi_reply[off], xmit_buffer, n);
+        memcpy(&spi_reply[0], xmit_buffer + n, len - n);
+        pos += len;
+        spi_xfers++;
+        spi_bytes += len;
+
+        std::lock_guard<std::mutex> lock(spi_mutex);
+        spi_completed = pos;
+        spi_done_cv.notify_all();
     }
+}
+
+// wait until all commands before ring position end have been transferred
+static void spi_queue_wait(uint32_t end)
+{
+    if (spi_reached(spi_completed.load(), end))
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(spi_mutex);
+    spi_done_cv.wait(lock, [&]() { return spi_reached(spi_completed.load(), end); });
+}
+
+// queue len command bytes (kept together, even when several threads queue commands), returns token
+static spi_token spi_queue(const uint8_t * cmds, uint32_t len)
+{
+    // reserve ring space (waiting for transfers when ring is full)
+    uint32_t pos = spi_reserved.load();
+    do
+    {
+        while (!spi_reached(spi_completed.load() + SPI_RING_SIZE, pos + len))
+        {
+            spi_queue_wait(pos + len - SPI_RING_SIZE);
+            pos = spi_reserved.load();
+        }
+    } while (!spi_reserved.compare_exchange_weak(pos, pos + len));
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        spi_ring[(pos + i) & (SPI_RING_SIZE - 1)] = cmds[i];
+    }
+
+    // publish after any earlier reservations, waking transfer thread if it is waiting
+    while (spi_committed.load() != pos)
+    {
+        std::this_thread::yield();
+    }
+    spi_committed = pos + len;
+    if (spi_idle)
+    {
+        std::lock_guard<std::mutex> lock(spi_mutex);
+        spi_queued_cv.notify_one();
+    }
+
+    return pos;
+}
+
+inline spi_token spi_queue_cmd(uint8_t cmd, uint8_t data)
+{
+    uint8_t cmds[2] = {cmd, data};
+    return spi_queue(cmds, 2);
+}
+
+// reply data byte for command queued as token (waits for command to be transferred)
+static inline uint8_t spi_result(spi_token token)
+{
+    spi_queue_wait(token + 2);
+    uint8_t ack  = spi_reply[token & (SPI_RING_SIZE - 1)];
+    uint8_t data = spi_reply[(token + 1) & (SPI_RING_SIZE - 1)];
+
+    // reply slot is only overwritten after its ring position is reserved again, so check that after reading it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (spi_reached(spi_reserved.load(std::memory_order_relaxed), token + SPI_RING_SIZE + 1))
+    {
+        printf("*** SPI result for token 0x%08x is stale (over %u command bytes queued before reading it)\n",
+               token,
+               SPI_RING_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    assert(ack == 0xcb);
+    (void)ack;
+    return data;
+}
+
+// wait until all queued commands have been transferred, returns bytes waited for
+inline int spi_queue_flush()
+{
+    uint32_t end = spi_reserved.load();
+    uint32_t len = end - spi_completed.load();
+    spi_queue_wait(end);
+    return static_cast<int>(len);
+}
 
-    return len;
+static void spi_queue_stop();
+
+// start transfer thread (after host_spi_open)
+static void spi_queue_start()
+{
+    spi_xfer_size = std::min<uint32_t>(chunksize, SPI_XFER_MAX) & ~1u;
+    spi_stop      = false;
+    spi_thread    = std::thread(spi_xfer_thread);
+    atexit(spi_queue_stop);        // before host_spi_cleanup (registered by host_spi_open)
+}
+
+// send any queued commands and stop transfer thread (before host_spi_close)
+static void spi_queue_stop()
+{
+    if (!spi_thread.joinable())
+    {
+        return;
+    }
+    if (spi_thread.get_id() == std::this_thread::get_id())        // exit() from transfer thread (on FTDI error)
+    {
+        spi_thread.detach();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(spi_mutex);
+        spi_stop = true;
+        spi_queued_cv.notify_one();
+    }
+    spi_thread.join();
+    printf("SPI: %llu bytes in %u transfers (average %llu bytes)\n",
+           static_cast<unsigned long long>(spi_bytes),
+           spi_xfers,
+           static_cast<unsigned long long>(spi_xfers ? spi_bytes / spi_xfers : 0));
 }
 
-inline int spi_queue_cmd(uint8_t cmd, uint8_t data)
+// de-select after all queued commands are sent
+static void spi_deselect()
 {
-    int off     = static_cast<int>(send_ptr - send_buffer);
-    *send_ptr++ = cmd;
-    *send_ptr++ = data;
-    return off;
+    spi_queue_flush();
+    host_spi_cs(true);
 }
 
 void delay(int ms)
@@ -126,50 +292,55 @@ void delay(int ms)
 
 static inline void xvid_setw(uint8_t r, uint16_t word)
 {
-    spi_queue_cmd(SPI_CMD_CS | SPI_CMD_WR | (r & SPI_CMD_REGMASK), (word >> 8) & 0xff);
-    spi_queue_cmd(SPI_CMD_CS | SPI_CMD_WR | SPI_CMD_BYTESEL | (r & SPI_CMD_REGMASK), word & 0xff);
-    if (spi_queue_len() > FLUSH_QUEUE)
-    {
-        spi_queue_flush();
-    }
+    uint8_t cmds[4] = {static_cast<uint8_t>(SPI_CMD_CS | SPI_CMD_WR | (r & SPI_CMD_REGMASK)),
+                       static_cast<uint8_t>((word >> 8) & 0xff),
+                       static_cast<uint8_t>(SPI_CMD_CS | SPI_CMD_WR | SPI_CMD_BYTESEL | (r & SPI_CMD_REGMASK)),
+                       static_cast<uint8_t>(word & 0xff)};
+    spi_queue(cmds, 4);
 }
 
 static inline void xvid_setlb(uint8_t r, uint8_t lsb)
 {
     spi_queue_cmd(SPI_CMD_CS | SPI_CMD_WR | SPI_CMD_BYTESEL | (r & SPI_CMD_REGMASK), lsb & 0xff);
-    if (spi_queue_len() > FLUSH_QUEUE)
-    {
-        spi_queue_flush();
-    }
 }
 
 static inline void xvid_sethb(uint8_t r, uint8_t msb)
 {
     spi_queue_cmd(SPI_CMD_CS | SPI_CMD_WR | (r & SPI_CMD_REGMASK), msb & 0xff);
-    if (spi_queue_len() > FLUSH_QUEUE)
-    {
-        spi_queue_flush();
-    }
 }
 
-static inline uint16_t xvid_getw(uint8_t r)
+// queue register word read, use xvid_result_w(token) for value (only waits for this read, see spi_token)
+static inline spi_token xvid_getw_async(uint8_t r)
 {
-    int msb = spi_queue_cmd(SPI_CMD_CS | (r & SPI_CMD_REGMASK), 0xff);
-    int lsb = spi_queue_cmd(SPI_CMD_CS | SPI_CMD_BYTESEL | (r & SPI_CMD_REGMASK), 0xff);
-    spi_queue_flush();
-    assert(xmit_buffer[msb] == 0xcb);
-    assert(xmit_buffer[lsb] == 0xcb);
+    uint8_t cmds[4] = {static_cast<uint8_t>(SPI_CMD_CS | (r & SPI_CMD_REGMASK)),
+                       0xff,
+                       static_cast<uint8_t>(SPI_CMD_CS | SPI_CMD_BYTESEL | (r & SPI_CMD_REGMASK)),
+                       0xff};
+    return spi_queue(cmds, 4);
+}
 
-    return (xmit_buffer[msb + 1] << 8) | xmit_buffer[lsb + 1];
+static inline uint16_t xvid_result_w(spi_token token)
+{
+    uint8_t msb = spi_result(token);
+    uint8_t lsb = spi_result(token + 2);
+    return (msb << 8) | lsb;
 }
 
+static inline uint16_t xvid_getw(uint8_t r)
+{
+    return xvid_result_w(xvid_getw_async(r));
+}
+
+// queue register byte read, use spi_result(token) for value (before queueing 64KB more, see spi_token)
 // bytesel = LSB (default) or 0 for MSB
+static inline spi_token xvid_getb_async(uint8_t r, uint8_t bytesel = 1)
+{
+    return spi_queue_cmd(SPI_CMD_CS | (bytesel ? SPI_CMD_BYTESEL : 0) | (r & SPI_CMD_REGMASK), 0xff);
+}
+
 static inline uint8_t xvid_getb(uint8_t r, uint8_t bytesel = 1)
 {
-    int off = spi_queue_cmd(SPI_CMD_CS | (bytesel ? SPI_CMD_BYTESEL : 0) | (r & SPI_CMD_REGMASK), 0xff);
-    spi_queue_flush();
-    assert(xmit_buffer[off] == 0xcb);
-    return xmit_buffer[off + 1];
+    return spi_result(xvid_getb_async(r, bytesel));
 }
 
 static inline uint8_t xvid_getbl(uint8_t r)
@@ -208,16 +379,16 @@ uint32_t mem_buffer[128 * 1024];
 static void spi_reset(uint8_t cmd)
 {
     spi_queue_flush();
-    spi_queue_cmd(cmd, cmd);
+    spi_token token = spi_queue_cmd(cmd, cmd);
     for (int i = 0; i < 100; i++)
     {
         delay_ms(10);
-        size_t len = spi_queue_flush();
-        if (xmit_buffer[len - 2] == 0xcb)
+        spi_queue_wait(token + 2);
+        if (spi_reply[token & (SPI_RING_SIZE - 1)] == 0xcb)
         {
             break;
         }
-        spi_queue_cmd(cmd, cmd);
+        token = spi_queue_cmd(cmd, cmd);
     }
 }
 
@@ -226,7 +397,7 @@ static bool sync_Xosera(bool reset)
     printf("Waiting for Xosera SPI sync%s...", reset ? " and reset" : "");
     fflush(stdout);
     xvid_setw(XM_SYS_CTRL, 0x8000);
-    host_spi_cs(true);        // de-select
+    spi_deselect();        // de-select
     delay_ms(100);
     bool result = false;
     for (int retry = 0; retry < 10; retry++)
@@ -238,7 +409,7 @@ static bool sync_Xosera(bool reset)
             result = true;
             break;
         }
-        host_spi_cs(true);        // de-select
+        spi_deselect();        // de-select
         delay_ms(100);
     }
 
@@ -252,27 +423,25 @@ static void reboot_Xosera(int8_t config)
     if (config >= 0)
     {
         printf("Xosera reconfiguring to config #%d...\n", config & 0x3);
-        host_spi_cs(true);        // de-select
+        spi_deselect();        // de-select
         delay_ms(10);
         //        xvid_setw(XVID_BLIT_CTRL, 0x8080 | ((config & 0x3) << 8));        // reboot FPGA to config
         spi_queue_flush();
         delay_ms(70);
-        host_spi_cs(true);        // de-select
+        spi_deselect();        // de-select
     }
     do
     {
-        spi_queue_flush();
-        host_spi_cs(true);        // de-select
+        spi_deselect();        // de-select
         delay_ms(10);
         xvid_setw(XM_RD_ADDR, 0x1234);
         xvid_setw(XM_RD_INCR, 0xABCD);
         spi_queue_flush();
     } while (xvid_getw(XM_RD_ADDR) != 0x1234 || xvid_getw(XM_RD_INCR) != 0xABCD);
 
-    width  = ((xvid_getbl(XM_FEATURES) & 0xF) == 0) ? 640 : 848;
-    height = 480;
-    xvid_setw(XM_RD_XADDR, XM_FEATURES);        // select features
-    features = xvid_getw(XM_XDATA);
+    width    = ((xvid_getbl(XM_FEATURE) & 0xF) == 0) ? 640 : 848;
+    height   = 480;
+    features = xvid_getw(XM_FEATURE);
     printf("(%dx%d, features=0x%04x) ready.\n", width, height, features);
     columns = width / 8;
     rows    = height / 16;
@@ -604,6 +773,7 @@ static void test_mono_bitmap(const char * filename)
     else
     {
         printf(" - FAILED\n");
+        error_flag = true;
     }
 }
 
@@ -951,6 +1121,7 @@ void test_smoothscroll()
 
 bool reset_only    = false;
 bool no_reset      = false;
+bool test_only     = false;        // run self-tests and exit with test result (e.g., for CI with simulation)
 int  xosera_config = -1;
 
 #define MAX_CMDS 256
@@ -971,6 +1142,11 @@ int main(int argc, char ** argv)
             no_reset = true;
             continue;
         }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            test_only = true;
+            continue;
+        }
         else if (strncmp(argv[i], "-c", 2) == 0)
         {
             if (argv[i][2] < '0' || argv[i][2] > '3')
@@ -1008,17 +1184,46 @@ int main(int argc, char ** argv)
     {
         exit(EXIT_FAILURE);
     }
+    spi_queue_start();
 
     bool res = sync_Xosera(no_reset ? 0 : 1);
 
     if (reset_only)
     {
+        spi_queue_stop();
         host_spi_close();
         printf("Exiting after reset (\"-r\" option)\n");
 
         exit(res ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
+    if (test_only)
+    {
+        if (res)
+        {
+            reboot_Xosera(-1);        // read video mode
+
+            test_reg_access();
+
+            // mono bitmap mode
+            xvid_setw(XM_WR_XADDR, XR_PA_GFX_CTRL);
+            xvid_setw(XM_XDATA, 0x0040);
+            test_mono_bitmap("space_shuttle_color_small.raw");
+
+            // text mode
+            xvid_setw(XM_WR_XADDR, XR_PA_GFX_CTRL);
+            xvid_setw(XM_XDATA, 0x0000);
+            test_smoothscroll();
+        }
+
+        spi_queue_stop();
+        host_spi_close();
+        res = res && !error_flag;
+        printf("Self-tests %s (%u errors)\n", res ? "passed" : "FAILED", errors);
+
+        exit(res ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     //    reboot_Xosera(xosera_config);
 
     // mono bitmap mode
@@ -1096,6 +1301,7 @@ int main(int argc, char ** argv)
     xvid_setw(XM_XDATA, 0x0040);
     test_mono_bitmap("space_shuttle_color_small.raw");
 
+    spi_queue_stop();
     host_spi_close();
 
     exit(EXIT_SUCCESS);